@@ -0,0 +1,127 @@
+#include "aot.h"
+#include "chip8_machine.h"
+#include "log.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    AOT_BLOCK_UNCHECKED,
+    AOT_BLOCK_VALID,
+    AOT_BLOCK_MODIFIED,
+} aot_block_state_t;
+
+static const CHIP8_aot_program *program = NULL;
+
+// Block index + 1 for every address a block starts at, 0 otherwise
+static uint16_t *aot_lookup = NULL;
+
+// Whether the memory of a block still matches the rom. Checked on first
+// use and again after the machine wrote to memory. Per thread, like the
+// selected machine.
+static _Thread_local uint8_t *block_state = NULL;
+static _Thread_local const CHIP8_machine *block_state_machine = NULL;
+static _Thread_local uint32_t block_state_writes = 0;
+
+const uint32_t CHIP8_aot_init(const CHIP8_aot_program *target) {
+    assert(target != NULL);
+
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    if (target->mode != machine->mode) {
+        log_warn("aot: %s was compiled for another mode, using the "
+                 "interpreter",
+                 target->rom_name);
+        return 1;
+    }
+
+    if (memcmp(machine->mem + CHIP8_MEM_OFFSET, target->rom,
+               target->rom_size) != 0) {
+        log_warn("aot: The loaded rom is not %s, using the interpreter",
+                 target->rom_name);
+        return 1;
+    }
+
+    if (aot_lookup == NULL) {
+        aot_lookup = calloc(CHIP8_MEM_SIZE, sizeof(*aot_lookup));
+        if (aot_lookup == NULL)
+            abort();
+    }
+
+    memset(aot_lookup, 0, CHIP8_MEM_SIZE * sizeof(*aot_lookup));
+    for (uint32_t i = 0; i < target->block_count; i++)
+        aot_lookup[target->blocks[i].start] = i + 1;
+
+    program = target;
+
+    log_info("aot: Running %s (%u compiled blocks)", target->rom_name,
+             target->block_count);
+
+    return 0;
+}
+
+// Forget which blocks are valid, if the machine changed or wrote to memory
+static inline void aot_sync(const CHIP8_machine *machine) {
+    if (block_state == NULL) {
+        block_state = malloc(program->block_count);
+        if (block_state == NULL)
+            abort();
+        block_state_machine = NULL;
+    }
+
+    if (block_state_machine != machine ||
+        block_state_writes != machine->mem_writes) {
+        memset(block_state, AOT_BLOCK_UNCHECKED, program->block_count);
+        block_state_machine = machine;
+        block_state_writes = machine->mem_writes;
+    }
+}
+
+static inline const uint8_t aot_block_is_valid(const CHIP8_machine *machine,
+                                               const uint32_t index) {
+    if (block_state[index] == AOT_BLOCK_UNCHECKED) {
+        const CHIP8_aot_block *block = &program->blocks[index];
+        const uint32_t offset = block->start - CHIP8_MEM_OFFSET;
+
+        block_state[index] =
+            memcmp(machine->mem + block->start, program->rom + offset,
+                   block->size) == 0
+                ? AOT_BLOCK_VALID
+                : AOT_BLOCK_MODIFIED;
+    }
+
+    return block_state[index] == AOT_BLOCK_VALID;
+}
+
+const int32_t CHIP8_aot_run(const uint32_t cycles, uint32_t *executed) {
+    CHIP8_machine *machine = CHIP8_machine_get();
+    int32_t status = 0;
+    uint32_t count = 0;
+
+    assert(program != NULL);
+
+    while (count < cycles && status == 0) {
+        aot_sync(machine);
+
+        const uint32_t index = aot_lookup[machine->pc];
+        if (index != 0 &&
+            program->blocks[index - 1].instructions <= cycles - count &&
+            aot_block_is_valid(machine, index - 1)) {
+            count += program->blocks[index - 1].func(machine, &status);
+            continue;
+        }
+
+        // Not compiled (modified since, or too long for the remaining
+        // cycles): interpret a single instruction
+        status = CHIP8_cpu_step();
+        if (status != -1)
+            count++;
+    }
+
+    machine->cycles += count;
+    if (executed != NULL)
+        *executed = count;
+
+    return status;
+}
@@ -0,0 +1,53 @@
+#ifndef _CHIP8_AOT_H_
+#define _CHIP8_AOT_H_
+
+#include "chip8.h"
+
+#include <stdint.h>
+
+// Runtime for roms compiled ahead of time by chip8_aot (see 'make aot').
+// The generated code has one function per basic block, which works on the
+// machine state directly. Everything the compiler couldn't resolve
+// statically (indirect jumps, returns into unknown code, blocks whose
+// memory has been overwritten) runs on the interpreter.
+
+/// A compiled basic block. Executes the instructions at
+/// [start, start + size), sets machine->pc to the next instruction and
+/// returns the number of executed instructions. <status> receives the
+/// status of the last instruction (see CHIP8_cpu_run).
+typedef uint32_t (*CHIP8_aot_func)(CHIP8_machine *machine, int32_t *status);
+
+typedef struct {
+    uint16_t start;
+    uint16_t size;
+    // Number of instructions (at most, i.e. if it ends early on 'exit')
+    uint16_t instructions;
+    CHIP8_aot_func func;
+} CHIP8_aot_block;
+
+typedef struct {
+    const char *rom_name;
+    CHIP8_MODE mode;
+
+    // The rom the blocks were compiled from (loaded at 0x200)
+    const uint8_t *rom;
+    uint32_t rom_size;
+
+    // Sorted by start address
+    const CHIP8_aot_block *blocks;
+    uint32_t block_count;
+} CHIP8_aot_program;
+
+/// Defined by the generated code, in builds made with 'make aot'
+extern const CHIP8_aot_program chip8_aot_program;
+
+/// Use <program> for CHIP8_aot_run. Fails (without changing anything) if
+/// the selected machine runs a different mode or rom.
+extern const uint32_t CHIP8_aot_init(const CHIP8_aot_program *program);
+
+/// Like CHIP8_cpu_run, but runs compiled blocks where possible. Blocks that
+/// don't fit into the remaining <cycles> run on the interpreter, so frames
+/// end on the same instruction as with the interpreter.
+extern const int32_t CHIP8_aot_run(uint32_t cycles, uint32_t *executed);
+
+#endif
@@ -0,0 +1,167 @@
+#include "backend.h"
+#include "chip8.h"
+#include "log.h"
+#include "scaler.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+typedef struct {
+    const CHIP8_backend *backend;
+    uint32_t interval;
+} backend_sink;
+
+static backend_sink sinks[CHIP8_BACKEND_MAX_SINKS];
+static uint32_t sink_count = 0;
+
+static CHIP8_SCALER scaler = CHIP8_SCALER_NONE;
+
+// The screen after the scaler, shared by every sink
+static uint8_t scaled[CHIP8_SCALER_MAX_HEIGHT * CHIP8_SCALER_MAX_FACTOR]
+                     [CHIP8_SCALER_MAX_WIDTH * CHIP8_SCALER_MAX_FACTOR];
+
+static CHIP8_frame frame = {
+    .pixels = &scaled[0][0],
+    .stride = sizeof(scaled[0]),
+};
+
+// 'scaled' holds a converted screen with this hash
+static uint8_t frame_valid = 0;
+static uint64_t frame_hash;
+
+// The screen has been drawn to since the last conversion. The run loop
+// clears the update status every frame, frames without a due sink included.
+static uint8_t frame_pending = 0;
+
+void CHIP8_backend_init(CHIP8_SCALER backend_scaler) {
+    assert(sink_count == 0);
+
+    scaler = backend_scaler;
+    frame.number = 0;
+    frame.version = 0;
+    frame_valid = 0;
+    frame_pending = 0;
+}
+
+const uint32_t CHIP8_backend_add(const CHIP8_backend *backend,
+                                 uint32_t interval) {
+    assert(backend != NULL && backend->frame != NULL &&
+           backend->close != NULL);
+
+    if (sink_count == CHIP8_BACKEND_MAX_SINKS) {
+        log_error("backend: Too many sinks, can't add %s", backend->name);
+        return 1;
+    }
+
+    sinks[sink_count].backend = backend;
+    sinks[sink_count].interval = interval > 0 ? interval : 1;
+    sink_count++;
+
+    return 0;
+}
+
+void CHIP8_backend_exit(void) {
+    while (sink_count > 0)
+        sinks[--sink_count].backend->close();
+}
+
+// Bring 'scaled' up to date, the screen itself is read in place. Redrawing
+// the same sprite twice sets the update status as well, hence the hash.
+static void backend_convert(void) {
+    if (frame_valid && !frame_pending)
+        return;
+
+    const uint64_t hash = CHIP8_screen_hash();
+    frame_pending = 0;
+    if (frame_valid && hash == frame_hash)
+        return;
+
+    CHIP8_screen_view view;
+    CHIP8_screen_get_view(&view);
+
+    CHIP8_scaler_run(scaler, view.pixels, view.stride, view.width,
+                     view.height, &scaled[0][0], sizeof(scaled[0]));
+
+    frame.screen = view.pixels;
+    frame.screen_stride = view.stride;
+    frame.factor = CHIP8_scaler_factor(scaler);
+    frame.width = view.width * frame.factor;
+    frame.height = view.height * frame.factor;
+    frame.version++;
+    frame_hash = hash;
+    frame_valid = 1;
+}
+
+const uint32_t CHIP8_backend_frame(void) {
+    uint32_t result = 0;
+    uint8_t converted = 0;
+
+    frame_pending |= CHIP8_screen_get_update_status();
+    frame.refresh = 0;
+
+    for (uint32_t i = 0; i < sink_count; i++) {
+        if (frame.number % sinks[i].interval != 0)
+            continue;
+
+        if (!converted) {
+            backend_convert();
+            converted = 1;
+        }
+
+        result |= sinks[i].backend->frame(&frame);
+    }
+
+    frame.number++;
+
+    return result;
+}
+
+void CHIP8_backend_refresh(void) {
+    frame_pending |= CHIP8_screen_get_update_status();
+    backend_convert();
+    frame.refresh = 1;
+
+    for (uint32_t i = 0; i < sink_count; i++)
+        sinks[i].backend->frame(&frame);
+}
+
+const uint32_t CHIP8_backend_handle_events(void) {
+    uint32_t result = 0;
+
+    for (uint32_t i = 0; i < sink_count; i++) {
+        if (sinks[i].backend->handle_events != NULL)
+            result |= sinks[i].backend->handle_events();
+    }
+
+    return result;
+}
+
+const CHIP8_BACKGROUND CHIP8_backend_background(void) {
+    CHIP8_BACKGROUND result = CHIP8_BACKGROUND_RUN;
+    uint8_t found = 0;
+
+    for (uint32_t i = 0; i < sink_count; i++) {
+        if (sinks[i].backend->background == NULL)
+            continue;
+
+        const CHIP8_BACKGROUND background = sinks[i].backend->background();
+        if (!found || background < result)
+            result = background;
+        found = 1;
+    }
+
+    return result;
+}
+
+const uint32_t CHIP8_backend_wait(void) {
+    for (uint32_t i = 0; i < sink_count; i++) {
+        const CHIP8_backend *backend = sinks[i].backend;
+
+        if (backend->wait != NULL && backend->background != NULL &&
+            backend->background() == CHIP8_BACKGROUND_PAUSE &&
+            backend->wait() != 0)
+            return 1;
+    }
+
+    return 0;
+}
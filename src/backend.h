@@ -1,11 +1,113 @@
 #ifndef _CHIP8_BACKEND_H_
 #define _CHIP8_BACKEND_H_
 
+#include "scaler.h"
+
 #include <stdint.h>
 
-extern void CHIP8_backend_exit();
-extern uint32_t CHIP8_backend_init(void);
-extern uint32_t CHIP8_backend_render(void);
-extern uint32_t CHIP8_backend_handle_events(void);
+// Outputs of the run loop (window, capture, ...) are sinks behind a small
+// vtable, kept in a registry. Every frame, the registry reads the screen in
+// place through the scaler once, into a buffer all sinks share, and hands it
+// to each sink that is due: A sink added with an interval of n only gets
+// every nth frame. Nothing is converted in frames no sink is due in, or if the
+// screen hasn't changed since the last conversion.
+
+// Sinks that can be added at the same time
+#define CHIP8_BACKEND_MAX_SINKS 8
+
+// Frames run back to back per wakeup with CHIP8_BACKGROUND_THROTTLE (4
+// wakeups per second)
+#define CHIP8_BACKEND_THROTTLE_FRAMES 15
+
+// What the run loop does while the window is hidden (minimized) or doesn't
+// have the focus
+typedef enum {
+    // Emulate and render, as usual
+    CHIP8_BACKGROUND_RUN,
+    // Emulate at full rate, without rendering
+    CHIP8_BACKGROUND_NORENDER,
+    // Emulate without rendering, waking up once per
+    // CHIP8_BACKEND_THROTTLE_FRAMES frames to run them all at once
+    CHIP8_BACKGROUND_THROTTLE,
+    // Stop emulating, blocked on window events (see CHIP8_backend_wait)
+    CHIP8_BACKGROUND_PAUSE,
+} CHIP8_BACKGROUND;
+
+// The screen as handed to the sinks: palette indices after the scaler
+typedef struct {
+    const uint8_t *pixels; // Rows of <stride> bytes
+    uint32_t stride;
+    uint32_t width;
+    uint32_t height;
+    uint32_t factor; // Of the scaler, <width> / screen width
+    // The same before the scaler, <width> / <factor> pixels per row. Points
+    // at the machine's screen (see CHIP8_screen_get_view).
+    const uint8_t *screen;
+    uint32_t screen_stride;
+    uint64_t number;  // Frames since the start
+    uint64_t version; // Changes whenever the pixels do
+    uint8_t refresh;  // Shows the same frame again, not a new one
+} CHIP8_frame;
+
+typedef struct {
+    const char *name;
+    /// Output <frame>. Returns 0, or 1 to stop the run loop.
+    uint32_t (*frame)(const CHIP8_frame *frame);
+    /// Optional: Poll input. Returns 1 to quit.
+    uint32_t (*handle_events)(void);
+    /// Optional: Policy in effect right now (see CHIP8_backend_background)
+    CHIP8_BACKGROUND (*background)(void);
+    /// Optional: Block until the policy is no longer CHIP8_BACKGROUND_PAUSE.
+    /// Returns 1 to quit.
+    uint32_t (*wait)(void);
+    void (*close)(void);
+} CHIP8_backend;
+
+/// Start over without sinks. Frames go through <scaler>.
+extern void CHIP8_backend_init(CHIP8_SCALER scaler);
+
+/// Add <backend>, which gets every <interval>th frame (1: every frame).
+/// Returns 1 if there are too many sinks.
+extern const uint32_t CHIP8_backend_add(const CHIP8_backend *backend,
+                                        uint32_t interval);
+
+/// Close every sink (in reverse order)
+extern void CHIP8_backend_exit(void);
+
+/// A frame has been emulated: Hand it to every sink that is due. Returns 1
+/// if a sink asks to stop.
+extern const uint32_t CHIP8_backend_frame(void);
+
+/// Show the current screen again (i.e. while the debugger waits), without
+/// counting it as a frame. Sinks writing frames ignore it.
+extern void CHIP8_backend_refresh(void);
+
+/// Poll input of every sink. Returns 1 to quit.
+extern const uint32_t CHIP8_backend_handle_events(void);
+
+/// Policy in effect right now: The least idle of the sinks that have one,
+/// CHIP8_BACKGROUND_RUN without any
+extern const CHIP8_BACKGROUND CHIP8_backend_background(void);
+
+/// Block until no sink is paused anymore. Returns 1 to quit.
+extern const uint32_t CHIP8_backend_wait(void);
+
+// -------------
+// Sinks, each adds itself on success
+
+/// Open the SDL window (backend_sdl.c), showing every <interval>th frame.
+/// With <overlay>, a frame time graph is drawn over the screen (see
+/// stats.h). <hidden> and <unfocused> are the policies while the window is
+/// hidden or doesn't have the focus, <P> pauses. Returns 0 on success.
+extern const uint32_t CHIP8_backend_sdl_open(uint8_t overlay,
+                                             CHIP8_BACKGROUND hidden,
+                                             CHIP8_BACKGROUND unfocused,
+                                             uint32_t interval);
+
+/// Draw into the terminal on stdout (backend_term.c), every <interval>th
+/// frame, two pixels per character (upper half block) in 256 colors. Only
+/// the cells that changed are written, all in one write per frame. Keys
+/// are read from stdin, <P> pauses. Returns 0 on success.
+extern const uint32_t CHIP8_backend_term_open(uint32_t interval);
 
 #endif
@@ -1,13 +1,29 @@
 #include "backend.h"
 #include "chip8.h"
+#include "input.h"
 #include "log.h"
+#include "palette.h"
+#include "stats.h"
+#include "timing.h"
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_render.h>
 #include <SDL2/SDL_video.h>
 
-#define WIN_WIDTH 64 * 20
-#define WIN_HEIGHT 32 * 20
+#include <stdio.h>
+
+#define WIN_WIDTH (64 * 20)
+#define WIN_HEIGHT (32 * 20)
+
+// Frame time graph of the overlay: One bar per frame, a frame's budget is
+// OVERLAY_BUDGET pixels high
+#define OVERLAY_BAR_WIDTH 4
+#define OVERLAY_BUDGET 48
+#define OVERLAY_MARGIN 8
+#define OVERLAY_TITLE_NSEC 1000000000ull
+
+#define TITLE "emu_chip8 - press <ESC> to quit, <P> to pause"
+#define TITLE_PAUSED "emu_chip8 - paused, press <P> to continue"
 
 #define ASSERT_SDL(condition)                                                  \
     do {                                                                       \
@@ -25,169 +41,357 @@
 static SDL_Window *win = NULL;
 static SDL_Renderer *renderer = NULL;
 
-static SDL_Rect rect;
+// Streaming texture of the scaled screen, recreated when its size changes
+// and only uploaded when the frame has changed
+static SDL_Texture *texture = NULL;
+static uint32_t texture_width = 0;
+static uint32_t texture_height = 0;
+static uint64_t texture_version = 0;
+
+static uint8_t overlay;
+static uint64_t overlay_title_time = 0;
+
+// Palette in the texture's format
+static uint32_t colors[CHIP8_PALETTE_SIZE];
+
+// Window state, as of the last window event
+static CHIP8_BACKGROUND policy_hidden;
+static CHIP8_BACKGROUND policy_unfocused;
+static uint8_t hidden = 0;
+static uint8_t focused = 1;
+static uint8_t paused = 0;
+
+static const char *background_names[] = {
+    [CHIP8_BACKGROUND_RUN] = "running",
+    [CHIP8_BACKGROUND_NORENDER] = "not rendering",
+    [CHIP8_BACKGROUND_THROTTLE] = "throttled",
+    [CHIP8_BACKGROUND_PAUSE] = "paused",
+};
+
+static const CHIP8_backend backend_sdl;
+
+const uint32_t CHIP8_backend_sdl_open(uint8_t backend_overlay,
+                                      CHIP8_BACKGROUND backend_hidden,
+                                      CHIP8_BACKGROUND backend_unfocused,
+                                      uint32_t interval) {
+    overlay = backend_overlay;
+    policy_hidden = backend_hidden;
+    policy_unfocused = backend_unfocused;
+    for (uint32_t i = 0; i < CHIP8_PALETTE_SIZE; i++)
+        colors[i] = 0xff000000 | CHIP8_palette[i];
 
-uint32_t CHIP8_backend_init(void) {
     SDL_Init(SDL_INIT_EVENTS | SDL_INIT_VIDEO);
 
-    win = SDL_CreateWindow("emu_chip8 - press <ESC> to quit", 0, 0, WIN_WIDTH,
-                           WIN_HEIGHT, SDL_WINDOW_OPENGL);
+    win = SDL_CreateWindow(TITLE, 0, 0, WIN_WIDTH, WIN_HEIGHT,
+                           SDL_WINDOW_OPENGL);
     ASSERT_SDL(win == NULL);
 
     renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
     ASSERT_SDL(renderer == NULL);
 
-    return 0;
+    return CHIP8_backend_add(&backend_sdl, interval);
 }
 
-void CHIP8_backend_exit(void) {
+static void backend_sdl_close(void) {
+    if (texture != NULL)
+        SDL_DestroyTexture(texture);
+    texture = NULL;
+
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(win);
 }
 
-uint32_t CHIP8_backend_render(void) {
-    // background / color 0
-    SET_COLOR(renderer, 0x282828);
-    SDL_RenderClear(renderer);
+// Draw the frame time graph over the bottom left corner of the screen.
+// Gray: time between frames (red: a frame was late), green: emulation,
+// white: the frame budget.
+static void backend_draw_overlay(void) {
+    uint64_t intervals[CHIP8_STATS_HISTORY], cpu[CHIP8_STATS_HISTORY];
+    const uint32_t count =
+        CHIP8_stats_history(intervals, cpu, CHIP8_STATS_HISTORY);
+
+    const int base = WIN_HEIGHT - OVERLAY_MARGIN;
+    SDL_Rect bar = {.w = OVERLAY_BAR_WIDTH - 1};
 
-    uint8_t width, height;
-    CHIP8_screen_get_resolution(&width, &height);
-    uint32_t pixel_size = WIN_WIDTH / width;
-
-    rect.w = pixel_size;
-    rect.h = pixel_size;
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            uint8_t pixel = CHIP8_screen_get_pixel(x, y);
-
-            if (pixel) {
-                // Colorscheme taken from: https://packagecontrol.io/packages/gruvbox#Palette
-                switch (pixel) {
-                case 1:
-                    SET_COLOR(renderer, 0x928374);
-                    break;
-                case 2:
-                    SET_COLOR(renderer, 0xcc241d);
-                    break;
-                case 3:
-                    SET_COLOR(renderer, 0xfb4934);
-                    break;
-                case 4:
-                    SET_COLOR(renderer, 0x98971a);
-                    break;
-                case 5:
-                    SET_COLOR(renderer, 0xb8bb26);
-                    break;
-                case 6:
-                    SET_COLOR(renderer, 0xd79921);
-                    break;
-                case 7:
-                    SET_COLOR(renderer, 0xfabd2f);
-                    break;
-                case 8:
-                    SET_COLOR(renderer, 0x458588);
-                    break;
-                case 9:
-                    SET_COLOR(renderer, 0x83a598);
-                    break;
-                case 10:
-                    SET_COLOR(renderer, 0xb16286);
-                    break;
-                case 11:
-                    SET_COLOR(renderer, 0xd3869b);
-                    break;
-                case 12:
-                    SET_COLOR(renderer, 0x689d6a);
-                    break;
-                case 13:
-                    SET_COLOR(renderer, 0x8ec07);
-                    break;
-                case 14:
-                    SET_COLOR(renderer, 0xa89984);
-                    break;
-                case 15:
-                    SET_COLOR(renderer, 0xebdbb2);
-                    break;
-                }
-
-                rect.x = x * pixel_size;
-                rect.y = y * pixel_size;
-                SDL_RenderFillRect(renderer, &rect);
-            }
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t height =
+            intervals[i] * OVERLAY_BUDGET / CHIP8_TIMER_RENDER_RATE_NSEC;
+        if (height > 2 * OVERLAY_BUDGET)
+            height = 2 * OVERLAY_BUDGET;
+
+        bar.x = OVERLAY_MARGIN + i * OVERLAY_BAR_WIDTH;
+        bar.y = base - height;
+        bar.h = height;
+        const uint8_t late =
+            intervals[i] > CHIP8_TIMER_RENDER_RATE_NSEC * 5 / 4;
+        SET_COLOR(renderer, late ? 0xd04040 : 0x808080);
+        SDL_RenderFillRect(renderer, &bar);
+
+        height = cpu[i] * OVERLAY_BUDGET / CHIP8_TIMER_RENDER_RATE_NSEC;
+        if (height > 2 * OVERLAY_BUDGET)
+            height = 2 * OVERLAY_BUDGET;
+
+        bar.y = base - height;
+        bar.h = height;
+        SET_COLOR(renderer, 0x40d040);
+        SDL_RenderFillRect(renderer, &bar);
+    }
+
+    const SDL_Rect budget = {
+        .x = OVERLAY_MARGIN,
+        .y = base - OVERLAY_BUDGET,
+        .w = CHIP8_STATS_HISTORY * OVERLAY_BAR_WIDTH,
+        .h = 1,
+    };
+    SET_COLOR(renderer, 0xffffff);
+    SDL_RenderFillRect(renderer, &budget);
+
+    // Numbers go into the window title, once per second
+    const uint64_t now = time_now_nsec();
+    if (now - overlay_title_time >= OVERLAY_TITLE_NSEC) {
+        char title[160];
+        char summary[96];
+
+        CHIP8_stats_summary(summary, sizeof(summary));
+        snprintf(title, sizeof(title),
+                 "emu_chip8 - %s - press <ESC> to quit, <P> to pause",
+                 summary);
+        SDL_SetWindowTitle(win, title);
+
+        overlay_title_time = now;
+    }
+}
+
+static CHIP8_BACKGROUND backend_sdl_background(void);
+
+static uint32_t backend_sdl_frame(const CHIP8_frame *frame) {
+    // In the background, the window isn't drawn at all
+    if (backend_sdl_background() != CHIP8_BACKGROUND_RUN)
+        return 0;
+
+    const uint32_t width = frame->width;
+    const uint32_t height = frame->height;
+
+    if (texture == NULL || width != texture_width ||
+        height != texture_height) {
+        if (texture != NULL)
+            SDL_DestroyTexture(texture);
+
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_STREAMING, width,
+                                    height);
+        ASSERT_SDL(texture == NULL);
+
+        texture_width = width;
+        texture_height = height;
+        texture_version = frame->version - 1;
+    }
+
+    if (texture_version != frame->version) {
+        void *pixels;
+        int pitch;
+        ASSERT_SDL(SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0);
+
+        for (uint32_t y = 0; y < height; y++) {
+            const uint8_t *in = frame->pixels + (size_t)y * frame->stride;
+            uint32_t *row =
+                (uint32_t *)((uint8_t *)pixels + (size_t)y * pitch);
+            for (uint32_t x = 0; x < width; x++)
+                row[x] = colors[in[x]];
         }
+
+        SDL_UnlockTexture(texture);
+        texture_version = frame->version;
     }
 
+    // Largest whole multiple that fits into the window, centered, so every
+    // pixel keeps the same size
+    uint32_t zoom = WIN_WIDTH / width;
+    if (WIN_HEIGHT / height < zoom)
+        zoom = WIN_HEIGHT / height;
+
+    const SDL_Rect target = {
+        .x = (WIN_WIDTH - width * zoom) / 2,
+        .y = (WIN_HEIGHT - height * zoom) / 2,
+        .w = width * zoom,
+        .h = height * zoom,
+    };
+
+    // background / color 0
+    SET_COLOR(renderer, CHIP8_palette[0]);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, &target);
+
+    if (overlay)
+        backend_draw_overlay();
+
     SDL_RenderPresent(renderer);
 
+    if (!frame->refresh)
+        CHIP8_input_presented(time_now_nsec());
+
+    return 0;
+}
+
+static CHIP8_BACKGROUND backend_sdl_background(void) {
+    if (paused)
+        return CHIP8_BACKGROUND_PAUSE;
+    if (hidden)
+        return policy_hidden;
+    if (!focused)
+        return policy_unfocused;
+
+    return CHIP8_BACKGROUND_RUN;
+}
+
+static void backend_window_event(const SDL_WindowEvent *event) {
+    const CHIP8_BACKGROUND before = backend_sdl_background();
+
+    switch (event->event) {
+    case SDL_WINDOWEVENT_HIDDEN:
+    case SDL_WINDOWEVENT_MINIMIZED:
+        hidden = 1;
+        break;
+    case SDL_WINDOWEVENT_SHOWN:
+    case SDL_WINDOWEVENT_RESTORED:
+    case SDL_WINDOWEVENT_MAXIMIZED:
+    case SDL_WINDOWEVENT_EXPOSED:
+        hidden = 0;
+        break;
+    case SDL_WINDOWEVENT_FOCUS_GAINED:
+        focused = 1;
+        break;
+    case SDL_WINDOWEVENT_FOCUS_LOST:
+        focused = 0;
+        break;
+    default:
+        return;
+    }
+
+    const CHIP8_BACKGROUND after = backend_sdl_background();
+    if (after != before)
+        log_info("backend: Window %s, %s",
+                 hidden ? "hidden" : focused ? "focused" : "unfocused",
+                 background_names[after]);
+}
+
+// Returns 1 to quit
+static uint32_t backend_event(const SDL_Event *event, const uint64_t now) {
+    if (event->type == SDL_QUIT)
+        return 1;
+
+    if (event->type == SDL_WINDOWEVENT) {
+        backend_window_event(&event->window);
+        return 0;
+    }
+
+    if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP)
+        return 0;
+
+    uint8_t keystate = event->key.state == SDL_PRESSED ? CHIP8_KEY_PRESSED
+                                                       : CHIP8_KEY_RELEASED;
+    switch (event->key.keysym.scancode) {
+    case SDL_SCANCODE_ESCAPE:
+        return 1;
+        break;
+    case SDL_SCANCODE_P:
+        if (event->type == SDL_KEYDOWN && !event->key.repeat) {
+            paused = !paused;
+            SDL_SetWindowTitle(win, paused ? TITLE_PAUSED : TITLE);
+            log_info("backend: %s", paused ? "Paused" : "Continued");
+        }
+        break;
+    case SDL_SCANCODE_1: // 0x0
+        CHIP8_input_push(0x0, keystate, now);
+        break;
+    case SDL_SCANCODE_2: // 0x1
+        CHIP8_input_push(0x1, keystate, now);
+        break;
+    case SDL_SCANCODE_3: // 0x2
+        CHIP8_input_push(0x2, keystate, now);
+        break;
+    case SDL_SCANCODE_4: // 0x3
+        CHIP8_input_push(0x3, keystate, now);
+        break;
+    case SDL_SCANCODE_Q: // 0x4
+        CHIP8_input_push(0x4, keystate, now);
+        break;
+    case SDL_SCANCODE_W: // 0x5
+        CHIP8_input_push(0x5, keystate, now);
+        break;
+    case SDL_SCANCODE_E: // 0x6
+        CHIP8_input_push(0x6, keystate, now);
+        break;
+    case SDL_SCANCODE_R: // 0x7
+        CHIP8_input_push(0x7, keystate, now);
+        break;
+    case SDL_SCANCODE_A: // 0x8
+        CHIP8_input_push(0x8, keystate, now);
+        break;
+    case SDL_SCANCODE_S: // 0x9
+        CHIP8_input_push(0x9, keystate, now);
+        break;
+    case SDL_SCANCODE_D: // 0xA
+        CHIP8_input_push(0xa, keystate, now);
+        break;
+    case SDL_SCANCODE_F: // 0xB
+        CHIP8_input_push(0xb, keystate, now);
+        break;
+    case SDL_SCANCODE_Z: // 0xC
+        CHIP8_input_push(0xc, keystate, now);
+        break;
+    case SDL_SCANCODE_X: // 0xD
+        CHIP8_input_push(0xd, keystate, now);
+        break;
+    case SDL_SCANCODE_C: // 0xE
+        CHIP8_input_push(0xe, keystate, now);
+        break;
+    case SDL_SCANCODE_V: // 0xF
+        CHIP8_input_push(0xf, keystate, now);
+        break;
+    default:
+        break;
+    }
+
     return 0;
 }
 
-uint32_t CHIP8_backend_handle_events(void) {
+static uint32_t backend_sdl_handle_events(void) {
     SDL_Event event;
 
+    // Events are queued with the time they were polled at, so this should
+    // be called often (see CHIP8_INPUT_POLL_NSEC)
+    const uint64_t now = time_now_nsec();
+
     while (SDL_PollEvent(&event)) {
-        if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
-            uint8_t keystate = event.key.state == SDL_PRESSED
-                                   ? CHIP8_KEY_PRESSED
-                                   : CHIP8_KEY_RELEASED;
-            switch (event.key.keysym.scancode) {
-            case SDL_SCANCODE_ESCAPE:
-                return 1;
-                break;
-            case SDL_SCANCODE_1: // 0x0
-                CHIP8_input_set(0x0, keystate);
-                break;
-            case SDL_SCANCODE_2: // 0x1
-                CHIP8_input_set(0x1, keystate);
-                break;
-            case SDL_SCANCODE_3: // 0x2
-                CHIP8_input_set(0x2, keystate);
-                break;
-            case SDL_SCANCODE_4: // 0x3
-                CHIP8_input_set(0x3, keystate);
-                break;
-            case SDL_SCANCODE_Q: // 0x4
-                CHIP8_input_set(0x4, keystate);
-                break;
-            case SDL_SCANCODE_W: // 0x5
-                CHIP8_input_set(0x5, keystate);
-                break;
-            case SDL_SCANCODE_E: // 0x6
-                CHIP8_input_set(0x6, keystate);
-                break;
-            case SDL_SCANCODE_R: // 0x7
-                CHIP8_input_set(0x7, keystate);
-                break;
-            case SDL_SCANCODE_A: // 0x8
-                CHIP8_input_set(0x8, keystate);
-                break;
-            case SDL_SCANCODE_S: // 0x9
-                CHIP8_input_set(0x9, keystate);
-                break;
-            case SDL_SCANCODE_D: // 0xA
-                CHIP8_input_set(0xa, keystate);
-                break;
-            case SDL_SCANCODE_F: // 0xB
-                CHIP8_input_set(0xb, keystate);
-                break;
-            case SDL_SCANCODE_Z: // 0xC
-                CHIP8_input_set(0xc, keystate);
-                break;
-            case SDL_SCANCODE_X: // 0xD
-                CHIP8_input_set(0xd, keystate);
-                break;
-            case SDL_SCANCODE_C: // 0xE
-                CHIP8_input_set(0xe, keystate);
-                break;
-            case SDL_SCANCODE_V: // 0xF
-                CHIP8_input_set(0xf, keystate);
-                break;
-            default:
-                break;
-            }
+        if (backend_event(&event, now))
+            return 1;
+    }
+
+    return 0;
+}
+
+static uint32_t backend_sdl_wait(void) {
+    SDL_Event event;
+
+    // Nothing runs until the next event, not even a timer
+    while (backend_sdl_background() == CHIP8_BACKGROUND_PAUSE) {
+        if (!SDL_WaitEvent(&event)) {
+            log_error("%s", SDL_GetError());
+            return 1;
         }
+
+        if (backend_event(&event, time_now_nsec()))
+            return 1;
     }
 
     return 0;
 }
+
+static const CHIP8_backend backend_sdl = {
+    .name = "sdl",
+    .frame = backend_sdl_frame,
+    .handle_events = backend_sdl_handle_events,
+    .background = backend_sdl_background,
+    .wait = backend_sdl_wait,
+    .close = backend_sdl_close,
+};
@@ -0,0 +1,372 @@
+#include "backend.h"
+#include "chip8.h"
+#include "input.h"
+#include "log.h"
+#include "palette.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Screen of the terminal: One character cell per column and two rows,
+// '▀' in the color of the upper pixel on the color of the lower one
+#define TERM_COLUMNS 128
+#define TERM_ROWS 32
+
+// Worst case of a cell: cursor move, both colors and the character
+#define TERM_CELL_MAX 48
+#define TERM_BUFFER_SIZE (TERM_COLUMNS * TERM_ROWS * TERM_CELL_MAX + 256)
+
+// Terminals only report key presses (and repeats): A key counts as held
+// until this long after its last one
+#define TERM_KEY_HOLD_NSEC 200000000ull
+
+#define TERM_UPPER_HALF "\xe2\x96\x80"
+
+typedef struct {
+    uint8_t upper;
+    uint8_t lower;
+} term_cell;
+
+static term_cell cells[TERM_ROWS][TERM_COLUMNS];
+static uint32_t columns = 0;
+static uint32_t rows = 0;
+static uint64_t drawn_version = 0;
+
+// Set by SIGWINCH: Everything is drawn again
+static volatile sig_atomic_t resized = 0;
+
+// Colors as last set, -1: unknown
+static int32_t current_fg;
+static int32_t current_bg;
+
+// Palette index to the closest color of the 256 color palette
+static uint8_t colors[CHIP8_PALETTE_SIZE];
+
+static char buffer[TERM_BUFFER_SIZE];
+static size_t buffer_used = 0;
+
+static struct termios saved_termios;
+static uint8_t raw_input = 0;
+static uint8_t paused = 0;
+
+// When each key is released, 0: not held
+static uint64_t key_release[16];
+
+static void term_put(const char *data, size_t size) {
+    memcpy(buffer + buffer_used, data, size);
+    buffer_used += size;
+}
+
+static void term_printf(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void term_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    buffer_used += vsnprintf(buffer + buffer_used,
+                             sizeof(buffer) - buffer_used, format, args);
+    va_end(args);
+}
+
+// Everything buffered, in one write (unless the terminal takes less)
+static uint32_t term_flush(void) {
+    size_t written = 0;
+
+    while (written < buffer_used) {
+        const ssize_t result =
+            write(STDOUT_FILENO, buffer + written, buffer_used - written);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            log_error("term: Failed to write (%s)", strerror(errno));
+            buffer_used = 0;
+            return 1;
+        }
+        written += result;
+    }
+
+    buffer_used = 0;
+    return 0;
+}
+
+// Component value of a level (0-5) of the color cube
+static uint32_t term_cube_value(const uint32_t level) {
+    return level == 0 ? 0 : 55 + level * 40;
+}
+
+static uint8_t term_color(const uint32_t rgb) {
+    const int32_t r = CHIP8_PALETTE_R(rgb);
+    const int32_t g = CHIP8_PALETTE_G(rgb);
+    const int32_t b = CHIP8_PALETTE_B(rgb);
+    uint8_t best = 16;
+    int32_t best_distance = INT32_MAX;
+
+    // 6x6x6 cube (16-231) and gray ramp (232-255)
+    for (uint32_t i = 16; i < 256; i++) {
+        int32_t cr, cg, cb;
+        if (i < 232) {
+            cr = term_cube_value((i - 16) / 36);
+            cg = term_cube_value((i - 16) / 6 % 6);
+            cb = term_cube_value((i - 16) % 6);
+        } else {
+            cr = cg = cb = 8 + (i - 232) * 10;
+        }
+
+        const int32_t distance = (cr - r) * (cr - r) + (cg - g) * (cg - g) +
+                                 (cb - b) * (cb - b);
+        if (distance < best_distance) {
+            best = i;
+            best_distance = distance;
+        }
+    }
+
+    return best;
+}
+
+static void term_sigwinch(int signal) {
+    (void)signal;
+    resized = 1;
+}
+
+// Clear the terminal and keep the lines below the screen for the log
+static void term_reset(void) {
+    struct winsize size;
+    uint32_t height = 0;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0)
+        height = size.ws_row;
+
+    term_printf("\033[0m\033[2J");
+    if (height > rows + 1)
+        term_printf("\033[%u;%ur\033[%u;1H", rows + 2, height, rows + 2);
+    else
+        term_printf("\033[r");
+
+    current_fg = -1;
+    current_bg = -1;
+    resized = 0;
+}
+
+static uint32_t term_frame(const CHIP8_frame *frame) {
+    if (paused)
+        return 0;
+
+    // Cells are too coarse for the scaler, they show the screen as is
+    const uint32_t width = frame->width / frame->factor;
+    const uint32_t height = frame->height / frame->factor;
+    const uint8_t full = resized || width != columns || height / 2 != rows;
+
+    // Nothing changed, nothing is written
+    if (!full && frame->version == drawn_version)
+        return 0;
+
+    if (full) {
+        columns = width;
+        rows = height / 2;
+        term_reset();
+    }
+
+    // Save the log's cursor, it comes back at the end
+    term_printf("\0337");
+
+    uint32_t cursor_row = UINT32_MAX;
+    uint32_t cursor_column = UINT32_MAX;
+
+    for (uint32_t y = 0; y < rows; y++) {
+        const uint8_t *upper =
+            frame->screen + (size_t)(2 * y) * frame->screen_stride;
+        const uint8_t *lower = upper + frame->screen_stride;
+
+        for (uint32_t x = 0; x < columns; x++) {
+            const term_cell cell = {.upper = upper[x], .lower = lower[x]};
+
+            if (!full && cells[y][x].upper == cell.upper &&
+                cells[y][x].lower == cell.lower)
+                continue;
+            cells[y][x] = cell;
+
+            if (y != cursor_row || x != cursor_column)
+                term_printf("\033[%u;%uH", y + 1, x + 1);
+
+            const int32_t fg = colors[cell.upper];
+            const int32_t bg = colors[cell.lower];
+
+            // Same color above and below: A blank in the background color
+            if (fg == bg) {
+                if (bg != current_bg)
+                    term_printf("\033[48;5;%dm", bg);
+                current_bg = bg;
+                term_put(" ", 1);
+            } else {
+                if (fg != current_fg && bg != current_bg)
+                    term_printf("\033[38;5;%d;48;5;%dm", fg, bg);
+                else if (fg != current_fg)
+                    term_printf("\033[38;5;%dm", fg);
+                else if (bg != current_bg)
+                    term_printf("\033[48;5;%dm", bg);
+                current_fg = fg;
+                current_bg = bg;
+                term_put(TERM_UPPER_HALF, sizeof(TERM_UPPER_HALF) - 1);
+            }
+
+            cursor_row = y;
+            cursor_column = x + 1;
+        }
+    }
+
+    // Log lines keep the terminal's colors
+    term_printf("\033[0m\0338");
+    current_fg = -1;
+    current_bg = -1;
+
+    drawn_version = frame->version;
+
+    return term_flush();
+}
+
+// Same layout as the window: '1'-'4', 'q'-'r', 'a'-'f' and 'z'-'v' are
+// keys 0x0 to 0xF (plus one, 0: not a key)
+static const uint8_t term_keys[128] = {
+    ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+    ['q'] = 0x5, ['w'] = 0x6, ['e'] = 0x7, ['r'] = 0x8,
+    ['a'] = 0x9, ['s'] = 0xa, ['d'] = 0xb, ['f'] = 0xc,
+    ['z'] = 0xd, ['x'] = 0xe, ['c'] = 0xf, ['v'] = 0x10,
+};
+
+// Returns 1 to quit
+static uint32_t term_input(const char *input, const size_t size,
+                           const uint64_t now) {
+    for (size_t i = 0; i < size; i++) {
+        const uint8_t c = input[i];
+
+        // Ctrl-C, or an escape on its own (not the start of a sequence)
+        if (c == 0x03 || (c == 0x1b && i + 1 == size))
+            return 1;
+
+        if (c == 'p' || c == 'P') {
+            paused = !paused;
+            log_info("term: %s", paused ? "Paused" : "Continued");
+            continue;
+        }
+
+        if (c >= sizeof(term_keys) || term_keys[c] == 0)
+            continue;
+
+        const uint8_t key = term_keys[c] - 1;
+        if (key_release[key] == 0)
+            CHIP8_input_push(key, CHIP8_KEY_PRESSED, now);
+        key_release[key] = now + TERM_KEY_HOLD_NSEC;
+    }
+
+    return 0;
+}
+
+static uint32_t term_handle_events(void) {
+    const uint64_t now = time_now_nsec();
+
+    for (uint32_t key = 0; key < 16; key++) {
+        if (key_release[key] != 0 && now >= key_release[key]) {
+            CHIP8_input_push(key, CHIP8_KEY_RELEASED, key_release[key]);
+            key_release[key] = 0;
+        }
+    }
+
+    if (!raw_input)
+        return 0;
+
+    // Returns right away (VMIN = VTIME = 0)
+    char input[64];
+    const ssize_t size = read(STDIN_FILENO, input, sizeof(input));
+
+    return size > 0 ? term_input(input, size, now) : 0;
+}
+
+static CHIP8_BACKGROUND term_background(void) {
+    return paused ? CHIP8_BACKGROUND_PAUSE : CHIP8_BACKGROUND_RUN;
+}
+
+static uint32_t term_wait(void) {
+    struct pollfd fd = {.fd = STDIN_FILENO, .events = POLLIN};
+
+    while (paused && raw_input) {
+        if (poll(&fd, 1, -1) < 0 && errno != EINTR) {
+            log_error("term: Failed to wait for input (%s)", strerror(errno));
+            return 1;
+        }
+
+        if (term_handle_events())
+            return 1;
+    }
+
+    return 0;
+}
+
+static void term_close(void) {
+    // Back to the main screen, with the cursor and the terminal settings
+    // as they were
+    term_printf("\033[0m\033[r\033[?25h\033[?1049l");
+    term_flush();
+
+    if (raw_input)
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+    raw_input = 0;
+
+    signal(SIGWINCH, SIG_DFL);
+}
+
+static const CHIP8_backend backend_term = {
+    .name = "term",
+    .frame = term_frame,
+    .handle_events = term_handle_events,
+    .background = term_background,
+    .wait = term_wait,
+    .close = term_close,
+};
+
+const uint32_t CHIP8_backend_term_open(uint32_t interval) {
+    if (!isatty(STDOUT_FILENO)) {
+        log_error("%s", "term: stdout is not a terminal");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < CHIP8_PALETTE_SIZE; i++)
+        colors[i] = term_color(CHIP8_palette[i]);
+
+    memset(key_release, 0, sizeof(key_release));
+    columns = 0;
+    rows = 0;
+    paused = 0;
+
+    // Keys arrive one by one, without echo, and reads don't block
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_termios) == 0) {
+        struct termios raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        raw_input = tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0;
+    }
+
+    signal(SIGWINCH, term_sigwinch);
+
+    // Alternate screen, no cursor
+    term_printf("\033[?1049h\033[?25l");
+    if (term_flush() != 0) {
+        term_close();
+        return 1;
+    }
+
+    if (CHIP8_backend_add(&backend_term, interval) != 0) {
+        term_close();
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,466 @@
+#include "batch.h"
+#include "chip8.h"
+#include "log.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BATCH_LINE_SIZE 4096
+
+typedef enum {
+    BATCH_EXIT_NONE,
+    BATCH_EXIT_EXIT,
+    BATCH_EXIT_INVALID,
+    BATCH_EXIT_FRAMES,
+    BATCH_EXIT_INSTRUCTIONS,
+    BATCH_EXIT_LOAD_ERROR,
+} batch_exit_t;
+
+static const char *batch_exit_names[] = {
+    [BATCH_EXIT_NONE] = "none",
+    [BATCH_EXIT_EXIT] = "exit",
+    [BATCH_EXIT_INVALID] = "invalid_opcode",
+    [BATCH_EXIT_FRAMES] = "frame_budget",
+    [BATCH_EXIT_INSTRUCTIONS] = "instruction_budget",
+    [BATCH_EXIT_LOAD_ERROR] = "load_error",
+};
+
+typedef struct {
+    char *path;
+
+    // Result, written by the worker which ran the job
+    CHIP8_MODE mode;
+    batch_exit_t exit_reason;
+    uint64_t instructions;
+    uint32_t frames;
+    uint64_t time;
+    uint64_t screen_hash;
+} batch_job_t;
+
+// Job indices of one worker. The owner takes jobs from the bottom, idle
+// workers steal from the top, so they rarely compete for the same end.
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t *jobs;
+    uint32_t top;
+    uint32_t bottom;
+} batch_deque_t;
+
+typedef struct {
+    const CHIP8_config *config;
+    batch_job_t *jobs;
+    batch_deque_t *deques;
+    uint32_t worker_count;
+} batch_t;
+
+typedef struct {
+    batch_t *batch;
+    uint32_t id;
+    uint32_t steals;
+} batch_worker_t;
+
+static int batch_compare_jobs(const void *a, const void *b) {
+    return strcmp(((const batch_job_t *)a)->path,
+                  ((const batch_job_t *)b)->path);
+}
+
+static void batch_add_job(batch_job_t **jobs, uint32_t *count,
+                          uint32_t *capacity, char *path) {
+    if (*count == *capacity) {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        *jobs = realloc(*jobs, *capacity * sizeof(**jobs));
+        if (*jobs == NULL)
+            abort();
+    }
+
+    memset(&(*jobs)[*count], 0, sizeof(**jobs));
+    (*jobs)[(*count)++].path = path;
+}
+
+static char *batch_join(const char *directory, const char *name) {
+    const size_t length = strlen(directory) + strlen(name) + 2;
+    char *path = malloc(length);
+    if (path == NULL)
+        abort();
+
+    snprintf(path, length, "%s/%s", directory, name);
+    return path;
+}
+
+static const uint8_t batch_is_file(const char *path) {
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// Every regular file in <path>, except rom configuration files
+static const uint32_t batch_read_directory(const char *path,
+                                           batch_job_t **jobs,
+                                           uint32_t *count) {
+    const size_t suffix_length = strlen(CHIP8_CONFIG_ROM_SUFFIX);
+    uint32_t capacity = 0;
+
+    DIR *directory = opendir(path);
+    if (directory == NULL)
+        return 1;
+
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        const size_t length = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' ||
+            (length >= suffix_length &&
+             strcmp(entry->d_name + length - suffix_length,
+                    CHIP8_CONFIG_ROM_SUFFIX) == 0))
+            continue;
+
+        char *rom_path = batch_join(path, entry->d_name);
+        if (!batch_is_file(rom_path)) {
+            free(rom_path);
+            continue;
+        }
+
+        batch_add_job(jobs, count, &capacity, rom_path);
+    }
+
+    closedir(directory);
+
+    // readdir has no particular order
+    if (*count > 1)
+        qsort(*jobs, *count, sizeof(**jobs), batch_compare_jobs);
+
+    return 0;
+}
+
+static const uint32_t batch_read_manifest(const char *path, batch_job_t **jobs,
+                                          uint32_t *count) {
+    char line[BATCH_LINE_SIZE];
+    uint32_t capacity = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 1;
+
+    // Relative paths are relative to the manifest
+    char *directory = strdup(path);
+    if (directory == NULL)
+        abort();
+    char *slash = strrchr(directory, '/');
+    if (slash != NULL)
+        *slash = '\0';
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char *start = line;
+        while (*start == ' ' || *start == '\t')
+            start++;
+
+        char *end = start + strlen(start);
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t' ||
+                               end[-1] == '\n' || end[-1] == '\r'))
+            end--;
+        *end = '\0';
+
+        if (*start == '\0')
+            continue;
+
+        char *rom_path = start[0] == '/' || slash == NULL
+                             ? strdup(start)
+                             : batch_join(directory, start);
+        if (rom_path == NULL)
+            abort();
+
+        batch_add_job(jobs, count, &capacity, rom_path);
+    }
+
+    free(directory);
+    fclose(file);
+
+    return 0;
+}
+
+static void batch_run_job(const CHIP8_config *base, batch_job_t *job) {
+    CHIP8_config config;
+
+    if (CHIP8_config_for_rom(base, job->path, &config) != 0) {
+        job->exit_reason = BATCH_EXIT_LOAD_ERROR;
+        return;
+    }
+
+    job->mode = config.mode;
+
+    CHIP8_reset();
+    CHIP8_set_mode(config.mode);
+    CHIP8_set_engine(config.engine);
+    CHIP8_seed(config.seed != 0 ? config.seed : CHIP8_BATCH_DEFAULT_SEED);
+
+    if (CHIP8_load_from_path(job->path) != 0) {
+        log_error("batch: Failed to load rom (%s): %s", strerror(errno),
+                  job->path);
+        job->exit_reason = BATCH_EXIT_LOAD_ERROR;
+        return;
+    }
+
+    // --instructions replaces the frame budget
+    const uint32_t frames =
+        config.instructions != 0
+            ? UINT32_MAX
+            : (config.frames != 0 ? config.frames
+                                  : CHIP8_CONFIG_DEFAULT_BATCH_FRAMES);
+
+    const uint64_t start = time_now_nsec();
+
+    while (job->exit_reason == BATCH_EXIT_NONE) {
+        uint32_t cycles = config.cycles_per_frame;
+        if (config.instructions != 0 &&
+            config.instructions - job->instructions < cycles)
+            cycles = config.instructions - job->instructions;
+
+        uint32_t executed = 0;
+        const int32_t status = CHIP8_cpu_run(cycles, &executed);
+        job->instructions += executed;
+
+        CHIP8_timer_tick();
+        CHIP8_screen_clear_update_status();
+        job->frames++;
+
+        if (status == -1)
+            job->exit_reason = BATCH_EXIT_INVALID;
+        else if (status == 2)
+            job->exit_reason = BATCH_EXIT_EXIT;
+        else if (job->frames >= frames)
+            job->exit_reason = BATCH_EXIT_FRAMES;
+        else if (config.instructions != 0 &&
+                 job->instructions >= config.instructions)
+            job->exit_reason = BATCH_EXIT_INSTRUCTIONS;
+    }
+
+    job->time = time_now_nsec() - start;
+    job->screen_hash = CHIP8_screen_hash();
+}
+
+// Take a job from the worker's own deque, or steal one from another worker.
+// Returns 0 once every deque is empty (jobs are never added while running).
+static const uint8_t batch_next_job(batch_worker_t *worker, uint32_t *job) {
+    batch_t *batch = worker->batch;
+
+    batch_deque_t *own = &batch->deques[worker->id];
+    pthread_mutex_lock(&own->lock);
+    const uint8_t found = own->bottom > own->top;
+    if (found)
+        *job = own->jobs[--own->bottom];
+    pthread_mutex_unlock(&own->lock);
+
+    if (found)
+        return 1;
+
+    for (uint32_t i = 1; i < batch->worker_count; i++) {
+        batch_deque_t *victim =
+            &batch->deques[(worker->id + i) % batch->worker_count];
+
+        pthread_mutex_lock(&victim->lock);
+        const uint8_t stolen = victim->bottom > victim->top;
+        if (stolen)
+            *job = victim->jobs[victim->top++];
+        pthread_mutex_unlock(&victim->lock);
+
+        if (stolen) {
+            worker->steals++;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void *batch_worker(void *arg) {
+    batch_worker_t *worker = arg;
+    batch_t *batch = worker->batch;
+    uint32_t job;
+
+    // One machine per worker, reset between roms
+    CHIP8_machine *machine = CHIP8_machine_create();
+    CHIP8_machine_select(machine);
+
+    while (batch_next_job(worker, &job))
+        batch_run_job(batch->config, &batch->jobs[job]);
+
+    CHIP8_machine_destroy(machine);
+
+    return NULL;
+}
+
+static void batch_write_string(FILE *file, const char *str) {
+    fputc('"', file);
+
+    for (; *str != '\0'; str++) {
+        const unsigned char c = *str;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+
+    fputc('"', file);
+}
+
+static void batch_write_job(FILE *file, const batch_job_t *job) {
+    const double seconds = job->time / 1e9;
+
+    fputs("{\"rom\": ", file);
+    batch_write_string(file, job->path);
+
+    if (job->exit_reason == BATCH_EXIT_LOAD_ERROR) {
+        fprintf(file, ", \"exit_reason\": \"%s\"}\n",
+                batch_exit_names[job->exit_reason]);
+        return;
+    }
+
+    fprintf(file,
+            ", \"mode\": \"%s\", \"exit_reason\": \"%s\", "
+            "\"instructions\": %llu, \"frames\": %u, \"seconds\": %.6f, "
+            "\"ips\": %.0f, \"screen_hash\": \"%016llx\"}\n",
+            CHIP8_config_mode_name(job->mode),
+            batch_exit_names[job->exit_reason],
+            (unsigned long long)job->instructions, job->frames, seconds,
+            seconds > 0 ? job->instructions / seconds : 0.0,
+            (unsigned long long)job->screen_hash);
+}
+
+const uint32_t CHIP8_batch_run(const CHIP8_config *config, const char *path) {
+    assert(config != NULL && path != NULL);
+
+    batch_job_t *jobs = NULL;
+    uint32_t job_count = 0;
+
+    // Per rom messages would drown the records
+    if (getenv("LOG_LEVEL") == NULL)
+        log_set_level(LOG_LEVEL_WARN);
+
+    struct stat info;
+    if (stat(path, &info) != 0 ||
+        (S_ISDIR(info.st_mode)
+             ? batch_read_directory(path, &jobs, &job_count)
+             : batch_read_manifest(path, &jobs, &job_count)) != 0) {
+        log_error("batch: Failed to read %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    if (job_count == 0) {
+        log_error("batch: No roms in %s", path);
+        return 1;
+    }
+
+    FILE *output = stdout;
+    if (config->batch_output != NULL) {
+        output = fopen(config->batch_output, "w");
+        if (output == NULL) {
+            log_error("batch: Failed to open %s: %s", config->batch_output,
+                      strerror(errno));
+            return 1;
+        }
+    }
+
+    uint32_t worker_count = config->threads;
+    if (worker_count == 0) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cores > 0 ? cores : 1;
+    }
+    if (worker_count > job_count)
+        worker_count = job_count;
+
+    batch_t batch = {
+        .config = config,
+        .jobs = jobs,
+        .deques = calloc(worker_count, sizeof(batch_deque_t)),
+        .worker_count = worker_count,
+    };
+    batch_worker_t *workers = calloc(worker_count, sizeof(batch_worker_t));
+    pthread_t *threads = calloc(worker_count, sizeof(pthread_t));
+    if (batch.deques == NULL || workers == NULL || threads == NULL)
+        abort();
+
+    // Deal the jobs round-robin. The owner works through its deque from the
+    // bottom, so reverse the order to start with the first job.
+    for (uint32_t i = 0; i < worker_count; i++) {
+        batch_deque_t *deque = &batch.deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->jobs = malloc((job_count / worker_count + 1) * sizeof(uint32_t));
+        if (deque->jobs == NULL)
+            abort();
+    }
+    for (uint32_t i = job_count; i-- > 0;) {
+        batch_deque_t *deque = &batch.deques[i % worker_count];
+        deque->jobs[deque->bottom++] = i;
+    }
+
+    const uint64_t start = time_now_nsec();
+
+    uint32_t started = 0;
+    for (; started < worker_count; started++) {
+        workers[started].batch = &batch;
+        workers[started].id = started;
+        if (pthread_create(&threads[started], NULL, batch_worker,
+                           &workers[started]) != 0)
+            break;
+    }
+
+    // The remaining jobs get stolen by the threads that did start
+    if (started == 0) {
+        log_error("%s", "batch: Failed to start any worker");
+        return 1;
+    }
+
+    uint32_t steals = 0;
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        steals += workers[i].steals;
+    }
+
+    const uint64_t time = time_now_nsec() - start;
+
+    uint32_t exit_code = 0;
+    uint64_t instructions = 0;
+    for (uint32_t i = 0; i < job_count; i++) {
+        batch_write_job(output, &jobs[i]);
+
+        instructions += jobs[i].instructions;
+        if (jobs[i].exit_reason == BATCH_EXIT_LOAD_ERROR ||
+            jobs[i].exit_reason == BATCH_EXIT_INVALID)
+            exit_code = 1;
+    }
+
+    if (output != stdout)
+        fclose(output);
+    else
+        fflush(output);
+
+    log_info("batch: %u roms, %llu instructions in %.3fs on %u threads "
+             "(%u steals)",
+             job_count, (unsigned long long)instructions, time / 1e9, started,
+             steals);
+
+    for (uint32_t i = 0; i < worker_count; i++) {
+        pthread_mutex_destroy(&batch.deques[i].lock);
+        free(batch.deques[i].jobs);
+    }
+    for (uint32_t i = 0; i < job_count; i++)
+        free(jobs[i].path);
+    free(jobs);
+    free(batch.deques);
+    free(workers);
+    free(threads);
+
+    return exit_code;
+}
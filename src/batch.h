@@ -0,0 +1,30 @@
+#ifndef _CHIP8_BATCH_H_
+#define _CHIP8_BATCH_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+// Seed used for every rom, unless --seed is given. Fixed, so that runs are
+// reproducible.
+#define CHIP8_BATCH_DEFAULT_SEED 0x2545f491
+
+/// Run every rom in <path> without a window, on <config->threads> worker
+/// threads. <path> is either a directory (every file except *.cfg) or a
+/// manifest with one rom path per line ('#' starts a comment, relative
+/// paths are relative to the manifest).
+///
+/// Each rom runs until it exits, hits an invalid optcode or uses up its
+/// budget (--frames, or --instructions). Roms are configured like on the
+/// command line (see CHIP8_config_for_rom).
+///
+/// Writes one JSON record per rom (in input order) to
+/// <config->batch_output> or stdout:
+///   {"rom": "...", "mode": "ch8", "exit_reason": "exit", "instructions": 1,
+///    "frames": 1, "seconds": 0.1, "ips": 10, "screen_hash": "..."}
+///
+/// Returns 0 if every rom was loaded and ran without an invalid optcode.
+extern const uint32_t CHIP8_batch_run(const CHIP8_config *config,
+                                      const char *path);
+
+#endif
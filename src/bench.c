@@ -0,0 +1,284 @@
+#include "bench.h"
+#include "aot.h"
+#include "batch.h"
+#include "chip8.h"
+#include "log.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Length of a run, unless --frames or --instructions is given
+#define BENCH_DEFAULT_INSTRUCTIONS 10000000ull
+
+typedef enum {
+    BENCH_CYCLES,
+    BENCH_INSTRUCTIONS,
+    BENCH_BRANCH_MISSES,
+    BENCH_L1D_MISSES,
+    BENCH_COUNTERS,
+} bench_counter;
+
+static const char *bench_counter_names[BENCH_COUNTERS] = {
+    [BENCH_CYCLES] = "cycles",
+    [BENCH_INSTRUCTIONS] = "instructions",
+    [BENCH_BRANCH_MISSES] = "branch misses",
+    [BENCH_L1D_MISSES] = "L1D read misses",
+};
+
+typedef struct {
+    const char *name;
+    CHIP8_ENGINE engine;
+    uint8_t aot;
+} bench_engine;
+
+static const bench_engine bench_engines[] = {
+    {"interpreter", CHIP8_ENGINE_INTERPRETER, 0},
+    {"predecoded", CHIP8_ENGINE_PREDECODED, 0},
+#ifdef CHIP8_AOT
+    {"aot", CHIP8_ENGINE_PREDECODED, 1},
+#endif
+};
+
+typedef struct {
+    uint64_t executed; // Emulated instructions
+    uint64_t time;
+    uint64_t counters[BENCH_COUNTERS];
+    uint8_t valid[BENCH_COUNTERS];
+} bench_result;
+
+// One file descriptor per counter (-1: not available)
+static int bench_fds[BENCH_COUNTERS];
+
+#ifdef __linux__
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} bench_events[BENCH_COUNTERS] = {
+    [BENCH_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [BENCH_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [BENCH_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [BENCH_L1D_MISSES] = {PERF_TYPE_HW_CACHE,
+                          PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+#endif
+
+// Open the counters for the calling thread (user space only, so it works
+// with the default perf_event_paranoid setting)
+static void bench_open(void) {
+    for (uint32_t i = 0; i < BENCH_COUNTERS; i++) {
+        bench_fds[i] = -1;
+
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = bench_events[i].type;
+        attr.config = bench_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        bench_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (bench_fds[i] == -1)
+            log_warn("bench: Counter '%s' is not available (%s)",
+                     bench_counter_names[i], strerror(errno));
+#endif
+    }
+}
+
+static void bench_close(void) {
+    for (uint32_t i = 0; i < BENCH_COUNTERS; i++) {
+#ifdef __linux__
+        if (bench_fds[i] != -1)
+            close(bench_fds[i]);
+#endif
+        bench_fds[i] = -1;
+    }
+}
+
+static void bench_start(void) {
+#ifdef __linux__
+    for (uint32_t i = 0; i < BENCH_COUNTERS; i++) {
+        if (bench_fds[i] == -1)
+            continue;
+
+        ioctl(bench_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(bench_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static void bench_stop(bench_result *result) {
+    for (uint32_t i = 0; i < BENCH_COUNTERS; i++) {
+        result->valid[i] = 0;
+
+#ifdef __linux__
+        if (bench_fds[i] == -1)
+            continue;
+
+        ioctl(bench_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        // Value, time enabled, time running
+        uint64_t values[3];
+        if (read(bench_fds[i], values, sizeof(values)) != sizeof(values) ||
+            values[2] == 0)
+            continue;
+
+        // Scale up, if the counter had to share the hardware with others
+        result->counters[i] =
+            values[2] < values[1]
+                ? (uint64_t)((double)values[0] * values[1] / values[2])
+                : values[0];
+        result->valid[i] = 1;
+#endif
+    }
+}
+
+// Load the rom and run it once with <engine>. Returns the status of the
+// last frame (-1: invalid optcode), 1 if the rom can't be loaded or 3 if
+// the engine can't run it.
+static const int32_t bench_run_engine(const CHIP8_config *config,
+                                      const bench_engine *engine,
+                                      bench_result *result) {
+    CHIP8_reset();
+    CHIP8_set_mode(config->mode);
+    CHIP8_set_engine(engine->engine);
+    CHIP8_seed(config->seed != 0 ? config->seed : CHIP8_BATCH_DEFAULT_SEED);
+
+    if (CHIP8_load_from_path(config->rom_path) != 0) {
+        log_error("bench: Failed to load rom (%s): %s", strerror(errno),
+                  config->rom_path);
+        return 1;
+    }
+
+    const int32_t (*run)(uint32_t cycles, uint32_t *executed) = CHIP8_cpu_run;
+#ifdef CHIP8_AOT
+    if (engine->aot) {
+        if (CHIP8_aot_init(&chip8_aot_program) != 0)
+            return 3;
+        run = CHIP8_aot_run;
+    }
+#endif
+
+    // Like batch runs, --instructions replaces the frame budget
+    const uint64_t budget =
+        config->instructions != 0
+            ? config->instructions
+            : (config->frames != 0
+                   ? (uint64_t)config->frames * config->cycles_per_frame
+                   : BENCH_DEFAULT_INSTRUCTIONS);
+
+    int32_t status = 0;
+    memset(result, 0, sizeof(*result));
+
+    const uint64_t start = time_now_nsec();
+    bench_start();
+
+    while (status == 0 && result->executed < budget) {
+        uint32_t cycles = config->cycles_per_frame;
+        if (budget - result->executed < cycles)
+            cycles = budget - result->executed;
+
+        uint32_t executed = 0;
+        status = run(cycles, &executed);
+        result->executed += executed;
+
+        CHIP8_timer_tick();
+        CHIP8_screen_clear_update_status();
+    }
+
+    bench_stop(result);
+    result->time = time_now_nsec() - start;
+
+    return status;
+}
+
+// Print <value> per emulated instruction, or "n/a"
+static void bench_print_ratio(const bench_result *result,
+                              const bench_counter counter) {
+    if (!result->valid[counter] || result->executed == 0) {
+        printf(" %12s", "n/a");
+        return;
+    }
+
+    printf(" %12.3f", (double)result->counters[counter] / result->executed);
+}
+
+const uint32_t CHIP8_bench_run(const CHIP8_config *config) {
+    uint32_t exit_code = 0;
+
+    // Tracing every instruction would be all that is measured
+    const LOG_LEVEL level = log_get_level();
+    if (level < LOG_LEVEL_INFO)
+        log_set_level(LOG_LEVEL_INFO);
+
+    CHIP8_init();
+    bench_open();
+
+    printf("Benchmark: %s (mode %s, %u instructions per frame, best of %d)\n",
+           config->rom_path, CHIP8_config_mode_name(config->mode),
+           config->cycles_per_frame, CHIP8_BENCH_RUNS);
+    printf("%-12s %12s %12s %12s %12s %12s %12s\n", "engine", "executed",
+           "ns/inst", "cycles/inst", "insts/inst", "brmiss/inst",
+           "l1dmiss/inst");
+
+    for (size_t i = 0; i < sizeof(bench_engines) / sizeof(*bench_engines);
+         i++) {
+        const bench_engine *engine = &bench_engines[i];
+        bench_result best;
+        int32_t status = 0;
+
+        for (uint32_t run = 0; run < CHIP8_BENCH_RUNS; run++) {
+            bench_result result;
+            status = bench_run_engine(config, engine, &result);
+            if (status == 1 || status == 3)
+                break;
+
+            if (run == 0 || result.time < best.time)
+                best = result;
+        }
+
+        if (status == 1) {
+            printf("%-12s %12s\n", engine->name, "failed");
+            exit_code = 1;
+            continue;
+        }
+
+        // Compiled for another rom or mode
+        if (status == 3) {
+            printf("%-12s %12s\n", engine->name, "skipped");
+            continue;
+        }
+
+        if (status == -1)
+            exit_code = 1;
+
+        printf("%-12s %12llu %12.3f", engine->name,
+               (unsigned long long)best.executed,
+               best.executed != 0 ? (double)best.time / best.executed : 0.0);
+        bench_print_ratio(&best, BENCH_CYCLES);
+        bench_print_ratio(&best, BENCH_INSTRUCTIONS);
+        bench_print_ratio(&best, BENCH_BRANCH_MISSES);
+        bench_print_ratio(&best, BENCH_L1D_MISSES);
+        printf("%s\n", status == -1 ? "  (invalid optcode)" : "");
+    }
+
+    bench_close();
+    CHIP8_exit();
+    log_set_level(level);
+
+    return exit_code;
+}
@@ -0,0 +1,24 @@
+#ifndef _CHIP8_BENCH_H_
+#define _CHIP8_BENCH_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+// Runs used per engine (the best one is reported)
+#define CHIP8_BENCH_RUNS 3
+
+/// Benchmark <config->rom_path>: Run the same fixed number of frames
+/// (--frames, default 600, or --instructions) once per engine, without a
+/// window and with a fixed seed, and print what each emulated instruction
+/// costs on the host. On Linux, the runs are wrapped in hardware counters
+/// (perf_event_open): cycles, instructions, branch misses and L1 data cache
+/// misses. Otherwise (or if the counters can't be opened, i.e. because of
+/// perf_event_paranoid), only the time is reported.
+///
+/// Instruction tracing is turned off while measuring.
+///
+/// Returns 0 unless the rom can't be loaded or hits an invalid optcode.
+extern const uint32_t CHIP8_bench_run(const CHIP8_config *config);
+
+#endif
@@ -0,0 +1,220 @@
+#include "capture.h"
+#include "backend.h"
+#include "log.h"
+#include "palette.h"
+#include "scaler.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames are always captured at the highest resolution
+#define CAPTURE_WIDTH 128
+#define CAPTURE_HEIGHT 64
+
+#define CAPTURE_FILE_BUFFER_SIZE (1024 * 1024)
+
+static FILE *capture_file = NULL;
+static CHIP8_CAPTURE_FORMAT capture_format;
+
+// The last converted frame, in its final output format
+static uint8_t *frame = NULL;
+static size_t frame_size;
+static uint32_t frame_width;
+static uint32_t frame_height;
+static uint64_t frame_version;
+static uint8_t frame_valid = 0;
+
+static uint64_t frames_written = 0;
+static uint64_t frames_repeated = 0;
+
+// Per palette index color, in the output format (Y/Cb/Cr or R/G/B)
+static uint8_t color_lut[3][CHIP8_PALETTE_SIZE];
+
+static void capture_build_lut(void) {
+    for (uint32_t i = 0; i < CHIP8_PALETTE_SIZE; i++) {
+        const int32_t r = CHIP8_PALETTE_R(CHIP8_palette[i]);
+        const int32_t g = CHIP8_PALETTE_G(CHIP8_palette[i]);
+        const int32_t b = CHIP8_PALETTE_B(CHIP8_palette[i]);
+
+        if (capture_format == CHIP8_CAPTURE_Y4M) {
+            // BT.601, limited range (fixed point, 8bit fraction)
+            color_lut[0][i] = ((16 << 8) + 66 * r + 129 * g + 25 * b + 128) >> 8;
+            color_lut[1][i] = ((128 << 8) - 38 * r - 74 * g + 112 * b + 128) >> 8;
+            color_lut[2][i] = ((128 << 8) + 112 * r - 94 * g - 18 * b + 128) >> 8;
+        } else {
+            color_lut[0][i] = r;
+            color_lut[1][i] = g;
+            color_lut[2][i] = b;
+        }
+    }
+}
+
+// Convert <screen> into 'frame'
+static void capture_convert(const CHIP8_frame *screen) {
+    const uint32_t width = screen->width;
+    const uint32_t height = screen->height;
+
+    // Output pixels per scaled pixel
+    const uint32_t factor = frame_width / width;
+
+    // Y4M is planar, rgb24 is packed
+    const uint32_t planes = capture_format == CHIP8_CAPTURE_Y4M ? 3 : 1;
+    const uint32_t pixel_size = capture_format == CHIP8_CAPTURE_RGB ? 3 : 1;
+    const size_t row_size = (size_t)frame_width * pixel_size;
+    const size_t plane_size = row_size * frame_height;
+
+    for (uint32_t y = 0; y < height; y++) {
+        const size_t row = (size_t)y * factor * row_size;
+        const uint8_t *in = screen->pixels + (size_t)y * screen->stride;
+
+        // Convert the first output row of each scaled row...
+        for (uint32_t x = 0; x < width; x++) {
+            const uint8_t pixel = in[x];
+            const size_t offset = row + (size_t)x * factor * pixel_size;
+
+            switch (capture_format) {
+            case CHIP8_CAPTURE_Y4M:
+                for (uint32_t plane = 0; plane < 3; plane++)
+                    memset(frame + plane * plane_size + offset,
+                           color_lut[plane][pixel], factor);
+                break;
+            case CHIP8_CAPTURE_RGB:
+                for (uint32_t i = 0; i < factor; i++) {
+                    uint8_t *out = frame + offset + i * 3;
+                    out[0] = color_lut[0][pixel];
+                    out[1] = color_lut[1][pixel];
+                    out[2] = color_lut[2][pixel];
+                }
+                break;
+            case CHIP8_CAPTURE_INDEX:
+                memset(frame + offset, pixel, factor);
+                break;
+            }
+        }
+
+        // ...and repeat it for the remaining ones
+        for (uint32_t plane = 0; plane < planes; plane++) {
+            uint8_t *first = frame + plane * plane_size + row;
+            for (uint32_t i = 1; i < factor; i++)
+                memcpy(first + i * row_size, first, row_size);
+        }
+    }
+}
+
+static const CHIP8_backend capture_backend;
+
+const uint32_t CHIP8_capture_open(const char *path,
+                                  CHIP8_CAPTURE_FORMAT format,
+                                  uint32_t scale, CHIP8_SCALER scaler,
+                                  uint32_t interval) {
+    assert(path != NULL);
+    assert(scale > 0);
+    assert(capture_file == NULL);
+
+    // Scaled pixels are only repeated, never cut
+    if (scale % CHIP8_scaler_factor(scaler) != 0) {
+        log_error("The capture scale has to be a multiple of %u for this "
+                  "scaler",
+                  CHIP8_scaler_factor(scaler));
+        return 1;
+    }
+
+    capture_format = format;
+    frame_width = CAPTURE_WIDTH * scale;
+    frame_height = CAPTURE_HEIGHT * scale;
+    frame_size = (size_t)frame_width * frame_height *
+                 (format == CHIP8_CAPTURE_INDEX ? 1 : 3);
+    frame_valid = 0;
+    frames_written = 0;
+    frames_repeated = 0;
+
+    frame = malloc(frame_size);
+    if (frame == NULL)
+        abort();
+
+    if (strcmp(path, "-") == 0)
+        capture_file = stdout;
+    else
+        capture_file = fopen(path, "wb");
+
+    if (capture_file == NULL) {
+        log_error("Failed to open capture file (%s): %s", path,
+                  strerror(errno));
+        free(frame);
+        frame = NULL;
+        return 1;
+    }
+
+    setvbuf(capture_file, NULL, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+    capture_build_lut();
+
+    if (format == CHIP8_CAPTURE_Y4M)
+        fprintf(capture_file, "YUV4MPEG2 W%u H%u F60:%u Ip A1:1 C444\n",
+                frame_width, frame_height, interval > 0 ? interval : 1);
+
+    log_info("Capturing %ux%u frames to: %s", frame_width, frame_height,
+             path);
+
+    if (CHIP8_backend_add(&capture_backend, interval) != 0) {
+        CHIP8_capture_close();
+        return 1;
+    }
+
+    return 0;
+}
+
+static uint32_t capture_frame(const CHIP8_frame *screen) {
+    assert(capture_file != NULL);
+
+    // Redraws (i.e. for the debugger) aren't frames of the recording
+    if (screen->refresh)
+        return 0;
+
+    // Only convert, if the screen has actually changed
+    const uint8_t is_repeat = frame_valid && screen->version == frame_version;
+    if (!is_repeat) {
+        capture_convert(screen);
+        frame_version = screen->version;
+        frame_valid = 1;
+    }
+
+    if (capture_format == CHIP8_CAPTURE_Y4M)
+        fputs("FRAME\n", capture_file);
+
+    if (fwrite(frame, 1, frame_size, capture_file) != frame_size) {
+        log_error("Failed to write frame: %s", strerror(errno));
+        return 1;
+    }
+
+    frames_written++;
+    frames_repeated += is_repeat;
+
+    return 0;
+}
+
+void CHIP8_capture_close(void) {
+    if (capture_file == NULL)
+        return;
+
+    if (capture_file == stdout)
+        fflush(capture_file);
+    else
+        fclose(capture_file);
+
+    log_info("Captured %llu frame(s), %llu repeated",
+             (unsigned long long)frames_written,
+             (unsigned long long)frames_repeated);
+
+    capture_file = NULL;
+    free(frame);
+    frame = NULL;
+}
+
+static const CHIP8_backend capture_backend = {
+    .name = "capture",
+    .frame = capture_frame,
+    .close = CHIP8_capture_close,
+};
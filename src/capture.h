@@ -0,0 +1,29 @@
+#ifndef _CHIP8_CAPTURE_H_
+#define _CHIP8_CAPTURE_H_
+
+#include "scaler.h"
+
+#include <stdint.h>
+
+typedef enum {
+    CHIP8_CAPTURE_Y4M,   // YUV4MPEG2 (4:4:4), i.e. for ffmpeg
+    CHIP8_CAPTURE_RGB,   // Raw rgb24 frames
+    CHIP8_CAPTURE_INDEX, // Raw frames of 8bit pixel values (palette indices)
+} CHIP8_CAPTURE_FORMAT;
+
+/// Start recording to <path> ("-" for stdout), as a sink (see backend.h)
+/// getting every <interval>th frame. Frames always have the hires size
+/// (128x64) times <scale>, lores frames are scaled up. <scaler> is the one
+/// of the backend, <scale> has to be a multiple of its factor. If the
+/// screen hasn't changed since the last frame, the previous frame is
+/// written again without converting it.
+extern const uint32_t CHIP8_capture_open(const char *path,
+                                         CHIP8_CAPTURE_FORMAT format,
+                                         uint32_t scale, CHIP8_SCALER scaler,
+                                         uint32_t interval);
+
+/// Finish the recording (also done by CHIP8_backend_exit). Logs how many
+/// frames were repeats.
+extern void CHIP8_capture_close(void);
+
+#endif
@@ -1,5 +1,8 @@
 #include "chip8.h"
+#include "chip8_machine.h"
+#include "debugger.h"
 #include "log.h"
+#include "recorder.h"
 
 #include <assert.h>
 #include <memory.h>
@@ -7,7 +10,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
 
 // Macros for pretty printing instructions + state. Basically *amazing* print
 // debugging
@@ -40,12 +45,11 @@
 
 // Macros for iterating over the bitplane/mask and
 // execute code only for actually set planes
-#define BITPLANE_ITER_START(selected_bitplane)                                 \
+#define BITPLANE_ITER_START                                                    \
     for (uint32_t bitplane_iter__index = 0;                                    \
          bitplane_iter__index < CHIP8_BITPLANE_BITS; bitplane_iter__index++) { \
         uint32_t bitplane_iter__is_selected =                                  \
             (machine->screen_bitplane >> bitplane_iter__index) & 0x1;          \
-        (selected_bitplane) = bitplane_iter__index + 1;                        \
         if (bitplane_iter__is_selected) {
 
 #define BITPLANE_ITER_END                                                      \
@@ -61,7 +65,7 @@
 // Set in selected bitplane to value
 #define BITPLANE_SET(x, y, value)                                              \
     machine->screen[((y)*CHIP8_SCREEN_BUFFER_WIDTH) + (x)] =                   \
-        (machine->screen[y * CHIP8_SCREEN_BUFFER_WIDTH + x] &                  \
+        (machine->screen[(y)*CHIP8_SCREEN_BUFFER_WIDTH + (x)] &                \
          ~(1 << bitplane_iter__index)) |                                       \
         (((value) << bitplane_iter__index))
 
@@ -73,70 +77,9 @@
 
 // -------------
 
-#define CHIP8_MEM_SIZE 1024 * 64
-#define CHIP8_MEM_OFFSET 512
-
-#define CHIP8_FONTSET_CHAR_SIZE 5
-#define CHIP8_FONTSET_CHAR_SIZE_SUPER 10
-#define CHIP8_FONTSET_SIZE 16
-#define CHIP8_FONTSET_SIZE_SUPER 16
-#define CHIP8_FONTSET_OFFSET 0
-#define CHIP8_FONTSET_OFFSET_SUPER CHIP8_FONTSET_SIZE *CHIP8_FONTSET_CHAR_SIZE
-
-#define CHIP8_KEYS 16
-#define CHIP8_STACK_SIZE 16
-#define CHIP8_REGISTERS 16
-#define CHIP8_FLAG_REGISTERS 8
-
-// The screen buffer always uses the larges available size
-// and restricts its drawing area to the machine->width/height
-// values
-#define CHIP8_SCREEN_WIDTH 64
-#define CHIP8_SCREEN_HEIGHT 32
-#define CHIP8_SCREEN_WIDTH_HIRES 128
-#define CHIP8_SCREEN_HEIGHT_HIRES 64
-
-#define CHIP8_SCREEN_BUFFER_WIDTH CHIP8_SCREEN_WIDTH_HIRES
-#define CHIP8_SCREEN_BUFFER_HEIGHT CHIP8_SCREEN_HEIGHT_HIRES
-
-// TODO: Enable/Disable certain extensions
-// Currently only used as tokens in descriptive macros
-typedef enum {
-    CHIP8_MODE_CH8, // Normal
-    CHIP8_MODE_SH8, // Super (SCHIP)
-    CHIP8_MODE_C48, // TODO: HP CHIP 48 flag registers
-    CHIP8_MODE_XH8, // Xo
-} CHIP8_MODE;
-
-typedef enum {
-    CHIP8_SCROLL_UP,
-    CHIP8_SCROLL_DOWN,
-    CHIP8_SCROLL_LEFT,
-    CHIP8_SCROLL_RIGHT,
-} CHIP8_SCROLL_DIR;
-
-struct {
-    uint8_t reg[CHIP8_REGISTERS];
-
-    uint8_t flag_reg[CHIP8_FLAG_REGISTERS];
-    uint8_t mem[CHIP8_MEM_SIZE];
-    uint8_t keys[CHIP8_KEYS];
-
-    uint8_t screen[CHIP8_SCREEN_BUFFER_HEIGHT * CHIP8_SCREEN_BUFFER_WIDTH];
-    uint8_t screen_width;
-    uint8_t screen_height;
-    uint8_t screen_bitplane;
-    uint8_t screen_is_hires;
-    uint8_t screen_update_status;
-
-    uint8_t timer_sound;
-    uint8_t timer;
-
-    uint16_t stack[CHIP8_STACK_SIZE];
-    uint16_t sp;
-    uint16_t pc;
-    uint16_t index_reg;
-} *machine = NULL;
+// The machine all CHIP8_* functions operate on. Every thread selects its
+// own, so independent machines can run in parallel.
+static _Thread_local CHIP8_machine *machine = NULL;
 
 static uint8_t fontset[CHIP8_FONTSET_SIZE * CHIP8_FONTSET_CHAR_SIZE] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -193,10 +136,23 @@ static uint8_t
         0x80,           0x80, 0x80, 0x80, 0x00,
 };
 
-static inline uint8_t CHIP8_get_rand(void) { return rand() % 255; }
+// xorshift32, per machine, so runs can be reproduced with CHIP8_seed
+static inline uint8_t CHIP8_get_rand(void) {
+    uint32_t state = machine->rand_state;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    machine->rand_state = state;
+
+    return state % 255;
+}
 
-static void CHIP8_screen_draw(const uint8_t reg_x, const uint8_t reg_y,
-                              const uint8_t n) {
+// Draw a sprite. With <wrap> set, sprites that cross the edge of the screen
+// continue on the other side, otherwise they are clipped.
+static inline void CHIP8_screen_draw_sprite(const uint8_t reg_x,
+                                            const uint8_t reg_y,
+                                            const uint8_t n,
+                                            const uint8_t wrap) {
     uint8_t width, height;
     CHIP8_screen_get_resolution(&width, &height);
 
@@ -209,21 +165,29 @@ static void CHIP8_screen_draw(const uint8_t reg_x, const uint8_t reg_y,
     const uint8_t sprite_height = n == 0 ? 16 : n;
     const uint8_t sprite_width = n == 0 ? 16 : 8;
 
+    // Each selected bitplane has its own sprite, stored one after the other
+    // (lowest bitplane first)
+    const uint16_t plane_size = sprite_height * (sprite_width / 8);
+    uint16_t plane_offset = 0;
+
     // Iterate over the bitplanes and proceed to draw
     // matches (i.e. b0111 will draw on bitplane 1, 2 and 3)
-    uint8_t selected_bitplane;
-
-    BITPLANE_ITER_START(selected_bitplane);
+    BITPLANE_ITER_START;
 
     // Draw the actual sprite
     for (uint32_t offset_y = 0; offset_y < sprite_height; offset_y++) {
-        if (pos_y + offset_y >= height)
-            return;
+        uint32_t draw_y = pos_y + offset_y;
+        if (draw_y >= height) {
+            if (!wrap)
+                break;
+            draw_y -= height;
+        }
+        machine->screen_dirty |= 1ull << draw_y;
+        machine->screen_rows_updated |= 1ull << draw_y;
 
         // Select different graphics data, for individual bitplanes.
         uint16_t bitmask;
-        const uint16_t mem_index = machine->index_reg +
-            (selected_bitplane - 1) * sprite_height +
+        const uint16_t mem_index = machine->index_reg + plane_offset +
             (sprite_width / 8) * offset_y;
         if (n == 0)
             bitmask = MEM_GET_WORD(mem_index);
@@ -231,15 +195,18 @@ static void CHIP8_screen_draw(const uint8_t reg_x, const uint8_t reg_y,
             bitmask = machine->mem[mem_index];
 
         for (uint32_t offset_x = 0; offset_x < sprite_width; offset_x++) {
-            if (pos_x + offset_x >= width)
-                continue;
+            uint32_t draw_x = pos_x + offset_x;
+            if (draw_x >= width) {
+                if (!wrap)
+                    continue;
+                draw_x -= width;
+            }
 
             const uint8_t bit =
                 ((bitmask >> (sprite_width - offset_x - 1)) & 0x1);
-            const uint8_t old_value =
-                BITPLANE_GET(pos_x + offset_x, pos_y + offset_y);
+            const uint8_t old_value = BITPLANE_GET(draw_x, draw_y);
 
-            BITPLANE_TOGGLE(pos_x + offset_x, pos_y + offset_y, bit);
+            BITPLANE_TOGGLE(draw_x, draw_y, bit);
 
             if (bit == 1 && old_value > 0)
                 machine->reg[0xf] = 1;
@@ -247,20 +214,35 @@ static void CHIP8_screen_draw(const uint8_t reg_x, const uint8_t reg_y,
 
     }
 
+    plane_offset += plane_size;
+
     BITPLANE_ITER_END;
 }
 
+static inline void CHIP8_screen_draw(const uint8_t reg_x, const uint8_t reg_y,
+                                     const uint8_t n, const uint8_t wrap) {
+    // The position, before drawing changes VF
+    const uint8_t x = machine->reg[reg_x];
+    const uint8_t y = machine->reg[reg_y];
+
+    CHIP8_screen_draw_sprite(reg_x, reg_y, n, wrap);
+
+    if (machine->recorder != NULL)
+        CHIP8_recorder_draw(x, y, n);
+}
+
 // Scroll the screen horizontally
 static void CHIP8_screen_scroll(const int8_t amount,
                                 CHIP8_SCROLL_DIR direction) {
     uint8_t width, height;
     CHIP8_screen_get_resolution(&width, &height);
 
+    machine->screen_dirty = UINT64_MAX;
+    machine->screen_rows_updated = UINT64_MAX;
+
     // Iterate over the bitplanes and proceed to draw
     // matches (i.e. b0111 will draw on bitplane 1, 2 and 3)
-    uint8_t selected_bitplane = 1;
-
-    BITPLANE_ITER_START(selected_bitplane);
+    BITPLANE_ITER_START;
 
     // TODO: This feels messy..
     switch (direction) {
@@ -314,12 +296,61 @@ static void CHIP8_screen_scroll(const int8_t amount,
     }
 
     BITPLANE_ITER_END;
+
+    if (machine->recorder != NULL)
+        CHIP8_recorder_screen();
 }
 
 const uint8_t CHIP8_screen_get_update_status(void) {
     return machine->screen_update_status;
 }
 
+void CHIP8_screen_clear_update_status(void) {
+    machine->screen_update_status = 0;
+    machine->screen_rows_updated = 0;
+}
+
+void CHIP8_screen_get_view(CHIP8_screen_view *view) {
+    view->pixels = machine->screen;
+    view->stride = CHIP8_SCREEN_BUFFER_WIDTH;
+    view->width = machine->screen_width;
+    view->height = machine->screen_height;
+    view->format = CHIP8_PIXEL_INDEX8;
+    view->rows_updated = machine->screen_rows_updated;
+}
+
+_Static_assert(sizeof(((CHIP8_screen_copy *)0)->pixels) ==
+                   CHIP8_SCREEN_BUFFER_WIDTH * CHIP8_SCREEN_BUFFER_HEIGHT,
+               "CHIP8_screen_copy doesn't match the screen buffer");
+
+void CHIP8_screen_snapshot(CHIP8_screen_copy *copy) {
+    CHIP8_screen_get_view(&copy->view);
+
+    // Only the visible area, the rest of the copy is left as it is
+    for (uint32_t y = 0; y < copy->view.height; y++)
+        memcpy(copy->pixels + y * CHIP8_SCREEN_BUFFER_WIDTH,
+               machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH,
+               copy->view.width);
+
+    copy->view.pixels = copy->pixels;
+}
+
+const uint64_t CHIP8_screen_hash(void) {
+    // FNV-1a, over the visible area and the resolution
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    hash = (hash ^ machine->screen_width) * 0x100000001b3ull;
+    hash = (hash ^ machine->screen_height) * 0x100000001b3ull;
+
+    for (uint32_t y = 0; y < machine->screen_height; y++) {
+        const uint8_t *row = machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH;
+        for (uint32_t x = 0; x < machine->screen_width; x++)
+            hash = (hash ^ row[x]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
 const uint8_t CHIP8_screen_get_pixel(const uint8_t x, const uint8_t y) {
     return machine->screen[y * CHIP8_SCREEN_BUFFER_WIDTH + x];
 }
@@ -340,60 +371,452 @@ void CHIP8_input_set(const CHIP8_KEY key, const CHIP8_KEYSTATE state) {
     machine->keys[key] = state;
 }
 
-const uint32_t CHIP8_reset(void) {
-    memset(machine, 0, sizeof(*machine));
-    memcpy(machine->mem + CHIP8_FONTSET_OFFSET, fontset, sizeof(fontset));
-    memcpy(machine->mem + CHIP8_FONTSET_OFFSET_SUPER, fontset_super,
-           sizeof(fontset_super));
+// -------------
+
+// Predecoded instructions, for CHIP8_ENGINE_PREDECODED. Every address is
+// decoded once, on first use, and stays decoded until memory is written
+// near it. Sequences that are common in roms are fused into a single
+// superinstruction, to save on dispatches.
+typedef enum {
+    DECODED_NONE,  // Not decoded (yet)
+    DECODED_STEP,  // Anything else, runs on the interpreter
+    DECODED_STORE, // Runs on the interpreter, writes memory at I
+    DECODED_BREAK, // Breakpoint, see debugger.h
+    DECODED_JP,
+    DECODED_SE,
+    DECODED_SNE,
+    DECODED_LD,
+    DECODED_ADD,
+    DECODED_LDI,
+    DECODED_ADDI,
+
+    // Superinstructions
+    DECODED_LD_RUN,     // 6XNN 6XNN ...
+    DECODED_LDI_DRAW,   // ANNN DXYN
+    DECODED_ADDI_READ,  // FX1E FX65
+    DECODED_ADD_SE,     // 7XNN 3XNN
+    DECODED_ADD_SNE,    // 7XNN 4XNN
+    DECODED_ADD_SE_JP,  // 7XNN 3XNN 1NNN
+    DECODED_ADD_SNE_JP, // 7XNN 4XNN 1NNN
+} CHIP8_DECODED_OP;
+
+// Longest sequence that is fused (in bytes, including lookahead)
+#define DECODED_MAX_SIZE 16
+#define DECODED_MAX_LD_RUN 8
+
+struct CHIP8_decoded {
+    uint8_t op;
+    // Number of instructions (at most, skips may end the sequence early)
+    uint8_t count;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t kk;
+    // Constant of the second instruction
+    uint8_t kk2;
+    // Distance a taken skip moves pc by (XO-CHIP skips 'F000 NNNN' whole)
+    uint8_t skip;
+    uint16_t nnn;
+};
+
+// The decoded instructions of the selected machine. Starts over if memory
+// has been written by anything but a decoded store (i.e. a rom has been
+// loaded), or the machine switched modes.
+static CHIP8_decoded *CHIP8_decoded_sync(void) {
+    const size_t size = CHIP8_MEM_SIZE * sizeof(*machine->decoded);
+
+    if (machine->decoded == NULL) {
+        machine->decoded = calloc(CHIP8_MEM_SIZE, sizeof(*machine->decoded));
+        if (machine->decoded == NULL)
+            abort();
+        machine->decoded_writes = machine->mem_writes;
+        machine->decoded_mode = machine->mode;
+    }
+
+    if (machine->decoded_writes != machine->mem_writes ||
+        machine->decoded_mode != machine->mode) {
+        memset(machine->decoded, 0, size);
+        machine->decoded_writes = machine->mem_writes;
+        machine->decoded_mode = machine->mode;
+    }
+
+    return machine->decoded;
+}
+
+// Forget the decoded instructions that overlap [start, end)
+static void CHIP8_decoded_invalidate(const uint32_t start, const uint32_t end) {
+    const uint32_t first =
+        start >= DECODED_MAX_SIZE ? start - DECODED_MAX_SIZE + 1 : 0;
+    const uint32_t last = end < CHIP8_MEM_SIZE ? end : CHIP8_MEM_SIZE;
+
+    for (uint32_t address = first; address < last; address++)
+        machine->decoded[address].op = DECODED_NONE;
+
+    machine->decoded_writes = machine->mem_writes;
+}
+
+void CHIP8_decoded_drop(const uint32_t start, const uint32_t end) {
+    // Outdated anyway, starts over on the next run
+    if (machine->decoded == NULL ||
+        machine->decoded_writes != machine->mem_writes ||
+        machine->decoded_mode != machine->mode)
+        return;
+
+    CHIP8_decoded_invalidate(start, end);
+}
+
+// -------------
+
+// Everything but memory and the screen back to its state after reset
+static void CHIP8_reset_registers(void) {
+    memset(machine, 0, offsetof(CHIP8_machine, mem_writes));
 
     machine->pc = 0x200;
     machine->screen_bitplane = CHIP8_BITPLANE_0;
     machine->screen_width = CHIP8_SCREEN_WIDTH;
     machine->screen_height = CHIP8_SCREEN_HEIGHT;
+}
+
+// Clear the screen rows drawn to since the last reset
+static void CHIP8_reset_screen(void) {
+    for (uint32_t y = 0; y < CHIP8_SCREEN_BUFFER_HEIGHT; y++) {
+        if ((machine->screen_dirty >> y) & 1)
+            memset(machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH, 0,
+                   CHIP8_SCREEN_BUFFER_WIDTH);
+    }
+
+    machine->screen_dirty = 0;
+
+    // Consumers see the cleared screen like any other change
+    machine->screen_rows_updated = UINT64_MAX;
+    machine->screen_update_status = 1;
+}
+
+// The marked pages of memory have been restored. Only the instructions
+// decoded from them are outdated.
+static void CHIP8_mem_restored(const uint64_t *pages) {
+    const uint8_t decoded_valid = machine->decoded != NULL &&
+                                  machine->decoded_writes == machine->mem_writes;
+
+    machine->mem_writes++;
+    if (!decoded_valid)
+        return;
+
+    for (uint32_t page = 0; page < CHIP8_MEM_PAGES; page++) {
+        if ((pages[page / 64] >> (page % 64)) & 1)
+            CHIP8_decoded_invalidate(page * CHIP8_MEM_PAGE_SIZE,
+                                     (page + 1) * CHIP8_MEM_PAGE_SIZE);
+    }
+
+    machine->decoded_writes = machine->mem_writes;
+}
+
+static void CHIP8_load_fonts(uint8_t *mem) {
+    memcpy(mem + CHIP8_FONTSET_OFFSET, fontset, sizeof(fontset));
+    memcpy(mem + CHIP8_FONTSET_OFFSET_SUPER, fontset_super,
+           sizeof(fontset_super));
+}
+
+// Only the pages that have been loaded or written since the last reset
+// differ from the empty memory
+const uint32_t CHIP8_reset(void) {
+    uint64_t pages[CHIP8_MEM_PAGES / 64];
+
+    CHIP8_reset_registers();
+    CHIP8_reset_screen();
+
+    for (uint32_t i = 0; i < CHIP8_MEM_PAGES / 64; i++)
+        pages[i] = machine->mem_dirty[i] | machine->mem_loaded[i];
+
+    if (machine->mem_mapped) {
+        // Drops the copied pages as well
+        CHIP8_rom_unmap(machine->mem);
+        machine->mem_mapped = 0;
+        CHIP8_load_fonts(machine->mem);
+    } else {
+        for (uint32_t page = 0; page < CHIP8_MEM_PAGES; page++) {
+            if ((pages[page / 64] >> (page % 64)) & 1)
+                memset(machine->mem + page * CHIP8_MEM_PAGE_SIZE, 0,
+                       CHIP8_MEM_PAGE_SIZE);
+        }
+
+        // The fonts share the first page
+        if (pages[0] & 1)
+            CHIP8_load_fonts(machine->mem);
+    }
+
+    CHIP8_rom_release(machine->rom);
+    machine->rom = NULL;
+
+    CHIP8_mem_restored(pages);
+    memset(machine->mem_dirty, 0, sizeof(machine->mem_dirty));
+    memset(machine->mem_loaded, 0, sizeof(machine->mem_loaded));
 
     return 0;
 }
 
-const uint32_t CHIP8_init(void) {
-    machine = malloc(sizeof(*machine));
+const uint32_t CHIP8_restart(void) {
+    if (machine->rom == NULL)
+        return CHIP8_reset();
 
-    // If malloc fails, we might aswell abort...
-    if (machine == NULL)
+    CHIP8_reset_registers();
+    CHIP8_reset_screen();
+
+    const uint8_t *image = CHIP8_rom_image(machine->rom);
+    for (uint32_t page = 0; page < CHIP8_MEM_PAGES; page++) {
+        if (!((machine->mem_dirty[page / 64] >> (page % 64)) & 1))
+            continue;
+
+        memcpy(machine->mem + page * CHIP8_MEM_PAGE_SIZE,
+               image + page * CHIP8_MEM_PAGE_SIZE, CHIP8_MEM_PAGE_SIZE);
+    }
+
+    // The image has no fonts
+    if (machine->mem_dirty[0] & 1)
+        CHIP8_load_fonts(machine->mem);
+
+    CHIP8_mem_restored(machine->mem_dirty);
+    memset(machine->mem_dirty, 0, sizeof(machine->mem_dirty));
+
+    return 0;
+}
+
+struct CHIP8_state {
+    // Everything CHIP8_reset_registers clears
+    uint8_t registers[offsetof(CHIP8_machine, mem_writes)];
+    uint32_t rand_state;
+
+    uint64_t mem_dirty[CHIP8_MEM_PAGES / 64];
+    uint64_t screen_dirty;
+
+    // Only the dirty pages and rows are saved
+    uint8_t mem[CHIP8_MEM_SIZE];
+    uint8_t screen[CHIP8_SCREEN_BUFFER_HEIGHT * CHIP8_SCREEN_BUFFER_WIDTH];
+};
+
+CHIP8_state *CHIP8_state_create(void) {
+    CHIP8_state *state = malloc(sizeof(*state));
+    if (state == NULL)
         abort();
 
-    srand(time(NULL));
+    return state;
+}
+
+void CHIP8_state_destroy(CHIP8_state *state) { free(state); }
+
+void CHIP8_state_save(CHIP8_state *state) {
+    memcpy(state->registers, machine, sizeof(state->registers));
+    state->rand_state = machine->rand_state;
+    memcpy(state->mem_dirty, machine->mem_dirty, sizeof(state->mem_dirty));
+    state->screen_dirty = machine->screen_dirty;
+
+    for (uint32_t page = 0; page < CHIP8_MEM_PAGES; page++) {
+        if ((machine->mem_dirty[page / 64] >> (page % 64)) & 1)
+            memcpy(state->mem + page * CHIP8_MEM_PAGE_SIZE,
+                   machine->mem + page * CHIP8_MEM_PAGE_SIZE,
+                   CHIP8_MEM_PAGE_SIZE);
+    }
+
+    for (uint32_t y = 0; y < CHIP8_SCREEN_BUFFER_HEIGHT; y++) {
+        if ((machine->screen_dirty >> y) & 1)
+            memcpy(state->screen + y * CHIP8_SCREEN_BUFFER_WIDTH,
+                   machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH,
+                   CHIP8_SCREEN_BUFFER_WIDTH);
+    }
+}
+
+// Pages dirty on either side are copied from the state, or from the rom's
+// image if the state has the page as loaded. Only pages whose contents
+// actually changed outdate their decoded instructions.
+void CHIP8_state_load(const CHIP8_state *state) {
+    const uint8_t *image =
+        machine->rom != NULL ? CHIP8_rom_image(machine->rom) : NULL;
+    uint64_t changed[CHIP8_MEM_PAGES / 64] = {0};
+    uint8_t any_changed = 0;
+
+    for (uint32_t page = 0; page < CHIP8_MEM_PAGES; page++) {
+        const uint64_t bit = 1ull << (page % 64);
+        if (!((machine->mem_dirty[page / 64] | state->mem_dirty[page / 64]) &
+              bit))
+            continue;
+
+        uint8_t *target = machine->mem + page * CHIP8_MEM_PAGE_SIZE;
+        uint8_t original[CHIP8_MEM_PAGE_SIZE];
+        const uint8_t *source = original;
+
+        if (state->mem_dirty[page / 64] & bit) {
+            source = state->mem + page * CHIP8_MEM_PAGE_SIZE;
+        } else {
+            if (image != NULL)
+                memcpy(original, image + page * CHIP8_MEM_PAGE_SIZE,
+                       CHIP8_MEM_PAGE_SIZE);
+            else
+                memset(original, 0, CHIP8_MEM_PAGE_SIZE);
+
+            // The image has no fonts
+            if (page == 0)
+                CHIP8_load_fonts(original);
+        }
+
+        if (memcmp(target, source, CHIP8_MEM_PAGE_SIZE) == 0)
+            continue;
+
+        memcpy(target, source, CHIP8_MEM_PAGE_SIZE);
+        changed[page / 64] |= bit;
+        any_changed = 1;
+    }
+
+    if (any_changed)
+        CHIP8_mem_restored(changed);
+
+    // Rows restored count as updated, whatever the state says
+    const uint64_t rows = state->screen_dirty | machine->screen_dirty;
+    const uint64_t rows_updated = machine->screen_rows_updated | rows;
+
+    for (uint32_t y = 0; y < CHIP8_SCREEN_BUFFER_HEIGHT; y++) {
+        uint8_t *row = machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH;
+
+        if ((state->screen_dirty >> y) & 1)
+            memcpy(row, state->screen + y * CHIP8_SCREEN_BUFFER_WIDTH,
+                   CHIP8_SCREEN_BUFFER_WIDTH);
+        else if ((machine->screen_dirty >> y) & 1)
+            memset(row, 0, CHIP8_SCREEN_BUFFER_WIDTH);
+    }
+
+    memcpy(machine, state->registers, sizeof(state->registers));
+    machine->rand_state = state->rand_state;
+    memcpy(machine->mem_dirty, state->mem_dirty, sizeof(state->mem_dirty));
+    machine->screen_dirty = state->screen_dirty;
+
+    if (rows != 0) {
+        machine->screen_rows_updated |= rows_updated;
+        machine->screen_update_status = 1;
+    }
+}
+
+// Machines are mapped, so that mem starts on a page boundary and roms can
+// be mapped into it (see CHIP8_rom_map). Returns the distance from the
+// start of the mapping to mem and the size of the mapping.
+static const size_t CHIP8_machine_layout(size_t *size) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t mem_offset = offsetof(CHIP8_machine, mem);
+    const size_t lead = (mem_offset + page_size - 1) / page_size * page_size;
+
+    *size = lead + (sizeof(CHIP8_machine) - mem_offset + page_size - 1) /
+                       page_size * page_size;
+
+    return lead;
+}
+
+CHIP8_machine *CHIP8_machine_create(void) {
+    size_t size;
+    const size_t lead = CHIP8_machine_layout(&size);
+
+    // Starts out empty, reset only has to restore what changes from there
+    uint8_t *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    // If mmap fails, we might aswell abort...
+    if (mapping == MAP_FAILED)
+        abort();
+
+    CHIP8_machine *result = (CHIP8_machine *)(mapping + lead -
+                                              offsetof(CHIP8_machine, mem));
+
+    CHIP8_machine *previous = machine;
+    machine = result;
+    machine->mode = CHIP8_MODE_ANY;
+    machine->engine = CHIP8_ENGINE_PREDECODED;
+    CHIP8_seed(rand());
+    CHIP8_load_fonts(machine->mem);
     CHIP8_reset();
+    machine = previous;
+
+    return result;
+}
+
+void CHIP8_machine_destroy(CHIP8_machine *target) {
+    if (target == machine)
+        machine = NULL;
+
+    size_t size;
+    const size_t lead = CHIP8_machine_layout(&size);
+
+    CHIP8_rom_release(target->rom);
+    free(target->decoded);
+    free(target->debugger);
+    munmap(target->mem - lead, size);
+}
+
+void CHIP8_machine_select(CHIP8_machine *target) { machine = target; }
+
+void CHIP8_seed(const uint32_t seed) {
+    // xorshift gets stuck on 0
+    machine->rand_state = seed != 0 ? seed : 0x9e3779b9;
+}
+
+const uint64_t CHIP8_get_cycles(void) { return machine->cycles; }
+
+CHIP8_machine *CHIP8_machine_get(void) { return machine; }
+
+const uint32_t CHIP8_init(void) {
+    srand(time(NULL));
+    machine = CHIP8_machine_create();
 
     return 0;
 }
 
-void CHIP8_exit(void) { free(machine); }
+void CHIP8_exit(void) { CHIP8_machine_destroy(machine); }
+
+// Load <rom> into an empty machine (takes over the reference). If
+// possible, memory becomes a copy-on-write mapping of the rom's image.
+static const uint32_t CHIP8_load_rom(CHIP8_rom *rom) {
+    uint64_t pages[CHIP8_MEM_PAGES / 64] = {0};
+
+    uint64_t used = 0;
+    for (uint32_t i = 0; i < CHIP8_MEM_PAGES / 64; i++)
+        used |= machine->mem_dirty[i] | machine->mem_loaded[i];
+
+    // Loading starts over
+    if (used != 0 || machine->rom != NULL)
+        CHIP8_reset();
+
+    const uint32_t size = CHIP8_rom_size(rom);
+    for (uint32_t page = CHIP8_MEM_OFFSET / CHIP8_MEM_PAGE_SIZE;
+         page * CHIP8_MEM_PAGE_SIZE < CHIP8_MEM_OFFSET + size; page++)
+        pages[page / 64] |= 1ull << (page % 64);
+
+    if (CHIP8_rom_map(rom, machine->mem) == 0) {
+        machine->mem_mapped = 1;
+        // The image has no fonts
+        CHIP8_load_fonts(machine->mem);
+    } else {
+        memcpy(machine->mem + CHIP8_MEM_OFFSET,
+               CHIP8_rom_image(rom) + CHIP8_MEM_OFFSET, size);
+    }
+
+    machine->rom = rom;
+    memcpy(machine->mem_loaded, pages, sizeof(pages));
+    CHIP8_mem_restored(pages);
+
+    return 0;
+}
 
 const uint32_t CHIP8_memcpy(void *src) {
     assert(src != NULL);
-    void *result = memcpy(machine->mem + CHIP8_MEM_OFFSET, src,
-                          CHIP8_MEM_SIZE - CHIP8_MEM_OFFSET - 1);
-    assert(result != NULL);
 
-    return 0;
+    return CHIP8_load_rom(CHIP8_rom_from_buffer(
+        src, CHIP8_MEM_SIZE - CHIP8_MEM_OFFSET - 1));
 }
 
 const uint32_t CHIP8_load_from_path(const char *path) {
     assert(path != NULL);
 
-    FILE *file = fopen(path, "rb");
-    if (file == NULL)
-        return 1;
-
-    // TODO: Make sure that the rom fits into memory
-    fread(machine->mem + CHIP8_MEM_OFFSET, 1,
-          CHIP8_MEM_SIZE - CHIP8_MEM_OFFSET - 1, file);
-
-    if (ferror(file))
+    CHIP8_rom *rom = CHIP8_rom_open(path);
+    if (rom == NULL)
         return 1;
 
-    fclose(file);
-    return 0;
+    return CHIP8_load_rom(rom);
 }
 
 void CHIP8_timer_tick() {
@@ -409,415 +832,200 @@ void CHIP8_timer_tick() {
     }
 }
 
-const int32_t CHIP8_cpu_cycle() {
-    // TODO: This assumes little endian...
-    uint16_t optcode = MEM_GET_WORD(machine->pc);
-
-    // 12-bit address
-    uint16_t nnn = optcode & 0x0fff;
-    // 8-bit constant
-    uint8_t kk = optcode & 0x00ff;
-    // 4-bit constant
-    uint8_t n = optcode & 0x000f;
-    // 4-bit register index (high bits)
-    uint8_t y = (optcode >> 4) & 0x000f;
-    // 4-bit register index (low bits)
-    uint8_t x = (optcode >> 8) & 0x000f;
-
-    // ref: http://devernay.free.fr/hacks/chip8/schip.txt
-    // xo:
-    // http://johnearnest.github.io/Octo/docs/XO-ChipSpecification.html
-    switch (optcode & 0xf000) {
-    case 0x0000:
-        if (x == 0 && y == 0xc) {
-            print_opt("SCRD", "Scroll screen down by n pixels", n,
-                    CHIP8_MODE_SC8);
-            CHIP8_screen_scroll(n, CHIP8_SCROLL_DOWN);
-            machine->screen_update_status = 1;
-            machine->pc += 2;
-            break;
-        } else if (x == 0 && y == 0xd) {
-            print_opt("SCRU", "Scroll screen up by n pixels", n,
-                    CHIP8_MODE_XC8);
-            CHIP8_screen_scroll(n, CHIP8_SCROLL_UP);
-            machine->screen_update_status = 1;
-            machine->pc += 2;
-            break;
-        }
-        switch (kk) {
-        case 0xe0:
-            print_opt("CLS", "Clear the screen", none, CHIP8_MODE_CH8);
-            memset(machine->screen, 0, sizeof(machine->screen));
-            machine->screen_update_status = 1;
-            machine->pc += 2;
-            break;
-        case 0xee:
-            print_opt("RET", "Return from subroutine", none, CHIP8_MODE_CH8);
-            machine->pc = machine->stack[--(machine->sp)];
-            break;
-        case 0xfb:
-            print_opt("SCRR", "Scroll right by 4 pixels", none, CHIP8_MODE_SC8);
-            CHIP8_screen_scroll(4, CHIP8_SCROLL_RIGHT);
-            machine->screen_update_status = 1;
-            machine->pc += 2;
-            break;
-        case 0xfc:
-            print_opt("SCRL", "Scroll left by 4 pixels", none, CHIP8_MODE_SC8);
-            CHIP8_screen_scroll(4, CHIP8_SCROLL_LEFT);
-            machine->screen_update_status = 1;
-            machine->pc += 2;
-            break;
-        case 0xfe:
-            print_opt("NSUPER", "Disable extended mode", none, CHIP8_MODE_SC8);
-            machine->screen_width = CHIP8_SCREEN_WIDTH;
-            machine->screen_height = CHIP8_SCREEN_HEIGHT;
-            machine->screen_is_hires = 0;
-            machine->screen_update_status = 1;
-            machine->pc += 2;
-            break;
-        case 0xfd:
-            print_opt("EXIT", "Exit the program", none, CHIP8_MODE_SC8);
-            return 2;
-            break;
-        case 0xff:
-            print_opt("SUPER", "Enable extended mode", none, CHIP8_MODE_SC8);
-            machine->screen_width = CHIP8_SCREEN_WIDTH_HIRES;
-            machine->screen_height = CHIP8_SCREEN_HEIGHT_HIRES;
-            machine->screen_is_hires = 1;
-            machine->screen_update_status = 1;
-            machine->pc += 2;
-            break;
-        default:
-            goto invalid_optcode;
-        }
-        break;
-    case 0x1000:
-        print_opt("JP", "Jump to location nnn", nnn, CHIP8_MODE_CH8);
-        machine->pc = nnn;
-        break;
-    case 0x2000:
-        print_opt("CALL", "Call subroutine at nnn", nnn, CHIP8_MODE_CH8);
-        machine->stack[(machine->sp)++] = machine->pc + 2;
-        machine->pc = nnn;
-        break;
-    case 0x3000:
-        print_opt("SE", "Skip next instruction if Vx = kk", xkk,
-                  CHIP8_MODE_CH8);
-        if (machine->reg[x] == kk)
-            if (MEM_GET_WORD(machine->pc + 2) == 0xf000)
-                machine->pc += 6;
-            else
-                machine->pc += 4;
-        else
-            machine->pc += 2;
-        break;
-    case 0x4000:
-        print_opt("SNE", "Skip next instruction if Vx != kk", xkk,
-                  CHIP8_MODE_CH8);
-        if (machine->reg[x] != kk)
-            if (MEM_GET_WORD(machine->pc + 2) == 0xf000)
-                machine->pc += 6;
-            else
-                machine->pc += 4;
-        else
-            machine->pc += 2;
-        break;
-    case 0x5000:
-        switch (n) {
-        case 0:
-            print_opt("SER", "Skip next instruction if Vx = Vy", xy,
-                      CHIP8_MODE_CH8);
-            if (machine->reg[x] == machine->reg[y])
-                if (MEM_GET_WORD(machine->pc + 2) == 0xf000)
-                    machine->pc += 6;
-                else
-                    machine->pc += 4;
-            else
-                machine->pc += 2;
-            break;
-        case 2:
-            print_opt("SAVER", "Save an inclusive range of registers to memory",
-                      xy, CHIP8_MODE_XC8);
-            for (uint8_t i = x; i < y; i++)
-                machine->mem[machine->index_reg + i] = machine->reg[i];
-            machine->pc += 2;
-            break;
-        case 3:
-            print_opt("LOADR",
-                      "Load an inclusive range of registers from memory", xy,
-                      CHIP8_MODE_XC8);
-            for (uint8_t i = x; i < y; i++)
-                machine->reg[i] = machine->mem[machine->index_reg + i];
-            machine->pc += 2;
-            break;
-        default:
-            goto invalid_optcode;
-        }
-        break;
-    case 0x6000:
-        print_opt("LD", "Set Vx = kk", xkk, CHIP8_MODE_CH8);
-        machine->reg[x] = kk;
-        machine->pc += 2;
-        break;
-    case 0x7000:
-        print_opt("ADD", "Set Vx = Vx + kk", xkk, CHIP8_MODE_CH8);
-        machine->reg[x] += kk;
-        machine->pc += 2;
-        break;
-    case 0x8000:
-        switch (n) {
-        case 0x00:
-            print_opt("LDR", "Set Vx = Vy", xy, CHIP8_MODE_CH8);
-            machine->reg[x] = machine->reg[y];
-            break;
-        case 0x01:
-            print_opt("OR", "Set Vx = Vx OR Vy", xy, CHIP8_MODE_CH8);
-            machine->reg[x] |= machine->reg[y];
-            break;
-        case 0x02:
-            print_opt("AND", "Set Vx = Vx AND Vy", xy, CHIP8_MODE_CH8);
-            machine->reg[x] &= machine->reg[y];
-            break;
-        case 0x03:
-            print_opt("XOR", "Set Vx = Vx XOR Vy", xy, CHIP8_MODE_CH8);
-            machine->reg[x] ^= machine->reg[y];
-            break;
-        case 0x04:
-            print_opt("ADDR", "Set Vx = Vx + Vy. Set VF on carry", xy,
-                      CHIP8_MODE_CH8);
-            machine->reg[0xf] =
-                ((uint32_t)machine->reg[x] + (uint32_t)machine->reg[y]) > 255
-                    ? 1
-                    : 0;
-            machine->reg[x] += machine->reg[y];
-            break;
-        case 0x05:
-            print_opt("SUBY", "Set Vx = Vx - Vy. Set VF if Vy > Vx", xy,
-                      CHIP8_MODE_CH8);
-            machine->reg[0xf] = machine->reg[y] > machine->reg[x] ? 1 : 0;
-            machine->reg[x] = machine->reg[x] - machine->reg[y];
-            break;
-        case 0x06:
-            print_opt("SHR", "Set Vx = Vx >> 1. Store rightmost bit in VF", x,
-                      CHIP8_MODE_CH8);
-            machine->reg[0xf] = machine->reg[x] & 0x1;
-            machine->reg[x] >>= 1;
-            break;
-        case 0x07:
-            print_opt("SUBX", "Set Vx = Vx - Vy. Set VF if Vx > Vy", xy,
-                      CHIP8_MODE_CH8);
-            machine->reg[0xf] = machine->reg[x] > machine->reg[y] ? 1 : 0;
-            machine->reg[x] = machine->reg[y] - machine->reg[x];
-            break;
-        case 0x0e:
-            print_opt("SHL", "Set Vx = Vx << 1. Store leftmost bit in VF", x,
-                      CHIP8_MODE_CH8);
-            machine->reg[0x0f] = (machine->reg[x] >> 7) & 0x1;
-            machine->reg[x] <<= 1;
-            break;
-        default:
-            goto invalid_optcode;
-        }
-        machine->pc += 2;
-        break;
-    case 0x9000:
-        if (n == 0) {
-            print_opt("SKRNE", "Skip next instruction if Vx != Vy", xy,
-                      CHIP8_MODE_CH8);
-            if (machine->reg[x] != machine->reg[y])
-                if (MEM_GET_WORD(machine->pc + 2) == 0xf000)
-                    machine->pc += 6;
-                else
-                    machine->pc += 4;
-            else
-                machine->pc += 2;
-        } else {
-            goto invalid_optcode;
-        }
-        break;
-    case 0xa000:
-        print_opt("LDI", "Set I = nnn", nnn, CHIP8_MODE_CH8);
-        machine->index_reg = nnn;
-        machine->pc += 2;
-        break;
-    case 0xb000:
-        print_opt("JPR", "Jump to location nnn + V0", nnn, CHIP8_MODE_CH8);
-        machine->pc = machine->reg[0x0] + nnn;
-        break;
-    case 0xc000:
-        print_opt("RND", "Set Vx = <random byte> AND kk", xkk, CHIP8_MODE_CH8);
-        machine->reg[x] = CHIP8_get_rand() & kk;
-        machine->pc += 2;
-        break;
-    case 0xd000:
-        if (n == 0) {
-            print_opt("DRAW HI",
-                      "Draw 16x16 sprite starting at I"
-                      "(Vx, Vy), set VF = collision",
-                      xyn, CHIP8_MODE_SC8);
-            CHIP8_screen_draw(x, y, 0);
-            machine->screen_update_status = 1;
-        } else {
-            print_opt("DRAW",
-                      "Draw 8xn sprite starting at I"
-                      "(Vx, Vy), set VF = collision",
-                      xyn, CHIP8_MODE_CH8);
-            CHIP8_screen_draw(x, y, n);
-            machine->screen_update_status = 1;
-        }
-        machine->pc += 2;
-        break;
-    case 0xe000:
-        switch (kk) {
-        case 0x9e:
-            print_opt("SKP",
-                      "Skip next instruction if key of value Vx is pressed", x,
-                      CHIP8_MODE_CH8);
-            if (machine->keys[machine->reg[x]] == CHIP8_KEY_PRESSED)
-                if (MEM_GET_WORD(machine->pc + 2) == 0xf000)
-                    machine->pc += 6;
-                else
-                    machine->pc += 4;
-            else
-                machine->pc += 2;
-            break;
-        case 0xa1:
-            print_opt("SKNP",
-                      "Skip next instruction if key of value Vx is released", x,
-                      CHIP8_MODE_CH8);
-            if (machine->keys[machine->reg[x]] == CHIP8_KEY_RELEASED)
-                if (MEM_GET_WORD(machine->pc + 1) == 0xf000)
-                    machine->pc += 8;
-                else
-                    machine->pc += 4;
-            else
-                machine->pc += 2;
-            break;
-        }
-        break;
-    case 0xf000:
-        if (nnn == 0) {
-            print_opt("LDI EXT", "Set I to 16bit address", none,
-                      CHIP8_MODE_XH8);
-            machine->index_reg = MEM_GET_WORD(machine->pc + 2);
-            machine->pc += 4;
-            break;
-        } else if (kk == 1) {
-            print_opt("BITPLANE", "Set the bitplane to the value of x", x,
-                      CHIP8_MODE_XC8);
-            machine->screen_bitplane = x;
-            machine->pc += 2;
-            break;
-        }
-        switch (kk) {
-        case 0x02:
-            print_opt("AUDIO STORE", "Store 16 bytes, starting at I, in the audio buffer", none, CHIP8_MODE_XC8);
-            print_warn("%s", "Not implemented");
-            machine->pc += 2;
-            break;
-        case 0x07:
-            print_opt("LDT", "Set Vx = <delay timer value>", x, CHIP8_MODE_CH8);
-            machine->reg[x] = machine->timer;
-            machine->pc += 2;
-            break;
-        case 0x0A:
-            print_opt("LDK", "Wait for a keypress. Store its value in Vx", x,
-                      CHIP8_MODE_CH8);
-            for (uint8_t i = 0; i < CHIP8_KEYS; i++) {
-                if (machine->keys[i] == CHIP8_KEY_PRESSED) {
-                    CHIP8_input_set(i, CHIP8_KEY_RELEASED);
-                    machine->reg[x] = i;
-                    machine->pc += 2;
-                }
-            }
-            break;
-        case 0x15:
-            print_opt("LDDT", "Set <delay timer> = Vx", x, CHIP8_MODE_CH8);
-            machine->timer = machine->reg[x];
-            machine->pc += 2;
-            break;
-        case 0x18:
-            print_opt("LDS", "Set <sound timer> = Vx", x, CHIP8_MODE_CH8);
-            machine->timer_sound = machine->reg[x];
-            machine->pc += 2;
-            break;
-        case 0x1e:
-            print_opt("ADDI", "Set I = I + Vx", x, CHIP8_MODE_CH8);
-            machine->index_reg += machine->reg[x];
-            machine->pc += 2;
-            break;
-        case 0x29:
-            print_opt("LDF", "Set I = <location of font-sprite in Vx>", x,
-                      CHIP8_MODE_CH8);
-            machine->index_reg = CHIP8_FONTSET_OFFSET +
-                                 CHIP8_FONTSET_CHAR_SIZE * machine->reg[x];
-            machine->pc += 2;
-            break;
-        case 0x30:
-            print_opt("LDF HIRES",
-                      "Set I = <location of hires font-sprite in Vx>", x,
-                      CHIP8_MODE_SC8);
-            machine->index_reg =
-                CHIP8_FONTSET_OFFSET_SUPER +
-                CHIP8_FONTSET_CHAR_SIZE_SUPER * machine->reg[x];
-            machine->pc += 2;
-            break;
-        case 0x33:
-            print_opt("BCD",
-                      "Store BCD repesentation of Vx in memory "
-                      "locations I, I+1, I+2",
-                      x, CHIP8_MODE_CH8);
-            machine->mem[machine->index_reg] = (machine->reg[x] % 1000) / 100;
-            machine->mem[machine->index_reg + 1] = (machine->reg[x] % 100) / 10;
-            machine->mem[machine->index_reg + 2] = (machine->reg[x] % 10) / 1;
-            machine->pc += 2;
-            break;
-        case 0x3a:
-            print_opt("PITCH", "Set the audio pattern playback rate to 4000*2^((Vx-64)/48)Hz", x, CHIP8_MODE_XC8);
-            print_warn("%s", "Not implemented");
-            machine->pc += 2;
-            break;
-        case 0x55:
-            print_opt("STORE",
-                      "Store registers V0 through Vx into adress I to I + x", x,
-                      CHIP8_MODE_CH8);
-            for (int i = 0; i < x + 1; i++)
-                machine->mem[machine->index_reg + i] = machine->reg[i];
-            machine->pc += 2;
-            break;
-        case 0x65:
-            print_opt("READ",
-                      "Read registers V0 through Vx from memory "
-                      "starting at I",
-                      x, CHIP8_MODE_CH8);
-            for (int i = 0; i < x + 1; i++)
-                machine->reg[i] = machine->mem[machine->index_reg + i];
-            machine->pc += 2;
-            break;
-        case 0x75:
-            print_opt("STOREF", "Read V0 to Vx into flag registers (0-7)", x,
-                      CHIP8_MODE_SC8);
-            log_warn("%s", "Not implemented");
-            machine->pc += 2;
-            break;
-        case 0x85:
-            print_opt("READF", "Restore V0 to Vx from flag registers (0-7)", x,
-                      CHIP8_MODE_SC8);
-            log_warn("%s", "Not implemented");
-            machine->pc += 2;
-            break;
+// Generate one interpreter core per platform mode, see chip8_core.h.
+// 'any' runs the union of all extensions and is the reference core.
+// clang-format off
+#define CORE_NAME any
+#define CORE_MODE CHIP8_MODE_ANY
+#define CORE_SCHIP 1
+#define CORE_XOCHIP 1
+#define CORE_FLAGS 0
+#define CORE_QUIRK_SHIFT 1
+#define CORE_QUIRK_LOAD_STORE 1
+#define CORE_QUIRK_WRAP 0
+#include "chip8_core.h"
+#undef CORE_NAME
+#undef CORE_MODE
+#undef CORE_SCHIP
+#undef CORE_XOCHIP
+#undef CORE_FLAGS
+#undef CORE_QUIRK_SHIFT
+#undef CORE_QUIRK_LOAD_STORE
+#undef CORE_QUIRK_WRAP
+
+#define CORE_NAME ch8
+#define CORE_MODE CHIP8_MODE_CH8
+#define CORE_SCHIP 0
+#define CORE_XOCHIP 0
+#define CORE_FLAGS 0
+#define CORE_QUIRK_SHIFT 0
+#define CORE_QUIRK_LOAD_STORE 0
+#define CORE_QUIRK_WRAP 0
+#include "chip8_core.h"
+#undef CORE_NAME
+#undef CORE_MODE
+#undef CORE_SCHIP
+#undef CORE_XOCHIP
+#undef CORE_FLAGS
+#undef CORE_QUIRK_SHIFT
+#undef CORE_QUIRK_LOAD_STORE
+#undef CORE_QUIRK_WRAP
+
+#define CORE_NAME sh8
+#define CORE_MODE CHIP8_MODE_SH8
+#define CORE_SCHIP 1
+#define CORE_XOCHIP 0
+#define CORE_FLAGS 0
+#define CORE_QUIRK_SHIFT 1
+#define CORE_QUIRK_LOAD_STORE 1
+#define CORE_QUIRK_WRAP 0
+#include "chip8_core.h"
+#undef CORE_NAME
+#undef CORE_MODE
+#undef CORE_SCHIP
+#undef CORE_XOCHIP
+#undef CORE_FLAGS
+#undef CORE_QUIRK_SHIFT
+#undef CORE_QUIRK_LOAD_STORE
+#undef CORE_QUIRK_WRAP
+
+#define CORE_NAME c48
+#define CORE_MODE CHIP8_MODE_C48
+#define CORE_SCHIP 1
+#define CORE_XOCHIP 0
+#define CORE_FLAGS 1
+#define CORE_QUIRK_SHIFT 1
+#define CORE_QUIRK_LOAD_STORE 1
+#define CORE_QUIRK_WRAP 0
+#include "chip8_core.h"
+#undef CORE_NAME
+#undef CORE_MODE
+#undef CORE_SCHIP
+#undef CORE_XOCHIP
+#undef CORE_FLAGS
+#undef CORE_QUIRK_SHIFT
+#undef CORE_QUIRK_LOAD_STORE
+#undef CORE_QUIRK_WRAP
+
+#define CORE_NAME xh8
+#define CORE_MODE CHIP8_MODE_XH8
+#define CORE_SCHIP 1
+#define CORE_XOCHIP 1
+#define CORE_FLAGS 1
+#define CORE_QUIRK_SHIFT 0
+#define CORE_QUIRK_LOAD_STORE 0
+#define CORE_QUIRK_WRAP 1
+#include "chip8_core.h"
+#undef CORE_NAME
+#undef CORE_MODE
+#undef CORE_SCHIP
+#undef CORE_XOCHIP
+#undef CORE_FLAGS
+#undef CORE_QUIRK_SHIFT
+#undef CORE_QUIRK_LOAD_STORE
+#undef CORE_QUIRK_WRAP
+// clang-format on
+
+const int32_t CHIP8_cpu_cycle(void) {
+    const int32_t status = chip8_core_any_step();
+    if (status != -1)
+        machine->cycles++;
+
+    return status;
+}
+
+const int32_t CHIP8_cpu_step(void) {
+    switch (machine->mode) {
+    case CHIP8_MODE_CH8:
+        return chip8_core_ch8_step();
+    case CHIP8_MODE_SH8:
+        return chip8_core_sh8_step();
+    case CHIP8_MODE_C48:
+        return chip8_core_c48_step();
+    case CHIP8_MODE_XH8:
+        return chip8_core_xh8_step();
+    case CHIP8_MODE_ANY:
+    default:
+        return chip8_core_any_step();
+    }
+}
+
+static const int32_t CHIP8_cpu_run_engine(const uint32_t cycles,
+                                          uint32_t *executed) {
+    // The interpreter has nothing to patch breakpoints into
+    if (machine->debugger != NULL &&
+        machine->engine == CHIP8_ENGINE_INTERPRETER && CHIP8_debugger_armed())
+        return CHIP8_debugger_run(cycles, executed);
+
+    if (machine->engine == CHIP8_ENGINE_PREDECODED) {
+        switch (machine->mode) {
+        case CHIP8_MODE_CH8:
+            return chip8_core_ch8_run_decoded(cycles, executed);
+        case CHIP8_MODE_SH8:
+            return chip8_core_sh8_run_decoded(cycles, executed);
+        case CHIP8_MODE_C48:
+            return chip8_core_c48_run_decoded(cycles, executed);
+        case CHIP8_MODE_XH8:
+            return chip8_core_xh8_run_decoded(cycles, executed);
+        case CHIP8_MODE_ANY:
         default:
-            goto invalid_optcode;
+            return chip8_core_any_run_decoded(cycles, executed);
         }
-        break;
+    }
+
+    switch (machine->mode) {
+    case CHIP8_MODE_CH8:
+        return chip8_core_ch8_run(cycles, executed);
+    case CHIP8_MODE_SH8:
+        return chip8_core_sh8_run(cycles, executed);
+    case CHIP8_MODE_C48:
+        return chip8_core_c48_run(cycles, executed);
+    case CHIP8_MODE_XH8:
+        return chip8_core_xh8_run(cycles, executed);
+    case CHIP8_MODE_ANY:
     default:
-        goto invalid_optcode;
+        return chip8_core_any_run(cycles, executed);
+    }
+}
+
+const int32_t CHIP8_cpu_run(const uint32_t cycles, uint32_t *executed) {
+    if (machine->recorder == NULL)
+        return CHIP8_cpu_run_engine(cycles, executed);
+
+    // The cores only count instructions at the end of a run, records need
+    // the count of their own instruction
+    uint32_t total = 0;
+    int32_t status = 0;
+    while (total < cycles && status == 0) {
+        uint32_t count = 0;
+        status = CHIP8_cpu_run_engine(1, &count);
+        total += count;
     }
 
-    return 0;
+    if (executed != NULL)
+        *executed = total;
+
+    return status;
+}
+
+void CHIP8_set_mode(const CHIP8_MODE mode) {
+    if (mode > CHIP8_MODE_ANY) {
+        print_error("%s: Invalid mode: %d", __func__, mode);
+        abort();
+    }
+
+    machine->mode = mode;
+}
 
-invalid_optcode:
-    print_error("Invalid Optcode: 0x%04x [PC=0x%04x]", optcode, machine->pc);
+const CHIP8_MODE CHIP8_get_mode(void) { return machine->mode; }
 
-    return -1;
+void CHIP8_set_engine(const CHIP8_ENGINE engine) {
+    if (engine > CHIP8_ENGINE_PREDECODED) {
+        print_error("%s: Invalid engine: %d", __func__, engine);
+        abort();
+    }
+
+    machine->engine = engine;
 }
+
+const CHIP8_ENGINE CHIP8_get_engine(void) { return machine->engine; }
@@ -10,6 +10,22 @@
 #define CHIP8_BITPLANE_ALL 0x10 // all layers
 #define CHIP8_BITPLANE_BITS 0x4
 
+// Platform modes. Every mode runs its own interpreter core, which only
+// knows the instructions and quirks of that platform.
+typedef enum {
+    CHIP8_MODE_CH8, // Normal
+    CHIP8_MODE_SH8, // Super (SCHIP)
+    CHIP8_MODE_C48, // Super, with HP CHIP 48 flag registers
+    CHIP8_MODE_XH8, // Xo
+    CHIP8_MODE_ANY, // Union of all extensions (reference core)
+} CHIP8_MODE;
+
+// Execution engines, see CHIP8_set_engine
+typedef enum {
+    CHIP8_ENGINE_INTERPRETER, // Decode every instruction when it runs
+    CHIP8_ENGINE_PREDECODED,  // Decode once, fuse common sequences
+} CHIP8_ENGINE;
+
 typedef enum {
     CHIP8_KEY_RELEASED,
     CHIP8_KEY_PRESSED,
@@ -34,20 +50,124 @@ typedef enum {
     CHIP8_KEY_F,
 } CHIP8_KEY;
 
+// Pixel formats of the screen
+typedef enum {
+    // One byte per pixel, bit n set if bitplane n is. Doubles as the
+    // palette index (see palette.h).
+    CHIP8_PIXEL_INDEX8,
+} CHIP8_PIXEL_FORMAT;
+
+// Read-only view of a screen, see CHIP8_screen_get_view
+typedef struct {
+    const uint8_t *pixels; // Row y starts at pixels + y * stride
+    uint32_t stride;
+    uint32_t width; // Active resolution (64x32 or 128x64)
+    uint32_t height;
+    CHIP8_PIXEL_FORMAT format;
+    // Rows changed since the update status was last cleared (bit y: row y)
+    uint64_t rows_updated;
+} CHIP8_screen_view;
+
+// A copy of the screen, see CHIP8_screen_snapshot
+typedef struct {
+    CHIP8_screen_view view; // Points into 'pixels'
+    uint8_t pixels[64 * 128];
+} CHIP8_screen_copy;
+
+// A complete machine (memory, registers, screen, ...). All other CHIP8_*
+// functions operate on the machine selected by the calling thread.
+typedef struct CHIP8_machine CHIP8_machine;
+
+/// Allocate a new, reset machine. Does not change the selection.
+extern CHIP8_machine *CHIP8_machine_create(void);
+extern void CHIP8_machine_destroy(CHIP8_machine *machine);
+
+/// Select the machine used by the calling thread
+extern void CHIP8_machine_select(CHIP8_machine *machine);
+extern CHIP8_machine *CHIP8_machine_get(void);
+
+/// Seed the random number generator of the selected machine. Machines
+/// start with a random seed.
+extern void CHIP8_seed(uint32_t seed);
+
+/// Number of instructions the selected machine has executed (since reset)
+extern const uint64_t CHIP8_get_cycles(void);
+
+/// Create and select a machine for the calling thread
 extern const uint32_t CHIP8_init(void);
+/// Clear memory, screen and registers, as if the machine was new. Keeps
+/// the mode, engine and random number generator. Only restores what has
+/// been loaded or written since the last reset.
 extern const uint32_t CHIP8_reset(void);
+/// Go back to the state right after the last rom was loaded (i.e. to run
+/// it again), restoring only the memory and screen the run has touched
+extern const uint32_t CHIP8_restart(void);
 extern void CHIP8_exit(void);
 
+// Saved state of a machine (registers, timers, memory, screen), to go back
+// to later (i.e. rollback netplay, see netplay.h)
+typedef struct CHIP8_state CHIP8_state;
+
+extern CHIP8_state *CHIP8_state_create(void);
+extern void CHIP8_state_destroy(CHIP8_state *state);
+
+/// Save the state of the selected machine. Only copies the memory written
+/// since the rom was loaded and the screen rows drawn to.
+extern void CHIP8_state_save(CHIP8_state *state);
+/// Go back to <state>, saved from the selected machine since its rom was
+/// loaded. Only restores what has been written since, or before the save.
+/// Keeps the mode and engine (and their decoded instructions, unless their
+/// memory changed).
+extern void CHIP8_state_load(const CHIP8_state *state);
+
 extern const uint32_t CHIP8_memcpy(void *buffer);
 extern const uint32_t CHIP8_load_from_path(const char *path);
 
 extern void CHIP8_timer_tick(void);
+
+/// Select the interpreter core used by CHIP8_cpu_run (per machine)
+extern void CHIP8_set_mode(CHIP8_MODE mode);
+extern const CHIP8_MODE CHIP8_get_mode(void);
+
+/// Select how CHIP8_cpu_run executes instructions (per machine). The
+/// predecoded engine (default) keeps every decoded instruction until memory
+/// changes underneath it, and runs common sequences (i.e. 'ANNN DXYN') as a
+/// single superinstruction. Both engines execute exactly the same
+/// instructions, but only the interpreter traces all of them.
+extern void CHIP8_set_engine(CHIP8_ENGINE engine);
+extern const CHIP8_ENGINE CHIP8_get_engine(void);
+
+/// Execute a single instruction, using the reference core (CHIP8_MODE_ANY).
+/// Returns 0 on success, 2 on 'exit' and -1 on an invalid instruction.
 extern const int32_t CHIP8_cpu_cycle(void);
 
+/// Execute up to <cycles> instructions, using the core of the current mode.
+/// Returns early on 'exit' (2), an invalid instruction (-1) or a
+/// breakpoint/watchpoint of an attached debugger (3, see debugger.h).
+/// <executed> (optional) receives the number of executed instructions.
+extern const int32_t CHIP8_cpu_run(uint32_t cycles, uint32_t *executed);
+
+/// Single pixel, see CHIP8_screen_get_view for whole frames
 extern const uint8_t CHIP8_screen_get_pixel(uint8_t x, uint8_t y);
 extern const uint8_t CHIP8_screen_get_resolution(uint8_t *width, uint8_t *height);
 extern const uint8_t CHIP8_screen_get_update_status(void);
 
+/// Reset the update status (and the updated rows), once every consumer has
+/// seen the current frame
+extern void CHIP8_screen_clear_update_status(void);
+
+/// Point <view> at the screen of the selected machine, without copying it.
+/// Valid until the machine runs again (or is destroyed).
+extern void CHIP8_screen_get_view(CHIP8_screen_view *view);
+
+/// Copy the visible area of the screen into <copy>, i.e. to hand a
+/// consistent frame to another thread. Its view points into the copy, so
+/// the copy must not be moved.
+extern void CHIP8_screen_snapshot(CHIP8_screen_copy *copy);
+
+/// Hash of the visible screen area (i.e. to detect identical frames)
+extern const uint64_t CHIP8_screen_hash(void);
+
 extern void CHIP8_input_set(CHIP8_KEY key, CHIP8_KEYSTATE state);
 
 #endif
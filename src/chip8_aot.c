@@ -0,0 +1,618 @@
+// Ahead-of-time compiler. Follows the control flow of a rom from 0x200
+// (jumps, calls, skips) and translates every reachable basic block into a
+// C function, for the runtime in aot.c (see aot.h). Instructions that need
+// the interpreter's helpers (drawing, scrolling, random numbers, ...) call
+// back into the interpreter, everything else works on the machine state
+// directly.
+//
+// Usage: chip8_aot [-m <mode>] <rom> <output.c>
+
+#include "chip8.h"
+#include "chip8_machine.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AOT_CODE_SIZE 512
+
+// Must match the core parameters in chip8.c
+static const struct {
+    const char *name;
+    const char *token;
+    CHIP8_MODE mode;
+    uint8_t schip;
+    uint8_t xochip;
+    uint8_t quirk_shift;
+    uint8_t quirk_load_store;
+} aot_modes[] = {
+    {"ch8", "CHIP8_MODE_CH8", CHIP8_MODE_CH8, 0, 0, 0, 0},
+    {"sh8", "CHIP8_MODE_SH8", CHIP8_MODE_SH8, 1, 0, 1, 1},
+    {"c48", "CHIP8_MODE_C48", CHIP8_MODE_C48, 1, 0, 1, 1},
+    {"xh8", "CHIP8_MODE_XH8", CHIP8_MODE_XH8, 1, 1, 0, 0},
+    {"any", "CHIP8_MODE_ANY", CHIP8_MODE_ANY, 1, 1, 1, 1},
+};
+
+typedef enum {
+    AOT_FLOW_NEXT,  // Continue with the next instruction
+    AOT_FLOW_BREAK, // Continue with the next instruction, in a new block
+    AOT_FLOW_STOP,  // No known successor (return, indirect jump, exit, ...)
+    AOT_FLOW_JUMP,
+    AOT_FLOW_CALL,
+    AOT_FLOW_SKIP,
+} aot_flow_t;
+
+typedef struct {
+    uint16_t address;
+    uint16_t optcode;
+    uint8_t length;
+    aot_flow_t flow;
+    uint16_t target;
+
+    // Native code, or empty if the interpreter has to run the instruction
+    char code[AOT_CODE_SIZE];
+} aot_inst_t;
+
+static uint8_t mem[CHIP8_MEM_SIZE];
+static uint32_t rom_end;
+static uint32_t mode_index;
+
+static uint8_t is_code[CHIP8_MEM_SIZE];
+static uint8_t is_leader[CHIP8_MEM_SIZE];
+
+static uint16_t aot_word(const uint32_t address) {
+    if (address + 1 >= rom_end)
+        return 0;
+
+    return (mem[address] << 8) | mem[address + 1];
+}
+
+static void aot_code(aot_inst_t *inst, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(inst->code, sizeof(inst->code), format, args);
+    va_end(args);
+}
+
+static void aot_skip(aot_inst_t *inst, const char *condition, ...) {
+    char buffer[AOT_CODE_SIZE / 2];
+    va_list args;
+    va_start(args, condition);
+    vsnprintf(buffer, sizeof(buffer), condition, args);
+    va_end(args);
+
+    // XO-CHIP: 'F000 NNNN' is skipped as a whole
+    const uint16_t next = inst->address + 2;
+    inst->flow = AOT_FLOW_SKIP;
+    inst->target =
+        next + (aot_modes[mode_index].xochip && aot_word(next) == 0xf000 ? 4
+                                                                         : 2);
+    aot_code(inst, "m->pc = (%s) ? 0x%04x : 0x%04x;", buffer, inst->target,
+             next);
+}
+
+// Decode the instruction at <address>, mirroring chip8_core.h
+static void aot_decode(const uint16_t address, aot_inst_t *inst) {
+    const uint8_t schip = aot_modes[mode_index].schip;
+    const uint8_t xochip = aot_modes[mode_index].xochip;
+
+    const uint16_t optcode = aot_word(address);
+    const uint16_t nnn = optcode & 0x0fff;
+    const uint8_t kk = optcode & 0x00ff;
+    const uint8_t n = optcode & 0x000f;
+    const uint8_t y = (optcode >> 4) & 0x000f;
+    const uint8_t x = (optcode >> 8) & 0x000f;
+
+    memset(inst, 0, sizeof(*inst));
+    inst->address = address;
+    inst->optcode = optcode;
+    inst->length = 2;
+    inst->flow = AOT_FLOW_NEXT;
+
+    switch (optcode & 0xf000) {
+    case 0x0000:
+        if ((schip && x == 0 && y == 0xc) || (xochip && x == 0 && y == 0xd))
+            break; // scrolling
+        if (kk == 0xe0) {
+            aot_code(inst, "memset(m->screen, 0, sizeof(m->screen)); "
+                           "m->screen_dirty = 0; "
+                           "m->screen_rows_updated = UINT64_MAX; "
+                           "m->screen_update_status = 1;");
+        } else if (kk == 0xee) {
+            inst->flow = AOT_FLOW_STOP;
+            aot_code(inst, "m->pc = m->stack[--(m->sp)];");
+        } else if (!schip ||
+                   (kk != 0xfb && kk != 0xfc && kk != 0xfe && kk != 0xff)) {
+            inst->flow = AOT_FLOW_STOP; // exit, or invalid
+        } // else: scrolling, resolution changes
+        break;
+    case 0x1000:
+        inst->flow = AOT_FLOW_JUMP;
+        inst->target = nnn;
+        aot_code(inst, "m->pc = 0x%04x;", nnn);
+        break;
+    case 0x2000:
+        inst->flow = AOT_FLOW_CALL;
+        inst->target = nnn;
+        aot_code(inst, "m->stack[(m->sp)++] = 0x%04x; m->pc = 0x%04x;",
+                 address + 2, nnn);
+        break;
+    case 0x3000:
+        aot_skip(inst, "m->reg[0x%x] == 0x%02x", x, kk);
+        break;
+    case 0x4000:
+        aot_skip(inst, "m->reg[0x%x] != 0x%02x", x, kk);
+        break;
+    case 0x5000:
+        if (n == 0) {
+            aot_skip(inst, "m->reg[0x%x] == m->reg[0x%x]", x, y);
+        } else if (xochip && n == 2) {
+            inst->flow = AOT_FLOW_BREAK;
+            aot_code(inst,
+                     "for (uint8_t i = 0x%x; i < 0x%x; i++) "
+                     "{ CHIP8_MEM_WRITE(m, m->index_reg + i, m->reg[i]); } "
+                     "m->mem_writes++;",
+                     x, y);
+        } else if (xochip && n == 3) {
+            aot_code(inst,
+                     "for (uint8_t i = 0x%x; i < 0x%x; i++) "
+                     "{ m->reg[i] = m->mem[m->index_reg + i]; }",
+                     x, y);
+        } else {
+            inst->flow = AOT_FLOW_STOP;
+        }
+        break;
+    case 0x6000:
+        aot_code(inst, "m->reg[0x%x] = 0x%02x;", x, kk);
+        break;
+    case 0x7000:
+        aot_code(inst, "m->reg[0x%x] += 0x%02x;", x, kk);
+        break;
+    case 0x8000: {
+        // Shift quirk: shift Vx in place, instead of Vy
+        const uint8_t src = aot_modes[mode_index].quirk_shift ? x : y;
+
+        switch (n) {
+        case 0x0:
+            aot_code(inst, "m->reg[0x%x] = m->reg[0x%x];", x, y);
+            break;
+        case 0x1:
+            aot_code(inst, "m->reg[0x%x] |= m->reg[0x%x];", x, y);
+            break;
+        case 0x2:
+            aot_code(inst, "m->reg[0x%x] &= m->reg[0x%x];", x, y);
+            break;
+        case 0x3:
+            aot_code(inst, "m->reg[0x%x] ^= m->reg[0x%x];", x, y);
+            break;
+        case 0x4:
+            aot_code(inst,
+                     "m->reg[0xf] = ((uint32_t)m->reg[0x%x] + "
+                     "(uint32_t)m->reg[0x%x]) > 255; "
+                     "m->reg[0x%x] += m->reg[0x%x];",
+                     x, y, x, y);
+            break;
+        case 0x5:
+            aot_code(inst,
+                     "m->reg[0xf] = m->reg[0x%x] > m->reg[0x%x]; "
+                     "m->reg[0x%x] = m->reg[0x%x] - m->reg[0x%x];",
+                     y, x, x, x, y);
+            break;
+        case 0x6:
+            aot_code(inst,
+                     "m->reg[0xf] = m->reg[0x%x] & 0x1; "
+                     "m->reg[0x%x] = m->reg[0x%x] >> 1;",
+                     src, x, src);
+            break;
+        case 0x7:
+            aot_code(inst,
+                     "m->reg[0xf] = m->reg[0x%x] > m->reg[0x%x]; "
+                     "m->reg[0x%x] = m->reg[0x%x] - m->reg[0x%x];",
+                     x, y, x, y, x);
+            break;
+        case 0xe:
+            aot_code(inst,
+                     "m->reg[0xf] = (m->reg[0x%x] >> 7) & 0x1; "
+                     "m->reg[0x%x] = m->reg[0x%x] << 1;",
+                     src, x, src);
+            break;
+        default:
+            inst->flow = AOT_FLOW_STOP;
+            break;
+        }
+        break;
+    }
+    case 0x9000:
+        if (n == 0)
+            aot_skip(inst, "m->reg[0x%x] != m->reg[0x%x]", x, y);
+        else
+            inst->flow = AOT_FLOW_STOP;
+        break;
+    case 0xa000:
+        aot_code(inst, "m->index_reg = 0x%04x;", nnn);
+        break;
+    case 0xb000:
+        // Indirect: the runtime looks up the target
+        inst->flow = AOT_FLOW_STOP;
+        aot_code(inst, "m->pc = m->reg[0x0] + 0x%04x;", nnn);
+        break;
+    case 0xc000:
+    case 0xd000:
+        break; // random numbers, drawing
+    case 0xe000:
+        if (kk == 0x9e)
+            aot_skip(inst, "m->keys[m->reg[0x%x]] == CHIP8_KEY_PRESSED", x);
+        else if (kk == 0xa1)
+            aot_skip(inst, "m->keys[m->reg[0x%x]] == CHIP8_KEY_RELEASED", x);
+        else
+            inst->flow = AOT_FLOW_STOP;
+        break;
+    case 0xf000:
+        if (xochip && nnn == 0) {
+            inst->length = 4;
+            aot_code(inst, "m->index_reg = 0x%04x;", aot_word(address + 2));
+            break;
+        } else if (xochip && kk == 0x01) {
+            aot_code(inst, "m->screen_bitplane = 0x%x;", x);
+            break;
+        }
+
+        switch (kk) {
+        case 0x07:
+            aot_code(inst, "m->reg[0x%x] = m->timer;", x);
+            break;
+        case 0x0a:
+            // Waits for a key (in the interpreter), the block has to end
+            inst->flow = AOT_FLOW_BREAK;
+            break;
+        case 0x15:
+            aot_code(inst, "m->timer = m->reg[0x%x];", x);
+            break;
+        case 0x18:
+            aot_code(inst, "m->timer_sound = m->reg[0x%x];", x);
+            break;
+        case 0x1e:
+            aot_code(inst, "m->index_reg += m->reg[0x%x];", x);
+            break;
+        case 0x29:
+            aot_code(inst,
+                     "m->index_reg = CHIP8_FONTSET_OFFSET + "
+                     "CHIP8_FONTSET_CHAR_SIZE * m->reg[0x%x];",
+                     x);
+            break;
+        case 0x30:
+            if (schip)
+                aot_code(inst,
+                         "m->index_reg = CHIP8_FONTSET_OFFSET_SUPER + "
+                         "CHIP8_FONTSET_CHAR_SIZE_SUPER * m->reg[0x%x];",
+                         x);
+            else
+                inst->flow = AOT_FLOW_STOP;
+            break;
+        case 0x33:
+            // Writes end the block, the next one might have been modified
+            inst->flow = AOT_FLOW_BREAK;
+            aot_code(inst,
+                     "CHIP8_MEM_WRITE(m, m->index_reg, "
+                     "(m->reg[0x%x] %% 1000) / 100); "
+                     "CHIP8_MEM_WRITE(m, m->index_reg + 1, "
+                     "(m->reg[0x%x] %% 100) / 10); "
+                     "CHIP8_MEM_WRITE(m, m->index_reg + 2, "
+                     "m->reg[0x%x] %% 10); "
+                     "m->mem_writes++;",
+                     x, x, x);
+            break;
+        case 0x55:
+            inst->flow = AOT_FLOW_BREAK;
+            if (aot_modes[mode_index].quirk_load_store)
+                aot_code(inst,
+                         "for (int i = 0; i < 0x%x; i++) "
+                         "{ CHIP8_MEM_WRITE(m, m->index_reg + i, m->reg[i]); } "
+                         "m->mem_writes++;",
+                         x + 1);
+            else
+                aot_code(inst,
+                         "for (int i = 0; i < 0x%x; i++) "
+                         "{ CHIP8_MEM_WRITE(m, m->index_reg + i, m->reg[i]); } "
+                         "m->mem_writes++; m->index_reg += 0x%x;",
+                         x + 1, x + 1);
+            break;
+        case 0x65:
+            if (aot_modes[mode_index].quirk_load_store)
+                aot_code(inst,
+                         "for (int i = 0; i < 0x%x; i++) "
+                         "{ m->reg[i] = m->mem[m->index_reg + i]; }",
+                         x + 1);
+            else
+                aot_code(inst,
+                         "for (int i = 0; i < 0x%x; i++) "
+                         "{ m->reg[i] = m->mem[m->index_reg + i]; } "
+                         "m->index_reg += 0x%x;",
+                         x + 1, x + 1);
+            break;
+        case 0x75:
+        case 0x85:
+            if (!schip)
+                inst->flow = AOT_FLOW_STOP;
+            break; // flag registers
+        case 0x02:
+        case 0x3a:
+            if (!xochip)
+                inst->flow = AOT_FLOW_STOP;
+            break; // audio
+        default:
+            inst->flow = AOT_FLOW_STOP;
+            break;
+        }
+        break;
+    }
+}
+
+static const uint8_t aot_in_rom(const uint32_t address) {
+    return address >= CHIP8_MEM_OFFSET && address + 1 < rom_end;
+}
+
+static void aot_mark_leader(uint16_t *worklist, uint32_t *count,
+                            const uint32_t address) {
+    if (!aot_in_rom(address) || is_leader[address])
+        return;
+
+    is_leader[address] = 1;
+    worklist[(*count)++] = address;
+}
+
+// Find all instructions reachable from 0x200 and the addresses basic
+// blocks start at
+static void aot_discover(void) {
+    static uint16_t worklist[CHIP8_MEM_SIZE];
+    uint32_t count = 0;
+    aot_inst_t inst;
+
+    aot_mark_leader(worklist, &count, CHIP8_MEM_OFFSET);
+
+    while (count > 0) {
+        uint32_t address = worklist[--count];
+
+        while (aot_in_rom(address) && !is_code[address]) {
+            aot_decode(address, &inst);
+            is_code[address] = 1;
+
+            const uint32_t next = address + inst.length;
+
+            switch (inst.flow) {
+            case AOT_FLOW_NEXT:
+                address = next;
+                continue;
+            case AOT_FLOW_BREAK:
+                aot_mark_leader(worklist, &count, next);
+                break;
+            case AOT_FLOW_STOP:
+                break;
+            case AOT_FLOW_JUMP:
+                aot_mark_leader(worklist, &count, inst.target);
+                break;
+            case AOT_FLOW_CALL:
+            case AOT_FLOW_SKIP:
+                aot_mark_leader(worklist, &count, inst.target);
+                aot_mark_leader(worklist, &count, next);
+                break;
+            }
+
+            break;
+        }
+    }
+}
+
+// Emit the block starting at <start>, returns its size in bytes and the
+// number of instructions in <instructions>
+static uint32_t aot_emit_block(FILE *out, const uint16_t start,
+                               uint32_t *instructions) {
+    aot_inst_t inst;
+    uint32_t address = start;
+    uint32_t count = 0;
+
+    fprintf(out,
+            "static uint32_t block_%04x(CHIP8_machine *m, int32_t *status) "
+            "{\n",
+            start);
+
+    for (;;) {
+        aot_decode(address, &inst);
+        count++;
+
+        const uint32_t next = address + inst.length;
+
+        const uint8_t continues = inst.flow == AOT_FLOW_NEXT &&
+                                  aot_in_rom(next) && is_code[next] &&
+                                  !is_leader[next];
+
+        if (inst.code[0] != '\0') {
+            fprintf(out, "    // 0x%04x: %04x\n    %s\n", address, inst.optcode,
+                    inst.code);
+        } else {
+            // Run it on the interpreter, which also sets pc
+            fprintf(out,
+                    "    // 0x%04x: %04x (interpreter)\n"
+                    "    m->pc = 0x%04x;\n"
+                    "    if ((*status = CHIP8_cpu_step()) != 0)\n"
+                    "        return %u + (*status == 2);\n",
+                    address, inst.optcode, address, count - 1);
+
+            // If it didn't continue with the next instruction (i.e. waiting
+            // for a key), let the runtime decide
+            if (continues)
+                fprintf(out, "    if (m->pc != 0x%04x)\n        return %u;\n",
+                        next, count);
+        }
+
+        if (continues) {
+            address = next;
+            continue;
+        }
+
+        // Control flow instructions have already set pc
+        if (inst.code[0] != '\0' &&
+            (inst.flow == AOT_FLOW_NEXT || inst.flow == AOT_FLOW_BREAK))
+            fprintf(out, "    m->pc = 0x%04x;\n", next);
+
+        fprintf(out, "    return %u;\n}\n\n", count);
+        *instructions = count;
+
+        // XO-CHIP skips depend on the instruction after the next, so it is
+        // part of the block (for the runtime's check for modified memory)
+        if (inst.flow == AOT_FLOW_SKIP && aot_modes[mode_index].xochip)
+            return next + 2 - start;
+
+        return next - start;
+    }
+}
+
+static void aot_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-m <mode>] <rom> <output.c>\n"
+            "  -m, --mode <mode>  ch8, sh8, c48, xh8 or any (default: by file\n"
+            "                     extension, like emu_chip8)\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char *mode_name = NULL;
+    int option;
+
+    while ((option = getopt_long(argc, argv, "m:h", long_options, NULL)) !=
+           -1) {
+        if (option == 'm') {
+            mode_name = optarg;
+        } else {
+            aot_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (argc - optind != 2) {
+        aot_usage(argv[0]);
+        return 2;
+    }
+
+    const char *rom_path = argv[optind];
+    const char *out_path = argv[optind + 1];
+
+    // Same defaults as emu_chip8
+    if (mode_name == NULL) {
+        const char *extension = strrchr(rom_path, '.');
+        mode_name = "any";
+        if (extension != NULL && strcmp(extension, ".sc8") == 0)
+            mode_name = "sh8";
+        else if (extension != NULL && strcmp(extension, ".xo8") == 0)
+            mode_name = "xh8";
+    }
+
+    for (mode_index = 0; mode_index < sizeof(aot_modes) / sizeof(*aot_modes);
+         mode_index++) {
+        if (strcmp(aot_modes[mode_index].name, mode_name) == 0)
+            break;
+    }
+    if (mode_index == sizeof(aot_modes) / sizeof(*aot_modes)) {
+        fprintf(stderr, "Invalid mode: %s\n", mode_name);
+        return 2;
+    }
+
+    FILE *file = fopen(rom_path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", rom_path, strerror(errno));
+        return 1;
+    }
+
+    const size_t rom_size = fread(mem + CHIP8_MEM_OFFSET, 1,
+                                  CHIP8_MEM_SIZE - CHIP8_MEM_OFFSET - 1, file);
+    fclose(file);
+    rom_end = CHIP8_MEM_OFFSET + rom_size;
+
+    if (rom_size == 0) {
+        fprintf(stderr, "Empty rom: %s\n", rom_path);
+        return 1;
+    }
+
+    aot_discover();
+
+    FILE *out = fopen(out_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", out_path, strerror(errno));
+        return 1;
+    }
+
+    // The name ends up in a string literal
+    const char *rom_base = strrchr(rom_path, '/');
+    char rom_name[256];
+    size_t length = 0;
+    for (const char *c = rom_base != NULL ? rom_base + 1 : rom_path;
+         *c != '\0' && length < sizeof(rom_name) - 1; c++) {
+        if (*c != '"' && *c != '\\' && *c >= 0x20)
+            rom_name[length++] = *c;
+    }
+    rom_name[length] = '\0';
+
+    fprintf(out,
+            "// Generated by chip8_aot from %s (mode: %s). Do not edit.\n\n"
+            "#include \"aot.h\"\n#include \"chip8_machine.h\"\n\n"
+            "#include <string.h>\n\n"
+            "static const uint8_t rom[%zu] = {",
+            rom_name, aot_modes[mode_index].name, rom_size);
+
+    for (size_t i = 0; i < rom_size; i++)
+        fprintf(out, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ",
+                mem[CHIP8_MEM_OFFSET + i]);
+    fprintf(out, "\n};\n\n");
+
+    static uint16_t block_starts[CHIP8_MEM_SIZE];
+    static uint16_t block_sizes[CHIP8_MEM_SIZE];
+    static uint16_t block_instructions[CHIP8_MEM_SIZE];
+    uint32_t block_count = 0;
+    uint32_t instructions = 0;
+
+    for (uint32_t address = CHIP8_MEM_OFFSET; address < rom_end; address++) {
+        instructions += is_code[address];
+        if (!is_leader[address] || !is_code[address])
+            continue;
+
+        block_starts[block_count] = address;
+        uint32_t count = 0;
+        block_sizes[block_count] = aot_emit_block(out, address, &count);
+        block_instructions[block_count] = count;
+        block_count++;
+    }
+
+    fprintf(out, "static const CHIP8_aot_block blocks[%u] = {\n",
+            block_count);
+    for (uint32_t i = 0; i < block_count; i++)
+        fprintf(out, "    {0x%04x, %u, %u, block_%04x},\n", block_starts[i],
+                block_sizes[i], block_instructions[i], block_starts[i]);
+    fprintf(out,
+            "};\n\n"
+            "const CHIP8_aot_program chip8_aot_program = {\n"
+            "    .rom_name = \"%s\",\n"
+            "    .mode = %s,\n"
+            "    .rom = rom,\n"
+            "    .rom_size = sizeof(rom),\n"
+            "    .blocks = blocks,\n"
+            "    .block_count = %u,\n"
+            "};\n",
+            rom_name, aot_modes[mode_index].token, block_count);
+
+    fclose(out);
+
+    fprintf(stderr, "%s: %u instructions in %u blocks\n", rom_name,
+            instructions, block_count);
+
+    return 0;
+}
@@ -0,0 +1,1284 @@
+// Assembler for the instructions the cores implement (see chip8_core.h),
+// including Super-CHIP and XO-CHIP: Long index loads (F000 NNNN), bitplane
+// selection (FN01) and sprites on up to four bitplanes. It also generates
+// parameterized stress roms, so performance work can target reproducible
+// worst cases.
+//
+// Usage: chip8_asm [-m <mode>] [-o <rom>] <source>
+//        chip8_asm --stress <kind> [-n <count>] [...] [-S] [-o <rom>]
+//
+// Source, one statement per line, ';' starts a comment:
+//   <label>:               Address of what follows
+//   <name> = <expr>        Constant
+//   CLS, RET, JP, CALL, SE, SNE, LD, ADD, OR, AND, XOR, SUB, SHR, SUBN,
+//   SHL, RND, DRW, SKP, SKNP        (CHIP-8)
+//   SCD, SCR, SCL, EXIT, LOW, HIGH  (Super-CHIP)
+//   SCU, SAVE, LOAD, PLANE, AUDIO, PITCH, LD I, LONG <addr>  (XO-CHIP)
+//   DB <byte>, ...         Bytes
+//   DW <word>, ...         Big endian words
+//   ORG <addr>             Continue at <addr>, zero filled
+//   SPRITE <planes>, "<row>", ...
+//                          A sprite for the bitplanes <planes> (PLANE
+//                          mask): One hex digit (color) per pixel, '.' for
+//                          0, 8 or 16 per row. Stored one bitplane after the
+//                          other, lowest first, as DRW reads them.
+// Expressions are numbers (decimal, 0x hex, 0b binary), labels and
+// constants, added or subtracted.
+
+#include "chip8_machine.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define ASM_MAX_OPERANDS 32
+#define ASM_MAX_SYMBOLS 4096
+#define ASM_MAX_NAME 32
+#define ASM_MAX_LINE 512
+
+// Extensions an instruction needs
+#define ASM_CHIP8 0x0
+#define ASM_SCHIP 0x1
+#define ASM_XOCHIP 0x2
+
+static const struct {
+    const char *name;
+    uint8_t extensions;
+} asm_modes[] = {
+    {"ch8", ASM_CHIP8},
+    {"sh8", ASM_SCHIP},
+    {"c48", ASM_SCHIP},
+    {"xh8", ASM_SCHIP | ASM_XOCHIP},
+    {"any", ASM_SCHIP | ASM_XOCHIP},
+};
+
+typedef enum {
+    ASM_OP_NONE,
+    ASM_OP_VX,     // Register, into the x nibble
+    ASM_OP_VY,     // Register, into the y nibble
+    ASM_OP_V0,     // V0 only
+    ASM_OP_BYTE,   // Expression, low byte
+    ASM_OP_NIBBLE, // Expression, low nibble
+    ASM_OP_PLANE,  // Expression, into the x nibble
+    ASM_OP_ADDR,   // Expression, 12 bits
+    ASM_OP_LONG,   // LONG <expression>, 16 bits in a second word
+    ASM_OP_I,
+    ASM_OP_MEM_I, // [I]
+    ASM_OP_DT,
+    ASM_OP_ST,
+    ASM_OP_K,
+    ASM_OP_F,
+    ASM_OP_HF,
+    ASM_OP_B,
+    ASM_OP_R,
+} asm_operand_t;
+
+typedef struct {
+    const char *name;
+    asm_operand_t operands[3];
+    uint16_t optcode;
+    uint8_t extensions;
+} asm_inst_t;
+
+// The first entry that matches the operands is taken
+static const asm_inst_t asm_insts[] = {
+    {"CLS", {0}, 0x00e0, ASM_CHIP8},
+    {"RET", {0}, 0x00ee, ASM_CHIP8},
+    {"SCD", {ASM_OP_NIBBLE}, 0x00c0, ASM_SCHIP},
+    {"SCU", {ASM_OP_NIBBLE}, 0x00d0, ASM_XOCHIP},
+    {"SCR", {0}, 0x00fb, ASM_SCHIP},
+    {"SCL", {0}, 0x00fc, ASM_SCHIP},
+    {"EXIT", {0}, 0x00fd, ASM_SCHIP},
+    {"LOW", {0}, 0x00fe, ASM_SCHIP},
+    {"HIGH", {0}, 0x00ff, ASM_SCHIP},
+    {"JP", {ASM_OP_V0, ASM_OP_ADDR}, 0xb000, ASM_CHIP8},
+    {"JP", {ASM_OP_ADDR}, 0x1000, ASM_CHIP8},
+    {"CALL", {ASM_OP_ADDR}, 0x2000, ASM_CHIP8},
+    {"SE", {ASM_OP_VX, ASM_OP_VY}, 0x5000, ASM_CHIP8},
+    {"SE", {ASM_OP_VX, ASM_OP_BYTE}, 0x3000, ASM_CHIP8},
+    {"SNE", {ASM_OP_VX, ASM_OP_VY}, 0x9000, ASM_CHIP8},
+    {"SNE", {ASM_OP_VX, ASM_OP_BYTE}, 0x4000, ASM_CHIP8},
+    {"SAVE", {ASM_OP_VX, ASM_OP_VY}, 0x5002, ASM_XOCHIP},
+    {"LOAD", {ASM_OP_VX, ASM_OP_VY}, 0x5003, ASM_XOCHIP},
+    {"LD", {ASM_OP_VX, ASM_OP_VY}, 0x8000, ASM_CHIP8},
+    {"LD", {ASM_OP_VX, ASM_OP_DT}, 0xf007, ASM_CHIP8},
+    {"LD", {ASM_OP_VX, ASM_OP_K}, 0xf00a, ASM_CHIP8},
+    {"LD", {ASM_OP_VX, ASM_OP_MEM_I}, 0xf065, ASM_CHIP8},
+    {"LD", {ASM_OP_VX, ASM_OP_R}, 0xf085, ASM_SCHIP},
+    {"LD", {ASM_OP_VX, ASM_OP_BYTE}, 0x6000, ASM_CHIP8},
+    {"LD", {ASM_OP_I, ASM_OP_LONG}, 0xf000, ASM_XOCHIP},
+    {"LD", {ASM_OP_I, ASM_OP_ADDR}, 0xa000, ASM_CHIP8},
+    {"LD", {ASM_OP_DT, ASM_OP_VX}, 0xf015, ASM_CHIP8},
+    {"LD", {ASM_OP_ST, ASM_OP_VX}, 0xf018, ASM_CHIP8},
+    {"LD", {ASM_OP_F, ASM_OP_VX}, 0xf029, ASM_CHIP8},
+    {"LD", {ASM_OP_HF, ASM_OP_VX}, 0xf030, ASM_SCHIP},
+    {"LD", {ASM_OP_B, ASM_OP_VX}, 0xf033, ASM_CHIP8},
+    {"LD", {ASM_OP_MEM_I, ASM_OP_VX}, 0xf055, ASM_CHIP8},
+    {"LD", {ASM_OP_R, ASM_OP_VX}, 0xf075, ASM_SCHIP},
+    {"ADD", {ASM_OP_I, ASM_OP_VX}, 0xf01e, ASM_CHIP8},
+    {"ADD", {ASM_OP_VX, ASM_OP_VY}, 0x8004, ASM_CHIP8},
+    {"ADD", {ASM_OP_VX, ASM_OP_BYTE}, 0x7000, ASM_CHIP8},
+    {"OR", {ASM_OP_VX, ASM_OP_VY}, 0x8001, ASM_CHIP8},
+    {"AND", {ASM_OP_VX, ASM_OP_VY}, 0x8002, ASM_CHIP8},
+    {"XOR", {ASM_OP_VX, ASM_OP_VY}, 0x8003, ASM_CHIP8},
+    {"SUB", {ASM_OP_VX, ASM_OP_VY}, 0x8005, ASM_CHIP8},
+    {"SHR", {ASM_OP_VX, ASM_OP_VY}, 0x8006, ASM_CHIP8},
+    {"SHR", {ASM_OP_VX}, 0x8006, ASM_CHIP8},
+    {"SUBN", {ASM_OP_VX, ASM_OP_VY}, 0x8007, ASM_CHIP8},
+    {"SHL", {ASM_OP_VX, ASM_OP_VY}, 0x800e, ASM_CHIP8},
+    {"SHL", {ASM_OP_VX}, 0x800e, ASM_CHIP8},
+    {"RND", {ASM_OP_VX, ASM_OP_BYTE}, 0xc000, ASM_CHIP8},
+    {"DRW", {ASM_OP_VX, ASM_OP_VY, ASM_OP_NIBBLE}, 0xd000, ASM_CHIP8},
+    {"SKP", {ASM_OP_VX}, 0xe09e, ASM_CHIP8},
+    {"SKNP", {ASM_OP_VX}, 0xe0a1, ASM_CHIP8},
+    {"PLANE", {ASM_OP_PLANE}, 0xf001, ASM_XOCHIP},
+    {"AUDIO", {0}, 0xf002, ASM_XOCHIP},
+    {"PITCH", {ASM_OP_VX}, 0xf03a, ASM_XOCHIP},
+};
+
+typedef struct {
+    char name[ASM_MAX_NAME];
+    uint32_t value;
+    uint32_t line;    // Of the definition
+    uint8_t resolved; // Value known (labels: after pass 1)
+} asm_symbol;
+
+static asm_symbol symbols[ASM_MAX_SYMBOLS];
+static uint32_t symbol_count = 0;
+
+static uint8_t rom[CHIP8_MEM_SIZE];
+static uint32_t rom_end = CHIP8_MEM_OFFSET;
+
+// State of the pass in progress
+static const char *source_name;
+static uint32_t line_number;
+static uint32_t pass;
+static uint32_t address;
+static uint32_t errors = 0;
+static uint8_t extensions = ASM_SCHIP | ASM_XOCHIP;
+
+// Set while operands are only tried against an instruction: asm_error
+// doesn't report anything
+static uint8_t quiet = 0;
+
+static void asm_verror(const char *format, va_list args) {
+    fprintf(stderr, "%s:%u: ", source_name, line_number);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+
+    errors++;
+}
+
+static void asm_error(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void asm_error(const char *format, ...) {
+    // Pass 1 doesn't know every label yet, pass 2 sees everything
+    if (pass != 2 || quiet)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    asm_verror(format, args);
+    va_end(args);
+}
+
+// Report an error in any pass, for what pass 2 can't tell anymore
+static void asm_error_now(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void asm_error_now(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    asm_verror(format, args);
+    va_end(args);
+}
+
+static asm_symbol *asm_find(const char *name) {
+    for (uint32_t i = 0; i < symbol_count; i++) {
+        if (strcmp(symbols[i].name, name) == 0)
+            return &symbols[i];
+    }
+
+    return NULL;
+}
+
+static void asm_define(const char *name, uint32_t value, uint8_t resolved) {
+    asm_symbol *symbol = asm_find(name);
+
+    if (symbol == NULL) {
+        if (symbol_count == ASM_MAX_SYMBOLS) {
+            asm_error("%s", "Too many symbols");
+            return;
+        }
+        symbol = &symbols[symbol_count++];
+        snprintf(symbol->name, sizeof(symbol->name), "%s", name);
+        symbol->line = line_number;
+    } else if (symbol->line != line_number) {
+        asm_error("'%s' is already defined on line %u", name, symbol->line);
+        return;
+    } else if (symbol->resolved && symbol->value != value) {
+        // Known in pass 1, but something above changed size in between: Code
+        // assembled before it uses the old value
+        asm_error("'%s' moved from 0x%x (pass 1) to 0x%x", name,
+                  symbol->value, value);
+    }
+
+    symbol->value = value;
+    symbol->resolved = resolved;
+}
+
+static uint8_t asm_is_name_char(const char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+static const char *asm_skip_space(const char *text) {
+    while (isspace((unsigned char)*text))
+        text++;
+
+    return text;
+}
+
+// A number, label or constant. Returns 0 if there is none.
+static uint8_t asm_term(const char **text, int32_t *value,
+                        uint8_t *resolved) {
+    const char *c = asm_skip_space(*text);
+    int32_t sign = 1;
+
+    if (*c == '-') {
+        sign = -1;
+        c = asm_skip_space(c + 1);
+    }
+
+    if (isdigit((unsigned char)*c)) {
+        uint32_t base = 10;
+        if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X')) {
+            base = 16;
+            c += 2;
+        } else if (c[0] == '0' && (c[1] == 'b' || c[1] == 'B')) {
+            base = 2;
+            c += 2;
+        }
+
+        char *end;
+        const long number = strtol(c, &end, base);
+        if (end == c || asm_is_name_char(*end))
+            return 0;
+
+        *value = sign * (int32_t)number;
+        *text = end;
+        return 1;
+    }
+
+    if (!asm_is_name_char(*c))
+        return 0;
+
+    char name[ASM_MAX_NAME];
+    size_t length = 0;
+    while (asm_is_name_char(*c)) {
+        if (length < sizeof(name) - 1)
+            name[length++] = *c;
+        c++;
+    }
+    name[length] = '\0';
+
+    // Pass 1 doesn't know labels further down yet, constants defined with
+    // them are only known once pass 2 gets to them
+    const asm_symbol *symbol = asm_find(name);
+    if (symbol == NULL) {
+        asm_error("Unknown symbol '%s'", name);
+        *resolved = 0;
+        *value = 0;
+    } else {
+        if (!symbol->resolved)
+            asm_error("'%s' is used before it is defined", name);
+        *resolved &= symbol->resolved;
+        *value = sign * (int32_t)symbol->value;
+    }
+
+    *text = c;
+    return 1;
+}
+
+// <term> ((+|-) <term>)..., the whole of <text>. Returns 0 if it isn't one.
+static uint8_t asm_expr(const char *text, int32_t *value,
+                        uint8_t *resolved) {
+    *resolved = 1;
+    if (!asm_term(&text, value, resolved))
+        return 0;
+
+    for (;;) {
+        text = asm_skip_space(text);
+        if (*text == '\0')
+            return 1;
+
+        const char op = *text++;
+        int32_t term;
+        if ((op != '+' && op != '-') || !asm_term(&text, &term, resolved))
+            return 0;
+
+        *value += op == '+' ? term : -term;
+    }
+}
+
+// Register number of "V0"-"VF", or -1
+static int32_t asm_register(const char *text) {
+    if ((text[0] != 'V' && text[0] != 'v') ||
+        !isxdigit((unsigned char)text[1]) || text[2] != '\0')
+        return -1;
+
+    return isdigit((unsigned char)text[1]) ? text[1] - '0'
+                                           : toupper(text[1]) - 'A' + 10;
+}
+
+static uint8_t asm_keyword_matches(const asm_operand_t kind,
+                                   const char *text) {
+    static const struct {
+        asm_operand_t kind;
+        const char *keyword;
+    } keywords[] = {
+        {ASM_OP_I, "I"},   {ASM_OP_MEM_I, "[I]"}, {ASM_OP_DT, "DT"},
+        {ASM_OP_ST, "ST"}, {ASM_OP_K, "K"},       {ASM_OP_F, "F"},
+        {ASM_OP_HF, "HF"}, {ASM_OP_B, "B"},       {ASM_OP_R, "R"},
+    };
+
+    for (uint32_t i = 0; i < sizeof(keywords) / sizeof(*keywords); i++) {
+        if (keywords[i].kind == kind)
+            return strcasecmp(keywords[i].keyword, text) == 0;
+    }
+
+    return 0;
+}
+
+// Starts with "LONG " (the operand of LD I, LONG <addr>)
+static const char *asm_long(const char *text) {
+    if (strncasecmp(text, "LONG", 4) != 0 || !isspace((unsigned char)text[4]))
+        return NULL;
+
+    return text + 5;
+}
+
+static uint8_t asm_operand_matches(const asm_operand_t kind,
+                                   const char *text) {
+    int32_t value;
+    uint8_t resolved;
+
+    switch (kind) {
+    case ASM_OP_NONE:
+        return 0;
+    case ASM_OP_VX:
+    case ASM_OP_VY:
+        return asm_register(text) >= 0;
+    case ASM_OP_V0:
+        return asm_register(text) == 0;
+    case ASM_OP_LONG:
+        return asm_long(text) != NULL;
+    case ASM_OP_BYTE:
+    case ASM_OP_NIBBLE:
+    case ASM_OP_PLANE:
+    case ASM_OP_ADDR: {
+        // Checked without reporting unknown symbols, asm_value does that
+        quiet = 1;
+        const uint8_t result = asm_register(text) < 0 &&
+                               asm_long(text) == NULL &&
+                               asm_expr(text, &value, &resolved);
+        quiet = 0;
+        return result;
+    }
+    default:
+        return asm_keyword_matches(kind, text);
+    }
+}
+
+static int32_t asm_value(const char *text, const int32_t min,
+                         const int32_t max) {
+    int32_t value;
+    uint8_t resolved;
+
+    if (!asm_expr(text, &value, &resolved)) {
+        asm_error("Invalid expression '%s'", text);
+        return 0;
+    }
+
+    if (resolved && (value < min || value > max))
+        asm_error("'%s' (%d) is out of range (%d to %d)", text, value, min,
+                  max);
+
+    return value;
+}
+
+// A value that decides how many bytes follow (ORG, SPRITE). Both passes
+// have to agree on it, so it can't use anything defined further down.
+static int32_t asm_size_value(const char *text, const int32_t min,
+                              const int32_t max) {
+    int32_t value;
+    uint8_t resolved;
+
+    // Reported right away, pass 2 would find it defined
+    if (pass == 1 && asm_expr(text, &value, &resolved) && !resolved)
+        asm_error_now("'%s' has to be defined before it is used here", text);
+
+    return asm_value(text, min, max);
+}
+
+static void asm_emit(const uint8_t byte) {
+    if (address >= CHIP8_MEM_SIZE) {
+        asm_error("Out of memory (0x%x)", address);
+        address++;
+        return;
+    }
+
+    if (pass == 2)
+        rom[address] = byte;
+    address++;
+    if (address > rom_end)
+        rom_end = address;
+}
+
+static void asm_emit_word(const uint16_t word) {
+    asm_emit(word >> 8);
+    asm_emit(word & 0xff);
+}
+
+static const char *asm_extension_name(const uint8_t needed) {
+    return needed & ASM_XOCHIP ? "XO-CHIP (mode xh8 or any)"
+                               : "Super-CHIP (mode sh8, c48, xh8 or any)";
+}
+
+static void asm_instruction(const char *mnemonic, char **operands,
+                            const uint32_t count) {
+    const asm_inst_t *inst = NULL;
+    uint8_t known = 0;
+
+    for (uint32_t i = 0; i < sizeof(asm_insts) / sizeof(*asm_insts); i++) {
+        if (strcasecmp(asm_insts[i].name, mnemonic) != 0)
+            continue;
+        known = 1;
+
+        uint32_t expected = 0;
+        while (expected < 3 && asm_insts[i].operands[expected] != ASM_OP_NONE)
+            expected++;
+        if (expected != count)
+            continue;
+
+        uint32_t matched = 0;
+        while (matched < count &&
+               asm_operand_matches(asm_insts[i].operands[matched],
+                                   operands[matched]))
+            matched++;
+
+        if (matched == count) {
+            inst = &asm_insts[i];
+            break;
+        }
+    }
+
+    if (inst == NULL) {
+        if (known)
+            asm_error("Invalid operands for '%s'", mnemonic);
+        else
+            asm_error("Unknown instruction '%s'", mnemonic);
+        // Keep the addresses of pass 1 and 2 in line
+        address += 2;
+        return;
+    }
+
+    if ((inst->extensions & extensions) != inst->extensions)
+        asm_error("'%s' needs %s", mnemonic,
+                  asm_extension_name(inst->extensions));
+
+    uint16_t optcode = inst->optcode;
+    uint32_t long_address = 0;
+    uint8_t has_long = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const char *text = operands[i];
+
+        switch (inst->operands[i]) {
+        case ASM_OP_VX:
+            optcode |= asm_register(text) << 8;
+            // A single register shifts itself (SHR Vx is SHR Vx, Vx)
+            if (count == 1 && (optcode & 0xf000) == 0x8000)
+                optcode |= asm_register(text) << 4;
+            break;
+        case ASM_OP_VY:
+            optcode |= asm_register(text) << 4;
+            break;
+        case ASM_OP_BYTE:
+            optcode |= asm_value(text, -128, 255) & 0xff;
+            break;
+        case ASM_OP_NIBBLE: {
+            const int32_t value = asm_value(text, 0, 15);
+            optcode |= value & 0xf;
+            // DXY0 draws 16x16 sprites on Super-CHIP, nothing on CHIP-8
+            if ((optcode & 0xf000) == 0xd000 && value == 0 &&
+                !(extensions & ASM_SCHIP))
+                asm_error("'DRW' with 0 rows needs %s",
+                          asm_extension_name(ASM_SCHIP));
+            break;
+        }
+        case ASM_OP_PLANE:
+            optcode |= (asm_value(text, 0, 15) & 0xf) << 8;
+            break;
+        case ASM_OP_ADDR:
+            optcode |= asm_value(text, 0, 0xfff) & 0xfff;
+            break;
+        case ASM_OP_LONG:
+            long_address = asm_value(asm_long(text), 0, 0xffff) & 0xffff;
+            has_long = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    asm_emit_word(optcode);
+    if (has_long)
+        asm_emit_word(long_address);
+}
+
+// A quoted string, without the quotes. Returns NULL if it isn't one.
+static const char *asm_string(char *text) {
+    const size_t length = strlen(text);
+    if (length < 2 || text[0] != '"' || text[length - 1] != '"')
+        return NULL;
+
+    text[length - 1] = '\0';
+    return text + 1;
+}
+
+static void asm_sprite(char **operands, const uint32_t count) {
+    if (count < 2) {
+        asm_error("%s", "SPRITE needs the bitplanes and at least one row");
+        return;
+    }
+
+    const uint32_t planes = asm_size_value(operands[0], 1, 15);
+    uint32_t width = 0;
+    uint8_t colors[ASM_MAX_OPERANDS][16];
+
+    for (uint32_t row = 0; row < count - 1; row++) {
+        const char *text = asm_string(operands[row + 1]);
+        if (text == NULL) {
+            asm_error("Row %u of the sprite is not a string", row);
+            return;
+        }
+
+        const size_t length = strlen(text);
+        if ((length != 8 && length != 16) || (width != 0 && length != width)) {
+            asm_error("Rows have to be 8 or 16 pixels, all the same (%zu)",
+                      length);
+            return;
+        }
+        width = length;
+
+        for (uint32_t x = 0; x < width; x++) {
+            const char c = text[x];
+            if (c == '.') {
+                colors[row][x] = 0;
+            } else if (isxdigit((unsigned char)c)) {
+                colors[row][x] = isdigit((unsigned char)c)
+                                     ? c - '0'
+                                     : toupper(c) - 'A' + 10;
+            } else {
+                asm_error("Invalid pixel '%c'", c);
+                return;
+            }
+
+            if (colors[row][x] & ~planes)
+                asm_error("Color %x is not on the bitplanes 0x%x",
+                          colors[row][x], planes);
+        }
+    }
+
+    // One bit per pixel and bitplane, left to right
+    for (uint32_t plane = 0; plane < 4; plane++) {
+        if (!((planes >> plane) & 1))
+            continue;
+
+        for (uint32_t row = 0; row < count - 1; row++) {
+            uint16_t bits = 0;
+            for (uint32_t x = 0; x < width; x++)
+                bits |= ((colors[row][x] >> plane) & 1) << (width - 1 - x);
+
+            if (width == 16)
+                asm_emit_word(bits);
+            else
+                asm_emit(bits);
+        }
+    }
+}
+
+// Split <text> at commas (outside of strings), trimmed. Returns the number
+// of operands.
+static uint32_t asm_split(char *text, char **operands) {
+    uint32_t count = 0;
+    uint8_t quoted = 0;
+
+    while (isspace((unsigned char)*text))
+        text++;
+    if (*text == '\0')
+        return 0;
+
+    operands[count++] = text;
+    for (char *c = text; *c != '\0'; c++) {
+        if (*c == '"')
+            quoted = !quoted;
+        if (*c != ',' || quoted)
+            continue;
+
+        *c = '\0';
+        if (count == ASM_MAX_OPERANDS) {
+            asm_error("More than %u operands", ASM_MAX_OPERANDS);
+            break;
+        }
+        operands[count++] = c + 1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        while (isspace((unsigned char)*operands[i]))
+            operands[i]++;
+        char *end = operands[i] + strlen(operands[i]);
+        while (end > operands[i] && isspace((unsigned char)end[-1]))
+            *--end = '\0';
+    }
+
+    return count;
+}
+
+static void asm_line(char *line) {
+    // Comments end the line, outside of strings
+    uint8_t quoted = 0;
+    for (char *c = line; *c != '\0'; c++) {
+        if (*c == '"')
+            quoted = !quoted;
+        if (*c == ';' && !quoted) {
+            *c = '\0';
+            break;
+        }
+    }
+
+    char *c = line;
+    while (isspace((unsigned char)*c))
+        c++;
+
+    // <label>: or <name> = <expr>
+    char *name = c;
+    while (asm_is_name_char(*c))
+        c++;
+    char *after = c;
+    while (isspace((unsigned char)*after))
+        after++;
+
+    if (c != name && (*after == ':' || *after == '=')) {
+        const char kind = *after;
+        *c = '\0';
+
+        if (isdigit((unsigned char)*name)) {
+            asm_error("Invalid name '%s'", name);
+            return;
+        }
+
+        if (kind == ':') {
+            asm_define(name, address, 1);
+            c = after + 1;
+        } else {
+            int32_t value;
+            uint8_t resolved;
+            if (!asm_expr(after + 1, &value, &resolved))
+                asm_error("Invalid expression '%s'", after + 1);
+            asm_define(name, value, resolved);
+            return;
+        }
+    } else {
+        c = name;
+    }
+
+    while (isspace((unsigned char)*c))
+        c++;
+    if (*c == '\0')
+        return;
+
+    char *mnemonic = c;
+    while (*c != '\0' && !isspace((unsigned char)*c))
+        c++;
+    if (*c != '\0')
+        *c++ = '\0';
+
+    char *operands[ASM_MAX_OPERANDS];
+    const uint32_t count = asm_split(c, operands);
+
+    if (strcasecmp(mnemonic, "DB") == 0 || strcasecmp(mnemonic, "DW") == 0) {
+        const uint8_t word = toupper(mnemonic[1]) == 'W';
+        if (count == 0)
+            asm_error("%s needs a value", mnemonic);
+        for (uint32_t i = 0; i < count; i++) {
+            if (word)
+                asm_emit_word(asm_value(operands[i], -32768, 0xffff));
+            else
+                asm_emit(asm_value(operands[i], -128, 0xff));
+        }
+    } else if (strcasecmp(mnemonic, "ORG") == 0) {
+        const uint32_t target =
+            count == 1
+                ? (uint32_t)asm_size_value(operands[0], 0, CHIP8_MEM_SIZE)
+                : address;
+        if (count != 1)
+            asm_error("%s", "ORG needs an address");
+        else if (target < address)
+            asm_error("ORG 0x%x goes back (from 0x%x)", target, address);
+
+        while (address < target)
+            asm_emit(0);
+    } else if (strcasecmp(mnemonic, "SPRITE") == 0) {
+        asm_sprite(operands, count);
+    } else {
+        asm_instruction(mnemonic, operands, count);
+    }
+}
+
+static void asm_pass(const char *source, const uint32_t number) {
+    pass = number;
+    address = CHIP8_MEM_OFFSET;
+    line_number = 0;
+
+    const char *start = source;
+    while (*start != '\0') {
+        const char *end = strchr(start, '\n');
+        const size_t length = end != NULL ? (size_t)(end - start)
+                                          : strlen(start);
+        line_number++;
+
+        char line[ASM_MAX_LINE];
+        if (length >= sizeof(line)) {
+            asm_error("Line longer than %u characters", ASM_MAX_LINE - 1);
+        } else {
+            memcpy(line, start, length);
+            line[length] = '\0';
+            asm_line(line);
+        }
+
+        start += length;
+        if (*start == '\n')
+            start++;
+    }
+}
+
+// Assemble <source> into 'rom'. Returns the number of errors.
+static uint32_t asm_assemble(const char *source, const char *name) {
+    source_name = name;
+    errors = 0;
+    rom_end = CHIP8_MEM_OFFSET;
+
+    // Pass 1 finds the addresses of labels (instructions have the same size
+    // whatever their operands), pass 2 emits the code
+    asm_pass(source, 1);
+    asm_pass(source, 2);
+
+    if (errors == 0 && rom_end == CHIP8_MEM_OFFSET) {
+        fprintf(stderr, "%s: Nothing to assemble\n", name);
+        errors++;
+    }
+
+    return errors;
+}
+
+// -------------
+// Stress roms
+
+typedef enum {
+    ASM_STRESS_DRAW,
+    ASM_STRESS_SCROLL,
+    ASM_STRESS_ALU,
+    ASM_STRESS_COPY,
+} asm_stress_t;
+
+static const struct {
+    const char *name;
+    asm_stress_t kind;
+    uint32_t count; // Default
+} asm_stresses[] = {
+    {"draw", ASM_STRESS_DRAW, 32},
+    {"scroll", ASM_STRESS_SCROLL, 8},
+    {"alu", ASM_STRESS_ALU, 64},
+    {"copy", ASM_STRESS_COPY, 1024},
+};
+
+typedef struct {
+    asm_stress_t kind;
+    uint32_t count;
+    uint32_t planes;
+    uint8_t hires;
+} asm_stress;
+
+static char *generated = NULL;
+static size_t generated_size = 0;
+static size_t generated_capacity = 0;
+
+static void asm_gen(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void asm_gen(const char *format, ...) {
+    va_list args;
+
+    for (;;) {
+        va_start(args, format);
+        const size_t free = generated_capacity - generated_size;
+        const int length =
+            vsnprintf(generated + generated_size, free, format, args);
+        va_end(args);
+
+        if ((size_t)length < free) {
+            generated_size += length;
+            return;
+        }
+
+        generated_capacity = generated_capacity * 2 + length + 4096;
+        generated = realloc(generated, generated_capacity);
+        if (generated == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+}
+
+// The next frame starts once the delay timer runs out
+static void asm_gen_frame_start(void) {
+    asm_gen("frame:\n"
+            "    LD VE, 1\n"
+            "    LD DT, VE\n");
+}
+
+static void asm_gen_frame_end(void) {
+    asm_gen("wait:\n"
+            "    LD VE, DT\n"
+            "    SE VE, 0\n"
+            "    JP wait\n"
+            "    JP frame\n\n");
+}
+
+// A sprite with a color per bitplane combination (diagonal stripes)
+static void asm_gen_sprite(const uint32_t planes, const uint32_t size) {
+    asm_gen("sprite:\n    SPRITE 0x%x", planes);
+
+    for (uint32_t y = 0; y < size; y++) {
+        asm_gen(", \"");
+        for (uint32_t x = 0; x < size; x++) {
+            // Only colors made of the selected bitplanes
+            uint32_t color = ((x + y) / 2) % 16;
+            while (color & ~planes)
+                color = (color + 1) % 16;
+            asm_gen("%x", color);
+        }
+        asm_gen("\"");
+    }
+    asm_gen("\n");
+}
+
+// <count> sprites at random positions per frame
+static void asm_gen_draw(const asm_stress *stress) {
+    const uint32_t size = stress->hires ? 16 : 8;
+
+    asm_gen("; %u %ux%u sprites per frame on bitplanes 0x%x%s\n\n",
+            stress->count, size, size, stress->planes,
+            stress->hires ? ", hires" : "");
+    if (stress->hires)
+        asm_gen("    HIGH\n");
+    if (stress->planes != 1)
+        asm_gen("    PLANE 0x%x\n", stress->planes);
+    asm_gen("    LD I, sprite\n");
+
+    asm_gen_frame_start();
+    asm_gen("    LD V2, %u\n"
+            "draw:\n"
+            "    RND V0, 0x7f\n"
+            "    RND V1, 0x3f\n"
+            "    DRW V0, V1, %u\n"
+            "    ADD V2, -1\n"
+            "    SE V2, 0\n"
+            "    JP draw\n",
+            stress->count, stress->hires ? 0 : size);
+    asm_gen_frame_end();
+
+    asm_gen_sprite(stress->planes, size);
+}
+
+// <count> scrolls per frame, all directions in turn, drawing a sprite
+// before each, so there is something to move
+static void asm_gen_scroll(const asm_stress *stress) {
+    asm_gen("; %u scrolls per frame\n\n"
+            "    HIGH\n"
+            "    LD I, sprite\n",
+            stress->count);
+
+    asm_gen_frame_start();
+    for (uint32_t i = 0; i < stress->count; i++) {
+        static const char *scrolls[] = {"SCD 1", "SCR", "SCU 1", "SCL"};
+
+        // Scrolling up is XO-CHIP only, down again instead
+        const char *scroll = scrolls[i % 4];
+        if (i % 4 == 2 && !(extensions & ASM_XOCHIP))
+            scroll = "SCD 2";
+
+        asm_gen("    RND V0, 0x7f\n"
+                "    RND V1, 0x3f\n"
+                "    DRW V0, V1, 8\n"
+                "    %s\n",
+                scroll);
+    }
+    asm_gen_frame_end();
+
+    asm_gen_sprite(1, 8);
+}
+
+// <count> arithmetic instructions in a loop, as fast as possible
+static void asm_gen_alu(const asm_stress *stress) {
+    static const char *ops[] = {"ADD", "OR", "SUB", "XOR", "SUBN", "AND"};
+
+    asm_gen("; %u arithmetic instructions per iteration\n\n"
+            "    LD V0, 0x5a\n"
+            "loop:\n",
+            stress->count);
+
+    // Each result feeds the next instruction, V0 to VE (VF gets the flags)
+    for (uint32_t i = 0; i < stress->count; i++) {
+        const uint32_t x = (i + 1) % 15;
+        const uint32_t y = i % 15;
+
+        switch (i % 8) {
+        case 6:
+            asm_gen("    SHR V%X, V%X\n", x, y);
+            break;
+        case 7:
+            asm_gen("    ADD V%X, 0x%02x\n", x, (i * 37 + 11) & 0xff);
+            break;
+        default:
+            asm_gen("    %s V%X, V%X\n", ops[i % 8], x, y);
+            break;
+        }
+    }
+
+    asm_gen("    JP loop\n");
+}
+
+// Copy <count> bytes from 'source' to 'target' in a loop, 8 bytes (V0-V7)
+// at a time, one loop per 256 bytes
+static void asm_gen_copy(const asm_stress *stress) {
+    asm_gen("; Copy %u bytes per iteration\n\n"
+            "target = source + %u\n\n"
+            "copy:\n",
+            stress->count, stress->count);
+
+    for (uint32_t page = 0; page * 256 < stress->count; page++) {
+        const uint32_t size = stress->count - page * 256 < 256
+                                  ? stress->count - page * 256
+                                  : 256;
+
+        asm_gen("    LD V8, 0\n"
+                "page_%u:\n"
+                "    LD I, source + %u\n"
+                "    ADD I, V8\n"
+                "    LD V7, [I]\n"
+                "    LD I, target + %u\n"
+                "    ADD I, V8\n"
+                "    LD [I], V7\n"
+                "    ADD V8, 8\n"
+                "    SE V8, %u\n"
+                "    JP page_%u\n",
+                page, page * 256, page * 256, size & 0xff, page);
+    }
+
+    asm_gen("    JP copy\n\n"
+            "source:\n");
+    for (uint32_t i = 0; i < stress->count; i++)
+        asm_gen("%s%u%s", i % 16 == 0 ? "    DB " : ", ",
+                (i * 73 + 41) & 0xff,
+                i % 16 == 15 || i + 1 == stress->count ? "\n" : "");
+}
+
+// Generate the source of <stress> into 'generated'. Returns 0 on success.
+static uint32_t asm_generate(const asm_stress *stress) {
+    generated_size = 0;
+    asm_gen("; Generated by chip8_asm --stress\n\n");
+
+    switch (stress->kind) {
+    case ASM_STRESS_DRAW:
+        if (stress->count < 1 || stress->count > 255) {
+            fprintf(stderr, "draw: 1 to 255 sprites per frame\n");
+            return 1;
+        }
+        if (stress->planes != 1 && !(extensions & ASM_XOCHIP)) {
+            fprintf(stderr, "draw: Bitplanes need XO-CHIP (-m xh8)\n");
+            return 1;
+        }
+        if (stress->hires && !(extensions & ASM_SCHIP)) {
+            fprintf(stderr, "draw: Hires needs Super-CHIP (-m sh8)\n");
+            return 1;
+        }
+        asm_gen_draw(stress);
+        break;
+    case ASM_STRESS_SCROLL:
+        if (stress->count < 1 || stress->count > 128) {
+            fprintf(stderr, "scroll: 1 to 128 scrolls per frame\n");
+            return 1;
+        }
+        if (!(extensions & ASM_SCHIP)) {
+            fprintf(stderr, "scroll: Scrolling needs Super-CHIP (-m sh8)\n");
+            return 1;
+        }
+        asm_gen_scroll(stress);
+        break;
+    case ASM_STRESS_ALU:
+        if (stress->count < 1 || stress->count > 1024) {
+            fprintf(stderr, "alu: 1 to 1024 instructions per iteration\n");
+            return 1;
+        }
+        asm_gen_alu(stress);
+        break;
+    case ASM_STRESS_COPY:
+        // Source and target have to be reachable with LD I, <addr>
+        if (stress->count < 8 || stress->count > 1536 ||
+            stress->count % 8 != 0) {
+            fprintf(stderr, "copy: 8 to 1536 bytes, a multiple of 8\n");
+            return 1;
+        }
+        asm_gen_copy(stress);
+        break;
+    }
+
+    return 0;
+}
+
+// -------------
+
+static char *asm_read(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    char *text = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    for (;;) {
+        if (capacity - size < 4096) {
+            capacity = capacity * 2 + 4096;
+            char *grown = realloc(text, capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                free(text);
+                fclose(file);
+                return NULL;
+            }
+            text = grown;
+        }
+
+        const size_t read = fread(text + size, 1, capacity - size - 1, file);
+        size += read;
+        if (read == 0)
+            break;
+    }
+
+    fclose(file);
+    text[size] = '\0';
+
+    return text;
+}
+
+static void asm_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-m <mode>] [-o <rom>] <source>\n"
+            "       %s --stress <kind> [options] [-S] [-o <rom>]\n"
+            "  -m, --mode <mode>    ch8, sh8, c48, xh8 or any (default: by\n"
+            "                       extension of <rom>, like emu_chip8).\n"
+            "                       Instructions the platform doesn't have\n"
+            "                       are errors.\n"
+            "  -o, --output <rom>   Write the rom to <rom> (default: <source>\n"
+            "                       without '.asm', or with '.ch8')\n"
+            "      --stress <kind>  Generate a stress rom: draw, scroll, alu\n"
+            "                       or copy\n"
+            "  -n, --count <n>      Sprites (draw, default: 32) or scrolls\n"
+            "                       (scroll, default: 8) per frame,\n"
+            "                       instructions per loop (alu, default: 64)\n"
+            "                       or bytes copied per loop (copy, default:\n"
+            "                       1024)\n"
+            "      --planes <mask>  Bitplanes of the sprites (draw, XO-CHIP)\n"
+            "      --hires          128x64 and 16x16 sprites (draw)\n"
+            "  -S, --source         Print the generated source\n",
+            name, name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {"output", required_argument, NULL, 'o'},
+        {"stress", required_argument, NULL, 's'},
+        {"count", required_argument, NULL, 'n'},
+        {"planes", required_argument, NULL, 'p'},
+        {"hires", no_argument, NULL, 'H'},
+        {"source", no_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    const char *mode_name = NULL;
+    const char *out_path = NULL;
+    const char *stress_name = NULL;
+    asm_stress stress = {.count = 0, .planes = 1, .hires = 0};
+    uint8_t print_source = 0;
+    int option;
+
+    while ((option = getopt_long(argc, argv, "m:o:n:Sh", long_options,
+                                 NULL)) != -1) {
+        switch (option) {
+        case 'm':
+            mode_name = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 's':
+            stress_name = optarg;
+            break;
+        case 'n':
+            stress.count = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            stress.planes = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            stress.hires = 1;
+            break;
+        case 'S':
+            print_source = 1;
+            break;
+        default:
+            asm_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if ((stress_name == NULL) != (argc - optind == 1) ||
+        (stress_name != NULL && out_path == NULL && !print_source)) {
+        asm_usage(argv[0]);
+        return 2;
+    }
+
+    const char *source_path = stress_name == NULL ? argv[optind] : NULL;
+
+    // <name>.xo8.asm -> <name>.xo8, <name>.asm -> <name>.ch8
+    char default_path[4096];
+    if (out_path == NULL && source_path != NULL) {
+        const char *slash = strrchr(source_path, '/');
+        const char *base = slash != NULL ? slash + 1 : source_path;
+        const char *extension = strrchr(base, '.');
+        const size_t length = extension != NULL
+                                  ? (size_t)(extension - source_path)
+                                  : strlen(source_path);
+
+        // Keep an extension left over, i.e. for the mode
+        uint8_t has_extension = 0;
+        for (const char *c = base; c < source_path + length; c++)
+            has_extension |= *c == '.';
+
+        snprintf(default_path, sizeof(default_path), "%.*s%s", (int)length,
+                 source_path, has_extension ? "" : ".ch8");
+        out_path = default_path;
+
+        if (strcmp(out_path, source_path) == 0) {
+            fprintf(stderr, "Refusing to overwrite %s, use -o\n",
+                    source_path);
+            return 2;
+        }
+    }
+
+    // Same defaults as emu_chip8
+    if (mode_name == NULL) {
+        const char *extension =
+            out_path != NULL ? strrchr(out_path, '.') : NULL;
+        mode_name = "any";
+        if (extension != NULL && strcmp(extension, ".sc8") == 0)
+            mode_name = "sh8";
+        else if (extension != NULL && strcmp(extension, ".xo8") == 0)
+            mode_name = "xh8";
+    }
+
+    uint32_t mode_index;
+    for (mode_index = 0; mode_index < sizeof(asm_modes) / sizeof(*asm_modes);
+         mode_index++) {
+        if (strcmp(asm_modes[mode_index].name, mode_name) == 0)
+            break;
+    }
+    if (mode_index == sizeof(asm_modes) / sizeof(*asm_modes)) {
+        fprintf(stderr, "Invalid mode: %s\n", mode_name);
+        return 2;
+    }
+    extensions = asm_modes[mode_index].extensions;
+
+    char *source;
+    char name[64];
+
+    if (stress_name != NULL) {
+        uint32_t i;
+        for (i = 0; i < sizeof(asm_stresses) / sizeof(*asm_stresses); i++) {
+            if (strcmp(asm_stresses[i].name, stress_name) == 0)
+                break;
+        }
+        if (i == sizeof(asm_stresses) / sizeof(*asm_stresses)) {
+            fprintf(stderr, "Invalid stress rom: %s\n", stress_name);
+            return 2;
+        }
+
+        stress.kind = asm_stresses[i].kind;
+        if (stress.count == 0)
+            stress.count = asm_stresses[i].count;
+        if (stress.planes < 1 || stress.planes > 15) {
+            fprintf(stderr, "Invalid bitplanes: 0x%x\n", stress.planes);
+            return 2;
+        }
+
+        if (asm_generate(&stress) != 0)
+            return 2;
+
+        source = generated;
+        snprintf(name, sizeof(name), "<stress %s>", stress_name);
+        source_path = name;
+
+        if (print_source)
+            fputs(source, stdout);
+        if (out_path == NULL)
+            return 0;
+    } else {
+        source = asm_read(source_path);
+        if (source == NULL)
+            return 1;
+    }
+
+    if (asm_assemble(source, source_path) != 0)
+        return 1;
+
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", out_path, strerror(errno));
+        return 1;
+    }
+
+    const size_t size = rom_end - CHIP8_MEM_OFFSET;
+    const uint8_t failed = fwrite(rom + CHIP8_MEM_OFFSET, 1, size, out) != size;
+    if (fclose(out) != 0 || failed) {
+        fprintf(stderr, "Failed to write %s: %s\n", out_path, strerror(errno));
+        return 1;
+    }
+
+    fprintf(stderr, "%s: %zu bytes (mode %s)\n", out_path, size, mode_name);
+
+    return 0;
+}
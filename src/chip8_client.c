@@ -0,0 +1,242 @@
+// Minimal client for the session server (see server.h). Draws the screen
+// into the terminal and forwards key presses.
+//
+// Usage: chip8_client <socket> [session id]
+
+#include "server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Terminals don't report key releases, so keys are released after a while
+#define CLIENT_KEY_HOLD_NSEC 150000000ull
+#define CLIENT_BUFFER_SIZE (64 * 1024)
+
+static const char client_keymap[16] = {'1', '2', '3', '4', 'q', 'w',
+                                       'e', 'r', 'a', 's', 'd', 'f',
+                                       'z', 'x', 'c', 'v'};
+
+static uint8_t screen[CHIP8_SERVER_MAX_HEIGHT][CHIP8_SERVER_MAX_WIDTH];
+static uint8_t screen_width = 0;
+static uint8_t screen_height = 0;
+
+static uint64_t key_release[16];
+static struct termios term_original;
+static int term_is_raw = 0;
+
+static uint64_t bytes_received = 0;
+static uint32_t frames_received = 0;
+
+static uint64_t client_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void client_term_restore(void) {
+    if (term_is_raw)
+        tcsetattr(STDIN_FILENO, TCSANOW, &term_original);
+    printf("\033[?25h\n");
+}
+
+static void client_term_raw(void) {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &term_original) != 0)
+        return;
+
+    struct termios raw = term_original;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    term_is_raw = 1;
+}
+
+static void client_draw(uint32_t session, uint32_t frame) {
+    static char line[CHIP8_SERVER_MAX_WIDTH + 2];
+
+    printf("\033[H\033[?25lsession %u, frame %u, %u updates, %llu bytes\n",
+           session, frame, frames_received,
+           (unsigned long long)bytes_received);
+
+    for (uint32_t y = 0; y < screen_height; y++) {
+        for (uint32_t x = 0; x < screen_width; x++)
+            line[x] = screen[y][x] ? '#' : ' ';
+        line[screen_width] = '\n';
+        line[screen_width + 1] = '\0';
+        fputs(line, stdout);
+    }
+
+    fflush(stdout);
+}
+
+static const int client_send_key(int fd, uint8_t key, uint8_t state) {
+    const uint8_t message[3] = {CHIP8_SERVER_MSG_KEY, key, state};
+    return send(fd, message, sizeof(message), MSG_NOSIGNAL) ==
+           sizeof(message);
+}
+
+// Handle all complete messages in <buffer>, returns the number of
+// consumed bytes (or -1 if the session has ended)
+static ssize_t client_parse(const uint8_t *buffer, size_t size,
+                            uint32_t *session) {
+    size_t offset = 0;
+
+    while (offset < size) {
+        const uint8_t *message = buffer + offset;
+        const size_t available = size - offset;
+
+        if (message[0] == CHIP8_SERVER_MSG_FRAME) {
+            if (available < CHIP8_SERVER_FRAME_HEADER_SIZE)
+                break;
+
+            const uint32_t frame = message[1] | (message[2] << 8) |
+                                   (message[3] << 16) |
+                                   ((uint32_t)message[4] << 24);
+            const uint16_t payload_size = message[7] | (message[8] << 8);
+            if (available < CHIP8_SERVER_FRAME_HEADER_SIZE + payload_size)
+                break;
+
+            if (message[5] != screen_width || message[6] != screen_height)
+                printf("\033[2J");
+            screen_width = message[5];
+            screen_height = message[6];
+
+            const uint8_t *payload = message + CHIP8_SERVER_FRAME_HEADER_SIZE;
+            for (size_t i = 0; i < payload_size;) {
+                const uint8_t row = payload[i++];
+                for (uint32_t x = 0; x < screen_width; x += payload[i], i += 2)
+                    memset(&screen[row][x], payload[i + 1], payload[i]);
+            }
+
+            frames_received++;
+            client_draw(*session, frame);
+            offset += CHIP8_SERVER_FRAME_HEADER_SIZE + payload_size;
+        } else {
+            if (available < 5)
+                break;
+
+            const uint32_t id = message[1] | (message[2] << 8) |
+                                (message[3] << 16) |
+                                ((uint32_t)message[4] << 24);
+            offset += 5;
+
+            switch (message[0]) {
+            case CHIP8_SERVER_MSG_SESSION:
+                *session = id;
+                printf("\033[2J");
+                break;
+            case CHIP8_SERVER_MSG_ERROR:
+                fprintf(stderr, "No such session: %u\n", id);
+                return -1;
+            case CHIP8_SERVER_MSG_STOPPED:
+                fprintf(stderr, "Session %u has stopped\n", id);
+                return -1;
+            default:
+                fprintf(stderr, "Unknown message: 0x%02x\n", message[0]);
+                return -1;
+            }
+        }
+    }
+
+    return offset;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t buffer[CLIENT_BUFFER_SIZE];
+    size_t buffer_size = 0;
+    uint32_t session = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <socket> [session id]\n", argv[0]);
+        return 2;
+    }
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Failed to connect to %s: %s\n", argv[1],
+                strerror(errno));
+        return 1;
+    }
+
+    if (argc > 2) {
+        const uint32_t id = strtoul(argv[2], NULL, 0);
+        const uint8_t message[5] = {CHIP8_SERVER_MSG_ATTACH, id & 0xff,
+                                    (id >> 8) & 0xff, (id >> 16) & 0xff,
+                                    (id >> 24) & 0xff};
+        send(fd, message, sizeof(message), MSG_NOSIGNAL);
+    } else {
+        const uint8_t message = CHIP8_SERVER_MSG_NEW;
+        send(fd, &message, 1, MSG_NOSIGNAL);
+    }
+
+    client_term_raw();
+    atexit(client_term_restore);
+
+    struct pollfd fds[2] = {
+        {.fd = fd, .events = POLLIN},
+        {.fd = STDIN_FILENO, .events = POLLIN},
+    };
+
+    for (;;) {
+        if (poll(fds, 2, 10) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t received = recv(fd, buffer + buffer_size,
+                                    sizeof(buffer) - buffer_size, 0);
+            if (received <= 0)
+                break;
+
+            bytes_received += received;
+            buffer_size += received;
+
+            ssize_t consumed = client_parse(buffer, buffer_size, &session);
+            if (consumed < 0)
+                break;
+
+            memmove(buffer, buffer + consumed, buffer_size - consumed);
+            buffer_size -= consumed;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char key;
+            if (read(STDIN_FILENO, &key, 1) != 1 || key == 0x1b)
+                break;
+
+            for (uint8_t i = 0; i < 16; i++) {
+                if (client_keymap[i] != key)
+                    continue;
+
+                if (key_release[i] == 0)
+                    client_send_key(fd, i, 1);
+                key_release[i] = client_now() + CLIENT_KEY_HOLD_NSEC;
+            }
+        }
+
+        const uint64_t now = client_now();
+        for (uint8_t i = 0; i < 16; i++) {
+            if (key_release[i] != 0 && key_release[i] <= now) {
+                client_send_key(fd, i, 0);
+                key_release[i] = 0;
+            }
+        }
+    }
+
+    close(fd);
+    return 0;
+}
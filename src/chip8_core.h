@@ -0,0 +1,791 @@
+// Interpreter core template. This file is included once per platform mode
+// by chip8.c (no include guard on purpose), with the following parameters:
+//
+//   CORE_NAME              Suffix for the generated functions:
+//                          chip8_core_<name>_step / chip8_core_<name>_run /
+//                          chip8_core_<name>_run_decoded
+//   CORE_MODE              CHIP8_MODE_* token, used for the debug output
+//   CORE_SCHIP             Super-CHIP instructions (hires, scrolling, exit)
+//   CORE_XOCHIP            XO-CHIP instructions (bitplanes, F000 NNNN, ...)
+//   CORE_FLAGS             FX75/FX85 use the flag registers
+//   CORE_QUIRK_SHIFT       8XY6/8XYE shift Vx in place (instead of Vy)
+//   CORE_QUIRK_LOAD_STORE  FX55/FX65 leave I unchanged (instead of I+x+1)
+//   CORE_QUIRK_WRAP        Sprites wrap around the screen (instead of clip)
+//
+// Everything a mode doesn't need is removed by the preprocessor, so each
+// core only pays for its own opcodes and quirks.
+
+#define CORE_CONCAT_(a, b, c) a##b##c
+#define CORE_CONCAT(a, b, c) CORE_CONCAT_(a, b, c)
+#define CORE_STEP CORE_CONCAT(chip8_core_, CORE_NAME, _step)
+#define CORE_RUN CORE_CONCAT(chip8_core_, CORE_NAME, _run)
+#define CORE_DECODE CORE_CONCAT(chip8_core_, CORE_NAME, _decode)
+#define CORE_RUN_DECODED CORE_CONCAT(chip8_core_, CORE_NAME, _run_decoded)
+
+// Skip the next instruction. The XO-CHIP 'F000 NNNN' instruction is
+// 4 bytes long and has to be skipped as a whole.
+#if CORE_XOCHIP
+#define CORE_SKIP(condition)                                                   \
+    do {                                                                       \
+        if ((condition))                                                       \
+            machine->pc +=                                                     \
+                MEM_GET_WORD(machine->pc + 2) == 0xf000 ? 6 : 4;               \
+        else                                                                   \
+            machine->pc += 2;                                                  \
+    } while (0)
+#else
+#define CORE_SKIP(condition)                                                   \
+    do {                                                                       \
+        machine->pc += (condition) ? 4 : 2;                                    \
+    } while (0)
+#endif
+
+static inline const int32_t CORE_STEP(void) {
+    uint16_t optcode = MEM_GET_WORD(machine->pc);
+
+    // 12-bit address
+    uint16_t nnn = optcode & 0x0fff;
+    // 8-bit constant
+    uint8_t kk = optcode & 0x00ff;
+    // 4-bit constant
+    uint8_t n = optcode & 0x000f;
+    // 4-bit register index (high bits)
+    uint8_t y = (optcode >> 4) & 0x000f;
+    // 4-bit register index (low bits)
+    uint8_t x = (optcode >> 8) & 0x000f;
+
+    // ref: http://devernay.free.fr/hacks/chip8/schip.txt
+    // xo:
+    // http://johnearnest.github.io/Octo/docs/XO-ChipSpecification.html
+    switch (optcode & 0xf000) {
+    case 0x0000:
+#if CORE_SCHIP
+        if (x == 0 && y == 0xc) {
+            print_opt("SCRD", "Scroll screen down by n pixels", n,
+                    CHIP8_MODE_SC8);
+            CHIP8_screen_scroll(n, CHIP8_SCROLL_DOWN);
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+        }
+#endif
+#if CORE_XOCHIP
+        if (x == 0 && y == 0xd) {
+            print_opt("SCRU", "Scroll screen up by n pixels", n,
+                    CHIP8_MODE_XC8);
+            CHIP8_screen_scroll(n, CHIP8_SCROLL_UP);
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+        }
+#endif
+        switch (kk) {
+        case 0xe0:
+            print_opt("CLS", "Clear the screen", none, CHIP8_MODE_CH8);
+            memset(machine->screen, 0, sizeof(machine->screen));
+            machine->screen_dirty = 0;
+            machine->screen_rows_updated = UINT64_MAX;
+            if (machine->recorder != NULL)
+                CHIP8_recorder_screen();
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+        case 0xee:
+            print_opt("RET", "Return from subroutine", none, CHIP8_MODE_CH8);
+            machine->pc = machine->stack[--(machine->sp)];
+            break;
+#if CORE_SCHIP
+        case 0xfb:
+            print_opt("SCRR", "Scroll right by 4 pixels", none, CHIP8_MODE_SC8);
+            CHIP8_screen_scroll(4, CHIP8_SCROLL_RIGHT);
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+        case 0xfc:
+            print_opt("SCRL", "Scroll left by 4 pixels", none, CHIP8_MODE_SC8);
+            CHIP8_screen_scroll(4, CHIP8_SCROLL_LEFT);
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+        case 0xfe:
+            print_opt("NSUPER", "Disable extended mode", none, CHIP8_MODE_SC8);
+            machine->screen_width = CHIP8_SCREEN_WIDTH;
+            machine->screen_height = CHIP8_SCREEN_HEIGHT;
+            machine->screen_is_hires = 0;
+            machine->screen_rows_updated = UINT64_MAX;
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+        case 0xfd:
+            print_opt("EXIT", "Exit the program", none, CHIP8_MODE_SC8);
+            return 2;
+            break;
+        case 0xff:
+            print_opt("SUPER", "Enable extended mode", none, CHIP8_MODE_SC8);
+            machine->screen_width = CHIP8_SCREEN_WIDTH_HIRES;
+            machine->screen_height = CHIP8_SCREEN_HEIGHT_HIRES;
+            machine->screen_is_hires = 1;
+            machine->screen_rows_updated = UINT64_MAX;
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+#endif
+        default:
+            goto invalid_optcode;
+        }
+        break;
+    case 0x1000:
+        print_opt("JP", "Jump to location nnn", nnn, CHIP8_MODE_CH8);
+        machine->pc = nnn;
+        break;
+    case 0x2000:
+        print_opt("CALL", "Call subroutine at nnn", nnn, CHIP8_MODE_CH8);
+        machine->stack[(machine->sp)++] = machine->pc + 2;
+        machine->pc = nnn;
+        break;
+    case 0x3000:
+        print_opt("SE", "Skip next instruction if Vx = kk", xkk,
+                  CHIP8_MODE_CH8);
+        CORE_SKIP(machine->reg[x] == kk);
+        break;
+    case 0x4000:
+        print_opt("SNE", "Skip next instruction if Vx != kk", xkk,
+                  CHIP8_MODE_CH8);
+        CORE_SKIP(machine->reg[x] != kk);
+        break;
+    case 0x5000:
+        switch (n) {
+        case 0:
+            print_opt("SER", "Skip next instruction if Vx = Vy", xy,
+                      CHIP8_MODE_CH8);
+            CORE_SKIP(machine->reg[x] == machine->reg[y]);
+            break;
+#if CORE_XOCHIP
+        case 2:
+            print_opt("SAVER", "Save an inclusive range of registers to memory",
+                      xy, CHIP8_MODE_XC8);
+            for (uint8_t i = x; i < y; i++)
+                CHIP8_MEM_WRITE(machine, machine->index_reg + i,
+                                machine->reg[i]);
+            if (machine->recorder != NULL && x < y)
+                CHIP8_recorder_store(machine->index_reg + x, y - x);
+            machine->mem_writes++;
+            machine->pc += 2;
+            break;
+        case 3:
+            print_opt("LOADR",
+                      "Load an inclusive range of registers from memory", xy,
+                      CHIP8_MODE_XC8);
+            for (uint8_t i = x; i < y; i++)
+                machine->reg[i] = machine->mem[machine->index_reg + i];
+            machine->pc += 2;
+            break;
+#endif
+        default:
+            goto invalid_optcode;
+        }
+        break;
+    case 0x6000:
+        print_opt("LD", "Set Vx = kk", xkk, CHIP8_MODE_CH8);
+        machine->reg[x] = kk;
+        machine->pc += 2;
+        break;
+    case 0x7000:
+        print_opt("ADD", "Set Vx = Vx + kk", xkk, CHIP8_MODE_CH8);
+        machine->reg[x] += kk;
+        machine->pc += 2;
+        break;
+    case 0x8000:
+        switch (n) {
+        case 0x00:
+            print_opt("LDR", "Set Vx = Vy", xy, CHIP8_MODE_CH8);
+            machine->reg[x] = machine->reg[y];
+            break;
+        case 0x01:
+            print_opt("OR", "Set Vx = Vx OR Vy", xy, CHIP8_MODE_CH8);
+            machine->reg[x] |= machine->reg[y];
+            break;
+        case 0x02:
+            print_opt("AND", "Set Vx = Vx AND Vy", xy, CHIP8_MODE_CH8);
+            machine->reg[x] &= machine->reg[y];
+            break;
+        case 0x03:
+            print_opt("XOR", "Set Vx = Vx XOR Vy", xy, CHIP8_MODE_CH8);
+            machine->reg[x] ^= machine->reg[y];
+            break;
+        case 0x04:
+            print_opt("ADDR", "Set Vx = Vx + Vy. Set VF on carry", xy,
+                      CHIP8_MODE_CH8);
+            machine->reg[0xf] =
+                ((uint32_t)machine->reg[x] + (uint32_t)machine->reg[y]) > 255
+                    ? 1
+                    : 0;
+            machine->reg[x] += machine->reg[y];
+            break;
+        case 0x05:
+            print_opt("SUBY", "Set Vx = Vx - Vy. Set VF if Vy > Vx", xy,
+                      CHIP8_MODE_CH8);
+            machine->reg[0xf] = machine->reg[y] > machine->reg[x] ? 1 : 0;
+            machine->reg[x] = machine->reg[x] - machine->reg[y];
+            break;
+        case 0x06:
+#if CORE_QUIRK_SHIFT
+            print_opt("SHR", "Set Vx = Vx >> 1. Store rightmost bit in VF", x,
+                      CORE_MODE);
+            machine->reg[0xf] = machine->reg[x] & 0x1;
+            machine->reg[x] >>= 1;
+#else
+            print_opt("SHR", "Set Vx = Vy >> 1. Store rightmost bit in VF", xy,
+                      CORE_MODE);
+            machine->reg[0xf] = machine->reg[y] & 0x1;
+            machine->reg[x] = machine->reg[y] >> 1;
+#endif
+            break;
+        case 0x07:
+            print_opt("SUBX", "Set Vx = Vx - Vy. Set VF if Vx > Vy", xy,
+                      CHIP8_MODE_CH8);
+            machine->reg[0xf] = machine->reg[x] > machine->reg[y] ? 1 : 0;
+            machine->reg[x] = machine->reg[y] - machine->reg[x];
+            break;
+        case 0x0e:
+#if CORE_QUIRK_SHIFT
+            print_opt("SHL", "Set Vx = Vx << 1. Store leftmost bit in VF", x,
+                      CORE_MODE);
+            machine->reg[0x0f] = (machine->reg[x] >> 7) & 0x1;
+            machine->reg[x] <<= 1;
+#else
+            print_opt("SHL", "Set Vx = Vy << 1. Store leftmost bit in VF", xy,
+                      CORE_MODE);
+            machine->reg[0x0f] = (machine->reg[y] >> 7) & 0x1;
+            machine->reg[x] = machine->reg[y] << 1;
+#endif
+            break;
+        default:
+            goto invalid_optcode;
+        }
+        machine->pc += 2;
+        break;
+    case 0x9000:
+        if (n == 0) {
+            print_opt("SKRNE", "Skip next instruction if Vx != Vy", xy,
+                      CHIP8_MODE_CH8);
+            CORE_SKIP(machine->reg[x] != machine->reg[y]);
+        } else {
+            goto invalid_optcode;
+        }
+        break;
+    case 0xa000:
+        print_opt("LDI", "Set I = nnn", nnn, CHIP8_MODE_CH8);
+        machine->index_reg = nnn;
+        machine->pc += 2;
+        break;
+    case 0xb000:
+        print_opt("JPR", "Jump to location nnn + V0", nnn, CHIP8_MODE_CH8);
+        machine->pc = machine->reg[0x0] + nnn;
+        break;
+    case 0xc000:
+        print_opt("RND", "Set Vx = <random byte> AND kk", xkk, CHIP8_MODE_CH8);
+        machine->reg[x] = CHIP8_get_rand() & kk;
+        machine->pc += 2;
+        break;
+    case 0xd000:
+#if CORE_SCHIP
+        if (n == 0) {
+            print_opt("DRAW HI",
+                      "Draw 16x16 sprite starting at I"
+                      "(Vx, Vy), set VF = collision",
+                      xyn, CHIP8_MODE_SC8);
+            CHIP8_screen_draw(x, y, 0, CORE_QUIRK_WRAP);
+            machine->screen_update_status = 1;
+            machine->pc += 2;
+            break;
+        }
+#else
+        // 16x16 sprites are a Super-CHIP extension, DXY0 draws nothing
+        if (n == 0) {
+            machine->pc += 2;
+            break;
+        }
+#endif
+        print_opt("DRAW",
+                  "Draw 8xn sprite starting at I"
+                  "(Vx, Vy), set VF = collision",
+                  xyn, CHIP8_MODE_CH8);
+        CHIP8_screen_draw(x, y, n, CORE_QUIRK_WRAP);
+        machine->screen_update_status = 1;
+        machine->pc += 2;
+        break;
+    case 0xe000:
+        switch (kk) {
+        case 0x9e:
+            print_opt("SKP",
+                      "Skip next instruction if key of value Vx is pressed", x,
+                      CHIP8_MODE_CH8);
+            CORE_SKIP(machine->keys[machine->reg[x]] == CHIP8_KEY_PRESSED);
+            break;
+        case 0xa1:
+            print_opt("SKNP",
+                      "Skip next instruction if key of value Vx is released", x,
+                      CHIP8_MODE_CH8);
+            CORE_SKIP(machine->keys[machine->reg[x]] == CHIP8_KEY_RELEASED);
+            break;
+        }
+        break;
+    case 0xf000:
+#if CORE_XOCHIP
+        if (nnn == 0) {
+            print_opt("LDI EXT", "Set I to 16bit address", none,
+                      CHIP8_MODE_XH8);
+            machine->index_reg = MEM_GET_WORD(machine->pc + 2);
+            machine->pc += 4;
+            break;
+        } else if (kk == 1) {
+            print_opt("BITPLANE", "Set the bitplane to the value of x", x,
+                      CHIP8_MODE_XC8);
+            machine->screen_bitplane = x;
+            machine->pc += 2;
+            break;
+        }
+#endif
+        switch (kk) {
+#if CORE_XOCHIP
+        case 0x02:
+            print_opt("AUDIO STORE", "Store 16 bytes, starting at I, in the audio buffer", none, CHIP8_MODE_XC8);
+            print_warn("%s", "Not implemented");
+            machine->pc += 2;
+            break;
+#endif
+        case 0x07:
+            print_opt("LDT", "Set Vx = <delay timer value>", x, CHIP8_MODE_CH8);
+            machine->reg[x] = machine->timer;
+            machine->pc += 2;
+            break;
+        case 0x0A:
+            print_opt("LDK", "Wait for a keypress. Store its value in Vx", x,
+                      CHIP8_MODE_CH8);
+            for (uint8_t i = 0; i < CHIP8_KEYS; i++) {
+                if (machine->keys[i] == CHIP8_KEY_PRESSED) {
+                    CHIP8_input_set(i, CHIP8_KEY_RELEASED);
+                    machine->reg[x] = i;
+                    machine->pc += 2;
+                }
+            }
+            break;
+        case 0x15:
+            print_opt("LDDT", "Set <delay timer> = Vx", x, CHIP8_MODE_CH8);
+            machine->timer = machine->reg[x];
+            machine->pc += 2;
+            break;
+        case 0x18:
+            print_opt("LDS", "Set <sound timer> = Vx", x, CHIP8_MODE_CH8);
+            machine->timer_sound = machine->reg[x];
+            machine->pc += 2;
+            break;
+        case 0x1e:
+            print_opt("ADDI", "Set I = I + Vx", x, CHIP8_MODE_CH8);
+            machine->index_reg += machine->reg[x];
+            machine->pc += 2;
+            break;
+        case 0x29:
+            print_opt("LDF", "Set I = <location of font-sprite in Vx>", x,
+                      CHIP8_MODE_CH8);
+            machine->index_reg = CHIP8_FONTSET_OFFSET +
+                                 CHIP8_FONTSET_CHAR_SIZE * machine->reg[x];
+            machine->pc += 2;
+            break;
+#if CORE_SCHIP
+        case 0x30:
+            print_opt("LDF HIRES",
+                      "Set I = <location of hires font-sprite in Vx>", x,
+                      CHIP8_MODE_SC8);
+            machine->index_reg =
+                CHIP8_FONTSET_OFFSET_SUPER +
+                CHIP8_FONTSET_CHAR_SIZE_SUPER * machine->reg[x];
+            machine->pc += 2;
+            break;
+#endif
+        case 0x33:
+            print_opt("BCD",
+                      "Store BCD repesentation of Vx in memory "
+                      "locations I, I+1, I+2",
+                      x, CHIP8_MODE_CH8);
+            CHIP8_MEM_WRITE(machine, machine->index_reg,
+                            (machine->reg[x] % 1000) / 100);
+            CHIP8_MEM_WRITE(machine, machine->index_reg + 1,
+                            (machine->reg[x] % 100) / 10);
+            CHIP8_MEM_WRITE(machine, machine->index_reg + 2,
+                            (machine->reg[x] % 10) / 1);
+            if (machine->recorder != NULL)
+                CHIP8_recorder_store(machine->index_reg, 3);
+            machine->mem_writes++;
+            machine->pc += 2;
+            break;
+#if CORE_XOCHIP
+        case 0x3a:
+            print_opt("PITCH", "Set the audio pattern playback rate to 4000*2^((Vx-64)/48)Hz", x, CHIP8_MODE_XC8);
+            print_warn("%s", "Not implemented");
+            machine->pc += 2;
+            break;
+#endif
+        case 0x55:
+            print_opt("STORE",
+                      "Store registers V0 through Vx into adress I to I + x", x,
+                      CHIP8_MODE_CH8);
+            for (int i = 0; i < x + 1; i++)
+                CHIP8_MEM_WRITE(machine, machine->index_reg + i,
+                                machine->reg[i]);
+            if (machine->recorder != NULL)
+                CHIP8_recorder_store(machine->index_reg, x + 1);
+            machine->mem_writes++;
+#if !CORE_QUIRK_LOAD_STORE
+            machine->index_reg += x + 1;
+#endif
+            machine->pc += 2;
+            break;
+        case 0x65:
+            print_opt("READ",
+                      "Read registers V0 through Vx from memory "
+                      "starting at I",
+                      x, CHIP8_MODE_CH8);
+            for (int i = 0; i < x + 1; i++)
+                machine->reg[i] = machine->mem[machine->index_reg + i];
+#if !CORE_QUIRK_LOAD_STORE
+            machine->index_reg += x + 1;
+#endif
+            machine->pc += 2;
+            break;
+#if CORE_SCHIP
+        case 0x75:
+            print_opt("STOREF", "Read V0 to Vx into flag registers (0-7)", x,
+                      CHIP8_MODE_SC8);
+#if CORE_FLAGS
+            for (int i = 0; i < x + 1 && i < CHIP8_FLAG_REGISTERS; i++)
+                machine->flag_reg[i] = machine->reg[i];
+#else
+            log_warn("%s", "Not implemented");
+#endif
+            machine->pc += 2;
+            break;
+        case 0x85:
+            print_opt("READF", "Restore V0 to Vx from flag registers (0-7)", x,
+                      CHIP8_MODE_SC8);
+#if CORE_FLAGS
+            for (int i = 0; i < x + 1 && i < CHIP8_FLAG_REGISTERS; i++)
+                machine->reg[i] = machine->flag_reg[i];
+#else
+            log_warn("%s", "Not implemented");
+#endif
+            machine->pc += 2;
+            break;
+#endif
+        default:
+            goto invalid_optcode;
+        }
+        break;
+    default:
+        goto invalid_optcode;
+    }
+
+    return 0;
+
+invalid_optcode:
+    print_error("Invalid Optcode: 0x%04x [PC=0x%04x]", optcode, machine->pc);
+
+    return -1;
+}
+
+// Execute up to <cycles> instructions. Stops early on 'exit' or an invalid
+// instruction. <executed> receives the number of executed instructions.
+static const int32_t CORE_RUN(const uint32_t cycles, uint32_t *executed) {
+    int32_t status = 0;
+    uint32_t count = 0;
+
+    while (count < cycles) {
+        status = CORE_STEP();
+        if (status != 0)
+            break;
+        count++;
+    }
+
+    // 'exit' has been executed, an invalid instruction has not
+    if (status == 2)
+        count++;
+
+    machine->cycles += count;
+    if (executed != NULL)
+        *executed = count;
+
+    return status;
+}
+
+// Word at <address>, 0 (an invalid instruction) past the end of memory
+#define CORE_DECODE_WORD(address)                                              \
+    ((uint32_t)(address) + 1 < CHIP8_MEM_SIZE ? MEM_GET_WORD(address) : 0)
+
+// Distance a taken skip at <address> moves pc by, see CORE_SKIP
+#if CORE_XOCHIP
+#define CORE_DECODE_SKIP(address)                                              \
+    (CORE_DECODE_WORD((address) + 2) == 0xf000 ? 6 : 4)
+#else
+#define CORE_DECODE_SKIP(address) 4
+#endif
+
+// Decode the instruction at <address>, fusing it with the following ones
+// where possible
+static void CORE_DECODE(CHIP8_decoded *entry, const uint32_t address) {
+    const uint16_t optcode = CORE_DECODE_WORD(address);
+    const uint16_t next = CORE_DECODE_WORD(address + 2);
+
+    memset(entry, 0, sizeof(*entry));
+    entry->op = DECODED_STEP;
+    entry->count = 1;
+    entry->x = (optcode >> 8) & 0x000f;
+    entry->y = (optcode >> 4) & 0x000f;
+    entry->n = optcode & 0x000f;
+    entry->kk = optcode & 0x00ff;
+    entry->nnn = optcode & 0x0fff;
+
+    switch (optcode & 0xf000) {
+    case 0x1000:
+        entry->op = DECODED_JP;
+        break;
+    case 0x3000:
+    case 0x4000:
+        entry->op = (optcode & 0xf000) == 0x3000 ? DECODED_SE : DECODED_SNE;
+        entry->skip = CORE_DECODE_SKIP(address);
+        break;
+#if CORE_XOCHIP
+    case 0x5000:
+        if (entry->n == 2)
+            entry->op = DECODED_STORE;
+        break;
+#endif
+    case 0x6000:
+        entry->op = DECODED_LD;
+        while (entry->count < DECODED_MAX_LD_RUN &&
+               (CORE_DECODE_WORD(address + 2 * entry->count) & 0xf000) ==
+                   0x6000)
+            entry->count++;
+        if (entry->count > 1)
+            entry->op = DECODED_LD_RUN;
+        break;
+    case 0x7000:
+        entry->op = DECODED_ADD;
+        if ((next & 0xf000) != 0x3000 && (next & 0xf000) != 0x4000)
+            break;
+
+        // Loop counters: 'ADD, SE/SNE' and 'ADD, SE/SNE, JP'
+        entry->y = (next >> 8) & 0x000f;
+        entry->kk2 = next & 0x00ff;
+        entry->skip = CORE_DECODE_SKIP(address + 2);
+        entry->count = 2;
+        if ((CORE_DECODE_WORD(address + 4) & 0xf000) == 0x1000) {
+            entry->nnn = CORE_DECODE_WORD(address + 4) & 0x0fff;
+            entry->count = 3;
+            entry->op = (next & 0xf000) == 0x3000 ? DECODED_ADD_SE_JP
+                                                  : DECODED_ADD_SNE_JP;
+        } else {
+            entry->op =
+                (next & 0xf000) == 0x3000 ? DECODED_ADD_SE : DECODED_ADD_SNE;
+        }
+        break;
+    case 0xa000:
+        entry->op = DECODED_LDI;
+        // Without Super-CHIP, DXY0 draws nothing
+        if ((next & 0xf000) == 0xd000 && (CORE_SCHIP || (next & 0x000f) != 0)) {
+            entry->x = (next >> 8) & 0x000f;
+            entry->y = (next >> 4) & 0x000f;
+            entry->n = next & 0x000f;
+            entry->count = 2;
+            entry->op = DECODED_LDI_DRAW;
+        }
+        break;
+    case 0xf000:
+        if (entry->kk == 0x33 || entry->kk == 0x55) {
+            entry->op = DECODED_STORE;
+        } else if (entry->kk == 0x1e) {
+            entry->op = DECODED_ADDI;
+            if ((next & 0xf0ff) == 0xf065) {
+                entry->y = (next >> 8) & 0x000f;
+                entry->count = 2;
+                entry->op = DECODED_ADDI_READ;
+            }
+        }
+        break;
+    }
+
+    // Breakpoints stop before their instruction, nothing is fused across
+    if (machine->debugger != NULL) {
+        if (CHIP8_debugger_has_breakpoint(address, address + 1)) {
+            entry->op = DECODED_BREAK;
+            entry->count = 1;
+        } else if (entry->count > 1 &&
+                   CHIP8_debugger_has_breakpoint(address + 2,
+                                                 address + 2 * entry->count)) {
+            entry->op = DECODED_STEP;
+            entry->count = 1;
+        }
+    }
+}
+
+// Like CORE_RUN, with predecoded instructions (CHIP8_ENGINE_PREDECODED).
+// Superinstructions only run if all of their instructions fit into the
+// remaining cycles, so frames end on the same instruction.
+static const int32_t CORE_RUN_DECODED(const uint32_t cycles,
+                                      uint32_t *executed) {
+    CHIP8_decoded *decoded = CHIP8_decoded_sync();
+    int32_t status = 0;
+    uint32_t count = 0;
+
+    while (count < cycles) {
+        const CHIP8_decoded *entry = &decoded[machine->pc];
+        if (entry->op == DECODED_NONE)
+            CORE_DECODE(&decoded[machine->pc], machine->pc);
+
+        if (entry->count > cycles - count) {
+            status = CORE_STEP();
+            if (status != 0)
+                break;
+            count++;
+            continue;
+        }
+
+        switch (entry->op) {
+        case DECODED_JP:
+            machine->pc = entry->nnn;
+            break;
+        case DECODED_SE:
+            machine->pc +=
+                machine->reg[entry->x] == entry->kk ? entry->skip : 2;
+            break;
+        case DECODED_SNE:
+            machine->pc +=
+                machine->reg[entry->x] != entry->kk ? entry->skip : 2;
+            break;
+        case DECODED_LD:
+            machine->reg[entry->x] = entry->kk;
+            machine->pc += 2;
+            break;
+        case DECODED_ADD:
+            machine->reg[entry->x] += entry->kk;
+            machine->pc += 2;
+            break;
+        case DECODED_LDI:
+            machine->index_reg = entry->nnn;
+            machine->pc += 2;
+            break;
+        case DECODED_ADDI:
+            machine->index_reg += machine->reg[entry->x];
+            machine->pc += 2;
+            break;
+        case DECODED_LD_RUN:
+            for (uint32_t i = 0; i < entry->count; i++) {
+                const uint16_t optcode = MEM_GET_WORD(machine->pc);
+                machine->reg[(optcode >> 8) & 0x000f] = optcode & 0x00ff;
+                machine->pc += 2;
+            }
+            count += entry->count - 1;
+            break;
+        case DECODED_LDI_DRAW:
+            machine->index_reg = entry->nnn;
+            CHIP8_screen_draw(entry->x, entry->y, entry->n, CORE_QUIRK_WRAP);
+            machine->screen_update_status = 1;
+            machine->pc += 4;
+            count++;
+            break;
+        case DECODED_ADDI_READ:
+            machine->index_reg += machine->reg[entry->x];
+            for (int i = 0; i < entry->y + 1; i++)
+                machine->reg[i] = machine->mem[machine->index_reg + i];
+#if !CORE_QUIRK_LOAD_STORE
+            machine->index_reg += entry->y + 1;
+#endif
+            machine->pc += 4;
+            count++;
+            break;
+        case DECODED_ADD_SE:
+        case DECODED_ADD_SNE:
+            machine->reg[entry->x] += entry->kk;
+            if ((machine->reg[entry->y] == entry->kk2) ==
+                (entry->op == DECODED_ADD_SE))
+                machine->pc += 2 + entry->skip;
+            else
+                machine->pc += 4;
+            count++;
+            break;
+        case DECODED_ADD_SE_JP:
+        case DECODED_ADD_SNE_JP:
+            machine->reg[entry->x] += entry->kk;
+            if ((machine->reg[entry->y] == entry->kk2) ==
+                (entry->op == DECODED_ADD_SE_JP)) {
+                machine->pc += 2 + entry->skip;
+                count++;
+            } else {
+                machine->pc = entry->nnn;
+                count += 2;
+            }
+            break;
+        case DECODED_STORE: {
+            // Stores write at most 16 bytes, starting at I
+            const uint32_t index = machine->index_reg;
+            status = CORE_STEP();
+            CHIP8_decoded_invalidate(index, index + CHIP8_REGISTERS);
+
+            // Stops after the store
+            if (status == 0 && machine->debugger != NULL &&
+                CHIP8_debugger_stored(index)) {
+                status = CHIP8_DEBUGGER_STATUS;
+                count++;
+            }
+            break;
+        }
+        case DECODED_BREAK: {
+            if (CHIP8_debugger_break()) {
+                status = CHIP8_DEBUGGER_STATUS;
+                break;
+            }
+
+            const uint32_t index = machine->index_reg;
+            const uint32_t writes = machine->mem_writes;
+            status = CORE_STEP();
+            if (machine->mem_writes == writes)
+                break;
+
+            CHIP8_decoded_invalidate(index, index + CHIP8_REGISTERS);
+            if (status == 0 && CHIP8_debugger_stored(index)) {
+                status = CHIP8_DEBUGGER_STATUS;
+                count++;
+            }
+            break;
+        }
+        case DECODED_STEP:
+        default:
+            status = CORE_STEP();
+            break;
+        }
+
+        if (status != 0)
+            break;
+        count++;
+    }
+
+    // 'exit' has been executed, an invalid instruction has not
+    if (status == 2)
+        count++;
+
+    machine->cycles += count;
+    if (executed != NULL)
+        *executed = count;
+
+    return status;
+}
+
+#undef CORE_DECODE_SKIP
+#undef CORE_DECODE_WORD
+#undef CORE_RUN_DECODED
+#undef CORE_DECODE
+#undef CORE_SKIP
+#undef CORE_RUN
+#undef CORE_STEP
+#undef CORE_CONCAT
+#undef CORE_CONCAT_
@@ -0,0 +1,470 @@
+// Queries on a recording of the emulator (see recorder.h), i.e. which
+// instruction last wrote an address, or last changed a pixel, before
+// instruction N. The file is mapped, and only its chunk offsets are read
+// up front. A query finds the block of instruction N by binary search and
+// walks back from there, skipping every block whose filter rules out the
+// address (or row).
+//
+// Usage: chip8_history <recording> [<query>]
+//
+// Without a query, queries are read from stdin, one per line.
+
+#include "recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HISTORY_MAX_ARGS 4
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    const CHIP8_recorder_header *header;
+
+    // Chunks of each type, in order
+    const CHIP8_recorder_block **mem;
+    const CHIP8_recorder_block **screen;
+    const CHIP8_recorder_snapshot **snapshots;
+    uint32_t mem_count;
+    uint32_t screen_count;
+    uint32_t snapshot_count;
+
+    uint64_t records;
+} history;
+
+// Blocks looked at (filter checked) and scanned (records read) by the last
+// query
+static uint32_t blocks_checked = 0;
+static uint32_t blocks_scanned = 0;
+
+static uint64_t history_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static const void **history_append(const void **list, uint32_t *count,
+                                   const void *entry) {
+    // Grows in powers of two
+    if ((*count & (*count - 1)) == 0) {
+        const void **grown =
+            realloc(list, (*count == 0 ? 1 : *count * 2) * sizeof(*list));
+        if (grown == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        list = grown;
+    }
+
+    list[(*count)++] = entry;
+    return list;
+}
+
+static const uint32_t history_open(history *h, const char *path) {
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    memset(h, 0, sizeof(*h));
+    h->size = st.st_size;
+
+    if (h->size < sizeof(CHIP8_recorder_header)) {
+        fprintf(stderr, "%s: Not a recording\n", path);
+        close(fd);
+        return 1;
+    }
+
+    h->data = mmap(NULL, h->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (h->data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    h->header = (const CHIP8_recorder_header *)h->data;
+    if (memcmp(h->header->magic, CHIP8_RECORDER_MAGIC,
+               sizeof(CHIP8_RECORDER_MAGIC)) != 0 ||
+        h->header->version != CHIP8_RECORDER_VERSION) {
+        fprintf(stderr, "%s: Not a recording (or of another version)\n",
+                path);
+        return 1;
+    }
+
+    size_t offset = sizeof(CHIP8_recorder_header);
+    while (offset < h->size) {
+        const CHIP8_recorder_chunk *chunk =
+            (const CHIP8_recorder_chunk *)(h->data + offset);
+        const uint8_t *body = h->data + offset + sizeof(*chunk);
+
+        // The emulator stopped while writing this chunk
+        if (h->size - offset < sizeof(*chunk) ||
+            h->size - offset - sizeof(*chunk) < chunk->size) {
+            fprintf(stderr, "%s: Truncated at offset %zu, ignoring the rest\n",
+                    path, offset);
+            break;
+        }
+
+        switch (chunk->type) {
+        case CHIP8_RECORDER_CHUNK_MEM:
+        case CHIP8_RECORDER_CHUNK_SCREEN: {
+            const CHIP8_recorder_block *block =
+                (const CHIP8_recorder_block *)body;
+            if (chunk->size < sizeof(*block) ||
+                chunk->size !=
+                    sizeof(*block) + block->count * sizeof(CHIP8_record)) {
+                fprintf(stderr, "%s: Invalid block at offset %zu\n", path,
+                        offset);
+                return 1;
+            }
+
+            if (chunk->type == CHIP8_RECORDER_CHUNK_MEM)
+                h->mem = (const CHIP8_recorder_block **)history_append(
+                    (const void **)h->mem, &h->mem_count, block);
+            else
+                h->screen = (const CHIP8_recorder_block **)history_append(
+                    (const void **)h->screen, &h->screen_count, block);
+
+            h->records += block->count;
+            break;
+        }
+        case CHIP8_RECORDER_CHUNK_SNAPSHOT:
+            if (chunk->size != sizeof(CHIP8_recorder_snapshot)) {
+                fprintf(stderr, "%s: Invalid snapshot at offset %zu\n", path,
+                        offset);
+                return 1;
+            }
+
+            h->snapshots = (const CHIP8_recorder_snapshot **)history_append(
+                (const void **)h->snapshots, &h->snapshot_count, body);
+            break;
+        default:
+            // Unknown chunks are skipped
+            break;
+        }
+
+        offset += sizeof(*chunk) + chunk->size;
+    }
+
+    if (h->snapshot_count == 0) {
+        fprintf(stderr, "%s: No snapshots\n", path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static const CHIP8_record *history_records(const CHIP8_recorder_block *block) {
+    return (const CHIP8_record *)(block + 1);
+}
+
+static const uint8_t history_filter_get(const CHIP8_recorder_block *block,
+                                        const uint32_t bit) {
+    return (block->filter[bit / 64] >> (bit % 64)) & 1;
+}
+
+// Number of blocks that start before instruction <cycle>
+static uint32_t history_find(const CHIP8_recorder_block **blocks,
+                             const uint32_t count, const uint64_t cycle) {
+    uint32_t low = 0, high = count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (blocks[middle]->first_cycle < cycle)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+// Whether <record> (and <row>, for row records) changed pixel (x, y)
+static const uint8_t history_record_has_pixel(const CHIP8_record *record,
+                                              const CHIP8_record *row,
+                                              const uint32_t x,
+                                              const uint32_t y) {
+    if (record->length != y)
+        return 0;
+
+    if (record->kind == CHIP8_RECORD_ROW) {
+        const CHIP8_record_row *mask = (const CHIP8_record_row *)row;
+        return (mask->mask[x / 64] >> (x % 64)) & 1;
+    }
+
+    return x >= record->address && x - record->address < 16 &&
+           ((record->mask >> (x - record->address)) & 1);
+}
+
+// Last record before instruction <cycle> that touches <target> (an address,
+// or y * CHIP8_RECORDER_SCREEN_WIDTH + x for pixels), NULL if there is none
+static const CHIP8_record *history_last(const CHIP8_recorder_block **blocks,
+                                        const uint32_t count,
+                                        const uint64_t cycle,
+                                        const uint8_t pixel,
+                                        const uint32_t target) {
+    const uint32_t x = target % CHIP8_RECORDER_SCREEN_WIDTH;
+    const uint32_t y = target / CHIP8_RECORDER_SCREEN_WIDTH;
+    const uint32_t bit = pixel ? y : target / CHIP8_RECORDER_FILTER_GRANULE;
+
+    blocks_checked = 0;
+    blocks_scanned = 0;
+
+    for (uint32_t i = history_find(blocks, count, cycle); i > 0; i--) {
+        const CHIP8_recorder_block *block = blocks[i - 1];
+
+        blocks_checked++;
+        if (!history_filter_get(block, bit))
+            continue;
+
+        blocks_scanned++;
+
+        // Row records take two entries, so the block is read forward
+        const CHIP8_record *records = history_records(block);
+        const CHIP8_record *found = NULL;
+        for (uint32_t r = 0; r < block->count; r++) {
+            const CHIP8_record *record = &records[r];
+            if (record->cycle >= cycle)
+                break;
+
+            if (record->kind == CHIP8_RECORD_ROW)
+                r++;
+
+            if (pixel) {
+                if (record->kind != CHIP8_RECORD_STORE &&
+                    history_record_has_pixel(record, &records[r], x, y))
+                    found = record;
+            } else if (record->kind == CHIP8_RECORD_STORE &&
+                       (uint16_t)(target - record->address) <
+                           record->length) {
+                found = record;
+            }
+        }
+
+        if (found != NULL)
+            return found;
+    }
+
+    return NULL;
+}
+
+// Last snapshot at or before instruction <cycle> (the first one, if there is
+// none)
+static const CHIP8_recorder_snapshot *history_snapshot(const history *h,
+                                                       const uint64_t cycle) {
+    uint32_t low = 1, high = h->snapshot_count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (h->snapshots[middle]->cycle <= cycle)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return h->snapshots[low - 1];
+}
+
+// Instructions covered by the recording (a truncated one may have records
+// after its last snapshot)
+static const uint64_t history_end(const history *h) {
+    uint64_t end = h->snapshots[h->snapshot_count - 1]->cycle;
+
+    if (h->mem_count > 0 && h->mem[h->mem_count - 1]->last_cycle >= end)
+        end = h->mem[h->mem_count - 1]->last_cycle + 1;
+    if (h->screen_count > 0 &&
+        h->screen[h->screen_count - 1]->last_cycle >= end)
+        end = h->screen[h->screen_count - 1]->last_cycle + 1;
+
+    return end;
+}
+
+static void history_print_record(const history *h,
+                                 const CHIP8_record *record) {
+    // The instruction as of the last snapshot (self modifying roms aside)
+    const uint8_t *mem = history_snapshot(h, record->cycle)->mem;
+    const uint16_t opcode = (mem[record->pc] << 8) |
+                            mem[(record->pc + 1) % CHIP8_RECORDER_MEM_SIZE];
+
+    printf("instruction %llu: pc 0x%04x (%04x), ",
+           (unsigned long long)record->cycle, record->pc, opcode);
+
+    switch (record->kind) {
+    case CHIP8_RECORD_STORE:
+        printf("stored %u byte(s) at 0x%04x\n", record->length,
+               record->address);
+        break;
+    case CHIP8_RECORD_DRAW:
+        printf("drew on row %u\n", record->length);
+        break;
+    case CHIP8_RECORD_ROW:
+        printf("cleared or scrolled row %u\n", record->length);
+        break;
+    }
+}
+
+static void history_info(const history *h) {
+    printf("rom: %.*s (mode %u)\n", (int)sizeof(h->header->rom),
+           h->header->rom, h->header->mode);
+    printf("instructions: %llu\n", (unsigned long long)history_end(h));
+    printf("records: %llu (%u memory block(s), %u screen block(s))\n",
+           (unsigned long long)h->records, h->mem_count, h->screen_count);
+    printf("snapshots: %u\n", h->snapshot_count);
+}
+
+static void history_print_snapshot(const CHIP8_recorder_snapshot *snapshot) {
+    printf("snapshot at instruction %llu:\n",
+           (unsigned long long)snapshot->cycle);
+    printf("  pc 0x%04x  I 0x%04x  sp %u  delay %u  sound %u\n", snapshot->pc,
+           snapshot->index_reg, snapshot->sp, snapshot->timer,
+           snapshot->timer_sound);
+
+    printf(" ");
+    for (uint32_t i = 0; i < 16; i++)
+        printf(" V%X %02x", i, snapshot->reg[i]);
+    printf("\n");
+
+    printf("  stack");
+    for (uint32_t i = 0; i < snapshot->sp && i < 16; i++)
+        printf(" 0x%04x", snapshot->stack[i]);
+    printf("\n");
+}
+
+static const uint32_t history_parse(const char *value, uint64_t *result) {
+    char *end = NULL;
+
+    errno = 0;
+    *result = strtoull(value, &end, 0);
+
+    return errno != 0 || end == value || *end != '\0';
+}
+
+static void history_usage(void) {
+    fprintf(stderr,
+            "Queries (instruction <n> defaults to the end of the recording):\n"
+            "  addr <address> [<n>]  Last store to <address> before\n"
+            "                        instruction <n>\n"
+            "  pixel <x> <y> [<n>]   Last change of pixel (<x>, <y>) before\n"
+            "                        instruction <n>\n"
+            "  snapshot <n>          Machine state at the last snapshot at\n"
+            "                        or before instruction <n>\n"
+            "  info                  Summary of the recording\n");
+}
+
+// Returns 1 if the query is invalid
+static const uint32_t history_query(const history *h, const uint32_t argc,
+                                    char **argv) {
+    uint64_t values[HISTORY_MAX_ARGS];
+    for (uint32_t i = 1; i < argc; i++) {
+        if (history_parse(argv[i], &values[i])) {
+            fprintf(stderr, "Invalid number: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    const uint64_t start = history_now();
+
+    if (strcmp(argv[0], "info") == 0 && argc == 1) {
+        history_info(h);
+        return 0;
+    } else if (strcmp(argv[0], "snapshot") == 0 && argc == 2) {
+        history_print_snapshot(history_snapshot(h, values[1]));
+    } else if (strcmp(argv[0], "addr") == 0 && (argc == 2 || argc == 3)) {
+        if (values[1] >= CHIP8_RECORDER_MEM_SIZE) {
+            fprintf(stderr, "Invalid address: %s\n", argv[1]);
+            return 1;
+        }
+
+        const uint64_t cycle = argc == 3 ? values[2] : history_end(h);
+        const CHIP8_record *record =
+            history_last(h->mem, h->mem_count, cycle, 0, values[1]);
+
+        if (record != NULL)
+            history_print_record(h, record);
+        else
+            printf("0x%04llx: not written before instruction %llu\n",
+                   (unsigned long long)values[1], (unsigned long long)cycle);
+    } else if (strcmp(argv[0], "pixel") == 0 && (argc == 3 || argc == 4)) {
+        if (values[1] >= CHIP8_RECORDER_SCREEN_WIDTH ||
+            values[2] >= CHIP8_RECORDER_SCREEN_HEIGHT) {
+            fprintf(stderr, "Invalid pixel: %s, %s\n", argv[1], argv[2]);
+            return 1;
+        }
+
+        const uint64_t cycle = argc == 4 ? values[3] : history_end(h);
+        const CHIP8_record *record = history_last(
+            h->screen, h->screen_count, cycle, 1,
+            values[2] * CHIP8_RECORDER_SCREEN_WIDTH + values[1]);
+
+        if (record != NULL)
+            history_print_record(h, record);
+        else
+            printf("(%llu, %llu): not changed before instruction %llu\n",
+                   (unsigned long long)values[1],
+                   (unsigned long long)values[2], (unsigned long long)cycle);
+    } else {
+        history_usage();
+        return 1;
+    }
+
+    printf("(%.3f ms, %u block(s) checked, %u scanned)\n",
+           (history_now() - start) / 1e6, blocks_checked, blocks_scanned);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <recording> [<query>]\n\n", argv[0]);
+        history_usage();
+        return 2;
+    }
+
+    history h;
+    if (history_open(&h, argv[1]) != 0)
+        return 1;
+
+    if (argc - 2 > HISTORY_MAX_ARGS) {
+        history_usage();
+        return 2;
+    }
+
+    if (argc > 2)
+        return history_query(&h, argc - 2, argv + 2);
+
+    char line[256];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char *args[HISTORY_MAX_ARGS + 1];
+        uint32_t count = 0;
+
+        for (char *token = strtok(line, " \t\r\n"); token != NULL;
+             token = strtok(NULL, " \t\r\n")) {
+            if (count == HISTORY_MAX_ARGS + 1)
+                break;
+            args[count++] = token;
+        }
+
+        if (count == 0)
+            continue;
+
+        if (count > HISTORY_MAX_ARGS)
+            history_usage();
+        else
+            history_query(&h, count, args);
+
+        fflush(stdout);
+    }
+
+    return 0;
+}
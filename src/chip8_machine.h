@@ -0,0 +1,152 @@
+#ifndef _CHIP8_MACHINE_H_
+#define _CHIP8_MACHINE_H_
+
+// Machine internals, shared by the interpreter (chip8.c) and code that
+// works on the machine state directly (i.e. the ahead-of-time compiled
+// roms, see aot.h). Everything else should use chip8.h.
+
+#include "chip8.h"
+#include "rom_cache.h"
+
+#include <stdint.h>
+
+#define CHIP8_MEM_SIZE (1024 * 64)
+#define CHIP8_MEM_OFFSET 512
+#define CHIP8_MEM_PAGE_SIZE 256
+#define CHIP8_MEM_PAGES (CHIP8_MEM_SIZE / CHIP8_MEM_PAGE_SIZE)
+
+#define CHIP8_FONTSET_CHAR_SIZE 5
+#define CHIP8_FONTSET_CHAR_SIZE_SUPER 10
+#define CHIP8_FONTSET_SIZE 16
+#define CHIP8_FONTSET_SIZE_SUPER 16
+#define CHIP8_FONTSET_OFFSET 0
+#define CHIP8_FONTSET_OFFSET_SUPER CHIP8_FONTSET_SIZE *CHIP8_FONTSET_CHAR_SIZE
+
+#define CHIP8_KEYS 16
+#define CHIP8_STACK_SIZE 16
+#define CHIP8_REGISTERS 16
+#define CHIP8_FLAG_REGISTERS 8
+
+// The screen buffer always uses the larges available size
+// and restricts its drawing area to the machine->width/height
+// values
+#define CHIP8_SCREEN_WIDTH 64
+#define CHIP8_SCREEN_HEIGHT 32
+#define CHIP8_SCREEN_WIDTH_HIRES 128
+#define CHIP8_SCREEN_HEIGHT_HIRES 64
+
+#define CHIP8_SCREEN_BUFFER_WIDTH CHIP8_SCREEN_WIDTH_HIRES
+#define CHIP8_SCREEN_BUFFER_HEIGHT CHIP8_SCREEN_HEIGHT_HIRES
+
+typedef enum {
+    CHIP8_SCROLL_UP,
+    CHIP8_SCROLL_DOWN,
+    CHIP8_SCROLL_LEFT,
+    CHIP8_SCROLL_RIGHT,
+} CHIP8_SCROLL_DIR;
+
+// Predecoded instruction, see chip8.c
+typedef struct CHIP8_decoded CHIP8_decoded;
+
+// Breakpoints and watchpoints, see debugger.h
+typedef struct CHIP8_debugger CHIP8_debugger;
+
+// Write log, see recorder.h
+typedef struct CHIP8_recorder CHIP8_recorder;
+
+struct CHIP8_machine {
+    // Everything up to mem_writes is cleared by CHIP8_reset/CHIP8_restart
+
+    uint8_t reg[CHIP8_REGISTERS];
+
+    uint8_t flag_reg[CHIP8_FLAG_REGISTERS];
+    uint8_t keys[CHIP8_KEYS];
+
+    uint8_t screen_width;
+    uint8_t screen_height;
+    uint8_t screen_bitplane;
+    uint8_t screen_is_hires;
+    uint8_t screen_update_status;
+
+    uint8_t timer_sound;
+    uint8_t timer;
+
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint16_t sp;
+    uint16_t pc;
+    uint16_t index_reg;
+
+    // Number of executed instructions
+    uint64_t cycles;
+
+    // Screen rows changed since the update status was last cleared (bit y:
+    // row y), see CHIP8_screen_get_view
+    uint64_t screen_rows_updated;
+
+    // Incremented by every instruction that writes to memory (and by
+    // loading a rom). Survives CHIP8_reset, so it never repeats.
+    uint32_t mem_writes;
+
+    // Random number generator state (never 0)
+    uint32_t rand_state;
+
+    // Interpreter core, see CHIP8_set_mode. Survives CHIP8_reset.
+    CHIP8_MODE mode;
+
+    // Execution engine and its decoded instructions (one per address,
+    // allocated on first use), see CHIP8_set_engine. Survive CHIP8_reset.
+    CHIP8_ENGINE engine;
+    CHIP8_decoded *decoded;
+    // The memory (mem_writes) and mode the decoded instructions belong to
+    uint32_t decoded_writes;
+    CHIP8_MODE decoded_mode;
+
+    // Attached debugger (NULL: none), see debugger.h. Survives CHIP8_reset.
+    CHIP8_debugger *debugger;
+
+    // Attached recorder (NULL: none), see recorder.h. Survives CHIP8_reset.
+    CHIP8_recorder *recorder;
+
+    // Pages of memory written since the last load (or reset), pages
+    // written by the load, and screen rows drawn to since the last reset.
+    // Resets only restore those.
+    uint64_t mem_dirty[CHIP8_MEM_PAGES / 64];
+    uint64_t mem_loaded[CHIP8_MEM_PAGES / 64];
+    uint64_t screen_dirty;
+
+    // The loaded rom, whose image CHIP8_restart restores from (NULL until a
+    // rom has been loaded). Matches mem, except for the dirty pages (and
+    // the fonts). If mem_mapped is set, mem is a copy-on-write mapping of
+    // the image, see CHIP8_rom_map.
+    CHIP8_rom *rom;
+    uint8_t mem_mapped;
+
+    // Page aligned by CHIP8_machine_create, which places the machine in
+    // front of it, so it has to keep the machine aligned as well
+    _Alignas(uint64_t) uint8_t mem[CHIP8_MEM_SIZE];
+    uint8_t screen[CHIP8_SCREEN_BUFFER_HEIGHT * CHIP8_SCREEN_BUFFER_WIDTH];
+};
+
+// Write <value> to memory at <address> (wrapping around at the end of
+// memory) and mark its page dirty. Everything that writes to memory while
+// a rom runs has to use this, or CHIP8_restart won't undo the write.
+#define CHIP8_MEM_WRITE(m, address, value)                                     \
+    do {                                                                       \
+        const uint32_t mem_write__address =                                    \
+            (uint32_t)(address) % CHIP8_MEM_SIZE;                              \
+        const uint32_t mem_write__page =                                       \
+            mem_write__address / CHIP8_MEM_PAGE_SIZE;                          \
+        (m)->mem[mem_write__address] = (value);                                \
+        (m)->mem_dirty[mem_write__page / 64] |=                                \
+            1ull << (mem_write__page % 64);                                    \
+    } while (0)
+
+/// Forget the predecoded instructions that overlap [start, end), so they
+/// are decoded again (i.e. after a breakpoint has been set there)
+extern void CHIP8_decoded_drop(uint32_t start, uint32_t end);
+
+/// Execute a single instruction with the core of the current mode. Unlike
+/// CHIP8_cpu_run, this does not count the instruction.
+extern const int32_t CHIP8_cpu_step(void);
+
+#endif
@@ -0,0 +1,609 @@
+#include "config.h"
+#include "log.h"
+#include "verify.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_LINE_SIZE 256
+
+// Options without a short form
+enum {
+    CONFIG_OPT_HEADLESS = 0x100,
+    CONFIG_OPT_FRAMES,
+    CONFIG_OPT_CAPTURE_FORMAT,
+    CONFIG_OPT_CAPTURE_SCALE,
+    CONFIG_OPT_SERVER,
+    CONFIG_OPT_BATCH,
+    CONFIG_OPT_BATCH_OUTPUT,
+    CONFIG_OPT_INSTRUCTIONS,
+    CONFIG_OPT_SEED,
+    CONFIG_OPT_ENGINE,
+    CONFIG_OPT_SCALER,
+    CONFIG_OPT_OVERLAY,
+    CONFIG_OPT_STATS,
+    CONFIG_OPT_BENCH,
+    CONFIG_OPT_VERIFY,
+    CONFIG_OPT_DEBUG,
+    CONFIG_OPT_RECORD,
+    CONFIG_OPT_NETPLAY,
+    CONFIG_OPT_NETPLAY_DELAY,
+    CONFIG_OPT_NETPLAY_LOSS,
+    CONFIG_OPT_HIDDEN,
+    CONFIG_OPT_UNFOCUSED,
+    CONFIG_OPT_RENDER_INTERVAL,
+    CONFIG_OPT_CAPTURE_INTERVAL,
+    CONFIG_OPT_TERMINAL,
+};
+
+static void config_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options] <rom>\n"
+            "\n"
+            "Options:\n"
+            "  -m, --mode <mode>       Platform: ch8, sh8, c48, xh8 or any\n"
+            "                          (default: by extension, otherwise any)\n"
+            "      --engine <engine>   predecoded (default) or interpreter\n"
+            "                          (traces every instruction)\n"
+            "  -c, --cycles <n>        Instructions per frame (default: %d)\n"
+            "  -a, --adaptive[=<n>]    Raise the instructions per frame up to\n"
+            "                          <n> while the host keeps up (default: %d)\n"
+            "      --headless          Run without a window, as fast as possible\n"
+            "      --frames <n>        Stop after <n> frames\n"
+            "      --terminal          Draw into the terminal instead of a\n"
+            "                          window (i.e. over SSH)\n"
+            "      --hidden <policy>   While the window is hidden: pause\n"
+            "                          (default), norender (emulate only),\n"
+            "                          throttle (emulate only, 4 wakeups per\n"
+            "                          second) or run\n"
+            "      --unfocused <policy>\n"
+            "                          The same, while the window doesn't have\n"
+            "                          the focus (default: run). <P> pauses.\n"
+            "      --render-interval <n>\n"
+            "                          Show every <n>th frame in the window\n"
+            "      --overlay           Draw a frame time graph over the\n"
+            "                          screen (numbers in the window title)\n"
+            "      --stats             Log frame timing statistics on exit\n"
+            "                          (and whenever SIGUSR1 is received)\n"
+            "      --debug             Start in the debugger (breakpoints,\n"
+            "                          watchpoints), Ctrl-C breaks into it\n"
+            "      --record <path>     Log every store and screen change to\n"
+            "                          <path>, for queries with chip8_history\n"
+            "      --netplay <port>:<host>:<port>\n"
+            "                          Two player netplay over UDP: local\n"
+            "                          port, then the other player's address\n"
+            "      --netplay-delay <ms>, --netplay-loss <percent>\n"
+            "                          Delay or drop outgoing packets, to try\n"
+            "                          netplay out over loopback\n"
+            "  -o, --capture <path>    Record the screen to <path> ('-': stdout)\n"
+            "      --capture-format <format>\n"
+            "                          y4m (default), rgb (raw rgb24) or index\n"
+            "                          (raw 8bit pixel values)\n"
+            "      --capture-scale <n> Scale captured frames by <n> (default: 1)\n"
+            "      --capture-interval <n>\n"
+            "                          Record every <n>th frame (default: 1)\n"
+            "      --scaler <scaler>   Upscale the window and captured frames\n"
+            "                          with none (default), scale2x, epx (same\n"
+            "                          as scale2x) or scale3x\n"
+            "      --server <path>     Host sessions of <rom> on a UNIX socket\n"
+            "                          (see chip8_client)\n"
+            "      --batch <path>      Run every rom in a directory (or listed\n"
+            "                          in a file, one per line) without a\n"
+            "                          window. Prints one JSON record per rom.\n"
+            "      --batch-output <path>\n"
+            "                          Write the records to <path>\n"
+            "  -j, --threads <n>       Batch worker threads (default: cores)\n"
+            "      --instructions <n>  Batch budget in instructions (i.e. 50M),\n"
+            "                          instead of --frames (default: %d)\n"
+            "      --seed <n>          Seed for the random number generator\n"
+            "      --bench             Run <rom> with every engine and print\n"
+            "                          the host cost per instruction (time and\n"
+            "                          hardware counters). Runs --frames or\n"
+            "                          --instructions (default: 10M).\n"
+            "      --verify[=<n>]      Run <rom> on the interpreter and on\n"
+            "                          --engine side by side and stop at the\n"
+            "                          first difference, comparing every <n>\n"
+            "                          instructions (default: %d)\n"
+            "  -h, --help              Show this message\n"
+            "\n"
+            "--mode, --cycles and --adaptive can also be stored per rom, in\n"
+            "'<rom>%s', using '<option> = <value>' lines (i.e.\n"
+            "'cycles = 1000').\n",
+            name, CHIP8_CONFIG_DEFAULT_CYCLES,
+            CHIP8_CONFIG_DEFAULT_ADAPTIVE_TARGET,
+            CHIP8_CONFIG_DEFAULT_BATCH_FRAMES, CHIP8_VERIFY_DEFAULT_INTERVAL,
+            CHIP8_CONFIG_ROM_SUFFIX);
+}
+
+static const uint32_t config_parse_uint(const char *value, uint32_t min,
+                                        uint32_t max, uint32_t *result) {
+    char *end = NULL;
+
+    errno = 0;
+    unsigned long number = strtoul(value, &end, 0);
+    if (errno != 0 || end == value || *end != '\0' || number < min ||
+        number > max)
+        return 1;
+
+    *result = number;
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    CHIP8_MODE mode;
+} config_modes[] = {
+    {"ch8", CHIP8_MODE_CH8}, {"sh8", CHIP8_MODE_SH8}, {"c48", CHIP8_MODE_C48},
+    {"xh8", CHIP8_MODE_XH8}, {"any", CHIP8_MODE_ANY},
+};
+
+const char *CHIP8_config_mode_name(CHIP8_MODE mode) {
+    for (size_t i = 0; i < sizeof(config_modes) / sizeof(*config_modes); i++) {
+        if (config_modes[i].mode == mode)
+            return config_modes[i].name;
+    }
+
+    return "unknown";
+}
+
+static const struct {
+    const char *name;
+    CHIP8_ENGINE engine;
+} config_engines[] = {
+    {"interpreter", CHIP8_ENGINE_INTERPRETER},
+    {"predecoded", CHIP8_ENGINE_PREDECODED},
+};
+
+static const struct {
+    const char *name;
+    CHIP8_CAPTURE_FORMAT format;
+} config_capture_formats[] = {
+    {"y4m", CHIP8_CAPTURE_Y4M},
+    {"rgb", CHIP8_CAPTURE_RGB},
+    {"index", CHIP8_CAPTURE_INDEX},
+};
+
+static const struct {
+    const char *name;
+    CHIP8_BACKGROUND background;
+} config_backgrounds[] = {
+    {"run", CHIP8_BACKGROUND_RUN},
+    {"norender", CHIP8_BACKGROUND_NORENDER},
+    {"throttle", CHIP8_BACKGROUND_THROTTLE},
+    {"pause", CHIP8_BACKGROUND_PAUSE},
+};
+
+static const uint32_t config_parse_background(const char *value,
+                                              CHIP8_BACKGROUND *result) {
+    for (size_t i = 0;
+         i < sizeof(config_backgrounds) / sizeof(*config_backgrounds); i++) {
+        if (strcmp(value, config_backgrounds[i].name) == 0) {
+            *result = config_backgrounds[i].background;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static const struct {
+    const char *name;
+    CHIP8_SCALER scaler;
+} config_scalers[] = {
+    {"none", CHIP8_SCALER_NONE},
+    {"scale2x", CHIP8_SCALER_SCALE2X},
+    {"epx", CHIP8_SCALER_SCALE2X},
+    {"scale3x", CHIP8_SCALER_SCALE3X},
+};
+
+static const uint32_t config_parse_bool(const char *value, uint8_t *result) {
+    if (strcmp(value, "on") == 0)
+        *result = 1;
+    else if (strcmp(value, "off") == 0)
+        *result = 0;
+    else
+        return 1;
+
+    return 0;
+}
+
+// Guess the platform from well known rom extensions. '.ch8' is not
+// considered, since plenty of Super-CHIP roms use it as well.
+static const CHIP8_MODE config_mode_from_path(const char *path) {
+    const char *extension = strrchr(path, '.');
+
+    if (extension == NULL)
+        return CHIP8_MODE_ANY;
+    if (strcmp(extension, ".sc8") == 0)
+        return CHIP8_MODE_SH8;
+    if (strcmp(extension, ".xo8") == 0)
+        return CHIP8_MODE_XH8;
+
+    return CHIP8_MODE_ANY;
+}
+
+// Apply a single 'key = value' option. Strings are kept as they are, not
+// copied: They only come from the command line (see config_rom_keys).
+static const uint32_t config_set(CHIP8_config *config, const char *key,
+                                 const char *value) {
+    if (strcmp(key, "mode") == 0) {
+        for (size_t i = 0; i < sizeof(config_modes) / sizeof(*config_modes);
+             i++) {
+            if (strcmp(value, config_modes[i].name) == 0) {
+                config->mode = config_modes[i].mode;
+                return 0;
+            }
+        }
+        return 1;
+    } else if (strcmp(key, "engine") == 0) {
+        for (size_t i = 0;
+             i < sizeof(config_engines) / sizeof(*config_engines); i++) {
+            if (strcmp(value, config_engines[i].name) == 0) {
+                config->engine = config_engines[i].engine;
+                return 0;
+            }
+        }
+        return 1;
+    } else if (strcmp(key, "cycles") == 0) {
+        return config_parse_uint(value, 1, CHIP8_CONFIG_MAX_CYCLES,
+                                 &config->cycles_per_frame);
+    } else if (strcmp(key, "adaptive") == 0) {
+        if (strcmp(value, "off") == 0) {
+            config->adaptive = 0;
+            return 0;
+        }
+
+        config->adaptive = 1;
+        if (strcmp(value, "on") == 0)
+            return 0;
+
+        return config_parse_uint(value, 1, CHIP8_CONFIG_MAX_CYCLES,
+                                 &config->adaptive_target);
+    } else if (strcmp(key, "headless") == 0) {
+        return config_parse_bool(value, &config->headless);
+    } else if (strcmp(key, "overlay") == 0) {
+        return config_parse_bool(value, &config->overlay);
+    } else if (strcmp(key, "stats") == 0) {
+        return config_parse_bool(value, &config->stats);
+    } else if (strcmp(key, "debug") == 0) {
+        return config_parse_bool(value, &config->debug);
+    } else if (strcmp(key, "netplay") == 0) {
+        config->netplay_address = value;
+        return 0;
+    } else if (strcmp(key, "netplay-delay") == 0) {
+        return config_parse_uint(value, 0, 10000, &config->netplay_delay);
+    } else if (strcmp(key, "netplay-loss") == 0) {
+        return config_parse_uint(value, 0, 100, &config->netplay_loss);
+    } else if (strcmp(key, "record") == 0) {
+        config->record_path = value;
+        return 0;
+    } else if (strcmp(key, "bench") == 0) {
+        return config_parse_bool(value, &config->bench);
+    } else if (strcmp(key, "verify") == 0) {
+        if (strcmp(value, "off") == 0) {
+            config->verify_interval = 0;
+            return 0;
+        }
+
+        if (strcmp(value, "on") == 0) {
+            config->verify_interval = CHIP8_VERIFY_DEFAULT_INTERVAL;
+            return 0;
+        }
+
+        return config_parse_uint(value, 1, CHIP8_CONFIG_MAX_CYCLES,
+                                 &config->verify_interval);
+    } else if (strcmp(key, "frames") == 0) {
+        return config_parse_uint(value, 0, UINT32_MAX, &config->frames);
+    } else if (strcmp(key, "hidden") == 0) {
+        return config_parse_background(value, &config->background_hidden);
+    } else if (strcmp(key, "unfocused") == 0) {
+        return config_parse_background(value, &config->background_unfocused);
+    } else if (strcmp(key, "terminal") == 0) {
+        return config_parse_bool(value, &config->terminal);
+    } else if (strcmp(key, "render-interval") == 0) {
+        return config_parse_uint(value, 1, CHIP8_CONFIG_MAX_INTERVAL,
+                                 &config->render_interval);
+    } else if (strcmp(key, "capture") == 0) {
+        config->capture_path = value;
+        return 0;
+    } else if (strcmp(key, "capture-format") == 0) {
+        for (size_t i = 0; i < sizeof(config_capture_formats) /
+                                   sizeof(*config_capture_formats);
+             i++) {
+            if (strcmp(value, config_capture_formats[i].name) == 0) {
+                config->capture_format = config_capture_formats[i].format;
+                return 0;
+            }
+        }
+        return 1;
+    } else if (strcmp(key, "capture-scale") == 0) {
+        return config_parse_uint(value, 1, CHIP8_CONFIG_MAX_CAPTURE_SCALE,
+                                 &config->capture_scale);
+    } else if (strcmp(key, "capture-interval") == 0) {
+        return config_parse_uint(value, 1, CHIP8_CONFIG_MAX_INTERVAL,
+                                 &config->capture_interval);
+    } else if (strcmp(key, "scaler") == 0) {
+        for (size_t i = 0;
+             i < sizeof(config_scalers) / sizeof(*config_scalers); i++) {
+            if (strcmp(value, config_scalers[i].name) == 0) {
+                config->scaler = config_scalers[i].scaler;
+                return 0;
+            }
+        }
+        return 1;
+    } else if (strcmp(key, "server") == 0) {
+        config->server_path = value;
+        return 0;
+    } else if (strcmp(key, "batch") == 0) {
+        config->batch_path = value;
+        return 0;
+    } else if (strcmp(key, "batch-output") == 0) {
+        config->batch_output = value;
+        return 0;
+    } else if (strcmp(key, "threads") == 0) {
+        return config_parse_uint(value, 0, CHIP8_CONFIG_MAX_THREADS,
+                                 &config->threads);
+    } else if (strcmp(key, "instructions") == 0) {
+        uint32_t millions;
+        // Accept plain numbers, or millions with an 'M' suffix
+        size_t length = strlen(value);
+        if (length > 1 && value[length - 1] == 'M') {
+            char number[32];
+            if (length >= sizeof(number))
+                return 1;
+            memcpy(number, value, length - 1);
+            number[length - 1] = '\0';
+            if (config_parse_uint(number, 0, UINT32_MAX, &millions) != 0)
+                return 1;
+            config->instructions = (uint64_t)millions * 1000000;
+            return 0;
+        }
+
+        char *end = NULL;
+        errno = 0;
+        config->instructions = strtoull(value, &end, 0);
+        return errno != 0 || end == value || *end != '\0';
+    } else if (strcmp(key, "seed") == 0) {
+        return config_parse_uint(value, 0, UINT32_MAX, &config->seed);
+    }
+
+    log_error("Unknown option: %s", key);
+    return 1;
+}
+
+// Options a rom's configuration file may set: How the rom runs, nothing
+// that writes files or opens sockets
+static const char *const config_rom_keys[] = {"mode", "cycles", "adaptive"};
+
+static const uint8_t config_is_rom_key(const char *key) {
+    for (size_t i = 0; i < sizeof(config_rom_keys) / sizeof(*config_rom_keys);
+         i++) {
+        if (strcmp(key, config_rom_keys[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static char *config_strip(char *str) {
+    while (isspace((unsigned char)*str))
+        str++;
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+
+    return str;
+}
+
+// Read '<rom><CHIP8_CONFIG_ROM_SUFFIX>', if it exists
+static const uint32_t config_load_rom(CHIP8_config *config,
+                                      const char *rom_path) {
+    char path[CONFIG_LINE_SIZE];
+    char line[CONFIG_LINE_SIZE];
+
+    if (snprintf(path, sizeof(path), "%s%s", rom_path,
+                 CHIP8_CONFIG_ROM_SUFFIX) >= (int)sizeof(path))
+        return 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    uint32_t result = 0;
+    uint32_t line_number = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char *key = config_strip(line);
+        if (*key == '\0')
+            continue;
+
+        char *value = strchr(key, '=');
+        if (value == NULL) {
+            log_error("%s:%u: Expected '<option> = <value>'", path,
+                      line_number);
+            result = 1;
+            break;
+        }
+
+        *value++ = '\0';
+        key = config_strip(key);
+        value = config_strip(value);
+
+        if (!config_is_rom_key(key)) {
+            log_error("%s:%u: '%s' can't be set per rom", path, line_number,
+                      key);
+            result = 1;
+            break;
+        }
+
+        if (config_set(config, key, value) != 0) {
+            log_error("%s:%u: Invalid value for '%s': %s", path, line_number,
+                      key, value);
+            result = 1;
+            break;
+        }
+    }
+
+    fclose(file);
+
+    if (result == 0)
+        log_info("Loaded rom configuration: %s", path);
+
+    return result;
+}
+
+void CHIP8_config_defaults(CHIP8_config *config) {
+    assert(config != NULL);
+
+    memset(config, 0, sizeof(*config));
+    config->mode = CHIP8_MODE_ANY;
+    config->engine = CHIP8_ENGINE_PREDECODED;
+    config->cycles_per_frame = CHIP8_CONFIG_DEFAULT_CYCLES;
+    config->adaptive = 0;
+    config->adaptive_target = CHIP8_CONFIG_DEFAULT_ADAPTIVE_TARGET;
+    config->capture_format = CHIP8_CAPTURE_Y4M;
+    config->capture_scale = 1;
+    config->capture_interval = 1;
+    config->render_interval = 1;
+    config->scaler = CHIP8_SCALER_NONE;
+    config->background_hidden = CHIP8_BACKGROUND_PAUSE;
+    config->background_unfocused = CHIP8_BACKGROUND_RUN;
+}
+
+static const uint32_t config_apply_args(CHIP8_config *config) {
+    for (uint32_t i = 0; i < config->arg_count; i++) {
+        if (config_set(config, config->args[i].key, config->args[i].value) !=
+            0) {
+            log_error("Invalid value for '--%s': %s", config->args[i].key,
+                      config->args[i].value);
+            return 1;
+        }
+    }
+
+    if (config->adaptive && config->adaptive_target < config->cycles_per_frame)
+        config->adaptive_target = config->cycles_per_frame;
+
+    return 0;
+}
+
+// Apply the rom's configuration file and then the command line options
+static const uint32_t config_apply_rom(CHIP8_config *config,
+                                       const char *rom_path) {
+    config->rom_path = rom_path;
+    config->mode = config_mode_from_path(rom_path);
+
+    if (config_load_rom(config, rom_path) != 0)
+        return 1;
+
+    return config_apply_args(config);
+}
+
+const uint32_t CHIP8_config_for_rom(const CHIP8_config *config,
+                                    const char *rom_path,
+                                    CHIP8_config *result) {
+    assert(config != NULL && rom_path != NULL && result != NULL);
+
+    // Start over from the defaults, so the options of another rom's
+    // configuration file don't leak into this one
+    CHIP8_config_defaults(result);
+    memcpy(result->args, config->args, sizeof(config->args));
+    result->arg_count = config->arg_count;
+
+    return config_apply_rom(result, rom_path);
+}
+
+const uint32_t CHIP8_config_init(CHIP8_config *config, int argc,
+                                 char **argv) {
+    // Every option sets the configuration key of the same name. Options
+    // without an argument (or with an omitted optional one) set "on".
+    static const struct option long_options[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {"engine", required_argument, NULL, CONFIG_OPT_ENGINE},
+        {"cycles", required_argument, NULL, 'c'},
+        {"adaptive", optional_argument, NULL, 'a'},
+        {"headless", no_argument, NULL, CONFIG_OPT_HEADLESS},
+        {"frames", required_argument, NULL, CONFIG_OPT_FRAMES},
+        {"terminal", no_argument, NULL, CONFIG_OPT_TERMINAL},
+        {"hidden", required_argument, NULL, CONFIG_OPT_HIDDEN},
+        {"unfocused", required_argument, NULL, CONFIG_OPT_UNFOCUSED},
+        {"render-interval", required_argument, NULL,
+         CONFIG_OPT_RENDER_INTERVAL},
+        {"overlay", no_argument, NULL, CONFIG_OPT_OVERLAY},
+        {"stats", no_argument, NULL, CONFIG_OPT_STATS},
+        {"debug", no_argument, NULL, CONFIG_OPT_DEBUG},
+        {"record", required_argument, NULL, CONFIG_OPT_RECORD},
+        {"netplay", required_argument, NULL, CONFIG_OPT_NETPLAY},
+        {"netplay-delay", required_argument, NULL, CONFIG_OPT_NETPLAY_DELAY},
+        {"netplay-loss", required_argument, NULL, CONFIG_OPT_NETPLAY_LOSS},
+        {"capture", required_argument, NULL, 'o'},
+        {"capture-format", required_argument, NULL, CONFIG_OPT_CAPTURE_FORMAT},
+        {"capture-scale", required_argument, NULL, CONFIG_OPT_CAPTURE_SCALE},
+        {"capture-interval", required_argument, NULL,
+         CONFIG_OPT_CAPTURE_INTERVAL},
+        {"scaler", required_argument, NULL, CONFIG_OPT_SCALER},
+        {"server", required_argument, NULL, CONFIG_OPT_SERVER},
+        {"batch", required_argument, NULL, CONFIG_OPT_BATCH},
+        {"batch-output", required_argument, NULL, CONFIG_OPT_BATCH_OUTPUT},
+        {"threads", required_argument, NULL, 'j'},
+        {"instructions", required_argument, NULL, CONFIG_OPT_INSTRUCTIONS},
+        {"seed", required_argument, NULL, CONFIG_OPT_SEED},
+        {"bench", no_argument, NULL, CONFIG_OPT_BENCH},
+        {"verify", optional_argument, NULL, CONFIG_OPT_VERIFY},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int option;
+    int index;
+
+    CHIP8_config_defaults(config);
+
+    while ((option = getopt_long(argc, argv, "m:c:a::o:j:h", long_options,
+                                 &index)) != -1) {
+        if (option == 'h' || option == '?') {
+            config_usage(argv[0]);
+            return 1;
+        }
+
+        // Short option: Look up its long form
+        if (option < CONFIG_OPT_HEADLESS) {
+            for (index = 0; long_options[index].val != option; index++)
+                ;
+        }
+
+        if (config->arg_count == CHIP8_CONFIG_MAX_ARGS) {
+            log_error("%s", "Too many options");
+            return 1;
+        }
+
+        // Command line options are applied last, so they are collected first
+        config->args[config->arg_count].key = long_options[index].name;
+        config->args[config->arg_count].value =
+            optarg != NULL ? optarg : "on";
+        config->arg_count++;
+    }
+
+    // Batch mode brings its own roms
+    if (optind >= argc) {
+        for (uint32_t i = 0; i < config->arg_count; i++) {
+            if (strcmp(config->args[i].key, "batch") == 0)
+                return config_apply_args(config);
+        }
+
+        return 2;
+    }
+
+    return config_apply_rom(config, argv[optind]);
+}
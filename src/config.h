@@ -0,0 +1,130 @@
+#ifndef _CHIP8_CONFIG_H_
+#define _CHIP8_CONFIG_H_
+
+#include "backend.h"
+#include "capture.h"
+#include "chip8.h"
+#include "scaler.h"
+
+#include <stdint.h>
+
+#define CHIP8_CONFIG_DEFAULT_CYCLES 50
+#define CHIP8_CONFIG_MAX_CYCLES 1000000
+#define CHIP8_CONFIG_DEFAULT_ADAPTIVE_TARGET 100000
+#define CHIP8_CONFIG_MAX_CAPTURE_SCALE 16
+#define CHIP8_CONFIG_MAX_INTERVAL 3600
+#define CHIP8_CONFIG_MAX_THREADS 1024
+#define CHIP8_CONFIG_DEFAULT_BATCH_FRAMES 600
+#define CHIP8_CONFIG_MAX_ARGS 32
+
+// Suffix of the optional per rom configuration file (i.e. "game.ch8.cfg")
+#define CHIP8_CONFIG_ROM_SUFFIX ".cfg"
+
+typedef struct {
+    const char *rom_path;
+
+    // Platform mode/interpreter core. Unless configured, it is derived from
+    // the rom's file extension (.sc8/.xo8), with CHIP8_MODE_ANY as fallback.
+    CHIP8_MODE mode;
+
+    // How instructions are executed (see CHIP8_set_engine)
+    CHIP8_ENGINE engine;
+
+    // Instructions executed per 60Hz frame
+    uint32_t cycles_per_frame;
+
+    // If set, the run loop raises the cycles per frame up to
+    // 'adaptive_target', as long as the host keeps up with the frame rate.
+    uint8_t adaptive;
+    uint32_t adaptive_target;
+
+    // Run without a window
+    uint8_t headless;
+
+    // What to do while the window is hidden (minimized) or unfocused
+    CHIP8_BACKGROUND background_hidden;
+    CHIP8_BACKGROUND background_unfocused;
+
+    // Draw into the terminal instead of a window
+    uint8_t terminal;
+
+    // Show every nth frame in the window
+    uint32_t render_interval;
+
+    // Frame time graph over the screen, and statistics on exit
+    uint8_t overlay;
+    uint8_t stats;
+
+    // Start in the debugger (see debugger.h)
+    uint8_t debug;
+
+    // Two player netplay with the peer at 'netplay_address' (see
+    // netplay.h), with simulated delay (ms) and loss (percent)
+    const char *netplay_address;
+    uint32_t netplay_delay;
+    uint32_t netplay_loss;
+
+    // Log every store and screen change to 'record_path', if set (see
+    // recorder.h)
+    const char *record_path;
+
+    // Stop after this many frames (0: run until exit)
+    uint32_t frames;
+
+    // Record the screen to 'capture_path', if set
+    const char *capture_path;
+    CHIP8_CAPTURE_FORMAT capture_format;
+    uint32_t capture_scale;
+    uint32_t capture_interval; // Every nth frame
+
+    // Upscaler for the window and captured frames
+    CHIP8_SCALER scaler;
+
+    // Host sessions on this UNIX socket instead of running a window
+    const char *server_path;
+
+    // Run every rom in this directory/manifest instead (see batch.h)
+    const char *batch_path;
+    const char *batch_output;
+    uint32_t threads;
+    uint64_t instructions;
+
+    // Measure every engine on the rom instead (see bench.h)
+    uint8_t bench;
+
+    // Check the engine against the interpreter instead, comparing the
+    // machines every this many instructions (0: off, see verify.h)
+    uint32_t verify_interval;
+
+    // Random number generator seed (0: random)
+    uint32_t seed;
+
+    // Command line options, applied on top of each rom's configuration
+    struct {
+        const char *key;
+        const char *value;
+    } args[CHIP8_CONFIG_MAX_ARGS];
+    uint32_t arg_count;
+} CHIP8_config;
+
+/// Fill <config> with the built-in defaults
+extern void CHIP8_config_defaults(CHIP8_config *config);
+
+/// Name of <mode>, as accepted by --mode
+extern const char *CHIP8_config_mode_name(CHIP8_MODE mode);
+
+/// Resolve the configuration for <rom_path> into <result>, like
+/// CHIP8_config_init did for the rom on the command line (i.e. for batch
+/// runs). Returns 0 on success.
+extern const uint32_t CHIP8_config_for_rom(const CHIP8_config *config,
+                                           const char *rom_path,
+                                           CHIP8_config *result);
+
+/// Resolve the configuration: Defaults, then the rom's configuration file
+/// (if any), then command line options.
+/// Returns 0 on success, 1 if the program should exit (i.e. invalid
+/// arguments or --help) and 2 if no rom was provided.
+extern const uint32_t CHIP8_config_init(CHIP8_config *config, int argc,
+                                        char **argv);
+
+#endif
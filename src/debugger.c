@@ -0,0 +1,699 @@
+#include "debugger.h"
+#include "chip8.h"
+#include "chip8_machine.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define DEBUGGER_LINE_SIZE 256
+#define DEBUGGER_MAX_WORDS 8
+#define DEBUGGER_REASON_SIZE 128
+
+// Bytes 'mem' shows, unless told otherwise
+#define DEBUGGER_DUMP_SIZE 64
+#define DEBUGGER_MAX_DUMP_SIZE 1024
+
+typedef enum {
+    DEBUGGER_NONE,
+    DEBUGGER_BREAKPOINT,
+    DEBUGGER_WATCHPOINT,
+} debugger_type;
+
+typedef struct {
+    uint8_t type;
+    uint8_t condition;
+    uint8_t reg;
+    uint16_t value;
+    // Breakpoint address, or the watched range [start, end]
+    uint16_t start;
+    uint16_t end;
+    uint32_t hits;
+} debugger_point;
+
+struct CHIP8_debugger {
+    debugger_point points[CHIP8_DEBUGGER_MAX_POINTS];
+    uint32_t armed;
+
+    // One bit per address with a breakpoint, and per page with a watchpoint
+    uint64_t breakpoints[CHIP8_MEM_SIZE / 64];
+    uint64_t watched[CHIP8_MEM_PAGES / 64];
+
+    // Watched memory as of the last store (or the last prompt), to tell
+    // which bytes a store changed
+    uint8_t shadow[CHIP8_MEM_SIZE];
+
+    // Don't stop at the breakpoint at resume_pc, if it comes first
+    uint8_t resume;
+    uint16_t resume_pc;
+
+    char reason[DEBUGGER_REASON_SIZE];
+};
+
+static const char *debugger_conditions[] = {
+    [CHIP8_DEBUGGER_ALWAYS] = "", [CHIP8_DEBUGGER_EQ] = "==",
+    [CHIP8_DEBUGGER_NE] = "!=",   [CHIP8_DEBUGGER_LT] = "<",
+    [CHIP8_DEBUGGER_LE] = "<=",   [CHIP8_DEBUGGER_GT] = ">",
+    [CHIP8_DEBUGGER_GE] = ">=",
+};
+
+static volatile sig_atomic_t debugger_interrupt = 0;
+static struct sigaction debugger_previous_action;
+
+static void debugger_signal(int signal) {
+    (void)signal;
+    debugger_interrupt = 1;
+}
+
+static const uint8_t debugger_bit(const uint64_t *bits, const uint32_t index) {
+    return (bits[index / 64] >> (index % 64)) & 1;
+}
+
+// Rebuild the address and page bits from the points
+static void debugger_update(CHIP8_debugger *debugger) {
+    memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+    memset(debugger->watched, 0, sizeof(debugger->watched));
+    debugger->armed = 0;
+
+    for (uint32_t i = 0; i < CHIP8_DEBUGGER_MAX_POINTS; i++) {
+        const debugger_point *point = &debugger->points[i];
+
+        if (point->type == DEBUGGER_BREAKPOINT) {
+            debugger->breakpoints[point->start / 64] |= 1ull
+                                                        << (point->start % 64);
+        } else if (point->type == DEBUGGER_WATCHPOINT) {
+            for (uint32_t page = point->start / CHIP8_MEM_PAGE_SIZE;
+                 page <= point->end / CHIP8_MEM_PAGE_SIZE; page++)
+                debugger->watched[page / 64] |= 1ull << (page % 64);
+        } else {
+            continue;
+        }
+
+        debugger->armed++;
+    }
+}
+
+// Take the current memory as what watchpoints compare against (memory can
+// change without a store, i.e. when the rom is restarted)
+static void debugger_sync(CHIP8_debugger *debugger) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    for (uint32_t i = 0; i < CHIP8_DEBUGGER_MAX_POINTS; i++) {
+        const debugger_point *point = &debugger->points[i];
+        if (point->type == DEBUGGER_WATCHPOINT)
+            memcpy(debugger->shadow + point->start, machine->mem + point->start,
+                   point->end - point->start + 1);
+    }
+}
+
+static const uint16_t debugger_reg_value(const uint8_t reg) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    return reg == CHIP8_DEBUGGER_REG_I ? machine->index_reg : machine->reg[reg];
+}
+
+static const uint8_t debugger_condition(const debugger_point *point) {
+    const uint16_t value = debugger_reg_value(point->reg);
+
+    switch (point->condition) {
+    case CHIP8_DEBUGGER_EQ:
+        return value == point->value;
+    case CHIP8_DEBUGGER_NE:
+        return value != point->value;
+    case CHIP8_DEBUGGER_LT:
+        return value < point->value;
+    case CHIP8_DEBUGGER_LE:
+        return value <= point->value;
+    case CHIP8_DEBUGGER_GT:
+        return value > point->value;
+    case CHIP8_DEBUGGER_GE:
+        return value >= point->value;
+    case CHIP8_DEBUGGER_ALWAYS:
+    default:
+        return 1;
+    }
+}
+
+static void debugger_reg_name(const uint8_t reg, char *name) {
+    if (reg == CHIP8_DEBUGGER_REG_I)
+        snprintf(name, 4, "I");
+    else
+        snprintf(name, 4, "V%X", reg);
+}
+
+const uint32_t CHIP8_debugger_attach(void) {
+    CHIP8_machine *machine = CHIP8_machine_get();
+
+    if (machine->debugger != NULL)
+        return 0;
+
+    machine->debugger = calloc(1, sizeof(*machine->debugger));
+    if (machine->debugger == NULL)
+        return 1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = debugger_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGINT, &action, &debugger_previous_action) != 0)
+        log_warn("%s", "debugger: Failed to install the SIGINT handler");
+
+    return 0;
+}
+
+void CHIP8_debugger_detach(void) {
+    CHIP8_machine *machine = CHIP8_machine_get();
+
+    if (machine->debugger == NULL)
+        return;
+
+    // Decode the breakpoints away
+    for (uint32_t i = 0; i < CHIP8_DEBUGGER_MAX_POINTS; i++) {
+        const debugger_point *point = &machine->debugger->points[i];
+        if (point->type == DEBUGGER_BREAKPOINT)
+            CHIP8_decoded_drop(point->start, point->start + 1);
+    }
+
+    free(machine->debugger);
+    machine->debugger = NULL;
+    sigaction(SIGINT, &debugger_previous_action, NULL);
+}
+
+// Free slot, or NULL
+static debugger_point *debugger_allocate(CHIP8_debugger *debugger,
+                                         uint32_t *number) {
+    for (uint32_t i = 0; i < CHIP8_DEBUGGER_MAX_POINTS; i++) {
+        if (debugger->points[i].type == DEBUGGER_NONE) {
+            memset(&debugger->points[i], 0, sizeof(debugger->points[i]));
+            *number = i + 1;
+            return &debugger->points[i];
+        }
+    }
+
+    return NULL;
+}
+
+const uint32_t
+CHIP8_debugger_add_breakpoint(const uint16_t address,
+                              const CHIP8_DEBUGGER_CONDITION condition,
+                              const uint8_t reg, const uint16_t value) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    uint32_t number = 0;
+    debugger_point *point = debugger_allocate(machine->debugger, &number);
+    if (point == NULL)
+        return 0;
+
+    point->type = DEBUGGER_BREAKPOINT;
+    point->start = point->end = address;
+    point->condition = condition;
+    point->reg = reg;
+    point->value = value;
+
+    debugger_update(machine->debugger);
+    CHIP8_decoded_drop(address, address + 1);
+
+    return number;
+}
+
+const uint32_t CHIP8_debugger_add_watchpoint(const uint16_t start,
+                                             const uint16_t end) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    uint32_t number = 0;
+    debugger_point *point = debugger_allocate(machine->debugger, &number);
+    if (point == NULL)
+        return 0;
+
+    point->type = DEBUGGER_WATCHPOINT;
+    point->start = start <= end ? start : end;
+    point->end = start <= end ? end : start;
+
+    debugger_update(machine->debugger);
+    debugger_sync(machine->debugger);
+
+    return number;
+}
+
+const uint32_t CHIP8_debugger_delete(const uint32_t number) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    if (number == 0 || number > CHIP8_DEBUGGER_MAX_POINTS)
+        return 1;
+
+    debugger_point *point = &machine->debugger->points[number - 1];
+    if (point->type == DEBUGGER_NONE)
+        return 1;
+
+    const uint8_t type = point->type;
+    point->type = DEBUGGER_NONE;
+    debugger_update(machine->debugger);
+
+    if (type == DEBUGGER_BREAKPOINT)
+        CHIP8_decoded_drop(point->start, point->start + 1);
+
+    return 0;
+}
+
+const uint8_t CHIP8_debugger_interrupted(void) {
+    const uint8_t result = debugger_interrupt;
+    debugger_interrupt = 0;
+
+    return result;
+}
+
+const char *CHIP8_debugger_reason(void) {
+    return CHIP8_machine_get()->debugger->reason;
+}
+
+// -------------
+
+const uint8_t CHIP8_debugger_has_breakpoint(const uint32_t start,
+                                            const uint32_t end) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    const CHIP8_debugger *debugger = machine->debugger;
+
+    for (uint32_t address = start; address < end && address < CHIP8_MEM_SIZE;
+         address++) {
+        if (debugger_bit(debugger->breakpoints, address))
+            return 1;
+    }
+
+    return 0;
+}
+
+const uint8_t CHIP8_debugger_break(void) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_debugger *debugger = machine->debugger;
+
+    if (debugger->resume) {
+        debugger->resume = 0;
+        if (machine->pc == debugger->resume_pc)
+            return 0;
+    }
+
+    for (uint32_t i = 0; i < CHIP8_DEBUGGER_MAX_POINTS; i++) {
+        debugger_point *point = &debugger->points[i];
+        if (point->type != DEBUGGER_BREAKPOINT || point->start != machine->pc ||
+            !debugger_condition(point))
+            continue;
+
+        point->hits++;
+        snprintf(debugger->reason, sizeof(debugger->reason),
+                 "breakpoint %u at 0x%04x", i + 1, point->start);
+        return 1;
+    }
+
+    return 0;
+}
+
+const uint8_t CHIP8_debugger_stored(const uint32_t index) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_debugger *debugger = machine->debugger;
+    uint8_t hit = 0;
+
+    for (uint32_t i = 0; i < CHIP8_REGISTERS; i++) {
+        const uint32_t address = (index + i) % CHIP8_MEM_SIZE;
+
+        if (!debugger_bit(debugger->watched, address / CHIP8_MEM_PAGE_SIZE) ||
+            machine->mem[address] == debugger->shadow[address])
+            continue;
+
+        for (uint32_t j = 0; j < CHIP8_DEBUGGER_MAX_POINTS && !hit; j++) {
+            debugger_point *point = &debugger->points[j];
+            if (point->type != DEBUGGER_WATCHPOINT || address < point->start ||
+                address > point->end)
+                continue;
+
+            point->hits++;
+            snprintf(debugger->reason, sizeof(debugger->reason),
+                     "watchpoint %u: mem[0x%04x] 0x%02x -> 0x%02x", j + 1,
+                     address, debugger->shadow[address], machine->mem[address]);
+            hit = 1;
+        }
+
+        debugger->shadow[address] = machine->mem[address];
+    }
+
+    return hit;
+}
+
+const uint8_t CHIP8_debugger_armed(void) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    return machine->debugger->armed != 0;
+}
+
+const int32_t CHIP8_debugger_run(const uint32_t cycles, uint32_t *executed) {
+    CHIP8_machine *machine = CHIP8_machine_get();
+    const CHIP8_debugger *debugger = machine->debugger;
+    int32_t status = 0;
+    uint32_t count = 0;
+
+    while (count < cycles) {
+        if (debugger_bit(debugger->breakpoints, machine->pc) &&
+            CHIP8_debugger_break()) {
+            status = CHIP8_DEBUGGER_STATUS;
+            break;
+        }
+
+        const uint32_t index = machine->index_reg;
+        const uint32_t writes = machine->mem_writes;
+        status = CHIP8_cpu_step();
+        if (status != 0)
+            break;
+        count++;
+
+        if (machine->mem_writes != writes && CHIP8_debugger_stored(index)) {
+            status = CHIP8_DEBUGGER_STATUS;
+            break;
+        }
+    }
+
+    // 'exit' has been executed, an invalid instruction has not
+    if (status == 2)
+        count++;
+
+    machine->cycles += count;
+    if (executed != NULL)
+        *executed = count;
+
+    return status;
+}
+
+// -------------
+
+static const uint32_t debugger_parse_number(const char *word,
+                                            const uint32_t max,
+                                            uint32_t *result) {
+    char *end = NULL;
+
+    errno = 0;
+    const unsigned long number = strtoul(word, &end, 0);
+    if (errno != 0 || end == word || *end != '\0' || number > max)
+        return 1;
+
+    *result = number;
+    return 0;
+}
+
+static const uint32_t debugger_parse_reg(const char *word, uint8_t *reg) {
+    if (strcasecmp(word, "i") == 0) {
+        *reg = CHIP8_DEBUGGER_REG_I;
+        return 0;
+    }
+
+    if ((word[0] != 'v' && word[0] != 'V') || !isxdigit(word[1]) ||
+        word[2] != '\0')
+        return 1;
+
+    *reg = strtoul(word + 1, NULL, 16);
+    return 0;
+}
+
+static const uint32_t debugger_parse_condition(const char *word,
+                                               uint8_t *condition) {
+    for (uint32_t i = CHIP8_DEBUGGER_EQ; i <= CHIP8_DEBUGGER_GE; i++) {
+        if (strcmp(word, debugger_conditions[i]) == 0) {
+            *condition = i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static const uint16_t debugger_word(const uint32_t address) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    return (machine->mem[address % CHIP8_MEM_SIZE] << 8) |
+           machine->mem[(address + 1) % CHIP8_MEM_SIZE];
+}
+
+static void debugger_where(void) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    printf("pc 0x%04x: %04x  (%llu instructions executed)\n", machine->pc,
+           debugger_word(machine->pc), (unsigned long long)machine->cycles);
+}
+
+static void debugger_help(void) {
+    printf("Commands:\n"
+           "  c, continue              Run until the next stop\n"
+           "  s, step [<n>]            Execute <n> instructions (default: 1)\n"
+           "  b, break <addr> [if <reg> <op> <value>]\n"
+           "                           Stop before the instruction at <addr>\n"
+           "                           (<reg>: V0-VF or I, <op>: == != < <= "
+           "> >=)\n"
+           "  w, watch <start> [<end>] Stop after a store changes memory in\n"
+           "                           [<start>, <end>]\n"
+           "  d, delete <n>            Remove breakpoint/watchpoint <n>\n"
+           "  i, info                  List breakpoints and watchpoints\n"
+           "  r, regs                  Show the registers, stack and timers\n"
+           "  x, mem <addr> [<n>]      Show <n> bytes of memory (default: "
+           "%d)\n"
+           "  q, quit                  Exit the emulator\n"
+           "Numbers are decimal, or hexadecimal with 0x. Ctrl-C stops the "
+           "rom.\n",
+           DEBUGGER_DUMP_SIZE);
+}
+
+static void debugger_info(const CHIP8_debugger *debugger) {
+    if (debugger->armed == 0) {
+        printf("No breakpoints or watchpoints\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < CHIP8_DEBUGGER_MAX_POINTS; i++) {
+        const debugger_point *point = &debugger->points[i];
+
+        if (point->type == DEBUGGER_BREAKPOINT) {
+            printf("%2u  breakpoint  0x%04x", i + 1, point->start);
+            if (point->condition != CHIP8_DEBUGGER_ALWAYS) {
+                char name[4];
+                debugger_reg_name(point->reg, name);
+                printf(" if %s %s 0x%x", name,
+                       debugger_conditions[point->condition], point->value);
+            }
+        } else if (point->type == DEBUGGER_WATCHPOINT) {
+            printf("%2u  watchpoint  0x%04x-0x%04x", i + 1, point->start,
+                   point->end);
+        } else {
+            continue;
+        }
+
+        printf("  (hit %u time(s))\n", point->hits);
+    }
+}
+
+static void debugger_regs(void) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    for (uint32_t i = 0; i < CHIP8_REGISTERS; i++)
+        printf("V%X 0x%02x%s", i, machine->reg[i], i % 8 == 7 ? "\n" : "  ");
+
+    printf("I  0x%04x  pc 0x%04x  sp %u  DT %u  ST %u\n", machine->index_reg,
+           machine->pc, machine->sp, machine->timer, machine->timer_sound);
+
+    if (machine->sp > 0) {
+        printf("stack:");
+        for (uint32_t i = 0; i < machine->sp && i < CHIP8_STACK_SIZE; i++)
+            printf(" 0x%04x", machine->stack[i]);
+        printf("\n");
+    }
+}
+
+static void debugger_dump(const uint32_t start, const uint32_t size) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    for (uint32_t offset = 0; offset < size; offset += 16) {
+        printf("0x%04x:", (start + offset) % CHIP8_MEM_SIZE);
+        for (uint32_t i = offset; i < offset + 16 && i < size; i++)
+            printf(" %02x", machine->mem[(start + i) % CHIP8_MEM_SIZE]);
+        printf("\n");
+    }
+}
+
+// 'break <addr> [if <reg> <op> <value>]'
+static void debugger_command_break(char **words, const uint32_t count) {
+    uint32_t address = 0;
+    uint8_t condition = CHIP8_DEBUGGER_ALWAYS;
+    uint8_t reg = 0;
+    uint32_t value = 0;
+
+    if ((count != 2 && count != 6) ||
+        debugger_parse_number(words[1], CHIP8_MEM_SIZE - 1, &address) != 0 ||
+        (count == 6 &&
+         (strcmp(words[2], "if") != 0 ||
+          debugger_parse_reg(words[3], &reg) != 0 ||
+          debugger_parse_condition(words[4], &condition) != 0 ||
+          debugger_parse_number(words[5], UINT16_MAX, &value) != 0))) {
+        printf("Usage: break <addr> [if <reg> <op> <value>]\n");
+        return;
+    }
+
+    const uint32_t number =
+        CHIP8_debugger_add_breakpoint(address, condition, reg, value);
+    if (number == 0)
+        printf("Too many breakpoints/watchpoints (max. %d)\n",
+               CHIP8_DEBUGGER_MAX_POINTS);
+    else
+        printf("Breakpoint %u at 0x%04x\n", number, address);
+}
+
+// 'watch <start> [<end>]'
+static void debugger_command_watch(char **words, const uint32_t count) {
+    uint32_t start = 0;
+    uint32_t end = 0;
+
+    if ((count != 2 && count != 3) ||
+        debugger_parse_number(words[1], CHIP8_MEM_SIZE - 1, &start) != 0 ||
+        debugger_parse_number(count == 3 ? words[2] : words[1],
+                              CHIP8_MEM_SIZE - 1, &end) != 0) {
+        printf("Usage: watch <start> [<end>]\n");
+        return;
+    }
+
+    const uint32_t number = CHIP8_debugger_add_watchpoint(start, end);
+    if (number == 0)
+        printf("Too many breakpoints/watchpoints (max. %d)\n",
+               CHIP8_DEBUGGER_MAX_POINTS);
+    else
+        printf("Watchpoint %u at 0x%04x-0x%04x\n", number,
+               start <= end ? start : end, start <= end ? end : start);
+}
+
+// Run <cycles> instructions from the prompt. Returns 1 if the rom is done.
+static const uint32_t
+debugger_step(const int32_t (*run)(uint32_t cycles, uint32_t *executed),
+              const uint32_t cycles) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_debugger *debugger = machine->debugger;
+
+    debugger->reason[0] = '\0';
+    debugger->resume = 1;
+    debugger->resume_pc = machine->pc;
+
+    uint32_t executed = 0;
+    const int32_t status = run(cycles, &executed);
+    debugger->resume = 0;
+
+    if (status == 2) {
+        printf("The rom exited\n");
+        return 1;
+    }
+
+    if (status == -1) {
+        printf("Invalid instruction at 0x%04x: %04x\n", machine->pc,
+               debugger_word(machine->pc));
+        return 1;
+    }
+
+    if (status == CHIP8_DEBUGGER_STATUS)
+        printf("Stopped: %s\n", debugger->reason);
+
+    debugger_where();
+    return 0;
+}
+
+const uint32_t
+CHIP8_debugger_prompt(const int32_t (*run)(uint32_t cycles,
+                                           uint32_t *executed)) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_debugger *debugger = machine->debugger;
+    char line[DEBUGGER_LINE_SIZE];
+
+    if (debugger->reason[0] != '\0')
+        printf("Stopped: %s\n", debugger->reason);
+    debugger_where();
+
+    for (;;) {
+        printf("(chip8) ");
+        fflush(stdout);
+
+        // End of input: Nobody is there to continue
+        if (fgets(line, sizeof(line), stdin) == NULL) {
+            printf("\n");
+            return 1;
+        }
+
+        char *words[DEBUGGER_MAX_WORDS];
+        uint32_t count = 0;
+        for (char *word = strtok(line, " \t\r\n");
+             word != NULL && count < DEBUGGER_MAX_WORDS;
+             word = strtok(NULL, " \t\r\n"))
+            words[count++] = word;
+
+        if (count == 0)
+            continue;
+
+        const char *command = words[0];
+#define DEBUGGER_IS(short_name, long_name)                                     \
+    (strcmp(command, short_name) == 0 || strcmp(command, long_name) == 0)
+
+        if (DEBUGGER_IS("c", "continue")) {
+            // The first instruction may be the breakpoint we stopped at
+            debugger->reason[0] = '\0';
+            debugger->resume = 1;
+            debugger->resume_pc = machine->pc;
+            debugger_sync(debugger);
+            debugger_interrupt = 0;
+            return 0;
+        } else if (DEBUGGER_IS("s", "step")) {
+            uint32_t steps = 1;
+            if (count > 1 &&
+                debugger_parse_number(words[1], UINT32_MAX, &steps) != 0) {
+                printf("Usage: step [<n>]\n");
+                continue;
+            }
+
+            debugger_sync(debugger);
+            if (debugger_step(run, steps) != 0)
+                return 1;
+        } else if (DEBUGGER_IS("b", "break")) {
+            debugger_command_break(words, count);
+        } else if (DEBUGGER_IS("w", "watch")) {
+            debugger_command_watch(words, count);
+        } else if (DEBUGGER_IS("d", "delete")) {
+            uint32_t number = 0;
+            if (count != 2 ||
+                debugger_parse_number(words[1], UINT32_MAX, &number) != 0 ||
+                CHIP8_debugger_delete(number) != 0)
+                printf("Usage: delete <n> (see 'info')\n");
+        } else if (DEBUGGER_IS("i", "info")) {
+            debugger_info(debugger);
+        } else if (DEBUGGER_IS("r", "regs")) {
+            debugger_regs();
+        } else if (DEBUGGER_IS("x", "mem")) {
+            uint32_t start = 0;
+            uint32_t size = DEBUGGER_DUMP_SIZE;
+            if (count < 2 || count > 3 ||
+                debugger_parse_number(words[1], CHIP8_MEM_SIZE - 1, &start) !=
+                    0 ||
+                (count == 3 && debugger_parse_number(
+                                   words[2], DEBUGGER_MAX_DUMP_SIZE, &size) !=
+                                   0)) {
+                printf("Usage: mem <addr> [<n>] (n <= %d)\n",
+                       DEBUGGER_MAX_DUMP_SIZE);
+                continue;
+            }
+
+            debugger_dump(start, size);
+        } else if (DEBUGGER_IS("q", "quit")) {
+            return 1;
+        } else if (DEBUGGER_IS("h", "help")) {
+            debugger_help();
+        } else {
+            printf("Unknown command '%s' (see 'help')\n", command);
+        }
+
+#undef DEBUGGER_IS
+    }
+}
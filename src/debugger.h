@@ -0,0 +1,90 @@
+#ifndef _CHIP8_DEBUGGER_H_
+#define _CHIP8_DEBUGGER_H_
+
+#include <stdint.h>
+
+// Interactive debugger for the selected machine: pc breakpoints (optionally
+// conditional on a register), write watchpoints on memory ranges and a
+// command prompt on stdin.
+//
+// Nothing is checked per instruction. Breakpoints are patched into the
+// predecoded instructions (an address with a breakpoint decodes to a stop,
+// and nothing is fused across it), and watchpoints mark the pages they
+// cover, which are only looked at when a store writes to one of them. The
+// interpreter engine checks every instruction, but only while a breakpoint
+// or watchpoint is set. Without any, both engines run as fast as without a
+// debugger.
+//
+// When the machine stops, CHIP8_cpu_run returns CHIP8_DEBUGGER_STATUS. A
+// breakpoint stops before its instruction, a watchpoint after the store
+// that changed the watched memory.
+
+// Status CHIP8_cpu_run returns when a breakpoint or watchpoint is hit
+#define CHIP8_DEBUGGER_STATUS 3
+
+// Breakpoints and watchpoints, together
+#define CHIP8_DEBUGGER_MAX_POINTS 32
+
+typedef enum {
+    CHIP8_DEBUGGER_ALWAYS,
+    CHIP8_DEBUGGER_EQ,
+    CHIP8_DEBUGGER_NE,
+    CHIP8_DEBUGGER_LT,
+    CHIP8_DEBUGGER_LE,
+    CHIP8_DEBUGGER_GT,
+    CHIP8_DEBUGGER_GE,
+} CHIP8_DEBUGGER_CONDITION;
+
+// Register in a condition: V0-VF, or I
+#define CHIP8_DEBUGGER_REG_I 16
+
+/// Attach a debugger to the selected machine (no breakpoints yet), and
+/// break into it on SIGINT (Ctrl-C) instead of exiting
+extern const uint32_t CHIP8_debugger_attach(void);
+extern void CHIP8_debugger_detach(void);
+
+/// Stop before the instruction at <address>, if <reg> (V0-VF or
+/// CHIP8_DEBUGGER_REG_I) compares to <value> as <condition> says. Returns
+/// the number of the breakpoint, 0 if all are in use.
+extern const uint32_t
+CHIP8_debugger_add_breakpoint(uint16_t address,
+                              CHIP8_DEBUGGER_CONDITION condition, uint8_t reg,
+                              uint16_t value);
+
+/// Stop after any store that changes memory in [start, end]. Returns the
+/// number of the watchpoint, 0 if all are in use.
+extern const uint32_t CHIP8_debugger_add_watchpoint(uint16_t start,
+                                                    uint16_t end);
+
+/// Remove breakpoint or watchpoint <number>. Returns 1 if there is none.
+extern const uint32_t CHIP8_debugger_delete(uint32_t number);
+
+/// Whether SIGINT was received since the last call
+extern const uint8_t CHIP8_debugger_interrupted(void);
+
+/// Why the machine stopped last (i.e. "breakpoint 1 at 0x0234")
+extern const char *CHIP8_debugger_reason(void);
+
+/// Read and execute commands from stdin until the rom should continue
+/// (returns 0) or exit (returns 1). Steps run on <run> (i.e. CHIP8_cpu_run).
+/// Type 'help' for the commands.
+extern const uint32_t
+CHIP8_debugger_prompt(const int32_t (*run)(uint32_t cycles,
+                                           uint32_t *executed));
+
+// Used by the cores (see chip8.c)
+
+/// Whether a breakpoint is set in [start, end)
+extern const uint8_t CHIP8_debugger_has_breakpoint(uint32_t start,
+                                                   uint32_t end);
+/// At a breakpoint address: Whether to stop before the instruction at pc
+extern const uint8_t CHIP8_debugger_break(void);
+/// After a store at <index> (writes at most 16 bytes): Whether it changed
+/// watched memory
+extern const uint8_t CHIP8_debugger_stored(uint32_t index);
+/// Whether any breakpoint or watchpoint is set
+extern const uint8_t CHIP8_debugger_armed(void);
+/// Like CHIP8_cpu_run with the interpreter, checking every instruction
+extern const int32_t CHIP8_debugger_run(uint32_t cycles, uint32_t *executed);
+
+#endif
@@ -1,6 +1,19 @@
 #include "chip8.h"
+#include "aot.h"
 #include "log.h"
 #include "backend.h"
+#include "batch.h"
+#include "bench.h"
+#include "capture.h"
+#include "config.h"
+#include "debugger.h"
+#include "input.h"
+#include "netplay.h"
+#include "recorder.h"
+#include "server.h"
+#include "stats.h"
+#include "timing.h"
+#include "verify.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -9,28 +22,32 @@
 #include <errno.h>
 #include <time.h>
 
-// TODO: Different hardware might have different clock resolutions...
-#define INT_PER_FRAME 50
+// Share of a frame the adaptive controller may spend on emulation
+// and rendering. The rest is kept as a safety margin.
+#define CHIP8_ADAPTIVE_LOAD_PERCENT 75
 
-#define CHIP8_TIMER_RENDER_HZ 60
-#define CHIP8_TIMER_RENDER_RATE_NSEC (int)(1000000000 / CHIP8_TIMER_RENDER_HZ)
+#define CHIP8_SPEED_REPORT_NSEC 1000000000ull
 
-#define CHIP8_TIMER_TIMER_HZ 60
-#define CHIP8_TIMER_TIMER_RATE_NSEC (int)(1000000000 / CHIP8_TIMER_TIMER_HZ)
+// Runs the instructions of a frame (replaced in ahead-of-time builds)
+static const int32_t (*cpu_run)(uint32_t cycles,
+                                uint32_t *executed) = CHIP8_cpu_run;
 
-#define CHIP8_TIMER_CPU_HZ (INT_PER_FRAME * CHIP8_TIMER_RENDER_HZ)
-#define CHIP8_TIMER_CPU_RATE_NSEC (int)(1000000000 / CHIP8_TIMER_CPU_HZ)
+// Stream for non-error messages. Moved to stderr, if stdout is used
+// for something else (i.e. capturing to stdout)
+static FILE *log_stream = NULL;
 
 void log_func_impl(LOG_LEVEL level, char *str) {
+    FILE *stream = log_stream != NULL ? log_stream : stdout;
+
     switch (level) {
     case LOG_LEVEL_DEBUG:
-        fprintf(stdout, "[\033[34mDEBUG\033[0m] %s\n", str);
+        fprintf(stream, "[\033[34mDEBUG\033[0m] %s\n", str);
         break;
     case LOG_LEVEL_INFO:
-        fprintf(stdout, "[\033[32mINFO\033[0m] %s\n", str);
+        fprintf(stream, "[\033[32mINFO\033[0m] %s\n", str);
         break;
     case LOG_LEVEL_WARN:
-        fprintf(stdout, "[\033[33mWARN\033[0m] %s\n", str);
+        fprintf(stream, "[\033[33mWARN\033[0m] %s\n", str);
         break;
     case LOG_LEVEL_ERROR:
         fprintf(stderr, "[\033[31mERROR\033[0m] %s\n", str);
@@ -40,62 +57,249 @@ void log_func_impl(LOG_LEVEL level, char *str) {
     }
 }
 
-uint32_t CHIP8_run(void) {
-    struct timespec timer_tick, timer_timer, timer_render, now;
+// Pick the instructions for the next frame, based on how long this frame
+// took (<time_cpu> for emulation, <time_frame> in total).
+static uint32_t CHIP8_adaptive_update(const CHIP8_config *config,
+                                      uint32_t cycles, uint64_t time_cpu,
+                                      uint64_t time_frame) {
+    const uint64_t budget =
+        CHIP8_TIMER_RENDER_RATE_NSEC * CHIP8_ADAPTIVE_LOAD_PERCENT / 100;
 
-    size_t diff_tick = 0;
-    size_t diff_timer = 0;
-    size_t diff_render = 0;
+    // Missed the safety margin: back off quickly
+    if (time_frame > budget) {
+        cycles -= cycles / 4;
+        return cycles < config->cycles_per_frame ? config->cycles_per_frame
+                                                 : cycles;
+    }
 
-    uint8_t is_running = 1;
-    uint8_t is_running_chip = 1;
+    if (time_cpu == 0)
+        time_cpu = 1;
+
+    // Time left for emulation, assuming rendering takes as long as now
+    const uint64_t budget_cpu = budget - (time_frame - time_cpu);
+    uint64_t estimate = (uint64_t)cycles * budget_cpu / time_cpu;
+
+    // Only cover half the distance, to smooth out noisy measurements
+    if (estimate > cycles)
+        estimate = cycles + (estimate - cycles + 1) / 2;
 
+    if (estimate > config->adaptive_target)
+        estimate = config->adaptive_target;
+    if (estimate < config->cycles_per_frame)
+        estimate = config->cycles_per_frame;
+
+    return estimate;
+}
+
+uint32_t CHIP8_run(const CHIP8_config *config) {
+    uint8_t is_running = 1;
     uint32_t exit_code = 0;
 
-    if (CHIP8_backend_init() == 1) {
+    uint32_t cycles = config->cycles_per_frame;
+    const uint32_t cycles_requested =
+        config->adaptive ? config->adaptive_target : config->cycles_per_frame;
+
+    uint64_t report_executed = 0;
+    uint32_t report_missed = 0;
+    uint32_t frame_count = 0;
+
+    // Every output is a sink, fed by CHIP8_backend_frame
+    CHIP8_backend_init(config->scaler);
+
+    if (!config->headless && config->terminal &&
+        CHIP8_backend_term_open(config->render_interval) != 0)
+        exit(1);
+
+    if (!config->headless && !config->terminal &&
+        CHIP8_backend_sdl_open(config->overlay, config->background_hidden,
+                               config->background_unfocused,
+                               config->render_interval) != 0) {
         log_error("%s", "Failed to initalize backend");
         exit(1);
     }
 
-    clock_gettime(CLOCK_REALTIME, &timer_tick);
-    clock_gettime(CLOCK_REALTIME, &timer_timer);
-    clock_gettime(CLOCK_REALTIME, &timer_render);
+    if (config->capture_path != NULL &&
+        CHIP8_capture_open(config->capture_path, config->capture_format,
+                           config->capture_scale, config->scaler,
+                           config->capture_interval) != 0)
+        exit(1);
+
+    CHIP8_netplay *netplay = NULL;
+    if (config->netplay_address != NULL) {
+        netplay = CHIP8_netplay_open(config->netplay_address, cycles,
+                                     config->netplay_delay,
+                                     config->netplay_loss);
+        if (netplay == NULL)
+            exit(1);
+    }
+
+    CHIP8_stats_init();
+
+    if (config->debug) {
+        CHIP8_backend_refresh();
+        if (CHIP8_debugger_prompt(cpu_run) != 0)
+            is_running = 0;
+    }
+
+    uint64_t deadline = time_now_nsec() + CHIP8_TIMER_RENDER_RATE_NSEC;
+    uint64_t report_start = time_now_nsec();
+    uint32_t throttled = 0;
 
     while (is_running) {
-        clock_gettime(CLOCK_REALTIME, &now);
+        CHIP8_BACKGROUND background = CHIP8_backend_background();
 
-        diff_tick = now.tv_nsec - timer_tick.tv_nsec;
-        if (is_running_chip && diff_tick >= CHIP8_TIMER_CPU_RATE_NSEC) {
-            int32_t cpu_status = CHIP8_cpu_cycle();
+        // The other player can't wait: Keep up, just don't render
+        if (netplay != NULL && background != CHIP8_BACKGROUND_RUN)
+            background = CHIP8_BACKGROUND_NORENDER;
 
-            switch (cpu_status) {
-            case -1: // invalid optcode
-                exit(1);
-            case 2: // optcode: exit
+        // Paused (or hidden): Sleep until a window event changes that. Real
+        // time starts over once the rom continues.
+        if (background == CHIP8_BACKGROUND_PAUSE) {
+            if (CHIP8_backend_wait() != 0)
                 is_running = 0;
-                break;
-            }
+            deadline = time_now_nsec() + CHIP8_TIMER_RENDER_RATE_NSEC;
+            continue;
+        }
 
-            clock_gettime(CLOCK_REALTIME, &timer_tick);
+        const uint64_t frame_start = time_now_nsec();
+
+        uint32_t executed = 0;
+        uint32_t ticks = 0;
+        int32_t cpu_status;
+
+        // Netplay runs whole frames (timers included), keys only change
+        // in between
+        if (netplay != NULL)
+            cpu_status =
+                CHIP8_netplay_frame(netplay, cpu_run,
+                                    CHIP8_input_take(frame_start), &executed,
+                                    &ticks);
+        else
+            cpu_status = CHIP8_input_run_frame(cpu_run, cycles, frame_start,
+                                               &executed);
+
+        switch (cpu_status) {
+        case -1: // invalid optcode
+            // Keep the history leading up to it
+            CHIP8_recorder_close();
+            exit(1);
+        case 2: // optcode: exit
+        case CHIP8_NETPLAY_STATUS_CLOSED:
+            is_running = 0;
+            break;
         }
 
-        diff_timer = now.tv_nsec - timer_timer.tv_nsec;
-        if (is_running_chip && diff_timer >= CHIP8_TIMER_TIMER_RATE_NSEC) {
+        if (netplay == NULL) {
             CHIP8_timer_tick();
+            ticks++;
+        }
+        CHIP8_recorder_frame();
 
-            clock_gettime(CLOCK_REALTIME, &timer_timer);
+        const uint64_t cpu_end = time_now_nsec();
+
+        // Sinks in the background skip the frame themselves
+        if (CHIP8_backend_frame() != 0 || CHIP8_backend_handle_events() != 0)
+            is_running = 0;
+
+        CHIP8_screen_clear_update_status();
+
+        // Stopped by a breakpoint, a watchpoint or Ctrl-C. Real time starts
+        // over once the rom continues.
+        if (config->debug && is_running &&
+            (cpu_status == CHIP8_DEBUGGER_STATUS ||
+             CHIP8_debugger_interrupted())) {
+            if (CHIP8_debugger_prompt(cpu_run) != 0)
+                is_running = 0;
+            deadline = time_now_nsec();
         }
 
-        diff_render = now.tv_nsec - timer_render.tv_nsec;
-        if (diff_render >= CHIP8_TIMER_RENDER_RATE_NSEC) {
-            CHIP8_backend_render();
-            is_running = !CHIP8_backend_handle_events();
+        if (config->frames != 0 && cpu_status != CHIP8_NETPLAY_STATUS_WAIT &&
+            ++frame_count >= config->frames)
+            is_running = 0;
+
+        const uint64_t frame_end = time_now_nsec();
+
+        const CHIP8_stats_frame stats = {
+            .start = frame_start,
+            .cpu = cpu_end - frame_start,
+            .render = frame_end - cpu_end,
+            .executed = executed,
+            .requested = cycles,
+            .ticks = ticks,
+            .missed = !config->headless && frame_end > deadline,
+        };
+        CHIP8_stats_record(&stats);
+        CHIP8_stats_poll();
+
+        // Without rendering, the frame times say nothing about the budget
+        if (config->adaptive && background == CHIP8_BACKGROUND_RUN)
+            cycles = CHIP8_adaptive_update(config, cycles,
+                                           cpu_end - frame_start,
+                                           frame_end - frame_start);
+
+        report_executed += executed;
+        if (frame_end - report_start >= CHIP8_SPEED_REPORT_NSEC) {
+            const uint64_t elapsed = frame_end - report_start;
 
-            clock_gettime(CLOCK_REALTIME, &timer_render);
+            log_info("Speed: %llu ips (requested: %u ips, %u per frame, "
+                     "%u missed frame(s))",
+                     (unsigned long long)(report_executed * 1000000000ull /
+                                          elapsed),
+                     cycles_requested * CHIP8_TIMER_RENDER_HZ, cycles,
+                     report_missed);
+
+            report_executed = 0;
+            report_missed = 0;
+            report_start = frame_end;
+        }
+
+        // Without a window, nobody is watching: Run as fast as possible
+        if (config->headless)
+            continue;
+
+        // Throttled: Run a batch of frames back to back, then sleep until
+        // the last one is due
+        if (background == CHIP8_BACKGROUND_THROTTLE &&
+            ++throttled < CHIP8_BACKEND_THROTTLE_FRAMES) {
+            deadline += CHIP8_TIMER_RENDER_RATE_NSEC;
+            continue;
+        }
+        throttled = 0;
+
+        // Running late: Start the next frame right away and resync,
+        // instead of trying to catch up
+        if (frame_end > deadline) {
+            report_missed++;
+            deadline = frame_end;
+        } else if (background != CHIP8_BACKGROUND_RUN) {
+            // Nobody is playing: Wake up once per frame (or batch) only
+            time_sleep_until(deadline);
+            if (CHIP8_backend_handle_events())
+                is_running = 0;
+        } else {
+            // Keep polling while waiting, so events are queued close to
+            // when they happened
+            for (uint64_t now = frame_end; is_running && now < deadline;
+                 now = time_now_nsec()) {
+                const uint64_t poll = now + CHIP8_INPUT_POLL_NSEC;
+                time_sleep_until(poll < deadline ? poll : deadline);
+
+                if (CHIP8_backend_handle_events())
+                    is_running = 0;
+            }
         }
+
+        deadline += CHIP8_TIMER_RENDER_RATE_NSEC;
     }
 
     CHIP8_backend_exit();
+    CHIP8_netplay_close(netplay);
+
+    if (config->stats)
+        CHIP8_stats_dump();
+
+    if (!config->headless)
+        CHIP8_input_report();
 
     return exit_code;
 }
@@ -104,16 +308,70 @@ int main(int argc, char **argv) {
     log_init();
     log_register(LOG_LEVEL_ALL, log_func_impl);
 
-    if(!argv[1]) {
+    CHIP8_config config;
+    uint32_t result = CHIP8_config_init(&config, argc, argv);
+
+    if (result == 2) {
         log_error("%s", "Missing rom path");
         exit(2);
+    } else if (result != 0) {
+        exit(1);
+    }
+
+    const char *path = config.rom_path;
+
+    const uint8_t capture_stdout =
+        config.capture_path != NULL && strcmp(config.capture_path, "-") == 0;
+
+    // The terminal backend draws on stdout as well
+    if (capture_stdout || config.terminal)
+        log_stream = stderr;
+
+    // Both need the terminal (stdin in the debugger's case)
+    if (config.terminal && !config.headless &&
+        (capture_stdout || config.debug)) {
+        log_error("%s", "--terminal can't be combined with --debug or "
+                        "--capture -");
+        exit(1);
     }
 
-    char *path = argv[1];
+    if (config.server_path != NULL)
+        return CHIP8_server_run(&config, config.server_path);
+
+    if (config.batch_path != NULL)
+        return CHIP8_batch_run(&config, config.batch_path);
+
+    if (config.bench)
+        return CHIP8_bench_run(&config);
+
+    if (config.verify_interval != 0)
+        return CHIP8_verify_run(&config);
 
     CHIP8_init();
+    CHIP8_set_mode(config.mode);
+    CHIP8_set_engine(config.engine);
+    if (config.seed != 0)
+        CHIP8_seed(config.seed);
+    else if (config.netplay_address != NULL)
+        CHIP8_seed(CHIP8_NETPLAY_DEFAULT_SEED);
+
+    // Both peers have to run exactly the same frames, and earlier frames
+    // run again on rollbacks
+    if (config.netplay_address != NULL) {
+        if (config.debug || config.record_path != NULL) {
+            log_error("%s", "Netplay can't be combined with --debug or "
+                            "--record");
+            exit(1);
+        }
 
-    uint32_t result = CHIP8_load_from_path(path);
+        if (config.adaptive) {
+            log_warn("%s", "Netplay runs a fixed number of instructions per "
+                           "frame, ignoring --adaptive");
+            config.adaptive = 0;
+        }
+    }
+
+    result = CHIP8_load_from_path(path);
     if(result != 0) {
         log_error("Failed to load rom (%s): %s", strerror(errno), path);
         exit(1);
@@ -121,7 +379,24 @@ int main(int argc, char **argv) {
 
     log_info("Loaded rom from path: %s", path);
 
-    uint32_t exit_code = CHIP8_run();
+    if (config.debug && CHIP8_debugger_attach() != 0) {
+        log_error("%s", "Failed to attach the debugger");
+        exit(1);
+    }
+
+#ifdef CHIP8_AOT
+    // Compiled blocks know nothing about breakpoints or the recorder
+    if (!config.debug && config.record_path == NULL &&
+        CHIP8_aot_init(&chip8_aot_program) == 0)
+        cpu_run = CHIP8_aot_run;
+#endif
+
+    if (config.record_path != NULL &&
+        CHIP8_recorder_open(config.record_path, path) != 0)
+        exit(1);
+
+    uint32_t exit_code = CHIP8_run(&config);
+    CHIP8_recorder_close();
     CHIP8_exit();
 
     return exit_code;
@@ -0,0 +1,140 @@
+#include "histogram.h"
+#include "log.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Values below this are counted exactly
+#define HISTOGRAM_EXACT CHIP8_HISTOGRAM_SUB_BUCKETS
+#define HISTOGRAM_BAR_WIDTH 40
+
+static uint32_t histogram_bucket(const uint64_t value) {
+    if (value < HISTOGRAM_EXACT)
+        return value;
+
+    // Power of two, then the bits below the leading one
+    const uint32_t exponent = 63 - __builtin_clzll(value);
+    const uint32_t sub =
+        (value >> (exponent - CHIP8_HISTOGRAM_SUB_BITS)) &
+        (CHIP8_HISTOGRAM_SUB_BUCKETS - 1);
+    const uint32_t bucket =
+        HISTOGRAM_EXACT +
+        (exponent - CHIP8_HISTOGRAM_SUB_BITS) * CHIP8_HISTOGRAM_SUB_BUCKETS +
+        sub;
+
+    return bucket < CHIP8_HISTOGRAM_BUCKETS ? bucket
+                                            : CHIP8_HISTOGRAM_BUCKETS - 1;
+}
+
+// Smallest value counted in <bucket>
+static uint64_t histogram_lower(const uint32_t bucket) {
+    if (bucket < HISTOGRAM_EXACT)
+        return bucket;
+
+    const uint32_t exponent =
+        (bucket - HISTOGRAM_EXACT) / CHIP8_HISTOGRAM_SUB_BUCKETS +
+        CHIP8_HISTOGRAM_SUB_BITS;
+    const uint32_t sub =
+        (bucket - HISTOGRAM_EXACT) % CHIP8_HISTOGRAM_SUB_BUCKETS;
+
+    return (uint64_t)(CHIP8_HISTOGRAM_SUB_BUCKETS + sub)
+           << (exponent - CHIP8_HISTOGRAM_SUB_BITS);
+}
+
+void CHIP8_histogram_init(CHIP8_histogram *histogram) {
+    assert(histogram != NULL);
+
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+void CHIP8_histogram_add(CHIP8_histogram *histogram, const uint64_t value) {
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+
+    if (value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+}
+
+const uint64_t CHIP8_histogram_percentile(const CHIP8_histogram *histogram,
+                                          const double percent) {
+    if (histogram->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(histogram->count * percent / 100.0 + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < CHIP8_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen < rank)
+            continue;
+
+        // Middle of the bucket, but never beyond what was recorded
+        const uint64_t lower = histogram_lower(i);
+        const uint64_t upper = i + 1 < CHIP8_HISTOGRAM_BUCKETS
+                                   ? histogram_lower(i + 1) - 1
+                                   : histogram->max;
+        const uint64_t middle = lower + (upper - lower) / 2;
+
+        if (middle < histogram->min)
+            return histogram->min;
+        return middle < histogram->max ? middle : histogram->max;
+    }
+
+    return histogram->max;
+}
+
+void CHIP8_histogram_log(const CHIP8_histogram *histogram, const char *name,
+                         const char *unit) {
+    if (histogram->count == 0) {
+        log_info("%s: no samples", name);
+        return;
+    }
+
+    log_info("%s: %llu sample(s), min %llu, mean %llu, p50 %llu, p90 %llu, "
+             "p99 %llu, max %llu (%s)",
+             name, (unsigned long long)histogram->count,
+             (unsigned long long)histogram->min,
+             (unsigned long long)(histogram->sum / histogram->count),
+             (unsigned long long)CHIP8_histogram_percentile(histogram, 50),
+             (unsigned long long)CHIP8_histogram_percentile(histogram, 90),
+             (unsigned long long)CHIP8_histogram_percentile(histogram, 99),
+             (unsigned long long)histogram->max, unit);
+
+    // Merge the buckets into powers of two: [0, 1), [1, 2), [2, 4), ...
+    uint64_t ranges[65] = {0};
+    uint64_t largest = 0;
+    for (uint32_t i = 0; i < CHIP8_HISTOGRAM_BUCKETS; i++) {
+        const uint64_t lower = histogram_lower(i);
+        const uint32_t range = lower == 0 ? 0 : 64 - __builtin_clzll(lower);
+
+        ranges[range] += histogram->buckets[i];
+        if (ranges[range] > largest)
+            largest = ranges[range];
+    }
+
+    uint32_t first = 0, last = 64;
+    while (ranges[first] == 0)
+        first++;
+    while (ranges[last] == 0)
+        last--;
+
+    for (uint32_t range = first; range <= last; range++) {
+        char bar[HISTOGRAM_BAR_WIDTH + 1];
+        const uint32_t length =
+            (ranges[range] * HISTOGRAM_BAR_WIDTH + largest - 1) / largest;
+
+        memset(bar, '#', length);
+        bar[length] = '\0';
+
+        const uint64_t lower = range == 0 ? 0 : 1ull << (range - 1);
+        log_info("  [%8llu, %8llu) %8llu %s", (unsigned long long)lower,
+                 (unsigned long long)(1ull << range),
+                 (unsigned long long)ranges[range], bar);
+    }
+}
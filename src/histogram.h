@@ -0,0 +1,37 @@
+#ifndef _CHIP8_HISTOGRAM_H_
+#define _CHIP8_HISTOGRAM_H_
+
+#include <stdint.h>
+
+// Log-linear histogram of durations (or any other positive values): Values
+// below 32 are counted exactly, larger ones in 32 buckets per power of two,
+// so every bucket is within 3% of the values it holds (up to 2^36). Fixed
+// size, no allocations, cheap enough to record every frame.
+
+#define CHIP8_HISTOGRAM_SUB_BITS 5
+#define CHIP8_HISTOGRAM_SUB_BUCKETS (1 << CHIP8_HISTOGRAM_SUB_BITS)
+#define CHIP8_HISTOGRAM_BUCKETS 1024
+
+typedef struct {
+    uint64_t buckets[CHIP8_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} CHIP8_histogram;
+
+extern void CHIP8_histogram_init(CHIP8_histogram *histogram);
+
+extern void CHIP8_histogram_add(CHIP8_histogram *histogram, uint64_t value);
+
+/// Value at <percent> percent of all values (the middle of its bucket).
+/// 0 if the histogram is empty.
+extern const uint64_t CHIP8_histogram_percentile(
+    const CHIP8_histogram *histogram, double percent);
+
+/// Log a summary (count, min, percentiles, max) and one bar per power of
+/// two, titled <name>. Values are shown in <unit>.
+extern void CHIP8_histogram_log(const CHIP8_histogram *histogram,
+                                const char *name, const char *unit);
+
+#endif
@@ -0,0 +1,177 @@
+#include "input.h"
+#include "histogram.h"
+#include "log.h"
+
+#include <assert.h>
+
+#define INPUT_QUEUE_MASK (CHIP8_INPUT_QUEUE_SIZE - 1)
+#define INPUT_KEYS (CHIP8_KEY_F + 1)
+
+// Presses waiting for a screen change
+#define INPUT_PENDING_SIZE 16
+
+typedef struct {
+    uint64_t time;
+    CHIP8_KEY key;
+    CHIP8_KEYSTATE state;
+} input_event;
+
+static input_event queue[CHIP8_INPUT_QUEUE_SIZE];
+static uint32_t queue_head = 0; // next free slot
+static uint32_t queue_tail = 0; // next event to apply
+
+static uint64_t events_dropped = 0;
+
+// State of each key as last queued, to tell presses from key repeats
+static CHIP8_KEYSTATE key_state[INPUT_KEYS];
+
+// Start of the previous frame: Events from there on belong to this frame
+static uint64_t frame_start = 0;
+
+static uint64_t pending[INPUT_PENDING_SIZE];
+static uint32_t pending_count = 0;
+static uint64_t presented_hash = 0;
+
+static CHIP8_histogram latency;
+static uint8_t latency_valid = 0;
+static uint64_t latency_timeouts = 0;
+
+void CHIP8_input_push(const CHIP8_KEY key, const CHIP8_KEYSTATE state,
+                      const uint64_t time) {
+    assert(key < INPUT_KEYS);
+
+    if (queue_head - queue_tail == CHIP8_INPUT_QUEUE_SIZE) {
+        events_dropped++;
+        return;
+    }
+
+    queue[queue_head & INPUT_QUEUE_MASK] = (input_event){
+        .time = time,
+        .key = key,
+        .state = state,
+    };
+    queue_head++;
+}
+
+// Take over an event and start waiting for its effect, if it is a new press
+static void input_track(const input_event *event) {
+    const uint8_t is_press = event->state == CHIP8_KEY_PRESSED &&
+                             key_state[event->key] != CHIP8_KEY_PRESSED;
+
+    key_state[event->key] = event->state;
+
+    if (is_press && pending_count < INPUT_PENDING_SIZE)
+        pending[pending_count++] = event->time;
+}
+
+static void input_apply(const input_event *event) {
+    input_track(event);
+    CHIP8_input_set(event->key, event->state);
+}
+
+const int32_t CHIP8_input_run_frame(const int32_t (*run)(uint32_t cycles,
+                                                         uint32_t *executed),
+                                    const uint32_t cycles, const uint64_t time,
+                                    uint32_t *executed) {
+    const uint64_t start = frame_start != 0 ? frame_start : time;
+    const uint64_t duration = time > start ? time - start : 1;
+    frame_start = time;
+
+    uint32_t done = 0;
+    *executed = 0;
+
+    while (queue_tail != queue_head) {
+        const input_event *event = &queue[queue_tail & INPUT_QUEUE_MASK];
+
+        // Happened during this frame: Leave it for the next one
+        if (event->time >= time)
+            break;
+
+        // Instruction matching the event's share of the previous frame
+        uint64_t offset = event->time > start
+                              ? (event->time - start) * cycles / duration
+                              : 0;
+        if (offset > cycles)
+            offset = cycles;
+
+        if (offset > done) {
+            uint32_t count = 0;
+            const int32_t status = run(offset - done, &count);
+
+            *executed += count;
+            done = offset;
+
+            if (status != 0)
+                return status;
+        }
+
+        input_apply(event);
+        queue_tail++;
+    }
+
+    if (done == cycles)
+        return 0;
+
+    uint32_t count = 0;
+    const int32_t status = run(cycles - done, &count);
+    *executed += count;
+
+    return status;
+}
+
+const uint16_t CHIP8_input_take(const uint64_t time) {
+    while (queue_tail != queue_head &&
+           queue[queue_tail & INPUT_QUEUE_MASK].time < time) {
+        input_track(&queue[queue_tail & INPUT_QUEUE_MASK]);
+        queue_tail++;
+    }
+
+    uint16_t keys = 0;
+    for (uint32_t key = 0; key < INPUT_KEYS; key++) {
+        if (key_state[key] == CHIP8_KEY_PRESSED)
+            keys |= 1u << key;
+    }
+
+    return keys;
+}
+
+void CHIP8_input_presented(const uint64_t time) {
+    if (!latency_valid) {
+        CHIP8_histogram_init(&latency);
+        latency_valid = 1;
+    }
+
+    // Redrawing the same sprites sets the update status as well
+    uint8_t changed = 0;
+    if (CHIP8_screen_get_update_status()) {
+        const uint64_t hash = CHIP8_screen_hash();
+        changed = hash != presented_hash;
+        presented_hash = hash;
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < pending_count; i++) {
+        if (changed)
+            CHIP8_histogram_add(&latency, (time - pending[i]) / 1000);
+        else if (time - pending[i] >= CHIP8_INPUT_LATENCY_TIMEOUT_NSEC)
+            latency_timeouts++;
+        else
+            pending[kept++] = pending[i];
+    }
+
+    pending_count = kept;
+}
+
+void CHIP8_input_report(void) {
+    if (!latency_valid || (latency.count == 0 && latency_timeouts == 0))
+        return;
+
+    CHIP8_histogram_log(&latency, "Input latency (key press to changed frame)",
+                        "us");
+
+    if (latency_timeouts > 0 || events_dropped > 0)
+        log_info("Input: %llu press(es) without a screen change, %llu "
+                 "event(s) dropped",
+                 (unsigned long long)latency_timeouts,
+                 (unsigned long long)events_dropped);
+}
@@ -0,0 +1,54 @@
+#ifndef _CHIP8_INPUT_H_
+#define _CHIP8_INPUT_H_
+
+#include "chip8.h"
+
+#include <stdint.h>
+
+// Queue of timestamped key events from the host. Instead of changing the
+// keys whenever the host gets around to polling, every event is applied at
+// the instruction matching the time it happened: A frame's instructions run
+// in a burst, standing in for the time since the previous frame, so an event
+// from halfway through that time is applied halfway through the burst.
+// Presses shorter than a frame are no longer lost, and the time between
+// events is kept.
+//
+// The queue also measures input latency: The time from a key press to the
+// first presented frame with a different screen.
+
+// Has to be a power of two
+#define CHIP8_INPUT_QUEUE_SIZE 256
+
+// How often the host polls for events while waiting for the next frame
+#define CHIP8_INPUT_POLL_NSEC 1000000ull
+
+// Presses without a screen change for this long aren't waited for anymore
+#define CHIP8_INPUT_LATENCY_TIMEOUT_NSEC 1000000000ull
+
+/// Queue a key event that happened at <time> (see time_now_nsec). Events
+/// have to be queued in order. If the queue is full, the event is dropped.
+extern void CHIP8_input_push(CHIP8_KEY key, CHIP8_KEYSTATE state,
+                             uint64_t time);
+
+/// Run a frame of <cycles> instructions with <run> (i.e. CHIP8_cpu_run),
+/// starting at <time>. Events queued since the previous frame started are
+/// applied at the matching instruction. Returns the status of <run>, which
+/// stops the frame early.
+extern const int32_t
+CHIP8_input_run_frame(const int32_t (*run)(uint32_t cycles,
+                                           uint32_t *executed),
+                      uint32_t cycles, uint64_t time, uint32_t *executed);
+
+/// Apply the events queued before <time> to the host's keys, without
+/// touching the machine, and return them (bit n: key n is pressed). For
+/// netplay, where keys only change between frames (see netplay.h).
+extern const uint16_t CHIP8_input_take(uint64_t time);
+
+/// Note that the current screen was presented at <time>. Has to be called
+/// before the update status is cleared.
+extern void CHIP8_input_presented(uint64_t time);
+
+/// Log the input latency histogram (if there was any input)
+extern void CHIP8_input_report(void);
+
+#endif
@@ -1,31 +1,184 @@
 #include "log.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define LOG_BUFFER_SIZE 512
 
+// Number of records in the queue. Has to be a power of two.
+#define LOG_QUEUE_SIZE 1024
+#define LOG_QUEUE_MASK (LOG_QUEUE_SIZE - 1)
+
+// Maximum number of records the writer handles per wakeup
+#define LOG_BATCH_SIZE 64
+#define LOG_WRITER_SLEEP_NSEC 1000000
+// Empty polls after which the writer blocks until the next message, instead
+// of waking up every LOG_WRITER_SLEEP_NSEC (i.e. while the window is paused)
+#define LOG_WRITER_IDLE_POLLS 100
+
+// A single slot in the queue. 'sequence' tells producers and the consumer
+// who currently owns the slot (see: Dmitry Vyukov's bounded MPMC queue).
+typedef struct {
+    atomic_size_t sequence;
+    LOG_LEVEL level;
+    char msg[LOG_BUFFER_SIZE];
+} log_record_t;
+
 static LOG_LEVEL log_level = LOG_LEVEL_ALL;
-static char log_buffer[LOG_BUFFER_SIZE];
+
+static log_record_t log_queue[LOG_QUEUE_SIZE];
+static atomic_size_t queue_head = 0; // next slot to be claimed by a producer
+static size_t queue_tail = 0;        // next slot to be read by the writer
+
+static atomic_size_t log_dropped = 0;
+static atomic_int writer_running = 0;
+static pthread_t writer_thread;
+
+// Set while the writer is blocked on writer_wakeup: Producers signal it
+static atomic_int writer_idle = 0;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wakeup = PTHREAD_COND_INITIALIZER;
 
 static log_func_t *func_debug = NULL;
 static log_func_t *func_info = NULL;
 static log_func_t *func_warn = NULL;
 static log_func_t *func_error = NULL;
 
-void log_init(void) {
-    char *level = getenv("LOG_LEVEL");
+static log_func_t *log_sink(LOG_LEVEL level) {
+    switch (level) {
+    case LOG_LEVEL_DEBUG:
+        return func_debug;
+    case LOG_LEVEL_INFO:
+        return func_info;
+    case LOG_LEVEL_WARN:
+        return func_warn;
+    case LOG_LEVEL_ERROR:
+        return func_error;
+    default:
+        fprintf(stderr, "%s: Invalid logging level", __func__);
+        abort();
+    }
+}
 
-    if(level == NULL) {
-        log_level = LOG_LEVEL_ALL;
+static void log_dispatch(LOG_LEVEL level, char *msg) {
+    log_func_t *func = log_sink(level);
+    assert(func != NULL);
+
+    func(level, msg);
+}
+
+// Hand at most <max> queued records to the sinks. Only ever called by
+// a single consumer (the writer thread, or log_exit after joining it).
+static size_t log_drain(size_t max) {
+    size_t count = 0;
+
+    while (count < max) {
+        log_record_t *record = &log_queue[queue_tail & LOG_QUEUE_MASK];
+        size_t sequence =
+            atomic_load_explicit(&record->sequence, memory_order_acquire);
+
+        // Slot has not been published yet
+        if (sequence != queue_tail + 1)
+            break;
+
+        log_dispatch(record->level, record->msg);
+
+        atomic_store_explicit(&record->sequence, queue_tail + LOG_QUEUE_SIZE,
+                              memory_order_release);
+        queue_tail++;
+        count++;
+    }
+
+    return count;
+}
+
+// Sequentially consistent, it pairs with the store in log_emit (see there)
+static int log_queued(void) {
+    const log_record_t *record = &log_queue[queue_tail & LOG_QUEUE_MASK];
+
+    return atomic_load(&record->sequence) == queue_tail + 1;
+}
+
+// Block until a message is queued or the writer is stopped. Holding the
+// lock from the check to the wait means a producer can't signal in between.
+static void log_writer_wait(void) {
+    pthread_mutex_lock(&writer_lock);
+    atomic_store(&writer_idle, 1);
+
+    while (atomic_load(&writer_running) && !log_queued())
+        pthread_cond_wait(&writer_wakeup, &writer_lock);
+
+    atomic_store(&writer_idle, 0);
+    pthread_mutex_unlock(&writer_lock);
+}
+
+static void log_writer_signal(void) {
+    pthread_mutex_lock(&writer_lock);
+    pthread_cond_signal(&writer_wakeup);
+    pthread_mutex_unlock(&writer_lock);
+}
+
+static void log_report_dropped(size_t *reported) {
+    size_t dropped = atomic_load_explicit(&log_dropped, memory_order_relaxed);
+
+    if (dropped == *reported || LOG_LEVEL_WARN < log_level)
         return;
+
+    char msg[LOG_BUFFER_SIZE];
+    snprintf(msg, sizeof(msg), "log: Queue overflow, dropped %zu message(s)",
+             dropped - *reported);
+    log_dispatch(LOG_LEVEL_WARN, msg);
+
+    *reported = dropped;
+}
+
+static void *log_writer(void *arg) {
+    (void)arg;
+    size_t reported = 0;
+    uint32_t empty = 0;
+    const struct timespec idle = {.tv_sec = 0,
+                                  .tv_nsec = LOG_WRITER_SLEEP_NSEC};
+
+    while (atomic_load_explicit(&writer_running, memory_order_acquire)) {
+        if (log_drain(LOG_BATCH_SIZE) != 0) {
+            empty = 0;
+            continue;
+        }
+
+        log_report_dropped(&reported);
+
+        // Polling keeps bursts cheap for producers, blocking keeps a quiet
+        // process asleep
+        if (++empty < LOG_WRITER_IDLE_POLLS) {
+            nanosleep(&idle, NULL);
+        } else {
+            log_writer_wait();
+            empty = 0;
+        }
     }
 
-    if(strcmp("all", level) == 0)
+    log_drain(SIZE_MAX);
+    log_report_dropped(&reported);
+
+    return NULL;
+}
+
+void log_init(void) {
+    char *level = getenv("LOG_LEVEL");
+
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; i++)
+        atomic_init(&log_queue[i].sequence, i);
+
+    if (level == NULL)
+        log_level = LOG_LEVEL_ALL;
+    else if(strcmp("all", level) == 0)
         log_level = LOG_LEVEL_ALL;
     else if(strcmp("debug", level) == 0)
         log_level = LOG_LEVEL_DEBUG;
@@ -37,10 +190,35 @@ void log_init(void) {
         log_level = LOG_LEVEL_ERROR;
     else if(strcmp("none", level) == 0)
         log_level = LOG_LEVEL_NONE;
+
+    // Without a writer thread log_emit falls back to calling the sinks
+    // directly, so a failure here is not fatal.
+    atomic_store(&writer_running, 1);
+    if (pthread_create(&writer_thread, NULL, log_writer, NULL) != 0) {
+        atomic_store(&writer_running, 0);
+        return;
+    }
+
+    // Make sure that messages emitted right before exit() still make it out
+    atexit(log_exit);
+}
+
+void log_exit(void) {
+    if (!atomic_exchange(&writer_running, 0))
+        return;
+
+    log_writer_signal();
+    pthread_join(writer_thread, NULL);
 }
 
 void log_set_level(LOG_LEVEL level) { log_level = level; }
 
+const LOG_LEVEL log_get_level(void) { return log_level; }
+
+const size_t log_get_dropped(void) {
+    return atomic_load_explicit(&log_dropped, memory_order_relaxed);
+}
+
 void log_register(LOG_LEVEL level, log_func_t func) {
     assert(func);
 
@@ -72,36 +250,63 @@ void log_register(LOG_LEVEL level, log_func_t func) {
 void log_emit(LOG_LEVEL level, char *format, ...) {
     assert(format != NULL);
 
-    if (level < log_level)
+    // Nothing registered for this level (i.e. when used as a library)
+    if (level < log_level || log_sink(level) == NULL)
         return;
 
     va_list valist;
     va_start(valist, format);
 
-    int result = vsprintf(log_buffer, format, valist);
-    assert(result >= 0);
+    // No writer (yet/anymore): format on the stack and call the sink directly
+    if (!atomic_load_explicit(&writer_running, memory_order_acquire)) {
+        char buffer[LOG_BUFFER_SIZE];
+        int result = vsnprintf(buffer, sizeof(buffer), format, valist);
+        assert(result >= 0);
+        (void)result;
+        va_end(valist);
 
-    va_end(valist);
+        log_dispatch(level, buffer);
+        return;
+    }
 
-    switch (level) {
-    case LOG_LEVEL_DEBUG:
-        assert(func_debug != NULL);
-        func_debug(LOG_LEVEL_DEBUG, log_buffer);
-        break;
-    case LOG_LEVEL_INFO:
-        assert(func_info != NULL);
-        func_info(LOG_LEVEL_INFO, log_buffer);
-        break;
-    case LOG_LEVEL_WARN:
-        assert(func_warn != NULL);
-        func_warn(LOG_LEVEL_WARN, log_buffer);
-        break;
-    case LOG_LEVEL_ERROR:
-        assert(func_error != NULL);
-        func_error(LOG_LEVEL_ERROR, log_buffer);
-        break;
-    default:
-        fprintf(stderr, "%s: Invalid logging level", __func__);
-        abort();
+    // Claim a slot. A full queue never blocks the caller, the message is
+    // dropped and accounted for instead.
+    log_record_t *record;
+    size_t pos = atomic_load_explicit(&queue_head, memory_order_relaxed);
+
+    for (;;) {
+        record = &log_queue[pos & LOG_QUEUE_MASK];
+        size_t sequence =
+            atomic_load_explicit(&record->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &queue_head, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+            va_end(valist);
+            return;
+        } else {
+            pos = atomic_load_explicit(&queue_head, memory_order_relaxed);
+        }
     }
+
+    // Messages exceeding LOG_BUFFER_SIZE are truncated
+    int result = vsnprintf(record->msg, sizeof(record->msg), format, valist);
+    assert(result >= 0);
+    (void)result;
+    va_end(valist);
+
+    record->level = level;
+    atomic_store(&record->sequence, pos + 1);
+
+    // Each side stores its flag and then loads the other's: With the
+    // sequence and writer_idle both stored and loaded sequentially
+    // consistent, either the writer sees the record before blocking, or
+    // this sees it idle
+    if (atomic_load(&writer_idle))
+        log_writer_signal();
 }
@@ -1,6 +1,8 @@
 #ifndef _LOG_H_
 #define _LOG_H_
 
+#include <stddef.h>
+
 typedef enum {
     LOG_LEVEL_ALL = 0,
     LOG_LEVEL_DEBUG,
@@ -12,17 +14,28 @@ typedef enum {
 
 typedef void(log_func_t)(LOG_LEVEL level, char *msg);
 
+/// Read LOG_LEVEL and start the background writer.
+/// Messages are queued by log_emit and handed to the registered callbacks
+/// from the writer thread, in batches.
 extern void log_init(void);
 
-/// Register a callback for <level>
+/// Stop the writer and flush all queued messages (registered with atexit)
+extern void log_exit(void);
+
+/// Register a callback for <level>. Messages without a callback are dropped.
 // TODO: This seems to be the most logical/practical implementation... ?
 //       Also, this should be it's own library
 extern void log_register(LOG_LEVEL level, log_func_t func);
 
 /// Set the desired log level at runtime
 extern void log_set_level(LOG_LEVEL level);
+extern const LOG_LEVEL log_get_level(void);
+
+/// Number of messages dropped because the queue was full
+extern const size_t log_get_dropped(void);
 
-/// Invoke the appropiate callback
+/// Queue a message for the appropiate callback. Never blocks: If the queue
+/// is full, the message is dropped and counted.
 extern void log_emit(LOG_LEVEL level, char *format, ...);
 
 #define log_debug(format, ...) log_emit(LOG_LEVEL_DEBUG, format, __VA_ARGS__)
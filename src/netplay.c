@@ -0,0 +1,545 @@
+#include "netplay.h"
+#include "chip8.h"
+#include "chip8_machine.h"
+#include "histogram.h"
+#include "log.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define NETPLAY_MASK (CHIP8_NETPLAY_WINDOW - 1)
+
+// The peer's keys reach up to a window past the current frame, and are
+// needed back to a window before it
+#define NETPLAY_REMOTE_SIZE (2 * CHIP8_NETPLAY_WINDOW)
+#define NETPLAY_REMOTE_MASK (NETPLAY_REMOTE_SIZE - 1)
+
+#define NETPLAY_MAX_PACKET                                                     \
+    (CHIP8_NETPLAY_HEADER_SIZE + 2 * CHIP8_NETPLAY_WINDOW)
+
+// Packets held back by the simulated delay
+#define NETPLAY_DELAY_QUEUE 1024
+
+// How long a waiting frame waits for packets
+#define NETPLAY_POLL_MSEC 1
+
+// Frames one peer may be ahead of the other (latency aside) before it
+// waits a frame for the other one to catch up
+#define NETPLAY_MAX_ADVANTAGE 2
+
+#define NETPLAY_NONE UINT32_MAX
+
+typedef struct {
+    uint64_t time;
+    uint32_t size;
+    uint8_t data[NETPLAY_MAX_PACKET];
+} netplay_packet;
+
+struct CHIP8_netplay {
+    int fd;
+    struct sockaddr_storage peer;
+    socklen_t peer_size;
+    char peer_name[160];
+
+    uint32_t session;
+    uint32_t cycles;
+
+    // Simulated network conditions
+    uint64_t delay_nsec;
+    uint32_t loss;
+    uint32_t loss_state;
+    netplay_packet delayed[NETPLAY_DELAY_QUEUE];
+    uint32_t delayed_head;
+    uint32_t delayed_tail;
+
+    // Next frame to run
+    uint32_t frame;
+
+    // Keys per frame: local ones, the peer's, and what was used for the
+    // peer's when the frame ran. States are saved before each frame.
+    uint16_t local[CHIP8_NETPLAY_WINDOW];
+    uint16_t remote[NETPLAY_REMOTE_SIZE];
+    uint16_t predicted[CHIP8_NETPLAY_WINDOW];
+    CHIP8_state *states[CHIP8_NETPLAY_WINDOW];
+
+    // The peer's keys of frames before remote_frames have arrived, and the
+    // peer has the local keys of frames before acked
+    uint32_t remote_frames;
+    uint32_t acked;
+    // Frame the peer was at, as of its last packet
+    uint32_t remote_frame;
+
+    // Earliest frame that ran with a wrong prediction
+    uint32_t rollback;
+
+    uint8_t connected;
+    uint8_t closed;
+    uint8_t waited;
+    uint8_t warned_session;
+    uint64_t last_received;
+
+    uint64_t rollbacks;
+    uint64_t rollback_frames;
+    uint32_t rollback_max_frames;
+    uint64_t rollback_over_budget;
+    uint64_t waits;
+    uint64_t dropped;
+    CHIP8_histogram rollback_time;
+};
+
+static void netplay_put_u32(uint8_t *buffer, const uint32_t value) {
+    buffer[0] = value & 0xff;
+    buffer[1] = (value >> 8) & 0xff;
+    buffer[2] = (value >> 16) & 0xff;
+    buffer[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t netplay_get_u32(const uint8_t *buffer) {
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) |
+           ((uint32_t)buffer[3] << 24);
+}
+
+// Everything both machines have to agree on
+static uint32_t netplay_session(const uint32_t cycles) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+
+    // FNV-1a
+    uint32_t hash = 0x811c9dc5;
+    for (uint32_t i = 0; i < CHIP8_MEM_SIZE; i++)
+        hash = (hash ^ machine->mem[i]) * 0x01000193;
+
+    const uint32_t values[3] = {machine->mode, machine->rand_state, cycles};
+    for (uint32_t i = 0; i < 3; i++)
+        hash = (hash ^ values[i]) * 0x01000193;
+
+    return hash;
+}
+
+static void netplay_send_now(CHIP8_netplay *netplay, const uint8_t *data,
+                             const uint32_t size) {
+    // Errors (i.e. the peer isn't there yet) are as good as lost packets
+    sendto(netplay->fd, data, size, 0, (struct sockaddr *)&netplay->peer,
+           netplay->peer_size);
+}
+
+static void netplay_send(CHIP8_netplay *netplay, const uint8_t *data,
+                         const uint32_t size, const uint64_t now) {
+    if (netplay->loss != 0) {
+        uint32_t state = netplay->loss_state;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        netplay->loss_state = state;
+
+        if (state % 100 < netplay->loss) {
+            netplay->dropped++;
+            return;
+        }
+    }
+
+    if (netplay->delay_nsec == 0) {
+        netplay_send_now(netplay, data, size);
+        return;
+    }
+
+    if (netplay->delayed_head - netplay->delayed_tail == NETPLAY_DELAY_QUEUE) {
+        netplay->dropped++;
+        return;
+    }
+
+    netplay_packet *packet =
+        &netplay->delayed[netplay->delayed_head++ % NETPLAY_DELAY_QUEUE];
+    packet->time = now + netplay->delay_nsec;
+    packet->size = size;
+    memcpy(packet->data, data, size);
+}
+
+// Send the delayed packets that are due
+static void netplay_flush(CHIP8_netplay *netplay, const uint64_t now) {
+    while (netplay->delayed_tail != netplay->delayed_head) {
+        const netplay_packet *packet =
+            &netplay->delayed[netplay->delayed_tail % NETPLAY_DELAY_QUEUE];
+        if (packet->time > now)
+            break;
+
+        netplay_send_now(netplay, packet->data, packet->size);
+        netplay->delayed_tail++;
+    }
+}
+
+// Send the local keys the peer doesn't have yet
+static void netplay_send_input(CHIP8_netplay *netplay, const uint64_t now) {
+    uint8_t packet[NETPLAY_MAX_PACKET];
+    const uint32_t count = netplay->frame - netplay->acked;
+
+    packet[0] = CHIP8_NETPLAY_MSG_INPUT;
+    netplay_put_u32(packet + 1, netplay->session);
+    netplay_put_u32(packet + 5, netplay->frame);
+    netplay_put_u32(packet + 9, netplay->remote_frames);
+    netplay_put_u32(packet + 13, netplay->acked);
+    packet[17] = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint16_t keys =
+            netplay->local[(netplay->acked + i) & NETPLAY_MASK];
+        packet[CHIP8_NETPLAY_HEADER_SIZE + 2 * i] = keys & 0xff;
+        packet[CHIP8_NETPLAY_HEADER_SIZE + 2 * i + 1] = keys >> 8;
+    }
+
+    netplay_send(netplay, packet, CHIP8_NETPLAY_HEADER_SIZE + 2 * count, now);
+}
+
+static void netplay_handle_input(CHIP8_netplay *netplay, const uint8_t *packet,
+                                 const uint32_t size) {
+    const uint32_t frame = netplay_get_u32(packet + 5);
+    const uint32_t ack = netplay_get_u32(packet + 9);
+    const uint32_t start = netplay_get_u32(packet + 13);
+    const uint32_t count = packet[17];
+
+    if (size != CHIP8_NETPLAY_HEADER_SIZE + 2 * count)
+        return;
+
+    // Packets may arrive out of order
+    if (frame > netplay->remote_frame)
+        netplay->remote_frame = frame;
+    if (ack > netplay->acked && ack <= netplay->frame)
+        netplay->acked = ack;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t target = start + i;
+        if (target < netplay->remote_frames)
+            continue;
+
+        // A gap (can't happen, packets start at the acknowledged frame), or
+        // too far ahead to keep
+        if (target > netplay->remote_frames ||
+            target >= netplay->frame + CHIP8_NETPLAY_WINDOW)
+            break;
+
+        const uint16_t keys = packet[CHIP8_NETPLAY_HEADER_SIZE + 2 * i] |
+                              (packet[CHIP8_NETPLAY_HEADER_SIZE + 2 * i + 1]
+                               << 8);
+        netplay->remote[target & NETPLAY_REMOTE_MASK] = keys;
+        netplay->remote_frames++;
+
+        // Already ran with a prediction
+        if (target < netplay->frame &&
+            netplay->predicted[target & NETPLAY_MASK] != keys &&
+            (netplay->rollback == NETPLAY_NONE || target < netplay->rollback))
+            netplay->rollback = target;
+    }
+}
+
+static void netplay_receive(CHIP8_netplay *netplay, const uint64_t now) {
+    uint8_t packet[NETPLAY_MAX_PACKET];
+
+    for (;;) {
+        const ssize_t size =
+            recv(netplay->fd, packet, sizeof(packet), MSG_DONTWAIT);
+        if (size < 0) {
+            // Refused: An earlier packet found nobody listening
+            if (errno == EINTR || errno == ECONNREFUSED)
+                continue;
+            return;
+        }
+
+        if (size < 5)
+            continue;
+
+        if (netplay_get_u32(packet + 1) != netplay->session) {
+            if (!netplay->warned_session) {
+                log_error("netplay: %s runs another rom, mode, seed or "
+                          "instructions per frame, ignoring it",
+                          netplay->peer_name);
+                netplay->warned_session = 1;
+            }
+            continue;
+        }
+
+        if (packet[0] == CHIP8_NETPLAY_MSG_QUIT) {
+            netplay->closed = 1;
+        } else if (packet[0] == CHIP8_NETPLAY_MSG_INPUT &&
+                   size >= CHIP8_NETPLAY_HEADER_SIZE) {
+            if (!netplay->connected)
+                log_info("netplay: Connected to %s", netplay->peer_name);
+            netplay->connected = 1;
+            netplay->last_received = now;
+            netplay_handle_input(netplay, packet, size);
+        }
+    }
+}
+
+// Save the state, set the keys of both players and run frame <frame>.
+// Counts the timer tick in <ticks>.
+static const int32_t netplay_run(CHIP8_netplay *netplay,
+                                 const int32_t (*run)(uint32_t cycles,
+                                                      uint32_t *executed),
+                                 const uint32_t frame, uint32_t *executed,
+                                 uint32_t *ticks) {
+    CHIP8_state_save(netplay->states[frame & NETPLAY_MASK]);
+
+    // Without the peer's keys, they stay as they were last
+    uint16_t remote = 0;
+    if (frame < netplay->remote_frames)
+        remote = netplay->remote[frame & NETPLAY_REMOTE_MASK];
+    else if (netplay->remote_frames > 0)
+        remote =
+            netplay->remote[(netplay->remote_frames - 1) & NETPLAY_REMOTE_MASK];
+    netplay->predicted[frame & NETPLAY_MASK] = remote;
+
+    const uint16_t keys = netplay->local[frame & NETPLAY_MASK] | remote;
+    for (uint32_t key = 0; key < CHIP8_KEYS; key++)
+        CHIP8_input_set(key, (keys >> key) & 1 ? CHIP8_KEY_PRESSED
+                                               : CHIP8_KEY_RELEASED);
+
+    const int32_t status = run(netplay->cycles, executed);
+    CHIP8_timer_tick();
+    (*ticks)++;
+
+    return status;
+}
+
+// Go back to the first mispredicted frame and run up to the current one
+static const int32_t
+netplay_rollback(CHIP8_netplay *netplay,
+                 const int32_t (*run)(uint32_t cycles, uint32_t *executed),
+                 uint32_t *ticks) {
+    const uint64_t start = time_now_nsec();
+    const uint32_t from = netplay->rollback;
+    netplay->rollback = NETPLAY_NONE;
+
+    CHIP8_state_load(netplay->states[from & NETPLAY_MASK]);
+
+    for (uint32_t frame = from; frame < netplay->frame; frame++) {
+        uint32_t executed = 0;
+        const int32_t status =
+            netplay_run(netplay, run, frame, &executed, ticks);
+        if (status != 0)
+            return status;
+    }
+
+    const uint64_t elapsed = time_now_nsec() - start;
+    const uint32_t frames = netplay->frame - from;
+
+    netplay->rollbacks++;
+    netplay->rollback_frames += frames;
+    if (frames > netplay->rollback_max_frames)
+        netplay->rollback_max_frames = frames;
+    if (elapsed > CHIP8_TIMER_RENDER_RATE_NSEC)
+        netplay->rollback_over_budget++;
+    CHIP8_histogram_add(&netplay->rollback_time, elapsed / 1000);
+
+    return 0;
+}
+
+// Whether this peer is further ahead of the other one than the other one
+// is of it (both include the latency)
+static const uint8_t netplay_is_ahead(const CHIP8_netplay *netplay) {
+    const int64_t local =
+        (int64_t)netplay->frame - (int64_t)netplay->remote_frame;
+    const int64_t remote =
+        (int64_t)netplay->remote_frame - (int64_t)netplay->acked;
+
+    return (local - remote) / 2 >= NETPLAY_MAX_ADVANTAGE;
+}
+
+const int32_t CHIP8_netplay_frame(CHIP8_netplay *netplay,
+                                  const int32_t (*run)(uint32_t cycles,
+                                                       uint32_t *executed),
+                                  const uint16_t keys, uint32_t *executed,
+                                  uint32_t *ticks) {
+    uint64_t now = time_now_nsec();
+    *executed = 0;
+    *ticks = 0;
+
+    netplay_flush(netplay, now);
+    netplay_receive(netplay, now);
+
+    if (netplay->closed) {
+        log_info("netplay: %s has stopped", netplay->peer_name);
+        return CHIP8_NETPLAY_STATUS_CLOSED;
+    }
+
+    if (netplay->connected &&
+        now - netplay->last_received >= CHIP8_NETPLAY_TIMEOUT_NSEC) {
+        log_error("netplay: Nothing received from %s for %llus, giving up",
+                  netplay->peer_name,
+                  CHIP8_NETPLAY_TIMEOUT_NSEC / 1000000000ull);
+        return CHIP8_NETPLAY_STATUS_CLOSED;
+    }
+
+    if (netplay->rollback != NETPLAY_NONE) {
+        const int32_t status = netplay_rollback(netplay, run, ticks);
+        if (status != 0)
+            return status;
+    }
+
+    // Out of saved states (or room in a packet), or ahead of the peer: Let
+    // it catch up
+    if (!netplay->connected ||
+        netplay->frame >= netplay->remote_frames + CHIP8_NETPLAY_WINDOW - 1 ||
+        netplay->frame >= netplay->acked + CHIP8_NETPLAY_WINDOW ||
+        (!netplay->waited && netplay_is_ahead(netplay))) {
+        if (netplay->connected)
+            netplay->waits++;
+        netplay->waited = 1;
+        netplay_send_input(netplay, now);
+
+        struct pollfd fds = {.fd = netplay->fd, .events = POLLIN};
+        poll(&fds, 1, NETPLAY_POLL_MSEC);
+
+        return CHIP8_NETPLAY_STATUS_WAIT;
+    }
+
+    netplay->waited = 0;
+    netplay->local[netplay->frame & NETPLAY_MASK] = keys;
+
+    const int32_t status =
+        netplay_run(netplay, run, netplay->frame, executed, ticks);
+    netplay->frame++;
+
+    now = time_now_nsec();
+    netplay_send_input(netplay, now);
+    netplay_flush(netplay, now);
+
+    return status;
+}
+
+// <address>: <local port>:<peer host>:<peer port>
+static const uint32_t netplay_connect(CHIP8_netplay *netplay,
+                                      const char *address) {
+    char local_port[16];
+    char host[128];
+    const char *first = strchr(address, ':');
+    const char *last = strrchr(address, ':');
+
+    if (first == NULL || first == last ||
+        (size_t)(first - address) >= sizeof(local_port) ||
+        (size_t)(last - first - 1) >= sizeof(host)) {
+        log_error("netplay: Invalid address (<local port>:<peer host>:<peer "
+                  "port>): %s",
+                  address);
+        return 1;
+    }
+
+    snprintf(local_port, sizeof(local_port), "%.*s", (int)(first - address),
+             address);
+    snprintf(host, sizeof(host), "%.*s", (int)(last - first - 1), first + 1);
+
+    struct addrinfo hints = {
+        .ai_socktype = SOCK_DGRAM,
+        .ai_flags = AI_NUMERICSERV,
+    };
+    struct addrinfo *peer = NULL;
+    int error = getaddrinfo(host, last + 1, &hints, &peer);
+    if (error != 0) {
+        log_error("netplay: Failed to resolve %s: %s", host,
+                  gai_strerror(error));
+        return 1;
+    }
+
+    memcpy(&netplay->peer, peer->ai_addr, peer->ai_addrlen);
+    netplay->peer_size = peer->ai_addrlen;
+    snprintf(netplay->peer_name, sizeof(netplay->peer_name), "%s:%s", host,
+             last + 1);
+
+    struct addrinfo *local = NULL;
+    hints.ai_family = peer->ai_family;
+    hints.ai_flags |= AI_PASSIVE;
+    freeaddrinfo(peer);
+
+    error = getaddrinfo(NULL, local_port, &hints, &local);
+    if (error != 0) {
+        log_error("netplay: Invalid port %s: %s", local_port,
+                  gai_strerror(error));
+        return 1;
+    }
+
+    netplay->fd = socket(local->ai_family, SOCK_DGRAM, 0);
+    if (netplay->fd < 0 ||
+        bind(netplay->fd, local->ai_addr, local->ai_addrlen) != 0) {
+        log_error("netplay: Failed to bind to port %s: %s", local_port,
+                  strerror(errno));
+        freeaddrinfo(local);
+        return 1;
+    }
+
+    freeaddrinfo(local);
+    fcntl(netplay->fd, F_SETFL, fcntl(netplay->fd, F_GETFL) | O_NONBLOCK);
+
+    return 0;
+}
+
+CHIP8_netplay *CHIP8_netplay_open(const char *address, const uint32_t cycles,
+                                  const uint32_t delay_ms,
+                                  const uint32_t loss) {
+    CHIP8_netplay *netplay = calloc(1, sizeof(*netplay));
+    if (netplay == NULL)
+        return NULL;
+
+    netplay->fd = -1;
+    if (netplay_connect(netplay, address) != 0) {
+        if (netplay->fd >= 0)
+            close(netplay->fd);
+        free(netplay);
+        return NULL;
+    }
+
+    netplay->session = netplay_session(cycles);
+    netplay->cycles = cycles;
+    netplay->delay_nsec = delay_ms * 1000000ull;
+    netplay->loss = loss;
+    netplay->loss_state = netplay->session | 1;
+    netplay->rollback = NETPLAY_NONE;
+    CHIP8_histogram_init(&netplay->rollback_time);
+
+    for (uint32_t i = 0; i < CHIP8_NETPLAY_WINDOW; i++)
+        netplay->states[i] = CHIP8_state_create();
+
+    log_info("netplay: Waiting for %s (session %08x%s)", netplay->peer_name,
+             netplay->session,
+             delay_ms != 0 || loss != 0 ? ", simulated delay and loss" : "");
+
+    return netplay;
+}
+
+void CHIP8_netplay_close(CHIP8_netplay *netplay) {
+    if (netplay == NULL)
+        return;
+
+    // Not delayed or dropped, and repeated in case one gets lost anyway
+    uint8_t packet[CHIP8_NETPLAY_HEADER_SIZE] = {CHIP8_NETPLAY_MSG_QUIT};
+    netplay_put_u32(packet + 1, netplay->session);
+    for (uint32_t i = 0; i < 3; i++)
+        netplay_send_now(netplay, packet, sizeof(packet));
+
+    log_info("netplay: %u frame(s), %llu rollback(s) running %llu frame(s) "
+             "again (at most %u at once), %llu wait(s), %llu packet(s) "
+             "dropped",
+             netplay->frame, (unsigned long long)netplay->rollbacks,
+             (unsigned long long)netplay->rollback_frames,
+             netplay->rollback_max_frames, (unsigned long long)netplay->waits,
+             (unsigned long long)netplay->dropped);
+
+    if (netplay->rollbacks > 0)
+        CHIP8_histogram_log(&netplay->rollback_time, "Netplay rollback time",
+                            "us");
+
+    if (netplay->rollback_over_budget > 0)
+        log_warn("netplay: %llu rollback(s) took longer than a frame",
+                 (unsigned long long)netplay->rollback_over_budget);
+
+    for (uint32_t i = 0; i < CHIP8_NETPLAY_WINDOW; i++)
+        CHIP8_state_destroy(netplay->states[i]);
+
+    close(netplay->fd);
+    free(netplay);
+}
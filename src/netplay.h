@@ -0,0 +1,80 @@
+#ifndef _CHIP8_NETPLAY_H_
+#define _CHIP8_NETPLAY_H_
+
+#include <stdint.h>
+
+// Two player netplay over UDP, with rollback. Both peers run the same rom
+// on their own machine, and the keys of both players are combined (a key
+// is pressed if either player presses it, i.e. '1'/'4' for the left and
+// 'C'/'D' for the right paddle in pong).
+//
+// Keys change only between frames. Every frame, each peer sends its keys,
+// stamped with the frame number, and runs the frame right away with the
+// last keys it has from the other peer (a prediction). Once the actual
+// keys arrive and differ from the prediction, the machine goes back to the
+// state before that frame (see CHIP8_state_load) and runs the frames since
+// again, within the current frame. Both machines execute exactly the same
+// instructions with exactly the same keys, they just see the other
+// player's keys late.
+//
+// Packets repeat every frame not yet acknowledged, so lost packets only
+// delay the keys. A peer that is too far ahead waits for the other one.
+//
+// Packet (all integers little endian):
+//   <u8 type> <u32 session> <u32 frame> <u32 ack> <u32 start> <u8 count>
+//   <u16 keys>...
+//   'I': <keys> of frames <start> to <start> + <count> - 1, the sender is
+//        at <frame> and has the receiver's keys of every frame before
+//        <ack>
+//   'Q': The sender has stopped
+// <session> is a hash of the rom, mode, seed and instructions per frame,
+// which have to be the same on both peers.
+#define CHIP8_NETPLAY_MSG_INPUT 'I'
+#define CHIP8_NETPLAY_MSG_QUIT 'Q'
+
+#define CHIP8_NETPLAY_HEADER_SIZE 18
+
+// Frames a peer may run ahead of the other one's keys. Saved states are
+// kept for as many frames.
+#define CHIP8_NETPLAY_WINDOW 32
+
+// Seed for peers without --seed, both machines need the same one
+#define CHIP8_NETPLAY_DEFAULT_SEED 0x6e657470
+
+// A peer that hasn't sent anything for this long has left
+#define CHIP8_NETPLAY_TIMEOUT_NSEC 5000000000ull
+
+// Status CHIP8_netplay_frame returns instead of running a frame: Waiting
+// for the other peer (a frame later, run again)
+#define CHIP8_NETPLAY_STATUS_WAIT 4
+// The other peer has stopped or stopped responding
+#define CHIP8_NETPLAY_STATUS_CLOSED 5
+
+typedef struct CHIP8_netplay CHIP8_netplay;
+
+/// Start netplay for the selected machine (with its rom loaded) on
+/// <address>: '<local port>:<peer host>:<peer port>'. Frames run
+/// <cycles> instructions. Outgoing packets are delayed by <delay_ms> and
+/// <loss> percent of them dropped, to try it out over loopback. Returns
+/// NULL on failure.
+extern CHIP8_netplay *CHIP8_netplay_open(const char *address,
+                                         uint32_t cycles, uint32_t delay_ms,
+                                         uint32_t loss);
+
+/// Tell the peer and log the rollback statistics
+extern void CHIP8_netplay_close(CHIP8_netplay *netplay);
+
+/// Run the next frame on the selected machine with <run> (i.e.
+/// CHIP8_cpu_run), with the local player's <keys> (bit n: key n pressed),
+/// and tick the timers. Goes back and runs earlier frames again first, if
+/// the other player's keys turned out to differ from the prediction.
+/// Returns the status of <run>, or CHIP8_NETPLAY_STATUS_WAIT/_CLOSED
+/// without running a frame. <executed> receives the number of instructions
+/// of the frame (without those run again), <ticks> the number of timer
+/// ticks (0 while waiting, one per frame run again on a rollback).
+extern const int32_t
+CHIP8_netplay_frame(CHIP8_netplay *netplay,
+                    const int32_t (*run)(uint32_t cycles, uint32_t *executed),
+                    uint16_t keys, uint32_t *executed, uint32_t *ticks);
+
+#endif
@@ -0,0 +1,9 @@
+#include "palette.h"
+
+// Colorscheme taken from: https://packagecontrol.io/packages/gruvbox#Palette
+const uint32_t CHIP8_palette[CHIP8_PALETTE_SIZE] = {
+    0x282828, // background
+    0x928374, 0xcc241d, 0xfb4934, 0x98971a, 0xb8bb26,
+    0xd79921, 0xfabd2f, 0x458588, 0x83a598, 0xb16286,
+    0xd3869b, 0x689d6a, 0x8ec07c, 0xa89984, 0xebdbb2,
+};
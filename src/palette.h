@@ -0,0 +1,15 @@
+#ifndef _CHIP8_PALETTE_H_
+#define _CHIP8_PALETTE_H_
+
+#include <stdint.h>
+
+#define CHIP8_PALETTE_SIZE 16
+
+/// RGB (0xrrggbb) value of each pixel value. Index 0 is the background.
+extern const uint32_t CHIP8_palette[CHIP8_PALETTE_SIZE];
+
+#define CHIP8_PALETTE_R(color) (uint8_t)(((color) >> 16) & 0xff)
+#define CHIP8_PALETTE_G(color) (uint8_t)(((color) >> 8) & 0xff)
+#define CHIP8_PALETTE_B(color) (uint8_t)((color)&0xff)
+
+#endif
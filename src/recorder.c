@@ -0,0 +1,319 @@
+#include "recorder.h"
+#include "chip8.h"
+#include "chip8_machine.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The file format spells the machine sizes out
+_Static_assert(CHIP8_RECORDER_MEM_SIZE == CHIP8_MEM_SIZE, "memory size");
+_Static_assert(CHIP8_RECORDER_SCREEN_WIDTH == CHIP8_SCREEN_BUFFER_WIDTH &&
+                   CHIP8_RECORDER_SCREEN_HEIGHT == CHIP8_SCREEN_BUFFER_HEIGHT,
+               "screen size");
+_Static_assert(sizeof(CHIP8_record) == 16 &&
+                   sizeof(CHIP8_record_row) == sizeof(CHIP8_record),
+               "record size");
+
+// Columns a sprite can cover
+#define RECORDER_SPRITE_WIDTH 16
+
+typedef struct {
+    CHIP8_recorder_block block;
+    CHIP8_record records[CHIP8_RECORDER_BLOCK_RECORDS];
+} recorder_buffer;
+
+struct CHIP8_recorder {
+    FILE *file;
+    const char *path;
+    uint8_t failed;
+
+    recorder_buffer mem;
+    recorder_buffer screen;
+
+    // The screen as of the last record, to tell which pixels changed
+    uint8_t shadow[CHIP8_SCREEN_BUFFER_HEIGHT * CHIP8_SCREEN_BUFFER_WIDTH];
+
+    uint32_t frames;
+    uint64_t records;
+    uint64_t bytes;
+
+    CHIP8_recorder_snapshot snapshot;
+};
+
+static void recorder_write(CHIP8_recorder *recorder, const void *data,
+                           const size_t size) {
+    if (recorder->failed)
+        return;
+
+    if (fwrite(data, 1, size, recorder->file) != size) {
+        log_error("recorder: Failed to write to %s (%s), recording stopped",
+                  recorder->path, strerror(errno));
+        recorder->failed = 1;
+        return;
+    }
+
+    recorder->bytes += size;
+}
+
+static void recorder_flush(CHIP8_recorder *recorder, recorder_buffer *buffer,
+                           const CHIP8_RECORDER_CHUNK type) {
+    if (buffer->block.count == 0)
+        return;
+
+    const size_t records = buffer->block.count * sizeof(CHIP8_record);
+    const CHIP8_recorder_chunk chunk = {
+        .type = type,
+        .size = sizeof(buffer->block) + records,
+    };
+
+    recorder_write(recorder, &chunk, sizeof(chunk));
+    recorder_write(recorder, &buffer->block, sizeof(buffer->block));
+    recorder_write(recorder, buffer->records, records);
+
+    memset(&buffer->block, 0, sizeof(buffer->block));
+}
+
+// Append <count> records (a row record takes two), starting a new block if
+// they don't fit
+static void recorder_add(CHIP8_recorder *recorder, recorder_buffer *buffer,
+                         const CHIP8_RECORDER_CHUNK type,
+                         const CHIP8_record *records, const uint32_t count) {
+    if (buffer->block.count + count > CHIP8_RECORDER_BLOCK_RECORDS)
+        recorder_flush(recorder, buffer, type);
+
+    if (buffer->block.count == 0)
+        buffer->block.first_cycle = records[0].cycle;
+    buffer->block.last_cycle = records[0].cycle;
+
+    memcpy(buffer->records + buffer->block.count, records,
+           count * sizeof(*records));
+    buffer->block.count += count;
+    recorder->records++;
+}
+
+static void recorder_filter_set(CHIP8_recorder_block *block,
+                                const uint32_t bit) {
+    block->filter[bit / 64] |= 1ull << (bit % 64);
+}
+
+static void recorder_snapshot(CHIP8_recorder *recorder) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_recorder_snapshot *snapshot = &recorder->snapshot;
+
+    // Keeps the file in (roughly) chronological order
+    recorder_flush(recorder, &recorder->mem, CHIP8_RECORDER_CHUNK_MEM);
+    recorder_flush(recorder, &recorder->screen, CHIP8_RECORDER_CHUNK_SCREEN);
+
+    memset(snapshot, 0, offsetof(CHIP8_recorder_snapshot, mem));
+    snapshot->cycle = machine->cycles;
+    snapshot->pc = machine->pc;
+    snapshot->index_reg = machine->index_reg;
+    snapshot->sp = machine->sp;
+    memcpy(snapshot->stack, machine->stack, sizeof(snapshot->stack));
+    memcpy(snapshot->reg, machine->reg, sizeof(snapshot->reg));
+    memcpy(snapshot->flag_reg, machine->flag_reg, sizeof(snapshot->flag_reg));
+    memcpy(snapshot->keys, machine->keys, sizeof(snapshot->keys));
+    snapshot->timer = machine->timer;
+    snapshot->timer_sound = machine->timer_sound;
+    snapshot->screen_width = machine->screen_width;
+    snapshot->screen_height = machine->screen_height;
+    snapshot->screen_bitplane = machine->screen_bitplane;
+    snapshot->rand_state = machine->rand_state;
+    memcpy(snapshot->mem, machine->mem, sizeof(snapshot->mem));
+    memcpy(snapshot->screen, machine->screen, sizeof(snapshot->screen));
+
+    const CHIP8_recorder_chunk chunk = {
+        .type = CHIP8_RECORDER_CHUNK_SNAPSHOT,
+        .size = sizeof(*snapshot),
+    };
+    recorder_write(recorder, &chunk, sizeof(chunk));
+    recorder_write(recorder, snapshot, sizeof(*snapshot));
+
+    // At most one snapshot interval is lost, if the emulator crashes
+    fflush(recorder->file);
+}
+
+const uint32_t CHIP8_recorder_open(const char *path, const char *rom) {
+    CHIP8_machine *machine = CHIP8_machine_get();
+
+    if (machine->recorder != NULL) {
+        log_error("%s", "recorder: Already recording");
+        return 1;
+    }
+
+    CHIP8_recorder *recorder = calloc(1, sizeof(*recorder));
+    if (recorder == NULL)
+        return 1;
+
+    recorder->path = path;
+    recorder->file = fopen(path, "wb");
+    if (recorder->file == NULL) {
+        log_error("recorder: Failed to open %s (%s)", path, strerror(errno));
+        free(recorder);
+        return 1;
+    }
+
+    CHIP8_recorder_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHIP8_RECORDER_MAGIC, sizeof(CHIP8_RECORDER_MAGIC));
+    header.version = CHIP8_RECORDER_VERSION;
+    header.mode = machine->mode;
+    snprintf(header.rom, sizeof(header.rom), "%s", rom != NULL ? rom : "");
+    recorder_write(recorder, &header, sizeof(header));
+
+    memcpy(recorder->shadow, machine->screen, sizeof(recorder->shadow));
+    recorder_snapshot(recorder);
+
+    if (recorder->failed) {
+        fclose(recorder->file);
+        free(recorder);
+        return 1;
+    }
+
+    machine->recorder = recorder;
+    log_info("recorder: Recording to %s", path);
+
+    return 0;
+}
+
+void CHIP8_recorder_frame(void) {
+    CHIP8_recorder *recorder = CHIP8_machine_get()->recorder;
+    if (recorder == NULL)
+        return;
+
+    if (++recorder->frames % CHIP8_RECORDER_SNAPSHOT_FRAMES == 0)
+        recorder_snapshot(recorder);
+}
+
+void CHIP8_recorder_close(void) {
+    CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_recorder *recorder = machine->recorder;
+    if (recorder == NULL)
+        return;
+
+    // Ends with the final state
+    recorder_snapshot(recorder);
+
+    if (fclose(recorder->file) != 0 && !recorder->failed)
+        log_error("recorder: Failed to write to %s (%s)", recorder->path,
+                  strerror(errno));
+
+    log_info("recorder: %llu record(s), %llu instruction(s), %.1f MiB "
+             "written to %s",
+             (unsigned long long)recorder->records,
+             (unsigned long long)machine->cycles,
+             recorder->bytes / (1024.0 * 1024.0), recorder->path);
+
+    free(recorder);
+    machine->recorder = NULL;
+}
+
+// -------------
+
+void CHIP8_recorder_store(const uint32_t address, const uint32_t length) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_recorder *recorder = machine->recorder;
+
+    const CHIP8_record record = {
+        .cycle = machine->cycles,
+        .pc = machine->pc,
+        .kind = CHIP8_RECORD_STORE,
+        .length = length,
+        .address = address % CHIP8_MEM_SIZE,
+    };
+    recorder_add(recorder, &recorder->mem, CHIP8_RECORDER_CHUNK_MEM, &record,
+                 1);
+
+    for (uint32_t i = 0; i < length; i++)
+        recorder_filter_set(&recorder->mem.block,
+                            (address + i) % CHIP8_MEM_SIZE /
+                                CHIP8_RECORDER_FILTER_GRANULE);
+}
+
+// Record the pixels of <row> in [start, end) that differ from the shadow
+static void recorder_draw_columns(CHIP8_recorder *recorder, const uint32_t row,
+                                  const uint32_t start, const uint32_t end) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    const uint8_t *pixels = machine->screen + row * CHIP8_SCREEN_BUFFER_WIDTH;
+    uint8_t *shadow = recorder->shadow + row * CHIP8_SCREEN_BUFFER_WIDTH;
+    uint16_t mask = 0;
+
+    for (uint32_t x = start; x < end; x++) {
+        if (pixels[x] != shadow[x])
+            mask |= 1u << (x - start);
+        shadow[x] = pixels[x];
+    }
+
+    if (mask == 0)
+        return;
+
+    const CHIP8_record record = {
+        .cycle = machine->cycles,
+        .pc = machine->pc,
+        .kind = CHIP8_RECORD_DRAW,
+        .length = row,
+        .address = start,
+        .mask = mask,
+    };
+    recorder_add(recorder, &recorder->screen, CHIP8_RECORDER_CHUNK_SCREEN,
+                 &record, 1);
+    recorder_filter_set(&recorder->screen.block, row);
+}
+
+void CHIP8_recorder_draw(const uint8_t x, const uint8_t y, const uint8_t n) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_recorder *recorder = machine->recorder;
+
+    const uint32_t width = machine->screen_width;
+    const uint32_t height = machine->screen_height;
+    const uint32_t pos_x = x % width;
+    const uint32_t pos_y = y % height;
+    const uint32_t rows = n == 0 ? 16 : n;
+
+    // Everything the sprite can cover, wrapped or not. Rows it didn't
+    // change aren't recorded.
+    for (uint32_t offset = 0; offset < rows && offset < height; offset++) {
+        const uint32_t row = (pos_y + offset) % height;
+        const uint32_t end = pos_x + RECORDER_SPRITE_WIDTH;
+
+        recorder_draw_columns(recorder, row, pos_x, end < width ? end : width);
+        if (end > width)
+            recorder_draw_columns(recorder, row, 0, end - width);
+    }
+}
+
+void CHIP8_recorder_screen(void) {
+    const CHIP8_machine *machine = CHIP8_machine_get();
+    CHIP8_recorder *recorder = machine->recorder;
+
+    for (uint32_t y = 0; y < CHIP8_SCREEN_BUFFER_HEIGHT; y++) {
+        const uint8_t *pixels = machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH;
+        uint8_t *shadow = recorder->shadow + y * CHIP8_SCREEN_BUFFER_WIDTH;
+
+        if (memcmp(pixels, shadow, CHIP8_SCREEN_BUFFER_WIDTH) == 0)
+            continue;
+
+        CHIP8_record records[2] = {{
+            .cycle = machine->cycles,
+            .pc = machine->pc,
+            .kind = CHIP8_RECORD_ROW,
+            .length = y,
+        }};
+
+        CHIP8_record_row row = {{0}};
+        for (uint32_t x = 0; x < CHIP8_SCREEN_BUFFER_WIDTH; x++) {
+            if (pixels[x] != shadow[x])
+                row.mask[x / 64] |= 1ull << (x % 64);
+        }
+        memcpy(&records[1], &row, sizeof(row));
+        memcpy(shadow, pixels, CHIP8_SCREEN_BUFFER_WIDTH);
+
+        recorder_add(recorder, &recorder->screen, CHIP8_RECORDER_CHUNK_SCREEN,
+                     records, 2);
+        recorder_filter_set(&recorder->screen.block, y);
+    }
+}
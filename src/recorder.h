@@ -0,0 +1,140 @@
+#ifndef _CHIP8_RECORDER_H_
+#define _CHIP8_RECORDER_H_
+
+#include <stdint.h>
+
+// Write log of a running rom, for questions like "which instruction last
+// wrote address X (or changed pixel (x, y)) before instruction N?" after
+// the fact (see chip8_history).
+//
+// Every store (FX33, FX55, 5XY2) is logged with its instruction number, pc
+// and the memory it wrote. Every sprite draw logs one record per screen row
+// it changed, with the pixels it toggled. Clears and scrolls log every row
+// they changed. Every CHIP8_RECORDER_SNAPSHOT_FRAMES frames, the whole
+// machine state is saved as well.
+//
+// File format (native byte order, read back on the same machine):
+//   CHIP8_recorder_header
+//   Chunks, each a CHIP8_recorder_chunk followed by <size> bytes:
+//     CHIP8_RECORDER_CHUNK_MEM / _SCREEN:
+//       CHIP8_recorder_block, then <count> CHIP8_record
+//     CHIP8_RECORDER_CHUNK_SNAPSHOT:
+//       CHIP8_recorder_snapshot
+//
+// Chunks of each type are in order of their instructions. Every block has
+// a filter of what its records touch, so queries walk back from the block
+// of instruction N and only look inside blocks that may contain an answer.
+// A file that wasn't closed (i.e. after a crash) is readable up to its
+// last complete chunk.
+
+#define CHIP8_RECORDER_MAGIC "CH8REC1"
+#define CHIP8_RECORDER_VERSION 1
+
+// Records per block (a block is written once it is full)
+#define CHIP8_RECORDER_BLOCK_RECORDS 4096
+
+// Bits in a block's filter. Memory blocks: one per 16 bytes of memory,
+// screen blocks: one per row.
+#define CHIP8_RECORDER_FILTER_BITS 4096
+#define CHIP8_RECORDER_FILTER_GRANULE 16
+
+// Frames between snapshots (10s at 60Hz)
+#define CHIP8_RECORDER_SNAPSHOT_FRAMES 600
+
+// Machine sizes (the history tool doesn't link the emulator)
+#define CHIP8_RECORDER_MEM_SIZE (64 * 1024)
+#define CHIP8_RECORDER_SCREEN_WIDTH 128
+#define CHIP8_RECORDER_SCREEN_HEIGHT 64
+
+typedef enum {
+    // Store of <length> bytes at <address> (wrapping at the end of memory)
+    CHIP8_RECORD_STORE,
+    // Sprite draw, changed pixels of row <length>: bit i of <mask> is column
+    // <address> + i
+    CHIP8_RECORD_DRAW,
+    // Clear or scroll, changed row <length>. The next record holds the
+    // changed pixels instead (CHIP8_record_row).
+    CHIP8_RECORD_ROW,
+} CHIP8_RECORD_KIND;
+
+typedef struct {
+    uint64_t cycle; // Instructions executed before this one
+    uint16_t pc;
+    uint8_t kind;
+    uint8_t length;
+    uint16_t address;
+    uint16_t mask;
+} CHIP8_record;
+
+// Follows a CHIP8_RECORD_ROW record: bit x % 64 of mask[x / 64] is column x
+typedef struct {
+    uint64_t mask[CHIP8_RECORDER_SCREEN_WIDTH / 64];
+} CHIP8_record_row;
+
+typedef enum {
+    CHIP8_RECORDER_CHUNK_MEM,
+    CHIP8_RECORDER_CHUNK_SCREEN,
+    CHIP8_RECORDER_CHUNK_SNAPSHOT,
+} CHIP8_RECORDER_CHUNK;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t mode;
+    char rom[256];
+} CHIP8_recorder_header;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+} CHIP8_recorder_chunk;
+
+typedef struct {
+    uint64_t first_cycle;
+    uint64_t last_cycle;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t filter[CHIP8_RECORDER_FILTER_BITS / 64];
+} CHIP8_recorder_block;
+
+typedef struct {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t index_reg;
+    uint16_t sp;
+    uint16_t stack[16];
+    uint8_t reg[16];
+    uint8_t flag_reg[8];
+    uint8_t keys[16];
+    uint8_t timer;
+    uint8_t timer_sound;
+    uint8_t screen_width;
+    uint8_t screen_height;
+    uint8_t screen_bitplane;
+    uint8_t reserved[3];
+    uint32_t rand_state;
+    uint8_t mem[CHIP8_RECORDER_MEM_SIZE];
+    uint8_t screen[CHIP8_RECORDER_SCREEN_HEIGHT * CHIP8_RECORDER_SCREEN_WIDTH];
+} CHIP8_recorder_snapshot;
+
+/// Start recording the selected machine into <path> (with a snapshot of
+/// its current state). <rom> is stored for reference.
+extern const uint32_t CHIP8_recorder_open(const char *path, const char *rom);
+
+/// A frame has ended (takes the periodic snapshots)
+extern void CHIP8_recorder_frame(void);
+
+/// Write everything that is still buffered and stop recording
+extern void CHIP8_recorder_close(void);
+
+// Used by the cores (see chip8.c). The instruction count has to be exact
+// while recording, see CHIP8_cpu_run.
+
+/// A store has written <length> bytes at <address>
+extern void CHIP8_recorder_store(uint32_t address, uint32_t length);
+/// A sprite of <n> rows (0: 16x16) has been drawn at (<x>, <y>)
+extern void CHIP8_recorder_draw(uint8_t x, uint8_t y, uint8_t n);
+/// The screen has been cleared or scrolled
+extern void CHIP8_recorder_screen(void);
+
+#endif
@@ -0,0 +1,207 @@
+// memfd_create
+#define _GNU_SOURCE
+
+#include "rom_cache.h"
+#include "chip8_machine.h"
+#include "log.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Largest rom that fits between 0x200 and the end of memory
+#define ROM_MAX_SIZE (CHIP8_MEM_SIZE - CHIP8_MEM_OFFSET)
+
+struct CHIP8_rom {
+    // Identity of the file (roms made from buffers aren't cached)
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+
+    uint32_t size;
+    uint32_t refs;
+
+    // Shared memory file holding the image (-1 if not supported)
+    int image_fd;
+    uint8_t *image;
+
+    struct CHIP8_rom *next;
+};
+
+static pthread_mutex_t rom_lock = PTHREAD_MUTEX_INITIALIZER;
+static CHIP8_rom *rom_cache = NULL;
+
+// Allocate the image, as a shared memory file where possible (so it can be
+// mapped into machines), and copy the rom into it
+static CHIP8_rom *rom_create(const uint8_t *data, const uint32_t size) {
+    CHIP8_rom *rom = calloc(1, sizeof(*rom));
+    if (rom == NULL)
+        abort();
+
+    rom->size = size;
+    rom->refs = 1;
+    rom->image_fd = -1;
+
+#ifdef __linux__
+    rom->image_fd = memfd_create("chip8-rom", MFD_CLOEXEC);
+    if (rom->image_fd != -1 && ftruncate(rom->image_fd, CHIP8_MEM_SIZE) == 0)
+        rom->image = mmap(NULL, CHIP8_MEM_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, rom->image_fd, 0);
+
+    if (rom->image_fd != -1 &&
+        (rom->image == NULL || rom->image == MAP_FAILED)) {
+        close(rom->image_fd);
+        rom->image_fd = -1;
+    }
+#endif
+
+    if (rom->image_fd == -1) {
+        rom->image = calloc(1, CHIP8_MEM_SIZE);
+        if (rom->image == NULL)
+            abort();
+    }
+
+    memcpy(rom->image + CHIP8_MEM_OFFSET, data, size);
+
+    // From here on, the image never changes
+    if (rom->image_fd != -1)
+        mprotect(rom->image, CHIP8_MEM_SIZE, PROT_READ);
+
+    return rom;
+}
+
+static void rom_destroy(CHIP8_rom *rom) {
+    if (rom->image_fd != -1) {
+        munmap(rom->image, CHIP8_MEM_SIZE);
+        close(rom->image_fd);
+    } else {
+        free(rom->image);
+    }
+
+    free(rom);
+}
+
+CHIP8_rom *CHIP8_rom_open(const char *path) {
+    assert(path != NULL);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    if (!S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (info.st_size > ROM_MAX_SIZE) {
+        log_error("%s: The rom is too large (%lld bytes, at most %d fit "
+                  "into memory)",
+                  path, (long long)info.st_size, ROM_MAX_SIZE);
+        close(fd);
+        errno = EFBIG;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&rom_lock);
+
+    for (CHIP8_rom *rom = rom_cache; rom != NULL; rom = rom->next) {
+        if (rom->dev == info.st_dev && rom->ino == info.st_ino &&
+            rom->size == info.st_size &&
+            rom->mtime.tv_sec == info.st_mtim.tv_sec &&
+            rom->mtime.tv_nsec == info.st_mtim.tv_nsec) {
+            rom->refs++;
+            pthread_mutex_unlock(&rom_lock);
+            close(fd);
+            return rom;
+        }
+    }
+
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        pthread_mutex_unlock(&rom_lock);
+        return NULL;
+    }
+
+    CHIP8_rom *rom = rom_create(data, info.st_size);
+    munmap(data, info.st_size);
+
+    rom->dev = info.st_dev;
+    rom->ino = info.st_ino;
+    rom->mtime = info.st_mtim;
+    rom->next = rom_cache;
+    rom_cache = rom;
+
+    pthread_mutex_unlock(&rom_lock);
+
+    return rom;
+}
+
+CHIP8_rom *CHIP8_rom_from_buffer(const void *buffer, const uint32_t size) {
+    assert(buffer != NULL && size <= ROM_MAX_SIZE);
+
+    return rom_create(buffer, size);
+}
+
+void CHIP8_rom_release(CHIP8_rom *rom) {
+    if (rom == NULL)
+        return;
+
+    pthread_mutex_lock(&rom_lock);
+
+    if (--rom->refs > 0) {
+        pthread_mutex_unlock(&rom_lock);
+        return;
+    }
+
+    for (CHIP8_rom **entry = &rom_cache; *entry != NULL;
+         entry = &(*entry)->next) {
+        if (*entry == rom) {
+            *entry = rom->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&rom_lock);
+
+    rom_destroy(rom);
+}
+
+const uint32_t CHIP8_rom_size(const CHIP8_rom *rom) { return rom->size; }
+
+const uint8_t *CHIP8_rom_image(const CHIP8_rom *rom) { return rom->image; }
+
+const uint32_t CHIP8_rom_map(const CHIP8_rom *rom, uint8_t *mem) {
+    const long page_size = sysconf(_SC_PAGESIZE);
+
+    if (rom->image_fd == -1 || page_size <= 0 ||
+        (uintptr_t)mem % page_size != 0 || CHIP8_MEM_SIZE % page_size != 0)
+        return 1;
+
+    void *result = mmap(mem, CHIP8_MEM_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED, rom->image_fd, 0);
+
+    return result == MAP_FAILED;
+}
+
+void CHIP8_rom_unmap(uint8_t *mem) {
+    void *result = mmap(mem, CHIP8_MEM_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
+
+    // The old mapping is gone either way, there is nothing to go back to
+    if (result == MAP_FAILED)
+        abort();
+}
@@ -0,0 +1,40 @@
+#ifndef _CHIP8_ROM_CACHE_H_
+#define _CHIP8_ROM_CACHE_H_
+
+#include <stdint.h>
+
+// Read-only rom images, shared by every machine that loads the same file.
+// Each rom is read (mmap) once into an image of the whole memory, with the
+// rom at 0x200 and zeros everywhere else. On Linux, machines map the image
+// copy-on-write over their memory, so a page is only copied once a machine
+// writes to it: Any number of machines running the same rom share a single
+// copy of it.
+
+typedef struct CHIP8_rom CHIP8_rom;
+
+/// Get the rom at <path>, from the cache or by reading it. Fails (returns
+/// NULL and sets errno) if the file can't be read, is empty or doesn't fit
+/// into memory (0x200 - 0xffff). Thread-safe.
+extern CHIP8_rom *CHIP8_rom_open(const char *path);
+
+/// Make a rom out of <size> bytes at <buffer> (copied, not cached)
+extern CHIP8_rom *CHIP8_rom_from_buffer(const void *buffer, uint32_t size);
+
+/// Drop a reference. The image is freed once the last user released it.
+extern void CHIP8_rom_release(CHIP8_rom *rom);
+
+/// Size of the rom (without the rest of the image)
+extern const uint32_t CHIP8_rom_size(const CHIP8_rom *rom);
+
+/// The memory image (CHIP8_MEM_SIZE bytes, read-only)
+extern const uint8_t *CHIP8_rom_image(const CHIP8_rom *rom);
+
+/// Map a private, copy-on-write view of the image over <mem>. Fails
+/// (without changing <mem>) if mapping isn't supported, or <mem> isn't page
+/// aligned. Returns 0 on success.
+extern const uint32_t CHIP8_rom_map(const CHIP8_rom *rom, uint8_t *mem);
+
+/// Replace a mapping made by CHIP8_rom_map with zeroed memory
+extern void CHIP8_rom_unmap(uint8_t *mem);
+
+#endif
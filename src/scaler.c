@@ -0,0 +1,153 @@
+#include "scaler.h"
+#include "chip8.h"
+
+#include <assert.h>
+#include <string.h>
+
+// A row and its neighbours to the left and right (edges repeated)
+typedef struct {
+    uint8_t left[CHIP8_SCALER_MAX_WIDTH];
+    uint8_t right[CHIP8_SCALER_MAX_WIDTH];
+} scaler_neighbours;
+
+static void scaler_shift(const uint8_t *restrict row, const uint32_t width,
+                         scaler_neighbours *restrict result) {
+    result->left[0] = row[0];
+    memcpy(result->left + 1, row, width - 1);
+    memcpy(result->right, row + 1, width - 1);
+    result->right[width - 1] = row[width - 1];
+}
+
+// Each output pixel takes the color of a neighbour, if the neighbours on
+// both sides of that corner agree (and the pixel isn't part of a straight
+// line). The conditions are evaluated for every pixel (no branches), so
+// each loop maps onto vector compares and selects.
+//
+//   A B C     E0 E1 E2
+//   D E F  -> E3 E4 E5  (Scale3x, Scale2x only uses the corners)
+//   G H I     E6 E7 E8
+
+static void scaler_scale2x_row(const uint8_t *restrict up,
+                               const uint8_t *restrict row,
+                               const uint8_t *restrict down,
+                               const uint32_t width, uint8_t *restrict out0,
+                               uint8_t *restrict out1) {
+    scaler_neighbours n;
+    scaler_shift(row, width, &n);
+
+    for (uint32_t x = 0; x < width; x++) {
+        const uint8_t b = up[x], d = n.left[x], e = row[x], f = n.right[x],
+                      h = down[x];
+        const uint8_t edge = (b != h) & (d != f);
+
+        out0[2 * x] = edge & (d == b) ? d : e;
+        out0[2 * x + 1] = edge & (b == f) ? f : e;
+        out1[2 * x] = edge & (d == h) ? d : e;
+        out1[2 * x + 1] = edge & (h == f) ? f : e;
+    }
+}
+
+static void scaler_scale3x_row(const uint8_t *restrict up,
+                               const uint8_t *restrict row,
+                               const uint8_t *restrict down,
+                               const uint32_t width, uint8_t *restrict out0,
+                               uint8_t *restrict out1,
+                               uint8_t *restrict out2) {
+    scaler_neighbours nu, n, nd;
+    scaler_shift(up, width, &nu);
+    scaler_shift(row, width, &n);
+    scaler_shift(down, width, &nd);
+
+    // Corners and edges first (contiguous, so the loop vectorizes), then
+    // they are interleaved into the output rows
+    uint8_t e0[CHIP8_SCALER_MAX_WIDTH], e1[CHIP8_SCALER_MAX_WIDTH],
+        e2[CHIP8_SCALER_MAX_WIDTH], e3[CHIP8_SCALER_MAX_WIDTH],
+        e5[CHIP8_SCALER_MAX_WIDTH], e6[CHIP8_SCALER_MAX_WIDTH],
+        e7[CHIP8_SCALER_MAX_WIDTH], e8[CHIP8_SCALER_MAX_WIDTH];
+
+    for (uint32_t x = 0; x < width; x++) {
+        const uint8_t a = nu.left[x], b = up[x], c = nu.right[x];
+        const uint8_t d = n.left[x], e = row[x], f = n.right[x];
+        const uint8_t g = nd.left[x], h = down[x], i = nd.right[x];
+        const uint8_t edge = (b != h) & (d != f);
+        const uint8_t db = edge & (d == b), bf = edge & (b == f);
+        const uint8_t dh = edge & (d == h), hf = edge & (h == f);
+
+        e0[x] = db ? d : e;
+        e1[x] = (db & (e != c)) | (bf & (e != a)) ? b : e;
+        e2[x] = bf ? f : e;
+        e3[x] = (db & (e != g)) | (dh & (e != a)) ? d : e;
+        e5[x] = (bf & (e != i)) | (hf & (e != c)) ? f : e;
+        e6[x] = dh ? d : e;
+        e7[x] = (dh & (e != i)) | (hf & (e != g)) ? h : e;
+        e8[x] = hf ? f : e;
+    }
+
+    for (uint32_t x = 0; x < width; x++) {
+        out0[3 * x] = e0[x];
+        out0[3 * x + 1] = e1[x];
+        out0[3 * x + 2] = e2[x];
+        out1[3 * x] = e3[x];
+        out1[3 * x + 1] = row[x];
+        out1[3 * x + 2] = e5[x];
+        out2[3 * x] = e6[x];
+        out2[3 * x + 1] = e7[x];
+        out2[3 * x + 2] = e8[x];
+    }
+}
+
+const uint32_t CHIP8_scaler_factor(CHIP8_SCALER scaler) {
+    switch (scaler) {
+    case CHIP8_SCALER_SCALE2X:
+        return 2;
+    case CHIP8_SCALER_SCALE3X:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+void CHIP8_scaler_run(CHIP8_SCALER scaler, const uint8_t *in,
+                      uint32_t in_stride, uint32_t width, uint32_t height,
+                      uint8_t *out, uint32_t out_stride) {
+    assert(width > 0 && width <= CHIP8_SCALER_MAX_WIDTH);
+    assert(height > 0);
+
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *row = in + (size_t)y * in_stride;
+        const uint8_t *up = y > 0 ? row - in_stride : row;
+        const uint8_t *down = y + 1 < height ? row + in_stride : row;
+
+        switch (scaler) {
+        case CHIP8_SCALER_SCALE2X: {
+            uint8_t *first = out + (size_t)y * 2 * out_stride;
+            scaler_scale2x_row(up, row, down, width, first,
+                               first + out_stride);
+            break;
+        }
+        case CHIP8_SCALER_SCALE3X: {
+            uint8_t *first = out + (size_t)y * 3 * out_stride;
+            scaler_scale3x_row(up, row, down, width, first,
+                               first + out_stride, first + 2 * out_stride);
+            break;
+        }
+        default:
+            memcpy(out + (size_t)y * out_stride, row, width);
+            break;
+        }
+    }
+}
+
+void CHIP8_scaler_screen(CHIP8_SCALER scaler, uint8_t *out,
+                         uint32_t out_stride, uint32_t *width,
+                         uint32_t *height) {
+    CHIP8_screen_view view;
+    CHIP8_screen_get_view(&view);
+
+    CHIP8_scaler_run(scaler, view.pixels, view.stride, view.width,
+                     view.height, out, out_stride);
+
+    const uint32_t factor = CHIP8_scaler_factor(scaler);
+    *width = view.width * factor;
+    *height = view.height * factor;
+}
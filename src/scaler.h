@@ -0,0 +1,40 @@
+#ifndef _CHIP8_SCALER_H_
+#define _CHIP8_SCALER_H_
+
+#include <stdint.h>
+
+// Pixel-art upscalers, run on the CPU on palette indices (before the
+// palette lookup), so every sink (window, capture) gets the same result on
+// every machine. The kernels are plain, branch-free loops over rows, which
+// the compiler turns into SIMD code.
+
+typedef enum {
+    CHIP8_SCALER_NONE,    // Plain pixels (1x, the sink scales them up)
+    CHIP8_SCALER_SCALE2X, // Scale2x (2x), also known as EPX
+    CHIP8_SCALER_SCALE3X, // Scale3x (3x)
+} CHIP8_SCALER;
+
+// Largest input accepted (the hires screen)
+#define CHIP8_SCALER_MAX_WIDTH 128
+#define CHIP8_SCALER_MAX_HEIGHT 64
+#define CHIP8_SCALER_MAX_FACTOR 3
+
+/// Output pixels per input pixel, in each direction
+extern const uint32_t CHIP8_scaler_factor(CHIP8_SCALER scaler);
+
+/// Scale <width> x <height> pixels from <in> (rows of <in_stride> bytes)
+/// into <out> (rows of <out_stride> bytes). Pixels outside of the input
+/// repeat its edges.
+extern void CHIP8_scaler_run(CHIP8_SCALER scaler, const uint8_t *in,
+                             uint32_t in_stride, uint32_t width,
+                             uint32_t height, uint8_t *out,
+                             uint32_t out_stride);
+
+/// Scale the screen of the selected machine into <out> (rows of
+/// <out_stride> bytes). The size of the result is stored in <width> and
+/// <height>.
+extern void CHIP8_scaler_screen(CHIP8_SCALER scaler, uint8_t *out,
+                                uint32_t out_stride, uint32_t *width,
+                                uint32_t *height);
+
+#endif
@@ -0,0 +1,535 @@
+#include "server.h"
+#include "chip8.h"
+#include "log.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVER_MAX_SESSIONS 1024
+#define SERVER_MAX_CLIENTS 1024
+#define SERVER_BACKLOG 64
+
+#define SERVER_IN_BUFFER_SIZE 64
+#define SERVER_OUT_BUFFER_SIZE                                                 \
+    (CHIP8_SERVER_FRAME_HEADER_SIZE + CHIP8_SERVER_MAX_PAYLOAD + 64)
+
+#define SERVER_SCREEN_SIZE (CHIP8_SERVER_MAX_WIDTH * CHIP8_SERVER_MAX_HEIGHT)
+
+typedef struct {
+    uint32_t id;
+    CHIP8_machine *machine;
+    uint8_t is_running;
+    uint32_t clients;
+    uint32_t frame;
+
+    // The screen as it was last sent to clients
+    uint8_t screen[SERVER_SCREEN_SIZE];
+    uint8_t width;
+    uint8_t height;
+
+    // Update for the current frame, relative to the previous one
+    uint8_t delta[CHIP8_SERVER_MAX_PAYLOAD];
+    size_t delta_size;
+
+    // Complete screen, for new or lagging clients. Built on demand.
+    uint8_t full[CHIP8_SERVER_MAX_PAYLOAD];
+    size_t full_size;
+    uint32_t full_frame;
+} server_session_t;
+
+typedef struct {
+    int fd;
+    server_session_t *session;
+
+    // Send every row with the next frame
+    uint8_t needs_full;
+
+    uint8_t in[SERVER_IN_BUFFER_SIZE];
+    size_t in_size;
+
+    uint8_t *out;
+    size_t out_size;
+} server_client_t;
+
+static server_session_t *sessions[SERVER_MAX_SESSIONS];
+static server_client_t clients[SERVER_MAX_CLIENTS];
+static uint32_t client_count = 0;
+static uint32_t session_next_id = 1;
+
+static volatile sig_atomic_t server_is_running = 1;
+
+static void server_handle_signal(int signal) {
+    (void)signal;
+    server_is_running = 0;
+}
+
+static inline void server_put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+}
+
+static inline uint32_t server_get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// Encode a single row as <row> (<count> <value>)...
+static size_t server_encode_row(uint8_t *out, uint8_t row,
+                                const uint8_t *pixels, uint8_t width) {
+    size_t size = 0;
+    out[size++] = row;
+
+    for (uint32_t x = 0; x < width;) {
+        const uint8_t value = pixels[x];
+        uint32_t count = 1;
+
+        while (x + count < width && pixels[x + count] == value && count < 255)
+            count++;
+
+        out[size++] = count;
+        out[size++] = value;
+        x += count;
+    }
+
+    return size;
+}
+
+// Send as much of the client's output buffer as the socket takes
+static void server_client_flush(server_client_t *client) {
+    while (client->out_size > 0) {
+        ssize_t sent = send(client->fd, client->out, client->out_size,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent <= 0)
+            return;
+
+        memmove(client->out, client->out + sent, client->out_size - sent);
+        client->out_size -= sent;
+    }
+}
+
+// Queue a message. Frames are only queued on an empty buffer, a client
+// that can't keep up skips frames and receives a complete one later.
+static const uint32_t server_client_send(server_client_t *client,
+                                         const uint8_t *header,
+                                         size_t header_size,
+                                         const uint8_t *payload,
+                                         size_t payload_size) {
+    const size_t size = header_size + payload_size;
+
+    if (client->out_size + size > SERVER_OUT_BUFFER_SIZE)
+        return 1;
+
+    memcpy(client->out + client->out_size, header, header_size);
+    if (payload_size > 0)
+        memcpy(client->out + client->out_size + header_size, payload,
+               payload_size);
+    client->out_size += size;
+
+    server_client_flush(client);
+    return 0;
+}
+
+static void server_client_send_id(server_client_t *client, uint8_t type,
+                                  uint32_t id) {
+    uint8_t message[5] = {type};
+    server_put_u32(message + 1, id);
+
+    server_client_send(client, message, sizeof(message), NULL, 0);
+}
+
+static server_session_t *server_session_find(uint32_t id) {
+    for (uint32_t i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        if (sessions[i] != NULL && sessions[i]->id == id)
+            return sessions[i];
+    }
+
+    return NULL;
+}
+
+static server_session_t *server_session_create(const CHIP8_config *config) {
+    uint32_t slot = 0;
+    while (slot < SERVER_MAX_SESSIONS && sessions[slot] != NULL)
+        slot++;
+
+    if (slot == SERVER_MAX_SESSIONS) {
+        log_warn("%s", "server: Too many sessions");
+        return NULL;
+    }
+
+    server_session_t *session = calloc(1, sizeof(*session));
+    if (session == NULL)
+        abort();
+
+    session->machine = CHIP8_machine_create();
+    CHIP8_machine_select(session->machine);
+    CHIP8_set_mode(config->mode);
+    CHIP8_set_engine(config->engine);
+    if (config->seed != 0)
+        CHIP8_seed(config->seed);
+
+    if (CHIP8_load_from_path(config->rom_path) != 0) {
+        log_error("server: Failed to load rom (%s): %s", strerror(errno),
+                  config->rom_path);
+        CHIP8_machine_destroy(session->machine);
+        free(session);
+        return NULL;
+    }
+
+    session->id = session_next_id++;
+    session->is_running = 1;
+    sessions[slot] = session;
+
+    log_info("server: Started session %u", session->id);
+
+    return session;
+}
+
+static void server_session_destroy(server_session_t *session) {
+    for (uint32_t i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        if (sessions[i] == session)
+            sessions[i] = NULL;
+    }
+
+    log_info("server: Closed session %u", session->id);
+
+    CHIP8_machine_destroy(session->machine);
+    free(session);
+}
+
+static void server_client_attach(server_client_t *client,
+                                 server_session_t *session) {
+    // Count the new session first, so attaching to the current one doesn't
+    // close it
+    if (session != NULL)
+        session->clients++;
+
+    if (client->session != NULL && --client->session->clients == 0)
+        server_session_destroy(client->session);
+
+    client->session = session;
+    client->needs_full = 1;
+
+    if (session != NULL)
+        server_client_send_id(client, CHIP8_SERVER_MSG_SESSION, session->id);
+}
+
+static void server_client_close(uint32_t index) {
+    server_client_t *client = &clients[index];
+
+    server_client_attach(client, NULL);
+    close(client->fd);
+    free(client->out);
+
+    clients[index] = clients[--client_count];
+}
+
+// Handle all complete messages in the client's input buffer.
+// Returns 1 if the client should be disconnected.
+static const uint32_t server_client_read(server_client_t *client,
+                                         const CHIP8_config *config) {
+    ssize_t received = recv(client->fd, client->in + client->in_size,
+                            SERVER_IN_BUFFER_SIZE - client->in_size,
+                            MSG_DONTWAIT);
+    if (received == 0)
+        return 1;
+    if (received < 0)
+        return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+
+    client->in_size += received;
+
+    size_t offset = 0;
+    while (offset < client->in_size) {
+        const uint8_t *message = client->in + offset;
+        const size_t available = client->in_size - offset;
+
+        if (message[0] == CHIP8_SERVER_MSG_NEW) {
+            server_client_attach(client, server_session_create(config));
+            if (client->session == NULL)
+                server_client_send_id(client, CHIP8_SERVER_MSG_ERROR, 0);
+            offset += 1;
+        } else if (message[0] == CHIP8_SERVER_MSG_ATTACH) {
+            if (available < 5)
+                break;
+
+            const uint32_t id = server_get_u32(message + 1);
+            server_session_t *session = server_session_find(id);
+            if (session != NULL)
+                server_client_attach(client, session);
+            else
+                server_client_send_id(client, CHIP8_SERVER_MSG_ERROR, id);
+            offset += 5;
+        } else if (message[0] == CHIP8_SERVER_MSG_KEY) {
+            if (available < 3)
+                break;
+
+            if (client->session != NULL && message[1] <= CHIP8_KEY_F) {
+                CHIP8_machine_select(client->session->machine);
+                CHIP8_input_set(message[1], message[2] ? CHIP8_KEY_PRESSED
+                                                       : CHIP8_KEY_RELEASED);
+            }
+            offset += 3;
+        } else {
+            log_warn("server: Unknown message type: 0x%02x", message[0]);
+            return 1;
+        }
+    }
+
+    memmove(client->in, client->in + offset, client->in_size - offset);
+    client->in_size -= offset;
+
+    return 0;
+}
+
+// Run a single frame of <session> and encode the changes
+static void server_session_frame(server_session_t *session,
+                                 const CHIP8_config *config) {
+    session->delta_size = 0;
+    if (!session->is_running)
+        return;
+
+    CHIP8_machine_select(session->machine);
+
+    int32_t status = CHIP8_cpu_run(config->cycles_per_frame, NULL);
+    CHIP8_timer_tick();
+
+    if (status != 0)
+        session->is_running = 0;
+
+    // Static screens cost nothing
+    if (!CHIP8_screen_get_update_status() && session->frame > 0) {
+        session->frame++;
+        return;
+    }
+
+    CHIP8_screen_view view;
+    CHIP8_screen_get_view(&view);
+    CHIP8_screen_clear_update_status();
+
+    const uint32_t width = view.width;
+    const uint32_t height = view.height;
+    const uint8_t is_full = session->frame == 0 || width != session->width ||
+                            height != session->height;
+
+    for (uint32_t y = 0; y < height; y++) {
+        // Rows not drawn to are still what the clients have
+        if (!is_full && !(view.rows_updated >> y & 1))
+            continue;
+
+        const uint8_t *row = view.pixels + y * view.stride;
+        uint8_t *previous = session->screen + y * CHIP8_SERVER_MAX_WIDTH;
+        if (!is_full && memcmp(row, previous, width) == 0)
+            continue;
+
+        memcpy(previous, row, width);
+        session->delta_size += server_encode_row(
+            session->delta + session->delta_size, y, row, width);
+    }
+
+    session->width = width;
+    session->height = height;
+    session->frame++;
+}
+
+static void server_session_build_full(server_session_t *session) {
+    if (session->full_frame == session->frame && session->full_size > 0)
+        return;
+
+    session->full_size = 0;
+    for (uint32_t y = 0; y < session->height; y++)
+        session->full_size += server_encode_row(
+            session->full + session->full_size, y,
+            session->screen + y * CHIP8_SERVER_MAX_WIDTH, session->width);
+
+    session->full_frame = session->frame;
+}
+
+static void server_client_frame(server_client_t *client) {
+    server_session_t *session = client->session;
+    if (session == NULL || session->frame == 0)
+        return;
+
+    const uint8_t *payload = session->delta;
+    size_t payload_size = session->delta_size;
+
+    if (client->needs_full) {
+        server_session_build_full(session);
+        payload = session->full;
+        payload_size = session->full_size;
+    } else if (payload_size == 0) {
+        return;
+    }
+
+    uint8_t header[CHIP8_SERVER_FRAME_HEADER_SIZE] = {CHIP8_SERVER_MSG_FRAME};
+    server_put_u32(header + 1, session->frame);
+    header[5] = session->width;
+    header[6] = session->height;
+    header[7] = payload_size & 0xff;
+    header[8] = (payload_size >> 8) & 0xff;
+
+    // Can't keep up: Skip the frame, send every row once there is room
+    client->needs_full = client->out_size > 0 ||
+                         server_client_send(client, header, sizeof(header),
+                                            payload, payload_size) != 0;
+}
+
+static int server_listen(const char *path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        log_error("server: Socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log_error("server: Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(fd, SERVER_BACKLOG) != 0) {
+        log_error("server: Failed to listen on %s: %s", path,
+                  strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+static void server_accept(int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+
+        if (client_count == SERVER_MAX_CLIENTS) {
+            log_warn("%s", "server: Too many clients");
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        server_client_t *client = &clients[client_count++];
+        memset(client, 0, sizeof(*client));
+        client->fd = fd;
+        client->out = malloc(SERVER_OUT_BUFFER_SIZE);
+        if (client->out == NULL)
+            abort();
+    }
+}
+
+const uint32_t CHIP8_server_run(const CHIP8_config *config,
+                                const char *path) {
+    static struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+
+    assert(config != NULL && path != NULL);
+
+    int listen_fd = server_listen(path);
+    if (listen_fd < 0)
+        return 1;
+
+    signal(SIGINT, server_handle_signal);
+    signal(SIGTERM, server_handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Sessions are seeded from rand()
+    srand(time(NULL));
+
+    log_info("server: Listening on %s", path);
+
+    uint64_t deadline = time_now_nsec() + CHIP8_TIMER_RENDER_RATE_NSEC;
+
+    while (server_is_running) {
+        // Wait for client activity until the next frame is due
+        const uint64_t now = time_now_nsec();
+        const int timeout =
+            now >= deadline ? 0 : (int)((deadline - now) / 1000000);
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (uint32_t i = 0; i < client_count; i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events =
+                POLLIN | (clients[i].out_size > 0 ? POLLOUT : 0);
+        }
+
+        const uint32_t polled = client_count;
+        if (poll(fds, polled + 1, timeout) < 0 && errno != EINTR) {
+            log_error("server: poll failed: %s", strerror(errno));
+            break;
+        }
+
+        // Iterate backwards, closing a client moves the last one into its slot
+        for (uint32_t i = polled; i > 0; i--) {
+            server_client_t *client = &clients[i - 1];
+            const short revents = fds[i].revents;
+
+            if (revents & POLLOUT)
+                server_client_flush(client);
+
+            if (revents & (POLLIN | POLLHUP | POLLERR) &&
+                server_client_read(client, config) != 0)
+                server_client_close(i - 1);
+        }
+
+        if (fds[0].revents & POLLIN)
+            server_accept(listen_fd);
+
+        if (time_now_nsec() < deadline)
+            continue;
+
+        for (uint32_t i = 0; i < SERVER_MAX_SESSIONS; i++) {
+            server_session_t *session = sessions[i];
+            if (session == NULL)
+                continue;
+
+            const uint8_t was_running = session->is_running;
+            server_session_frame(session, config);
+
+            if (was_running && !session->is_running) {
+                log_info("server: Session %u stopped", session->id);
+                for (uint32_t c = 0; c < client_count; c++) {
+                    if (clients[c].session == session)
+                        server_client_send_id(&clients[c],
+                                              CHIP8_SERVER_MSG_STOPPED,
+                                              session->id);
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < client_count; i++)
+            server_client_frame(&clients[i]);
+
+        deadline += CHIP8_TIMER_RENDER_RATE_NSEC;
+        if (deadline < time_now_nsec())
+            deadline = time_now_nsec() + CHIP8_TIMER_RENDER_RATE_NSEC;
+    }
+
+    while (client_count > 0)
+        server_client_close(client_count - 1);
+
+    close(listen_fd);
+    unlink(path);
+
+    log_info("%s", "server: Stopped");
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef _CHIP8_SERVER_H_
+#define _CHIP8_SERVER_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+// Protocol, spoken over a UNIX stream socket. All integers are little
+// endian.
+//
+// Client -> Server:
+//   'N'                      Start a new session (running the server's rom)
+//                            and attach to it
+//   'A' <u32 id>             Attach to an existing session (i.e. to watch)
+//   'K' <u8 key> <u8 state>  Key event for the attached session
+//                            (see CHIP8_KEY/CHIP8_KEYSTATE)
+//
+// Server -> Client:
+//   'S' <u32 id>             Attached to session <id>
+//   'E' <u32 id>             No such session
+//   'X' <u32 id>             The session has stopped (exit/invalid optcode)
+//   'F' <u32 frame> <u8 width> <u8 height> <u16 size> <payload>
+//                            Screen update. The payload contains one entry
+//                            per changed row:
+//                              <u8 row> (<u8 count> <u8 value>)...
+//                            The runs of a row always add up to <width>.
+//                            After attaching or a resolution change, every
+//                            row is sent. Unchanged frames are not sent.
+#define CHIP8_SERVER_MSG_NEW 'N'
+#define CHIP8_SERVER_MSG_ATTACH 'A'
+#define CHIP8_SERVER_MSG_KEY 'K'
+
+#define CHIP8_SERVER_MSG_SESSION 'S'
+#define CHIP8_SERVER_MSG_ERROR 'E'
+#define CHIP8_SERVER_MSG_STOPPED 'X'
+#define CHIP8_SERVER_MSG_FRAME 'F'
+
+#define CHIP8_SERVER_FRAME_HEADER_SIZE 9
+
+#define CHIP8_SERVER_MAX_WIDTH 128
+#define CHIP8_SERVER_MAX_HEIGHT 64
+
+// Worst case payload: Every row changed, every pixel its own run
+#define CHIP8_SERVER_MAX_PAYLOAD                                               \
+    (CHIP8_SERVER_MAX_HEIGHT * (1 + 2 * CHIP8_SERVER_MAX_WIDTH))
+
+/// Host sessions of <config->rom_path> on the socket at <path>, until
+/// interrupted. Every session runs with the configured mode and speed.
+extern const uint32_t CHIP8_server_run(const CHIP8_config *config,
+                                       const char *path);
+
+#endif
@@ -0,0 +1,188 @@
+#include "stats.h"
+#include "histogram.h"
+#include "log.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STATS_SUMMARY_NSEC 1000000000ull
+
+static struct {
+    // Start to start of consecutive frames, emulation and render time (us)
+    CHIP8_histogram interval;
+    CHIP8_histogram cpu;
+    CHIP8_histogram render;
+
+    uint64_t first_start;
+    uint64_t last_start;
+    uint32_t last_executed;
+    uint32_t last_ticks;
+
+    uint64_t frames;
+    uint64_t missed;
+    uint64_t executed;
+    uint64_t requested;
+    uint64_t ticks;
+
+    // Ring buffer for the overlay graph
+    uint64_t history_interval[CHIP8_STATS_HISTORY];
+    uint64_t history_cpu[CHIP8_STATS_HISTORY];
+
+    // The current second, and the rates of the previous one
+    uint64_t second_start;
+    uint64_t second_frames;
+    uint64_t second_executed;
+    uint64_t second_requested;
+    uint64_t second_missed;
+    double summary_fps;
+    double summary_ips;
+    double summary_share;
+    uint64_t summary_missed;
+} stats;
+
+static volatile sig_atomic_t dump_requested = 0;
+
+static void stats_signal(int signal) {
+    (void)signal;
+    dump_requested = 1;
+}
+
+void CHIP8_stats_init(void) {
+    memset(&stats, 0, sizeof(stats));
+    CHIP8_histogram_init(&stats.interval);
+    CHIP8_histogram_init(&stats.cpu);
+    CHIP8_histogram_init(&stats.render);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stats_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGUSR1, &action, NULL) != 0)
+        log_warn("%s", "Failed to install the SIGUSR1 handler");
+}
+
+void CHIP8_stats_record(const CHIP8_stats_frame *frame) {
+    assert(frame != NULL);
+
+    if (stats.frames == 0) {
+        stats.first_start = frame->start;
+        stats.second_start = frame->start;
+    } else {
+        const uint64_t interval = frame->start - stats.last_start;
+        CHIP8_histogram_add(&stats.interval, interval / 1000);
+
+        const uint32_t slot = stats.frames % CHIP8_STATS_HISTORY;
+        stats.history_interval[slot] = interval;
+        stats.history_cpu[slot] = frame->cpu;
+    }
+
+    stats.last_start = frame->start;
+    stats.last_executed = frame->executed;
+    stats.last_ticks = frame->ticks;
+
+    CHIP8_histogram_add(&stats.cpu, frame->cpu / 1000);
+    CHIP8_histogram_add(&stats.render, frame->render / 1000);
+
+    stats.frames++;
+    stats.missed += frame->missed;
+    stats.executed += frame->executed;
+    stats.requested += frame->requested;
+    stats.ticks += frame->ticks;
+
+    stats.second_frames++;
+    stats.second_executed += frame->executed;
+    stats.second_requested += frame->requested;
+    stats.second_missed += frame->missed;
+
+    const uint64_t elapsed = frame->start - stats.second_start;
+    if (elapsed >= STATS_SUMMARY_NSEC) {
+        stats.summary_fps = stats.second_frames * 1e9 / elapsed;
+        stats.summary_ips = stats.second_executed * 1e9 / elapsed;
+        stats.summary_share =
+            stats.second_requested != 0
+                ? 100.0 * stats.second_executed / stats.second_requested
+                : 100.0;
+        stats.summary_missed = stats.second_missed;
+
+        stats.second_start = frame->start;
+        stats.second_frames = 0;
+        stats.second_executed = 0;
+        stats.second_requested = 0;
+        stats.second_missed = 0;
+    }
+}
+
+void CHIP8_stats_poll(void) {
+    if (!dump_requested)
+        return;
+
+    dump_requested = 0;
+    CHIP8_stats_dump();
+}
+
+void CHIP8_stats_dump(void) {
+    if (stats.frames == 0) {
+        log_info("%s", "Stats: no frames");
+        return;
+    }
+
+    const uint64_t elapsed = stats.last_start - stats.first_start;
+    const double seconds = elapsed / 1e9;
+
+    // The last frame's start ends the measured time, it isn't part of it
+    const uint64_t frames = stats.frames - 1;
+    const uint64_t ticks = stats.ticks - stats.last_ticks;
+    const uint64_t executed = stats.executed - stats.last_executed;
+
+    log_info("Stats: %llu frame(s) in %.2fs, %llu missed deadline(s)",
+             (unsigned long long)stats.frames, seconds,
+             (unsigned long long)stats.missed);
+
+    if (elapsed > 0) {
+        log_info("Stats: %.2f fps (requested: %d), %.2f timer ticks/s "
+                 "(requested: %d)",
+                 frames / seconds, CHIP8_TIMER_RENDER_HZ, ticks / seconds,
+                 CHIP8_TIMER_RENDER_HZ);
+        log_info("Stats: %.0f ips, %llu of %llu requested instructions "
+                 "executed (%.1f%%)",
+                 executed / seconds, (unsigned long long)stats.executed,
+                 (unsigned long long)stats.requested,
+                 stats.requested != 0
+                     ? 100.0 * stats.executed / stats.requested
+                     : 100.0);
+    }
+
+    CHIP8_histogram_log(&stats.interval, "Frame interval", "us");
+    CHIP8_histogram_log(&stats.cpu, "Emulation time per frame", "us");
+    CHIP8_histogram_log(&stats.render, "Render time per frame", "us");
+}
+
+const uint32_t CHIP8_stats_history(uint64_t *intervals, uint64_t *cpu,
+                                   uint32_t count) {
+    // The first frame has no interval
+    const uint64_t available = stats.frames > 0 ? stats.frames - 1 : 0;
+
+    if (count > CHIP8_STATS_HISTORY)
+        count = CHIP8_STATS_HISTORY;
+    if (count > available)
+        count = available;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t slot = (stats.frames - count + i) % CHIP8_STATS_HISTORY;
+        intervals[i] = stats.history_interval[slot];
+        cpu[i] = stats.history_cpu[slot];
+    }
+
+    return count;
+}
+
+void CHIP8_stats_summary(char *buffer, size_t size) {
+    snprintf(buffer, size, "%.1f fps, %.2fM ips (%.0f%%), %llu missed",
+             stats.summary_fps, stats.summary_ips / 1e6, stats.summary_share,
+             (unsigned long long)stats.summary_missed);
+}
@@ -0,0 +1,47 @@
+#ifndef _CHIP8_STATS_H_
+#define _CHIP8_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame timing telemetry of the run loop: How long frames take, how evenly
+// they are spaced and whether the emulator keeps up with real time. Kept in
+// fixed size histograms (see histogram.h), recording a frame never
+// allocates. Dumped on exit (--stats) or whenever the process receives
+// SIGUSR1.
+
+// Frames kept for the overlay graph
+#define CHIP8_STATS_HISTORY 128
+
+typedef struct {
+    uint64_t start;     // When the frame started (time_now_nsec)
+    uint64_t cpu;       // Time spent emulating (nsec)
+    uint64_t render;    // Time spent capturing, rendering and presenting
+    uint32_t executed;  // Instructions executed
+    uint32_t requested; // Instructions the frame should have executed
+    uint32_t ticks;     // Timer ticks made (60Hz timers), 0 or more
+    uint8_t missed;     // Finished after its deadline
+} CHIP8_stats_frame;
+
+/// Reset the statistics and install the SIGUSR1 handler
+extern void CHIP8_stats_init(void);
+
+extern void CHIP8_stats_record(const CHIP8_stats_frame *frame);
+
+/// Dump the statistics, if SIGUSR1 was received since the last call
+extern void CHIP8_stats_poll(void);
+
+/// Log everything recorded so far
+extern void CHIP8_stats_dump(void);
+
+/// Copy the frame intervals and emulation times (nsec) of the last <count>
+/// frames into <intervals> and <cpu>, oldest first. Returns the number of
+/// frames copied.
+extern const uint32_t CHIP8_stats_history(uint64_t *intervals, uint64_t *cpu,
+                                          uint32_t count);
+
+/// One line summary of the last second (frame rate, instructions per
+/// second, missed deadlines)
+extern void CHIP8_stats_summary(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _CHIP8_TIMING_H_
+#define _CHIP8_TIMING_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CHIP8_TIMER_RENDER_HZ 60
+#define CHIP8_TIMER_RENDER_RATE_NSEC (uint64_t)(1000000000 / CHIP8_TIMER_RENDER_HZ)
+
+static inline uint64_t time_now_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void time_sleep_until(uint64_t deadline) {
+    struct timespec until = {
+        .tv_sec = deadline / 1000000000ull,
+        .tv_nsec = deadline % 1000000000ull,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) ==
+           EINTR)
+        ;
+}
+
+#endif
@@ -0,0 +1,490 @@
+#include "vecenv.h"
+#include "chip8_machine.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VECENV_ALIGNMENT 64
+
+// Registers are stored per register, so one register of all lanes is
+// contiguous
+#define VECENV_REG(env, index) ((env)->reg + (size_t)(index) * (env)->lanes)
+
+#define VECENV_MEM_WORD(machine, index)                                        \
+    (((machine)->mem[(index)] << 8) | (machine)->mem[(uint16_t)((index) + 1)])
+
+struct CHIP8_vecenv {
+    uint32_t lanes;
+    CHIP8_MODE mode;
+
+    // Per lane state, as arrays over all lanes
+    uint8_t *reg;
+    uint16_t *pc;
+    uint16_t *index_reg;
+    uint8_t *timer;
+    uint8_t *timer_sound;
+    int32_t *status;
+    // Instructions left in the current frame
+    uint32_t *remaining;
+
+    // Everything else (memory, screen, stack, keys), one machine per lane.
+    // The fields above are only valid in here while a lane runs on the
+    // interpreter.
+    CHIP8_machine *machines;
+    CHIP8_machine *pristine;
+
+    // Addresses any lane has written to. Everything else is still the same
+    // in every lane.
+    uint8_t written[CHIP8_MEM_SIZE / 8];
+
+    uint8_t *observation;
+    uint8_t *observation_dirty;
+
+    CHIP8_vecenv_stats stats;
+};
+
+static void *vecenv_alloc(size_t size) {
+    size = (size + VECENV_ALIGNMENT - 1) & ~(size_t)(VECENV_ALIGNMENT - 1);
+
+    void *result = aligned_alloc(VECENV_ALIGNMENT, size);
+    if (result == NULL)
+        abort();
+
+    memset(result, 0, size);
+    return result;
+}
+
+// Copy the state of <lane> into its machine (to run it on the interpreter)
+static inline void vecenv_fill(CHIP8_vecenv *env, const uint32_t lane) {
+    CHIP8_machine *machine = &env->machines[lane];
+
+    for (uint32_t i = 0; i < CHIP8_REGISTERS; i++)
+        machine->reg[i] = VECENV_REG(env, i)[lane];
+    machine->pc = env->pc[lane];
+    machine->index_reg = env->index_reg[lane];
+    machine->timer = env->timer[lane];
+    machine->timer_sound = env->timer_sound[lane];
+}
+
+// ... and back
+static inline void vecenv_spill(CHIP8_vecenv *env, const uint32_t lane) {
+    const CHIP8_machine *machine = &env->machines[lane];
+
+    for (uint32_t i = 0; i < CHIP8_REGISTERS; i++)
+        VECENV_REG(env, i)[lane] = machine->reg[i];
+    env->pc[lane] = machine->pc;
+    env->index_reg[lane] = machine->index_reg;
+    env->timer[lane] = machine->timer;
+    env->timer_sound[lane] = machine->timer_sound;
+}
+
+CHIP8_vecenv *CHIP8_vecenv_create(const char *rom_path, const CHIP8_MODE mode,
+                                  const uint32_t lanes, const uint32_t seed) {
+    assert(rom_path != NULL && lanes > 0);
+
+    CHIP8_machine *previous = CHIP8_machine_get();
+    CHIP8_machine *pristine = CHIP8_machine_create();
+
+    CHIP8_machine_select(pristine);
+    CHIP8_set_mode(mode);
+    const uint32_t result = CHIP8_load_from_path(rom_path);
+    CHIP8_machine_select(previous);
+
+    if (result != 0) {
+        CHIP8_machine_destroy(pristine);
+        return NULL;
+    }
+
+    CHIP8_vecenv *env = vecenv_alloc(sizeof(*env));
+    env->lanes = lanes;
+    env->mode = mode;
+    env->pristine = pristine;
+
+    env->reg = vecenv_alloc((size_t)CHIP8_REGISTERS * lanes);
+    env->pc = vecenv_alloc(lanes * sizeof(*env->pc));
+    env->index_reg = vecenv_alloc(lanes * sizeof(*env->index_reg));
+    env->timer = vecenv_alloc(lanes);
+    env->timer_sound = vecenv_alloc(lanes);
+    env->status = vecenv_alloc(lanes * sizeof(*env->status));
+    env->remaining = vecenv_alloc(lanes * sizeof(*env->remaining));
+    env->machines = vecenv_alloc(lanes * sizeof(*env->machines));
+    env->observation = vecenv_alloc((size_t)lanes * CHIP8_VECENV_OBS_SIZE);
+    env->observation_dirty = vecenv_alloc(lanes);
+
+    // Lanes share the rom (and its memory image) of the loaded machine,
+    // which they restore from when they are reset. They only ever restart,
+    // never reset or load, so they don't need a reference of their own.
+    for (uint32_t lane = 0; lane < lanes; lane++) {
+        memcpy(&env->machines[lane], pristine, sizeof(*pristine));
+        CHIP8_machine_select(&env->machines[lane]);
+        CHIP8_seed(seed + lane);
+        CHIP8_vecenv_reset(env, lane);
+    }
+
+    CHIP8_machine_select(previous);
+
+    return env;
+}
+
+void CHIP8_vecenv_destroy(CHIP8_vecenv *env) {
+    if (env == NULL)
+        return;
+
+    CHIP8_machine_destroy(env->pristine);
+    free(env->reg);
+    free(env->pc);
+    free(env->index_reg);
+    free(env->timer);
+    free(env->timer_sound);
+    free(env->status);
+    free(env->remaining);
+    free(env->machines);
+    free(env->observation);
+    free(env->observation_dirty);
+    free(env);
+}
+
+const uint32_t CHIP8_vecenv_lanes(const CHIP8_vecenv *env) {
+    return env->lanes;
+}
+
+void CHIP8_vecenv_reset(CHIP8_vecenv *env, const uint32_t lane) {
+    assert(lane < env->lanes);
+
+    CHIP8_machine *previous = CHIP8_machine_get();
+    CHIP8_machine_select(&env->machines[lane]);
+    CHIP8_restart();
+    CHIP8_machine_select(previous);
+
+    vecenv_spill(env, lane);
+    env->status[lane] = 0;
+    env->observation_dirty[lane] = 1;
+}
+
+void CHIP8_vecenv_set_keys(CHIP8_vecenv *env, const uint32_t lane,
+                           const uint16_t keys) {
+    assert(lane < env->lanes);
+
+    for (uint32_t i = 0; i < CHIP8_KEYS; i++)
+        env->machines[lane].keys[i] =
+            (keys >> i) & 1 ? CHIP8_KEY_PRESSED : CHIP8_KEY_RELEASED;
+}
+
+static inline const uint8_t vecenv_is_written(const CHIP8_vecenv *env,
+                                              const uint16_t address) {
+    return (env->written[address / 8] >> (address % 8)) & 1;
+}
+
+// Whether every lane is running, has instructions left and is at the same
+// instruction
+static inline const uint8_t vecenv_converged(const CHIP8_vecenv *env) {
+    uint32_t diverged = 0;
+
+    for (uint32_t lane = 0; lane < env->lanes; lane++)
+        diverged |= (env->pc[lane] ^ env->pc[0]) |
+                    (uint32_t)env->status[lane] | (env->remaining[lane] == 0);
+
+    if (diverged != 0)
+        return 0;
+
+    const uint16_t pc = env->pc[0];
+    if (!vecenv_is_written(env, pc) && !vecenv_is_written(env, pc + 1))
+        return 1;
+
+    // Lanes might have overwritten the instruction differently
+    const uint16_t optcode = VECENV_MEM_WORD(&env->machines[0], pc);
+    for (uint32_t lane = 1; lane < env->lanes; lane++) {
+        if (VECENV_MEM_WORD(&env->machines[lane], pc) != optcode)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Run <optcode> for all lanes at once. Returns 0 for instructions that
+// can't run in lockstep (memory, screen, stack, keys, ...).
+static const uint8_t vecenv_lockstep(CHIP8_vecenv *env,
+                                     const uint16_t optcode) {
+    const uint32_t lanes = env->lanes;
+
+    const uint16_t nnn = optcode & 0x0fff;
+    const uint8_t kk = optcode & 0x00ff;
+    const uint8_t n = optcode & 0x000f;
+    const uint8_t y = (optcode >> 4) & 0x000f;
+    const uint8_t x = (optcode >> 8) & 0x000f;
+
+    uint8_t *vx = VECENV_REG(env, x);
+    uint8_t *vy = VECENV_REG(env, y);
+    uint8_t *vf = VECENV_REG(env, 0xf);
+    uint16_t *pc = env->pc;
+
+    // Skips: The XO-CHIP 'F000 NNNN' instruction is skipped as a whole
+    // (lanes might disagree on that, if they wrote to it)
+    uint16_t skip = 4;
+    if (env->mode == CHIP8_MODE_XH8 || env->mode == CHIP8_MODE_ANY) {
+        const uint16_t next = pc[0] + 2;
+        if (vecenv_is_written(env, next) || vecenv_is_written(env, next + 1))
+            skip = 0;
+        else if (VECENV_MEM_WORD(&env->machines[0], next) == 0xf000)
+            skip = 6;
+    }
+
+    const uint16_t group = optcode & 0xf000;
+    if (skip == 0 && (group == 0x3000 || group == 0x4000 ||
+                      group == 0x5000 || group == 0x9000))
+        return 0;
+
+    switch (group) {
+    case 0x1000:
+        for (uint32_t i = 0; i < lanes; i++)
+            pc[i] = nnn;
+        return 1;
+    case 0x3000:
+        for (uint32_t i = 0; i < lanes; i++)
+            pc[i] += vx[i] == kk ? skip : 2;
+        return 1;
+    case 0x4000:
+        for (uint32_t i = 0; i < lanes; i++)
+            pc[i] += vx[i] != kk ? skip : 2;
+        return 1;
+    case 0x5000:
+        if (n != 0)
+            return 0;
+        for (uint32_t i = 0; i < lanes; i++)
+            pc[i] += vx[i] == vy[i] ? skip : 2;
+        return 1;
+    case 0x9000:
+        if (n != 0)
+            return 0;
+        for (uint32_t i = 0; i < lanes; i++)
+            pc[i] += vx[i] != vy[i] ? skip : 2;
+        return 1;
+    case 0x6000:
+        memset(vx, kk, lanes);
+        break;
+    case 0x7000:
+        for (uint32_t i = 0; i < lanes; i++)
+            vx[i] += kk;
+        break;
+    case 0x8000:
+        // Same order as the interpreter, in case x or y is 0xf
+        switch (n) {
+        case 0x0:
+            for (uint32_t i = 0; i < lanes; i++)
+                vx[i] = vy[i];
+            break;
+        case 0x1:
+            for (uint32_t i = 0; i < lanes; i++)
+                vx[i] |= vy[i];
+            break;
+        case 0x2:
+            for (uint32_t i = 0; i < lanes; i++)
+                vx[i] &= vy[i];
+            break;
+        case 0x3:
+            for (uint32_t i = 0; i < lanes; i++)
+                vx[i] ^= vy[i];
+            break;
+        case 0x4:
+            for (uint32_t i = 0; i < lanes; i++) {
+                vf[i] = (uint32_t)vx[i] + vy[i] > 255;
+                vx[i] += vy[i];
+            }
+            break;
+        case 0x5:
+            for (uint32_t i = 0; i < lanes; i++) {
+                vf[i] = vy[i] > vx[i];
+                vx[i] = vx[i] - vy[i];
+            }
+            break;
+        case 0x7:
+            for (uint32_t i = 0; i < lanes; i++) {
+                vf[i] = vx[i] > vy[i];
+                vx[i] = vy[i] - vx[i];
+            }
+            break;
+        default:
+            // Shifts depend on the mode's quirks
+            return 0;
+        }
+        break;
+    case 0xa000:
+        for (uint32_t i = 0; i < lanes; i++)
+            env->index_reg[i] = nnn;
+        break;
+    case 0xf000:
+        switch (kk) {
+        case 0x07:
+            memcpy(vx, env->timer, lanes);
+            break;
+        case 0x15:
+            memcpy(env->timer, vx, lanes);
+            break;
+        case 0x18:
+            memcpy(env->timer_sound, vx, lanes);
+            break;
+        case 0x1e:
+            for (uint32_t i = 0; i < lanes; i++)
+                env->index_reg[i] += vx[i];
+            break;
+        default:
+            return 0;
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < lanes; i++)
+        pc[i] += 2;
+
+    return 1;
+}
+
+// Note the addresses <optcode> is about to write to
+static void vecenv_check_store(CHIP8_vecenv *env, const CHIP8_machine *machine,
+                               const uint16_t optcode) {
+    const uint8_t x = (optcode >> 8) & 0x000f;
+    const uint8_t y = (optcode >> 4) & 0x000f;
+    uint32_t start, end;
+
+    if ((optcode & 0xf0ff) == 0xf033) {
+        start = machine->index_reg;
+        end = start + 3;
+    } else if ((optcode & 0xf0ff) == 0xf055) {
+        start = machine->index_reg;
+        end = start + x + 1;
+    } else if ((optcode & 0xf00f) == 0x5002) {
+        start = machine->index_reg + x;
+        end = machine->index_reg + y;
+    } else {
+        return;
+    }
+
+    for (uint32_t address = start; address < end; address++) {
+        const uint16_t index = address;
+        env->written[index / 8] |= 1 << (index % 8);
+    }
+}
+
+static inline void vecenv_step_lane(CHIP8_vecenv *env, const uint32_t lane) {
+    CHIP8_machine *machine = &env->machines[lane];
+
+    vecenv_fill(env, lane);
+    vecenv_check_store(env, machine, VECENV_MEM_WORD(machine, machine->pc));
+
+    CHIP8_machine_select(machine);
+    env->status[lane] = CHIP8_cpu_step();
+
+    vecenv_spill(env, lane);
+}
+
+static void vecenv_observe_lane(CHIP8_vecenv *env, const uint32_t lane) {
+    CHIP8_machine *machine = &env->machines[lane];
+    uint8_t *out = env->observation + (size_t)lane * CHIP8_VECENV_OBS_SIZE;
+
+    if (machine->screen_is_hires) {
+        for (uint32_t y = 0; y < CHIP8_VECENV_OBS_HEIGHT; y++)
+            memcpy(out + y * CHIP8_VECENV_OBS_WIDTH,
+                   machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH,
+                   CHIP8_VECENV_OBS_WIDTH);
+    } else {
+        for (uint32_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++) {
+            const uint8_t *row = machine->screen + y * CHIP8_SCREEN_BUFFER_WIDTH;
+            uint8_t *first = out + 2 * y * CHIP8_VECENV_OBS_WIDTH;
+
+            for (uint32_t x = 0; x < CHIP8_SCREEN_WIDTH; x++)
+                first[2 * x] = first[2 * x + 1] = row[x];
+            memcpy(first + CHIP8_VECENV_OBS_WIDTH, first,
+                   CHIP8_VECENV_OBS_WIDTH);
+        }
+    }
+
+    machine->screen_update_status = 0;
+    machine->screen_rows_updated = 0;
+    env->observation_dirty[lane] = 0;
+}
+
+void CHIP8_vecenv_step(CHIP8_vecenv *env, const uint32_t frames,
+                       const uint32_t cycles, int32_t *status) {
+    assert(env != NULL);
+
+    CHIP8_machine *previous = CHIP8_machine_get();
+    const uint32_t lanes = env->lanes;
+
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        for (uint32_t i = 0; i < lanes; i++)
+            env->remaining[i] = env->status[i] == 0 ? cycles : 0;
+
+        for (;;) {
+            if (vecenv_converged(env)) {
+                const uint16_t optcode =
+                    VECENV_MEM_WORD(&env->machines[0], env->pc[0]);
+                if (vecenv_lockstep(env, optcode)) {
+                    for (uint32_t i = 0; i < lanes; i++)
+                        env->remaining[i]--;
+                    env->stats.lockstep += lanes;
+                    continue;
+                }
+            }
+
+            // Diverged (or an instruction that can't run in lockstep): Only
+            // step the lanes with the lowest pc. Lanes that took a different
+            // path through the same code catch up with each other that way,
+            // until they are back in lockstep.
+            uint32_t pc_min = UINT32_MAX;
+            for (uint32_t i = 0; i < lanes; i++) {
+                if (env->remaining[i] != 0 && env->pc[i] < pc_min)
+                    pc_min = env->pc[i];
+            }
+
+            // Every lane has finished the frame
+            if (pc_min == UINT32_MAX)
+                break;
+
+            for (uint32_t lane = 0; lane < lanes; lane++) {
+                if (env->remaining[lane] == 0 || env->pc[lane] != pc_min)
+                    continue;
+
+                vecenv_step_lane(env, lane);
+                env->stats.scalar++;
+
+                env->remaining[lane]--;
+                if (env->status[lane] != 0)
+                    env->remaining[lane] = 0;
+            }
+        }
+
+        // Timers of the lanes that are still running
+        for (uint32_t i = 0; i < lanes; i++) {
+            const uint8_t running = env->status[i] == 0;
+            env->timer[i] -= running & (env->timer[i] > 0);
+            env->timer_sound[i] -= running & (env->timer_sound[i] > 0);
+        }
+    }
+
+    for (uint32_t lane = 0; lane < lanes; lane++) {
+        if (env->machines[lane].screen_update_status ||
+            env->observation_dirty[lane])
+            vecenv_observe_lane(env, lane);
+    }
+
+    if (status != NULL)
+        memcpy(status, env->status, lanes * sizeof(*status));
+
+    CHIP8_machine_select(previous);
+}
+
+const uint8_t *CHIP8_vecenv_observe(CHIP8_vecenv *env) {
+    for (uint32_t lane = 0; lane < env->lanes; lane++) {
+        if (env->observation_dirty[lane])
+            vecenv_observe_lane(env, lane);
+    }
+
+    return env->observation;
+}
+
+const CHIP8_vecenv_stats CHIP8_vecenv_get_stats(const CHIP8_vecenv *env) {
+    return env->stats;
+}
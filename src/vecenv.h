@@ -0,0 +1,62 @@
+#ifndef _CHIP8_VECENV_H_
+#define _CHIP8_VECENV_H_
+
+#include "chip8.h"
+
+#include <stdint.h>
+
+// Batched environments: <lanes> copies of the same rom, stepped together
+// (i.e. for reinforcement learning or search). Registers, pc, I and the
+// timers of all lanes are kept as contiguous arrays (struct of arrays).
+// While every lane is at the same instruction, register and control flow
+// instructions run across all lanes at once, in loops the compiler turns
+// into SIMD code. Everything else (memory, the screen, the stack) stays
+// per lane and runs on the interpreter, one lane at a time.
+//
+// Available as a library, see 'make lib'.
+
+// Observations always have the hires size, lores screens are scaled up
+#define CHIP8_VECENV_OBS_WIDTH 128
+#define CHIP8_VECENV_OBS_HEIGHT 64
+#define CHIP8_VECENV_OBS_SIZE                                                  \
+    (CHIP8_VECENV_OBS_WIDTH * CHIP8_VECENV_OBS_HEIGHT)
+
+typedef struct CHIP8_vecenv CHIP8_vecenv;
+
+typedef struct {
+    // Instructions executed for all lanes at once, and for single lanes
+    uint64_t lockstep;
+    uint64_t scalar;
+} CHIP8_vecenv_stats;
+
+/// Load <rom_path> into <lanes> machines running <mode>. Lane i is seeded
+/// with <seed> + i. Returns NULL if the rom can't be loaded.
+extern CHIP8_vecenv *CHIP8_vecenv_create(const char *rom_path,
+                                         CHIP8_MODE mode, uint32_t lanes,
+                                         uint32_t seed);
+extern void CHIP8_vecenv_destroy(CHIP8_vecenv *env);
+
+extern const uint32_t CHIP8_vecenv_lanes(const CHIP8_vecenv *env);
+
+/// Put <lane> back into the state right after loading the rom (keeps its
+/// random number generator running)
+extern void CHIP8_vecenv_reset(CHIP8_vecenv *env, uint32_t lane);
+
+/// Set the pressed keys of <lane>, one bit per key (bit 0: CHIP8_KEY_0)
+extern void CHIP8_vecenv_set_keys(CHIP8_vecenv *env, uint32_t lane,
+                                  uint16_t keys);
+
+/// Run every lane for <frames> frames of <cycles> instructions each.
+/// Lanes that exit or hit an invalid instruction stop, until they are reset.
+/// <status> (optional, one per lane) receives 0 (running), 2 (exit) or
+/// -1 (invalid instruction).
+extern void CHIP8_vecenv_step(CHIP8_vecenv *env, uint32_t frames,
+                              uint32_t cycles, int32_t *status);
+
+/// The screens of all lanes, as one contiguous [lanes][64][128] array of
+/// palette indices. Valid until the next step.
+extern const uint8_t *CHIP8_vecenv_observe(CHIP8_vecenv *env);
+
+extern const CHIP8_vecenv_stats CHIP8_vecenv_get_stats(const CHIP8_vecenv *env);
+
+#endif
@@ -0,0 +1,318 @@
+#include "verify.h"
+#include "aot.h"
+#include "batch.h"
+#include "chip8_machine.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+// Chance (1 in n) of a key changing each frame
+#define VERIFY_KEY_CHANGE 8
+
+typedef struct {
+    uint64_t index; // Instructions executed before this one
+    uint16_t pc;
+    uint16_t opcode;
+} verify_trace;
+
+static const char *verify_engine_name(const CHIP8_ENGINE engine) {
+    return engine == CHIP8_ENGINE_INTERPRETER ? "interpreter" : "predecoded";
+}
+
+static const uint32_t verify_load(CHIP8_machine *target,
+                                  const CHIP8_config *config,
+                                  const CHIP8_ENGINE engine) {
+    CHIP8_machine_select(target);
+    CHIP8_set_mode(config->mode);
+    CHIP8_set_engine(engine);
+    CHIP8_seed(config->seed != 0 ? config->seed : CHIP8_BATCH_DEFAULT_SEED);
+
+    if (CHIP8_load_from_path(config->rom_path) != 0) {
+        log_error("verify: Failed to load rom (%s): %s", strerror(errno),
+                  config->rom_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Press or release a random key on both machines, now and then
+static void verify_keys(CHIP8_machine *reference, CHIP8_machine *candidate,
+                        uint32_t *state, uint16_t *pressed) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    if (*state % VERIFY_KEY_CHANGE != 0)
+        return;
+
+    const CHIP8_KEY key = (*state >> 8) % CHIP8_KEYS;
+    *pressed ^= 1u << key;
+    const CHIP8_KEYSTATE keystate = (*pressed >> key) & 1
+                                        ? CHIP8_KEY_PRESSED
+                                        : CHIP8_KEY_RELEASED;
+
+    CHIP8_machine_select(reference);
+    CHIP8_input_set(key, keystate);
+    CHIP8_machine_select(candidate);
+    CHIP8_input_set(key, keystate);
+}
+
+// Compare the state of both machines. Returns the number of differing
+// fields, logging each of them if <report> is set.
+static const uint32_t verify_compare(const CHIP8_machine *reference,
+                                     const CHIP8_machine *candidate,
+                                     const uint8_t report) {
+    uint32_t differences = 0;
+
+    // The name is only formatted for the report
+#define VERIFY_FIELD(field, ...)                                               \
+    do {                                                                       \
+        if (reference->field != candidate->field) {                            \
+            differences++;                                                     \
+            if (report) {                                                      \
+                char name[32];                                                 \
+                snprintf(name, sizeof(name), __VA_ARGS__);                     \
+                log_error("verify:   %-16s reference 0x%llx, "               \
+                          "candidate 0x%llx",                                  \
+                          name, (unsigned long long)reference->field,          \
+                          (unsigned long long)candidate->field);               \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+    VERIFY_FIELD(pc, "pc");
+    VERIFY_FIELD(index_reg, "I");
+    VERIFY_FIELD(sp, "sp");
+    VERIFY_FIELD(cycles, "cycles");
+
+    for (uint32_t i = 0; i < CHIP8_REGISTERS; i++)
+        VERIFY_FIELD(reg[i], "V%X", i);
+
+    for (uint32_t i = 0; i < CHIP8_FLAG_REGISTERS; i++)
+        VERIFY_FIELD(flag_reg[i], "flag register %u", i);
+
+    for (uint32_t i = 0; i < CHIP8_STACK_SIZE; i++)
+        VERIFY_FIELD(stack[i], "stack[%u]", i);
+
+    for (uint32_t i = 0; i < CHIP8_KEYS; i++)
+        VERIFY_FIELD(keys[i], "key %X", i);
+
+    VERIFY_FIELD(timer, "delay timer");
+    VERIFY_FIELD(timer_sound, "sound timer");
+    VERIFY_FIELD(rand_state, "random state");
+    VERIFY_FIELD(screen_width, "screen width");
+    VERIFY_FIELD(screen_height, "screen height");
+    VERIFY_FIELD(screen_bitplane, "bitplane");
+    VERIFY_FIELD(screen_update_status, "screen updated");
+    VERIFY_FIELD(screen_rows_updated, "updated rows");
+    VERIFY_FIELD(screen_dirty, "dirty rows");
+
+    for (uint32_t i = 0; i < CHIP8_MEM_PAGES / 64; i++) {
+        VERIFY_FIELD(mem_dirty[i], "dirty pages[%u]", i);
+
+        // Pages neither machine wrote to still match the rom
+        const uint64_t pages =
+            reference->mem_dirty[i] | candidate->mem_dirty[i];
+        for (uint32_t bit = 0; bit < 64; bit++) {
+            if (!((pages >> bit) & 1))
+                continue;
+
+            const uint32_t start = (i * 64 + bit) * CHIP8_MEM_PAGE_SIZE;
+            for (uint32_t address = start;
+                 address < start + CHIP8_MEM_PAGE_SIZE; address++)
+                VERIFY_FIELD(mem[address], "mem[0x%04x]", address);
+        }
+    }
+
+    const uint64_t rows = reference->screen_dirty | candidate->screen_dirty;
+    for (uint32_t y = 0; y < CHIP8_SCREEN_BUFFER_HEIGHT; y++) {
+        if (!((rows >> y) & 1))
+            continue;
+
+        for (uint32_t x = 0; x < CHIP8_SCREEN_BUFFER_WIDTH; x++)
+            VERIFY_FIELD(screen[y * CHIP8_SCREEN_BUFFER_WIDTH + x],
+                         "pixel %u,%u", x, y);
+    }
+
+#undef VERIFY_FIELD
+
+    return differences;
+}
+
+static void verify_report(const CHIP8_machine *reference,
+                          const CHIP8_machine *candidate,
+                          const char *candidate_name, const char *when,
+                          const int32_t status[2], const uint32_t executed[2],
+                          const verify_trace *trace, const uint64_t traced) {
+    log_error("verify: The %s engine differs from the interpreter %s",
+              candidate_name, when);
+
+    if (status[0] != status[1] || executed[0] != executed[1])
+        log_error("verify:   %-16s reference %d (%u executed), candidate %d "
+                  "(%u executed)",
+                  "status", status[0], executed[0], status[1], executed[1]);
+
+    verify_compare(reference, candidate, 1);
+
+    log_error("%s", "verify: Last instructions of the reference:");
+
+    const uint64_t count =
+        traced < CHIP8_VERIFY_TRACE ? traced : CHIP8_VERIFY_TRACE;
+    for (uint64_t i = traced - count; i < traced; i++) {
+        const verify_trace *entry = &trace[i % CHIP8_VERIFY_TRACE];
+        log_error("verify:   #%llu  pc 0x%04x  %04x",
+                  (unsigned long long)entry->index, entry->pc, entry->opcode);
+    }
+}
+
+const uint32_t CHIP8_verify_run(const CHIP8_config *config) {
+    // Tracing every instruction of the reference would be all that runs
+    const LOG_LEVEL level = log_get_level();
+    if (level < LOG_LEVEL_INFO)
+        log_set_level(LOG_LEVEL_INFO);
+
+    CHIP8_machine *reference = CHIP8_machine_create();
+    CHIP8_machine *candidate = CHIP8_machine_create();
+
+    uint32_t result = 0;
+
+    if (verify_load(reference, config, CHIP8_ENGINE_INTERPRETER) != 0 ||
+        verify_load(candidate, config, config->engine) != 0) {
+        result = 1;
+        goto done;
+    }
+
+    const int32_t (*run)(uint32_t cycles, uint32_t *executed) = CHIP8_cpu_run;
+    const char *candidate_name = verify_engine_name(config->engine);
+
+#ifdef CHIP8_AOT
+    // The candidate is still selected
+    if (CHIP8_aot_init(&chip8_aot_program) == 0) {
+        run = CHIP8_aot_run;
+        candidate_name = "aot";
+    }
+#endif
+
+    if (run == CHIP8_cpu_run && config->engine == CHIP8_ENGINE_INTERPRETER)
+        log_warn("%s", "verify: Comparing the interpreter with itself");
+
+    const uint32_t interval = config->verify_interval;
+    const uint32_t frames =
+        config->instructions != 0
+            ? UINT32_MAX
+            : (config->frames != 0 ? config->frames
+                                   : CHIP8_CONFIG_DEFAULT_BATCH_FRAMES);
+
+    log_info("verify: %s: %s against the interpreter, compared every %u "
+             "instruction(s)",
+             config->rom_path, candidate_name, interval);
+
+    verify_trace trace[CHIP8_VERIFY_TRACE];
+    uint64_t traced = 0;
+    uint64_t instructions = 0;
+    uint32_t key_state = config->seed != 0 ? config->seed : 0x2545f491;
+    uint16_t pressed = 0;
+    int32_t status = 0;
+    uint32_t frame = 0;
+
+    while (status == 0 && result == 0 && frame < frames) {
+        verify_keys(reference, candidate, &key_state, &pressed);
+
+        uint32_t remaining = config->cycles_per_frame;
+        if (config->instructions != 0) {
+            if (instructions >= config->instructions)
+                break;
+            if (config->instructions - instructions < remaining)
+                remaining = config->instructions - instructions;
+        }
+
+        while (remaining > 0) {
+            const uint32_t chunk = remaining < interval ? remaining : interval;
+            int32_t statuses[2] = {0, 0};
+            uint32_t executed[2] = {0, 0};
+
+            // The reference steps through the chunk, to keep a trace
+            CHIP8_machine_select(reference);
+            while (executed[0] < chunk && statuses[0] == 0) {
+                verify_trace *entry = &trace[traced++ % CHIP8_VERIFY_TRACE];
+                entry->index = instructions + executed[0];
+                entry->pc = reference->pc;
+                entry->opcode = (reference->mem[reference->pc] << 8) |
+                                reference->mem[(reference->pc + 1) %
+                                               CHIP8_MEM_SIZE];
+
+                uint32_t count = 0;
+                statuses[0] = CHIP8_cpu_run(1, &count);
+                executed[0] += count;
+            }
+
+            CHIP8_machine_select(candidate);
+            statuses[1] = run(chunk, &executed[1]);
+
+            instructions += executed[0];
+
+            if (statuses[0] != statuses[1] || executed[0] != executed[1] ||
+                verify_compare(reference, candidate, 0) != 0) {
+                char when[96];
+                snprintf(when, sizeof(when),
+                         "after instruction %llu (frame %u)",
+                         (unsigned long long)instructions, frame);
+                verify_report(reference, candidate, candidate_name, when,
+                              statuses, executed, trace, traced);
+                result = 1;
+                break;
+            }
+
+            status = statuses[0];
+            if (status != 0)
+                break;
+
+            remaining -= chunk;
+        }
+
+        if (status != 0 || result != 0)
+            break;
+
+        CHIP8_machine_select(reference);
+        CHIP8_timer_tick();
+        CHIP8_screen_clear_update_status();
+        CHIP8_machine_select(candidate);
+        CHIP8_timer_tick();
+        CHIP8_screen_clear_update_status();
+
+        if (verify_compare(reference, candidate, 0) != 0) {
+            const int32_t statuses[2] = {0, 0};
+            const uint32_t executed[2] = {0, 0};
+            char when[96];
+            snprintf(when, sizeof(when), "after the timer tick of frame %u",
+                     frame);
+            verify_report(reference, candidate, candidate_name, when,
+                          statuses, executed, trace, traced);
+            result = 1;
+        }
+
+        frame++;
+    }
+
+    if (result == 0) {
+        log_info("verify: %s: No differences in %llu instruction(s), %u "
+                 "frame(s)%s",
+                 config->rom_path, (unsigned long long)instructions, frame,
+                 status == 2    ? " (the rom exited)"
+                 : status == -1 ? " (invalid optcode)"
+                                : "");
+
+        if (status == -1)
+            result = 1;
+    }
+
+done:
+    CHIP8_machine_destroy(reference);
+    CHIP8_machine_destroy(candidate);
+    log_set_level(level);
+
+    return result;
+}
@@ -0,0 +1,34 @@
+#ifndef _CHIP8_VERIFY_H_
+#define _CHIP8_VERIFY_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+// Instructions between comparisons, unless --verify=<n> says otherwise
+#define CHIP8_VERIFY_DEFAULT_INTERVAL 100
+
+// Reference instructions shown in a mismatch report
+#define CHIP8_VERIFY_TRACE 16
+
+/// Differential check of <config->rom_path>: Run the rom on two machines
+/// side by side, without a window. The reference runs on the interpreter,
+/// one instruction at a time. The candidate runs on <config->engine> (or
+/// the compiled rom, in 'make aot' builds), in chunks of
+/// <config->verify_interval> instructions. Both get the same seed and the
+/// same (pseudo random) key presses.
+///
+/// After every chunk and every timer tick, the machines are compared:
+/// registers, pc, I, the stack, timers, keys, the random number generator,
+/// every memory page either of them has written and every screen row
+/// either of them has drawn to. The first difference stops the run, with
+/// a report of all differing fields and the last instructions the
+/// reference executed.
+///
+/// Runs until the rom exits, hits an invalid optcode or uses up its budget
+/// (--frames, default 600, or --instructions).
+///
+/// Returns 0 if the machines never differed.
+extern const uint32_t CHIP8_verify_run(const CHIP8_config *config);
+
+#endif
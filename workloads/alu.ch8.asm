@@ -0,0 +1,37 @@
+; Arithmetic and flags, BCD, loads and stores, calls, timers and keys
+
+    LD V0, 1
+    LD V1, 3
+loop:
+    ADD V0, V1
+    SUB V1, V0
+    AND V0, V1
+    XOR V0, V1
+    OR V0, V1
+    SHL V0
+    SHR V1
+    SUBN V1, V0
+    ADD V1, 7
+    SNE V0, 0
+    LD V0, 0x55
+    LD F, V0
+    LD I, 0x300
+    ADD I, V0
+    LD B, V2
+    LD V3, [I]
+    LD I, 0x300
+    LD [I], V3
+    CALL next
+    SKP V1
+    LD V2, 0
+    LD DT, V2
+    LD V3, DT
+    SE V2, V3
+    SNE V0, V1
+    JP loop
+    JP loop
+
+next:
+    ADD V3, 1
+    LD V2, V3
+    RET
@@ -0,0 +1,16 @@
+; Random 8x5 sprites, the screen is cleared every 256 sprites
+
+    CLS
+loop:
+    LD I, sprite
+    RND V0, 0x3f
+    RND V1, 0x1f
+    DRW V0, V1, 5
+    ADD V2, 1
+    SE V2, 0
+    JP loop
+    CLS
+    JP loop
+
+sprite:
+    DB 0xf0, 0x90, 0x90, 0x90, 0xf0
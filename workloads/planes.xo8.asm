@@ -0,0 +1,26 @@
+; XO-CHIP sprites on both bitplanes, scrolled every 16 sprites, with I
+; loaded from a long address
+
+    HIGH
+    PLANE 3
+draw:
+    LD I, LONG sprite
+    RND V0, 0x7f
+    RND V1, 0x3f
+    DRW V0, V1, 8
+    PLANE 1
+    DRW V0, V1, 5
+    PLANE 3
+    ADD V2, 1
+    SNE V2, 16
+    JP scroll
+    JP draw
+scroll:
+    LD V2, 0
+    SCU 2
+    SCD 3
+    JP draw
+
+    ORG 0x300
+sprite:
+    SPRITE 3, "..1111..", ".111111.", "33333333", "11.11.11", "11111111", ".111111.", "..1111..", "...11..."
@@ -0,0 +1,24 @@
+; 16x16 sprites in hires, scrolled every 16 sprites
+
+    HIGH
+    LD I, sprite
+draw:
+    RND V0, 0x7f
+    RND V1, 0x3f
+    DRW V0, V1, 0
+    ADD V2, 1
+    SNE V2, 16
+    JP scroll
+    JP draw
+scroll:
+    LD V2, 0
+    SCD 1
+    SCR
+    SCL
+    LOW
+    HIGH
+    JP draw
+
+sprite:
+    DW 0xffff, 0xc003, 0xffff, 0xc003, 0xffff, 0xc003, 0xffff, 0xc003
+    DW 0xffff, 0xc003, 0xffff, 0xc003, 0xffff, 0xc003, 0xffff, 0xc003